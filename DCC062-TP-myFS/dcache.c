@@ -0,0 +1,167 @@
+/*
+*  dcache.c - Cache de entradas de diretorio (dentries) em memoria
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "dcache.h"
+
+//Entrada do cache. As entradas ficam em um vetor de tamanho fixo,
+//encadeadas na lista do seu balde da tabela hash e na lista LRU
+typedef struct dentry {
+	unsigned int parent;		// I-node do diretorio
+	unsigned int inumber;		// I-node da entrada, 0 se inexistente
+	unsigned int hash;
+	int used;
+	char name[DCACHE_MAX_NAME + 1];
+	struct dentry *next;		// Proxima entrada do mesmo balde
+	struct dentry *lruPrev;		// Entrada usada mais recentemente
+	struct dentry *lruNext;		// Entrada usada menos recentemente
+} DEntry;
+
+struct dcache {
+	unsigned int capacity;
+	unsigned int numBuckets;	// Potencia de 2
+	DEntry **buckets;
+	DEntry *entries;
+	DEntry *lruHead;		// Mais recente
+	DEntry *lruTail;		// Menos recente, a proxima a sair
+	DEntry *freeList;		// Entradas livres, encadeadas por next
+};
+
+// Hash FNV-1a do par (parent, name)
+unsigned int __dcacheHash (unsigned int parent, const char *name) {
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < 4; i++) {
+		hash = (hash ^ ((parent >> (8 * i)) & 0xFF)) * 16777619u;
+	}
+	for (; *name; name++) {
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	}
+	return hash;
+}
+
+void __dcacheLruUnlink (DCache *dc, DEntry *e) {
+	if (e->lruPrev) e->lruPrev->lruNext = e->lruNext;
+	else dc->lruHead = e->lruNext;
+	if (e->lruNext) e->lruNext->lruPrev = e->lruPrev;
+	else dc->lruTail = e->lruPrev;
+	e->lruPrev = e->lruNext = NULL;
+}
+
+void __dcacheLruPushFront (DCache *dc, DEntry *e) {
+	e->lruPrev = NULL;
+	e->lruNext = dc->lruHead;
+	if (dc->lruHead) dc->lruHead->lruPrev = e;
+	dc->lruHead = e;
+	if (!dc->lruTail) dc->lruTail = e;
+}
+
+// Busca a entrada (parent, name), cujo hash e' hash
+DEntry* __dcacheFind (DCache *dc, unsigned int parent, const char *name,
+                      unsigned int hash) {
+	DEntry *e = dc->buckets[hash & (dc->numBuckets - 1)];
+	for (; e; e = e->next) {
+		if (e->hash == hash && e->parent == parent && strcmp(e->name, name) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+// Retira uma entrada do cache, devolvendo-a para a lista de livres
+void __dcacheEvict (DCache *dc, DEntry *e) {
+	DEntry **p = &dc->buckets[e->hash & (dc->numBuckets - 1)];
+	while (*p != e) p = &(*p)->next;
+	*p = e->next;
+	__dcacheLruUnlink(dc, e);
+	e->used = 0;
+	e->next = dc->freeList;
+	dc->freeList = e;
+}
+
+DCache* dcacheCreate (unsigned int capacity) {
+	if (capacity == 0) return NULL;
+
+	DCache *dc = calloc(1, sizeof(DCache));
+	if (!dc) return NULL;
+
+	dc->capacity = capacity;
+	dc->numBuckets = 1;
+	while (dc->numBuckets < capacity) dc->numBuckets <<= 1;
+	dc->buckets = calloc(dc->numBuckets, sizeof(DEntry*));
+	dc->entries = calloc(capacity, sizeof(DEntry));
+	if (!dc->buckets || !dc->entries) {
+		dcacheDestroy(dc);
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < capacity; i++) {
+		dc->entries[i].next = dc->freeList;
+		dc->freeList = &dc->entries[i];
+	}
+	return dc;
+}
+
+void dcacheDestroy (DCache *dc) {
+	if (!dc) return;
+	free(dc->buckets);
+	free(dc->entries);
+	free(dc);
+}
+
+int dcacheLookup (DCache *dc, unsigned int parent, const char *name,
+                  unsigned int *inumber) {
+	if (!dc || strlen(name) > DCACHE_MAX_NAME) return 0;
+
+	DEntry *e = __dcacheFind(dc, parent, name, __dcacheHash(parent, name));
+	if (!e) return 0;
+
+	__dcacheLruUnlink(dc, e);
+	__dcacheLruPushFront(dc, e);
+	*inumber = e->inumber;
+	return 1;
+}
+
+void dcacheInsert (DCache *dc, unsigned int parent, const char *name,
+                   unsigned int inumber) {
+	if (!dc || strlen(name) > DCACHE_MAX_NAME) return;
+
+	unsigned int hash = __dcacheHash(parent, name);
+	DEntry *e = __dcacheFind(dc, parent, name, hash);
+	if (e) {
+		e->inumber = inumber;
+		__dcacheLruUnlink(dc, e);
+		__dcacheLruPushFront(dc, e);
+		return;
+	}
+
+	if (!dc->freeList) __dcacheEvict(dc, dc->lruTail);
+	e = dc->freeList;
+	dc->freeList = e->next;
+
+	e->parent = parent;
+	e->inumber = inumber;
+	e->hash = hash;
+	e->used = 1;
+	strcpy(e->name, name);
+	e->next = dc->buckets[hash & (dc->numBuckets - 1)];
+	dc->buckets[hash & (dc->numBuckets - 1)] = e;
+	__dcacheLruPushFront(dc, e);
+}
+
+void dcachePurgeDir (DCache *dc, unsigned int parent) {
+	if (!dc) return;
+	for (unsigned int i = 0; i < dc->capacity; i++) {
+		if (dc->entries[i].used && dc->entries[i].parent == parent) {
+			__dcacheEvict(dc, &dc->entries[i]);
+		}
+	}
+}
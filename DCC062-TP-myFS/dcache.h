@@ -0,0 +1,43 @@
+/*
+*  dcache.h - Cache de entradas de diretorio (dentries) em memoria
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#define DCACHE_MAX_NAME 63	//Nomes maiores nao sao guardados no cache
+
+//Tipo para representacao do cache de entradas de diretorio
+typedef struct dcache DCache;
+
+//Funcao que cria um cache com capacidade para capacity entradas. Retorna
+//ponteiro para o cache ou NULL se nao houver memoria suficiente
+DCache* dcacheCreate (unsigned int capacity);
+
+//Funcao que libera toda a memoria ocupada por um cache
+void dcacheDestroy (DCache *dc);
+
+//Funcao que busca a entrada de nome name no diretorio de i-node parent.
+//Retorna 1 se a entrada esta no cache, copiando para inumber o numero do
+//i-node correspondente (0 se o cache registra que o nome nao existe), ou
+//0 se a entrada nao esta no cache
+int dcacheLookup (DCache *dc, unsigned int parent, const char *name,
+                  unsigned int *inumber);
+
+//Funcao que registra no cache que o nome name do diretorio de i-node
+//parent corresponde ao i-node inumber, ou que nao existe se inumber for 0.
+//Quando o cache esta cheio, a entrada usada ha mais tempo e' descartada
+void dcacheInsert (DCache *dc, unsigned int parent, const char *name,
+                   unsigned int inumber);
+
+//Funcao que descarta todas as entradas do diretorio de i-node parent
+void dcachePurgeDir (DCache *dc, unsigned int parent);
+
+#endif
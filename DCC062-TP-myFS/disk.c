@@ -12,6 +12,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "disk.h"
 
 #define DISK_SEEKDELAY 10
@@ -32,6 +33,8 @@ struct disk {
 	unsigned long numSectors;	//Numero de setores
 	unsigned long size;		//Espaco util total para dados no disco
 	unsigned long currCylinder;	//Cilindro atual 
+	pthread_mutex_t lock;		//Uma operacao por vez: as cabecas e o
+					//arquivo sao compartilhados
 };
 
 
@@ -73,6 +76,7 @@ Disk* diskConnect(int id, char* rawDiskPath) {
 		d->numCylinders = d->numSectors / DISK_SECTORSPERTRACK;
 		d->size = d->numSectors * DISK_SECTORDATASIZE;
 		d->currCylinder = 0;
+		pthread_mutex_init (&d->lock, NULL);
 	}
 	return d;
 }
@@ -80,6 +84,7 @@ Disk* diskConnect(int id, char* rawDiskPath) {
 //Funcao que disconecta um disco fisico do sistema operacional
 int diskDisconnect(Disk* d) {
 	int result = fclose (d->fp);
+	pthread_mutex_destroy (&d->lock);
 	free(d);
 	return result;
 }
@@ -109,7 +114,10 @@ unsigned long diskGetSize (Disk* d) {
 //Funcao que retorna o cilindro sobre o qual as cabecas estao atualmente
 //posicionadas em um disco
 unsigned long diskGetCurrentCylinder (Disk* d) {
-	return d->currCylinder;
+	pthread_mutex_lock (&d->lock);
+	unsigned long cyl = d->currCylinder;
+	pthread_mutex_unlock (&d->lock);
+	return cyl;
 }
 
 //Funcao que escreve em *cyl o numero do cilindro correspondente a um endereco
@@ -125,10 +133,11 @@ int diskAddrToCylinder (Disk* d, unsigned long addr, unsigned long *cyl) {
 //sem erros e -1 caso contrario
 int diskReadSector (Disk* d, unsigned long addr, unsigned char *data) {
 	if (addr >= d->numSectors) return -1;
+	pthread_mutex_lock (&d->lock);
 	__diskSeek (d,addr);
-	if (fread (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
-		return -1;
-	return 0;
+	int ret = (fread (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE ? -1 : 0);
+	pthread_mutex_unlock (&d->lock);
+	return ret;
 }
 
 //Funcao para realzar a escrita de um setor identificado pelo endereco LBA
@@ -136,10 +145,59 @@ int diskReadSector (Disk* d, unsigned long addr, unsigned char *data) {
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long addr, unsigned char* data) {
 	if (addr >= d->numSectors) return -1;
+	pthread_mutex_lock (&d->lock);
 	__diskSeek (d,addr);
-	if (fwrite (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
-		return -1;
-	return 0;
+	int ret = (fwrite (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE ? -1 : 0);
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao interna que posiciona a cabeca sobre o setor addr + k de uma
+//transferencia de varios setores consecutivos. A cabeca so' se desloca ao
+//mudar de trilha; dentro dela, os setores passam em sequencia
+void __diskSeekNext(Disk *d, unsigned long addr, unsigned int k) {
+	if (k == 0 || (addr + k) % DISK_SECTORSPERTRACK == 0)
+		__diskSeek (d, addr + k);
+	else
+		fseek (d->fp, 2 * DISK_SECTORDATAOFFSET, SEEK_CUR);
+}
+
+//Funcao para realizar a leitura de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao. Os dados sao transferidos para
+//*data, que deve ter espaco para count setores. Retorna 0 se a leitura
+//ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned int count,
+                     unsigned char* data) {
+	if (addr >= d->numSectors || count > d->numSectors - addr) return -1;
+	int ret = 0;
+	pthread_mutex_lock (&d->lock);
+	for (unsigned int k = 0; k < count && ret == 0; k++) {
+		__diskSeekNext (d, addr, k);
+		if (fread (data + (unsigned long)k * DISK_SECTORDATASIZE, 1,
+		           DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
+			ret = -1;
+	}
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao para realizar a escrita de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao. Os dados sao transferidos a
+//partir de *data. Retorna 0 se a escrita ocorreu sem erros e -1 caso
+//contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned int count,
+                      unsigned char* data) {
+	if (addr >= d->numSectors || count > d->numSectors - addr) return -1;
+	int ret = 0;
+	pthread_mutex_lock (&d->lock);
+	for (unsigned int k = 0; k < count && ret == 0; k++) {
+		__diskSeekNext (d, addr, k);
+		if (fwrite (data + (unsigned long)k * DISK_SECTORDATASIZE, 1,
+		            DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
+			ret = -1;
+	}
+	pthread_mutex_unlock (&d->lock);
+	return ret;
 }
 
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
@@ -79,6 +79,20 @@ int diskReadSector (Disk* d, unsigned long addr, unsigned char* data);
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long int addr, unsigned char* data);
 
+//Funcao para realizar a leitura de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao. Os dados sao transferidos para
+//*data, que deve ter espaco para count setores. Retorna 0 se a leitura
+//ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned int count,
+                     unsigned char* data);
+
+//Funcao para realizar a escrita de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao. Os dados sao transferidos a
+//partir de *data. Retorna 0 se a escrita ocorreu sem erros e -1 caso
+//contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned int count,
+                      unsigned char* data);
+
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
 //regular indicado por rawDiskPath e com numero total de cilindros indicado
 //por numCylinders. Retorna 0 se o disco fisico for criado com sucesso e -1
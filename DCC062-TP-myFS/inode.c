@@ -130,13 +130,7 @@ int inodeSave (Inode *i) {
                            * INODE_SIZE * sizeUInt;
 
 		//Alterando enderecos de blocos e atributos do i-node no setor
-		for (int a=0; a < NUMITEMS_PERINODE; a++)
-			ul2char (i->inodeItem[a], 
-			         &sector[offset+a*sizeUInt]);
-		ul2char (i->number, 
-		         &sector[offset+(INODE_SIZE-2)*sizeUInt]);
-		ul2char (i->next, 
-			 &sector[offset+(INODE_SIZE-1)*sizeUInt]);
+		inodeEncode (i, &sector[offset]);
 
 		//Salvando todo o setor onde se encontra o i-node...
 		ret = diskWriteSector (i->d, inodeSectorAddr, sector);
@@ -145,6 +139,40 @@ int inodeSave (Inode *i) {
 	return -1;
 }
 
+//Funcao que retorna o tamanho, em bytes, da representacao de um i-node em disco
+unsigned int inodeRecordSize ( void ) {
+	return INODE_SIZE * sizeof (unsigned int);
+}
+
+//Funcao que copia para data (inodeRecordSize() bytes) a representacao em
+//disco de um i-node, tal como gravada por inodeSave
+void inodeEncode (Inode *i, unsigned char *data) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	for (int a=0; a < NUMITEMS_PERINODE; a++)
+		ul2char (i->inodeItem[a], &data[a*sizeUInt]);
+	ul2char (i->number, &data[(INODE_SIZE-2)*sizeUInt]);
+	ul2char (i->next, &data[(INODE_SIZE-1)*sizeUInt]);
+}
+
+//Funcao que cria um i-node de numero number, do disco d, a partir de sua
+//representacao em disco em data (inodeRecordSize() bytes). O numero gravado
+//em data e' ignorado. Retorna NULL se nao houver memoria suficiente
+Inode* inodeDecode (unsigned int number, Disk *d, const unsigned char *data) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	Inode *i = malloc (sizeof(Inode));
+	if (i) {
+		i->d = d;
+		i->number = number;
+		//Recuperando enderecos de blocos e atributos do i-node
+		for (int a=0; a < NUMITEMS_PERINODE; a++)
+			char2ul ((unsigned char *)&data[a*sizeUInt],
+			         &(i->inodeItem[a]));
+		char2ul ((unsigned char *)&data[(INODE_SIZE-1)*sizeUInt],
+		         &(i->next));
+	}
+	return i;
+}
+
 //Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
 //i-node lido ou NULL em caso de falha.
 Inode* inodeLoad (unsigned int number, Disk *d) {
@@ -209,6 +237,15 @@ void inodeSetRefCount (Inode *i, unsigned int refCount) {
 	if (i) i->inodeItem[INODE_ITEM_REFCOUNT] = refCount;
 }
 
+//Funcao que modifica o endereco correspondente a um bloco (blockNum) no
+//array de blocos de um i-node, sem percorrer extensoes. Retorna -1 se
+//blockNum nao couber no proprio i-node ou 0 caso contrario
+int inodeSetBlockAddr (Inode *i, unsigned int blockNum, unsigned int blockAddr) {
+	if (!i || blockNum >= NUMBLOCKS_PERINODE) return -1;
+	i->inodeItem[INODE_ITEM_BLOCKADDR + blockNum] = blockAddr;
+	return 0;
+}
+
 //Funcao que adiciona um endereco ao fim do array de blocos de um i-node
 //Retorna -1 caso a inclusao do endereco nao seja bem sucedida
 //E' a unica funcao que salva automaticamente o i-node em disco
@@ -48,6 +48,18 @@ int inodeSave (Inode *i);
 //i-node lido ou NULL em caso de falha.
 Inode* inodeLoad (unsigned int number, Disk *d);
 
+//Funcao que retorna o tamanho, em bytes, da representacao de um i-node em disco
+unsigned int inodeRecordSize ( void );
+
+//Funcao que copia para data (inodeRecordSize() bytes) a representacao em
+//disco de um i-node, tal como gravada por inodeSave
+void inodeEncode (Inode *i, unsigned char *data);
+
+//Funcao que cria um i-node de numero number, do disco d, a partir de sua
+//representacao em disco em data (inodeRecordSize() bytes). O numero gravado
+//em data e' ignorado. Retorna NULL se nao houver memoria suficiente
+Inode* inodeDecode (unsigned int number, Disk *d, const unsigned char *data);
+
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType);
 
@@ -66,6 +78,11 @@ void inodeSetPermission (Inode *i, unsigned int permission);
 //Funcao que modifica o contador de referencia do arquivo referente a um i-node
 void inodeSetRefCount (Inode *i, unsigned int refCount);
 
+//Funcao que modifica o endereco correspondente a um bloco (blockNum) no
+//array de blocos de um i-node, sem percorrer extensoes. Retorna -1 se
+//blockNum nao couber no proprio i-node ou 0 caso contrario
+int inodeSetBlockAddr (Inode *i, unsigned int blockNum, unsigned int blockAddr);
+
 //Funcao que adiciona um endereco ao fim do array de blocos de um i-node
 //Retorna -1 caso a inclusao do endereco nao seja bem sucedida
 //E' a unica funcao que salva automaticamente o i-node em disco
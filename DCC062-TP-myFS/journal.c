@@ -0,0 +1,589 @@
+/*
+*  journal.c - Diario (journal) de metadados com confirmacao em grupo
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "journal.h"
+#include "util.h"
+
+//Layout da regiao do diario:
+//  setor 0:  cabecalho (magic, numero da primeira transacao do log)
+//  setor 1-: log, com as transacoes confirmadas desde o ultimo checkpoint,
+//            uma apos a outra. O log volta ao inicio a cada checkpoint
+//Transacao: descritor com os setores alterados, suas imagens, na mesma
+//ordem, e o setor de confirmacao, com o checksum dos anteriores. O primeiro
+//setor do descritor comeca com magic, numero e quantidade de registros;
+//os registros que nao couberem nele seguem nos setores seguintes
+#define JOURNAL_MAGIC 0x4C4E524A	// "JRNL"
+#define JOURNAL_DESC_MAGIC 0x4353444A	// "JDSC"
+#define JOURNAL_COMMIT_MAGIC 0x544D434A	// "JCMT"
+#define JOURNAL_REVOKE 0x80000000u	// Registro que anula as imagens
+					// anteriores do setor, sem imagem
+#define JOURNAL_FIRST_RECORDS ((DISK_SECTORDATASIZE - 12) / 4)
+#define JOURNAL_MORE_RECORDS (DISK_SECTORDATASIZE / 4)
+#define JOURNAL_MAX_RUN 64		// Setores por escrita no checkpoint
+
+//Imagem mais recente de um setor registrada no diario
+typedef struct jentry {
+	unsigned long addr;
+	int committed;			// Ja' gravada no log desde o checkpoint
+	int running;			// Alterada na transacao corrente
+	unsigned char data[DISK_SECTORDATASIZE]; // Imagem mais recente
+	unsigned char *saved;		// Ultima imagem confirmada, se o setor
+					// foi alterado de novo depois dela
+	struct jentry *next;		// Proxima entrada do mesmo balde
+} JEntry;
+
+struct journal {
+	Disk *d;
+	unsigned long start;		// Setor do cabecalho
+	unsigned int logSectors;	// Setores do log
+	unsigned int head;		// Proxima posicao livre do log
+	unsigned int seq;		// Numero da proxima transacao
+	unsigned int numBuckets;	// Potencia de 2
+	JEntry **buckets;
+	unsigned int numEntries;
+	JEntry **running;		// Entradas alteradas na transacao corrente
+	unsigned int numRunning;
+	unsigned int capRunning;
+	unsigned int *revokes;		// Setores anulados na transacao corrente
+	unsigned int numRevokes;
+	unsigned int capRevokes;
+	pthread_mutex_t lock;		// Todas as operacoes sobre o diario
+};
+
+JEntry* __journalFind (Journal *j, unsigned long addr) {
+	JEntry *e = j->buckets[addr & (j->numBuckets - 1)];
+	while (e && e->addr != addr) e = e->next;
+	return e;
+}
+
+// Retorna a entrada do setor addr, criando-a (vazia) se nao existir
+JEntry* __journalGet (Journal *j, unsigned long addr) {
+	JEntry *e = __journalFind (j, addr);
+	if (e) return e;
+	e = calloc (1, sizeof(JEntry));
+	if (!e) return NULL;
+	e->addr = addr;
+	e->next = j->buckets[addr & (j->numBuckets - 1)];
+	j->buckets[addr & (j->numBuckets - 1)] = e;
+	j->numEntries++;
+	return e;
+}
+
+void __journalRemove (Journal *j, JEntry *e) {
+	JEntry **p = &j->buckets[e->addr & (j->numBuckets - 1)];
+	while (*p != e) p = &(*p)->next;
+	*p = e->next;
+	if (e->running) {
+		for (unsigned int k = 0; k < j->numRunning; k++) {
+			if (j->running[k] == e) {
+				j->running[k] = j->running[--j->numRunning];
+				break;
+			}
+		}
+	}
+	j->numEntries--;
+	free (e->saved);
+	free (e);
+}
+
+// Setores de descritor necessarios para records registros
+unsigned int __journalDescSectors (unsigned int records) {
+	if (records <= JOURNAL_FIRST_RECORDS) return 1;
+	return 1 + (records - JOURNAL_FIRST_RECORDS + JOURNAL_MORE_RECORDS - 1)
+	           / JOURNAL_MORE_RECORDS;
+}
+
+// Posicao, em bytes a partir do inicio do descritor, do registro k
+unsigned int __journalRecordOffset (unsigned int k) {
+	if (k < JOURNAL_FIRST_RECORDS) return 12 + 4 * k;
+	return DISK_SECTORDATASIZE + 4 * (k - JOURNAL_FIRST_RECORDS);
+}
+
+// Hash FNV-1a dos len bytes de data, continuando de hash
+unsigned int __journalChecksum (unsigned int hash, const unsigned char *data,
+                                unsigned long len) {
+	for (unsigned long i = 0; i < len; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+}
+
+int __journalWriteHeader (Journal *j) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	memset (sector, 0, DISK_SECTORDATASIZE);
+	ul2char (JOURNAL_MAGIC, sector);
+	ul2char (j->seq, &sector[4]);
+	return diskWriteSector (j->d, j->start, sector);
+}
+
+int __journalWriteBack (Journal *j);
+
+// Garante espaco no log para a transacao corrente com mais images imagens
+// e records registros. Se preciso, leva as transacoes ja' confirmadas aos
+// seus lugares, esvaziando o log. A transacao corrente pode estar no meio
+// de uma operacao, entao continua so' na memoria ate' ser confirmada
+int __journalReserve (Journal *j, unsigned int images, unsigned int records) {
+	unsigned int n = j->numRunning + images;
+	unsigned int r = j->numRunning + j->numRevokes + records;
+	unsigned int size = __journalDescSectors (r) + n + 1;
+	if (j->head + size <= j->logSectors) return 0;
+	if (__journalWriteBack (j) < 0) return -1;
+	return size <= j->logSectors ? 0 : -1;
+}
+
+// Descarta todas as entradas
+void __journalClear (Journal *j) {
+	for (unsigned int b = 0; b < j->numBuckets; b++) {
+		while (j->buckets[b]) {
+			JEntry *e = j->buckets[b];
+			j->buckets[b] = e->next;
+			free (e->saved);
+			free (e);
+		}
+	}
+	j->numEntries = 0;
+	j->numRunning = 0;
+	j->numRevokes = 0;
+}
+
+// Libera a memoria de um diario, sem gravar nada
+void __journalFree (Journal *j) {
+	__journalClear (j);
+	pthread_mutex_destroy (&j->lock);
+	free (j->buckets);
+	free (j->running);
+	free (j->revokes);
+	free (j);
+}
+
+int __journalCompareAddr (const void *a, const void *b) {
+	unsigned long x = (*(JEntry * const *)a)->addr;
+	unsigned long y = (*(JEntry * const *)b)->addr;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+//Funcao que prepara a regiao de sectors setores, a partir do setor start do
+//disco d, para conter um diario vazio. Retorna 0 se bem sucedido ou -1,
+//caso contrario
+int journalFormat (Disk *d, unsigned long start, unsigned int sectors) {
+	if (!d || sectors < JOURNAL_MIN_SECTORS) return -1;
+
+	// Restos de um diario anterior nao podem ser confundidos com transacoes
+	unsigned char *zero = calloc (JOURNAL_MAX_RUN, DISK_SECTORDATASIZE);
+	if (!zero) return -1;
+	int ret = 0;
+	for (unsigned int s = 1; s < sectors && ret == 0; s += JOURNAL_MAX_RUN) {
+		unsigned int count = sectors - s < JOURNAL_MAX_RUN ? sectors - s : JOURNAL_MAX_RUN;
+		ret = diskWriteSectors (d, start + s, count, zero);
+	}
+	free (zero);
+	if (ret < 0) return -1;
+
+	Journal j;
+	j.d = d;
+	j.start = start;
+	j.seq = 1;
+	return __journalWriteHeader (&j);
+}
+
+//Funcao que abre o diario da regiao de sectors setores a partir do setor
+//start do disco d. As transacoes confirmadas que ainda nao estavam nos seus
+//lugares (p.ex. apos uma queda) sao refeitas antes do retorno. Retorna
+//ponteiro para o diario ou NULL em caso de falha
+Journal* journalOpen (Disk *d, unsigned long start, unsigned int sectors) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int magic;
+
+	if (!d || sectors < JOURNAL_MIN_SECTORS ||
+	    diskReadSector (d, start, sector) < 0) return NULL;
+	char2ul (sector, &magic);
+	if (magic != JOURNAL_MAGIC) return NULL;
+
+	Journal *j = calloc (1, sizeof(Journal));
+	if (!j) return NULL;
+	j->d = d;
+	j->start = start;
+	j->logSectors = sectors - 1;
+	char2ul (&sector[4], &j->seq);
+	j->numBuckets = 64;
+	while (j->numBuckets < j->logSectors) j->numBuckets *= 2;
+	j->buckets = calloc (j->numBuckets, sizeof(JEntry *));
+	if (!j->buckets) {
+		free (j);
+		return NULL;
+	}
+	pthread_mutex_init (&j->lock, NULL);
+
+	// Recupera as transacoes do log em ordem, ate' a primeira que nao foi
+	// confirmada por inteiro. Cada uma so' e' aplicada se o checksum bate
+	unsigned char *txn = NULL;
+	while (j->head + 2 <= j->logSectors) {
+		unsigned long pos = start + 1 + j->head;
+		unsigned int value, records, images = 0;
+		if (diskReadSector (d, pos, sector) < 0) break;
+		char2ul (sector, &value);
+		if (value != JOURNAL_DESC_MAGIC) break;
+		char2ul (&sector[4], &value);
+		if (value != j->seq) break;
+		char2ul (&sector[8], &records);
+		unsigned int desc = __journalDescSectors (records);
+		if (records > j->logSectors * JOURNAL_MORE_RECORDS ||
+		    j->head + desc + 1 > j->logSectors) break;
+
+		unsigned char *grown = realloc (txn, (unsigned long)(desc + records + 1) * DISK_SECTORDATASIZE);
+		if (!grown) break;
+		txn = grown;
+		if (diskReadSectors (d, pos, desc, txn) < 0) break;
+		for (unsigned int k = 0; k < records; k++) {
+			char2ul (&txn[__journalRecordOffset (k)], &value);
+			if (!(value & JOURNAL_REVOKE)) images++;
+		}
+		unsigned int size = desc + images + 1;
+		if (j->head + size > j->logSectors ||
+		    diskReadSectors (d, pos + desc, images + 1,
+		                     &txn[(unsigned long)desc * DISK_SECTORDATASIZE]) < 0) break;
+
+		unsigned char *commit = &txn[(unsigned long)(size - 1) * DISK_SECTORDATASIZE];
+		unsigned int checksum;
+		char2ul (commit, &value);
+		char2ul (&commit[8], &checksum);
+		if (value != JOURNAL_COMMIT_MAGIC ||
+		    checksum != __journalChecksum (2166136261u, txn,
+		                    (unsigned long)(size - 1) * DISK_SECTORDATASIZE)) break;
+
+		unsigned char *image = &txn[(unsigned long)desc * DISK_SECTORDATASIZE];
+		int ok = 1;
+		for (unsigned int k = 0; k < records && ok; k++) {
+			char2ul (&txn[__journalRecordOffset (k)], &value);
+			if (value & JOURNAL_REVOKE) {
+				JEntry *e = __journalFind (j, value & ~JOURNAL_REVOKE);
+				if (e) __journalRemove (j, e);
+				continue;
+			}
+			JEntry *e = __journalGet (j, value);
+			if (!e) {
+				ok = 0;
+				break;
+			}
+			memcpy (e->data, image, DISK_SECTORDATASIZE);
+			e->committed = 1;
+			image += DISK_SECTORDATASIZE;
+		}
+		if (!ok) {
+			free (txn);
+			__journalFree (j);
+			return NULL;
+		}
+		j->head += size;
+		j->seq++;
+	}
+	free (txn);
+
+	// Leva as transacoes recuperadas aos seus lugares e esvazia o log
+	if (j->head > 0 && journalCheckpoint (j) < 0) {
+		__journalFree (j);
+		return NULL;
+	}
+	return j;
+}
+
+//Funcao que grava nos seus lugares todas as alteracoes registradas no
+//diario e libera a memoria ocupada por ele. Retorna 0 se bem sucedido ou
+//-1, caso contrario
+int journalClose (Journal *j) {
+	if (!j) return -1;
+	int ret = journalCheckpoint (j);
+	__journalFree (j);
+	return ret;
+}
+
+// journalWrite com a trava do diario ja' obtida
+int __journalWrite (Journal *j, unsigned long addr, const unsigned char *data) {
+	if (!j || addr >= diskGetNumSectors (j->d)) return -1;
+
+	JEntry *e = __journalFind (j, addr);
+	if (!e || !e->running) {
+		if (__journalReserve (j, 1, 1) < 0) return -1;
+		if (j->numRunning == j->capRunning) {
+			unsigned int cap = j->capRunning ? 2 * j->capRunning : 64;
+			JEntry **grown = realloc (j->running, cap * sizeof(JEntry *));
+			if (!grown) return -1;
+			j->running = grown;
+			j->capRunning = cap;
+		}
+		e = __journalGet (j, addr);
+		if (!e) return -1;
+		// A imagem confirmada ainda pode ter que ir para o lugar antes
+		// que a transacao corrente seja confirmada
+		if (e->committed && !e->saved) {
+			e->saved = malloc (DISK_SECTORDATASIZE);
+			if (!e->saved) return -1;
+			memcpy (e->saved, e->data, DISK_SECTORDATASIZE);
+		}
+		e->running = 1;
+		j->running[j->numRunning++] = e;
+	}
+	memcpy (e->data, data, DISK_SECTORDATASIZE);
+	return 0;
+}
+
+//Funcao que registra, na transacao corrente, o novo conteudo (data) do
+//setor addr. O setor so' e' gravado no diario na confirmacao da transacao e
+//no seu lugar no checkpoint. Retorna 0 se bem sucedido ou -1, caso
+//contrario
+int journalWrite (Journal *j, unsigned long addr, const unsigned char *data) {
+	if (!j) return -1;
+	pthread_mutex_lock (&j->lock);
+	int ret = __journalWrite (j, addr, data);
+	pthread_mutex_unlock (&j->lock);
+	return ret;
+}
+
+// journalRead com a trava do diario ja' obtida
+int __journalRead (Journal *j, unsigned long addr, unsigned int count,
+                   unsigned char *data) {
+	if (!j) return -1;
+
+	// O disco so' e' lido se algum setor nao estiver no diario
+	unsigned int cached = 0;
+	for (unsigned int k = 0; k < count && j->numEntries > 0; k++) {
+		if (__journalFind (j, addr + k)) cached++;
+	}
+	if (cached < count && diskReadSectors (j->d, addr, count, data) < 0) {
+		return -1;
+	}
+	for (unsigned int k = 0; k < count && cached > 0; k++) {
+		JEntry *e = __journalFind (j, addr + k);
+		if (e) {
+			memcpy (&data[(unsigned long)k * DISK_SECTORDATASIZE], e->data,
+			        DISK_SECTORDATASIZE);
+			cached--;
+		}
+	}
+	return 0;
+}
+
+//Funcao que le count setores consecutivos a partir do setor addr para
+//data, com as alteracoes registradas no diario. Retorna 0 se bem sucedido
+//ou -1, caso contrario
+int journalRead (Journal *j, unsigned long addr, unsigned int count,
+                 unsigned char *data) {
+	if (!j) return -1;
+	pthread_mutex_lock (&j->lock);
+	int ret = __journalRead (j, addr, count, data);
+	pthread_mutex_unlock (&j->lock);
+	return ret;
+}
+
+// journalForget com a trava do diario ja' obtida
+int __journalForget (Journal *j, unsigned long addr, unsigned int count) {
+	if (!j) return -1;
+	for (unsigned int k = 0; k < count && j->numEntries > 0; k++) {
+		JEntry *e = __journalFind (j, addr + k);
+		if (!e) continue;
+
+		// Uma imagem ja' no log seria refeita por cima do novo conteudo
+		// numa recuperacao, entao a transacao corrente a anula
+		if (e->committed) {
+			if (__journalReserve (j, 0, 1) < 0) return -1;
+			e = __journalFind (j, addr + k);
+			if (!e) continue;
+		}
+		if (e->committed) {
+			if (j->numRevokes == j->capRevokes) {
+				unsigned int cap = j->capRevokes ? 2 * j->capRevokes : 16;
+				unsigned int *grown = realloc (j->revokes, cap * sizeof(unsigned int));
+				if (!grown) return -1;
+				j->revokes = grown;
+				j->capRevokes = cap;
+			}
+			j->revokes[j->numRevokes++] = addr + k;
+		}
+		__journalRemove (j, e);
+	}
+	return 0;
+}
+
+//Funcao que descarta as alteracoes registradas para os count setores a
+//partir de addr, que passam a ser gravados diretamente no disco (p.ex.
+//blocos liberados e reaproveitados para dados). Retorna 0 se bem sucedido
+//ou -1, caso contrario
+int journalForget (Journal *j, unsigned long addr, unsigned int count) {
+	if (!j) return -1;
+	pthread_mutex_lock (&j->lock);
+	int ret = __journalForget (j, addr, count);
+	pthread_mutex_unlock (&j->lock);
+	return ret;
+}
+
+// journalCommit com a trava do diario ja' obtida
+int __journalCommit (Journal *j) {
+	if (!j) return -1;
+	if (j->numRunning == 0 && j->numRevokes == 0) return 0;
+
+	// As anulacoes vem antes das imagens, que podem ser do mesmo setor
+	unsigned int records = j->numRevokes + j->numRunning;
+	unsigned int desc = __journalDescSectors (records);
+	unsigned int size = desc + j->numRunning + 1;
+	unsigned char *txn = calloc (size, DISK_SECTORDATASIZE);
+	if (!txn) return -1;
+
+	ul2char (JOURNAL_DESC_MAGIC, txn);
+	ul2char (j->seq, &txn[4]);
+	ul2char (records, &txn[8]);
+	for (unsigned int k = 0; k < j->numRevokes; k++) {
+		ul2char (j->revokes[k] | JOURNAL_REVOKE, &txn[__journalRecordOffset (k)]);
+	}
+	for (unsigned int k = 0; k < j->numRunning; k++) {
+		JEntry *e = j->running[k];
+		ul2char (e->addr, &txn[__journalRecordOffset (j->numRevokes + k)]);
+		memcpy (&txn[(unsigned long)(desc + k) * DISK_SECTORDATASIZE], e->data,
+		        DISK_SECTORDATASIZE);
+	}
+	unsigned char *commit = &txn[(unsigned long)(size - 1) * DISK_SECTORDATASIZE];
+	ul2char (JOURNAL_COMMIT_MAGIC, commit);
+	ul2char (j->seq, &commit[4]);
+	ul2char (__journalChecksum (2166136261u, txn,
+	                            (unsigned long)(size - 1) * DISK_SECTORDATASIZE),
+	         &commit[8]);
+
+	int ret = diskWriteSectors (j->d, j->start + 1 + j->head, size, txn);
+	free (txn);
+	if (ret < 0) return -1;
+
+	for (unsigned int k = 0; k < j->numRunning; k++) {
+		j->running[k]->running = 0;
+		j->running[k]->committed = 1;
+		free (j->running[k]->saved);
+		j->running[k]->saved = NULL;
+	}
+	j->numRunning = 0;
+	j->numRevokes = 0;
+	j->head += size;
+	j->seq++;
+	return 0;
+}
+
+//Funcao que confirma a transacao corrente, gravando todas as suas
+//alteracoes no diario em uma unica escrita sequencial. Apos uma queda,
+//as transacoes confirmadas sao refeitas por inteiro. Retorna 0 se bem
+//sucedido ou -1, caso contrario
+int journalCommit (Journal *j) {
+	if (!j) return -1;
+	pthread_mutex_lock (&j->lock);
+	int ret = __journalCommit (j);
+	pthread_mutex_unlock (&j->lock);
+	return ret;
+}
+
+//Funcao que indica se a transacao corrente ja' ocupa mais de um quarto do
+//log. Como ela so' pode ser confirmada inteira, quem usa o diario deve
+//confirma'-la no fim de uma operacao antes que deixe de caber no log.
+//Retorna 1 se sim ou 0, caso contrario
+int journalNeedsCommit (Journal *j) {
+	if (!j) return 0;
+	pthread_mutex_lock (&j->lock);
+	unsigned int size = __journalDescSectors (j->numRunning + j->numRevokes) +
+	                    j->numRunning + 1;
+	int ret = size > j->logSectors / 4;
+	pthread_mutex_unlock (&j->lock);
+	return ret;
+}
+
+// Grava nos seus lugares as imagens confirmadas, em ordem de cilindro a
+// partir da posicao atual das cabecas, e esvazia o log. A transacao
+// corrente fica so' na memoria: os setores alterados apenas por ela nao
+// sao gravados, e os que ja' tinham imagem confirmada vao com ela
+int __journalWriteBack (Journal *j) {
+	if (j->head == 0) return 0;
+
+	JEntry **sorted = malloc ((j->numEntries + 1) * sizeof(JEntry *));
+	unsigned char *run = malloc (JOURNAL_MAX_RUN * DISK_SECTORDATASIZE);
+	if (!sorted || !run) {
+		free (sorted);
+		free (run);
+		return -1;
+	}
+	unsigned int n = 0;
+	for (unsigned int b = 0; b < j->numBuckets; b++) {
+		for (JEntry *e = j->buckets[b]; e; e = e->next) {
+			if (e->committed) sorted[n++] = e;
+		}
+	}
+	qsort (sorted, n, sizeof(JEntry *), __journalCompareAddr);
+
+	// Uma unica varredura: do cilindro atual ate' o fim do disco e, depois,
+	// do inicio ate' o cilindro atual. Setores consecutivos vao juntos
+	unsigned long cyl, current = diskGetCurrentCylinder (j->d);
+	unsigned int first = 0;
+	while (first < n && diskAddrToCylinder (j->d, sorted[first]->addr, &cyl) == 0 &&
+	       cyl < current) first++;
+
+	int ret = 0;
+	for (unsigned int k = 0; k < n && ret == 0; ) {
+		unsigned int i = (first + k) % n;
+		unsigned int len = 0;
+		while (k + len < n && len < JOURNAL_MAX_RUN &&
+		       (len == 0 || ((first + k + len) % n != 0 &&
+		        sorted[(first + k + len) % n]->addr == sorted[i]->addr + len))) {
+			JEntry *e = sorted[(first + k + len) % n];
+			memcpy (&run[len * DISK_SECTORDATASIZE], e->saved ? e->saved : e->data,
+			        DISK_SECTORDATASIZE);
+			len++;
+		}
+		ret = diskWriteSectors (j->d, sorted[i]->addr, len, run);
+		k += len;
+	}
+	free (run);
+	free (sorted);
+	if (ret < 0) return -1;
+
+	// So' depois de tudo no lugar o log pode ser reaproveitado
+	if (__journalWriteHeader (j) < 0) return -1;
+	j->head = 0;
+	for (unsigned int b = 0; b < j->numBuckets; b++) {
+		JEntry **p = &j->buckets[b];
+		while (*p) {
+			JEntry *e = *p;
+			if (e->running) {
+				e->committed = 0;
+				free (e->saved);
+				e->saved = NULL;
+				p = &e->next;
+			}
+			else {
+				*p = e->next;
+				j->numEntries--;
+				free (e);
+			}
+		}
+	}
+	return 0;
+}
+
+// journalCheckpoint com a trava do diario ja' obtida
+int __journalCheckpoint (Journal *j) {
+	if (!j || __journalCommit (j) < 0) return -1;
+	return __journalWriteBack (j);
+}
+
+//Funcao que grava nos seus lugares as alteracoes confirmadas, em ordem de
+//cilindro a partir da posicao atual das cabecas, liberando o diario.
+//Retorna 0 se bem sucedido ou -1, caso contrario
+int journalCheckpoint (Journal *j) {
+	if (!j) return -1;
+	pthread_mutex_lock (&j->lock);
+	int ret = __journalCheckpoint (j);
+	pthread_mutex_unlock (&j->lock);
+	return ret;
+}
@@ -0,0 +1,73 @@
+/*
+*  journal.h - Diario (journal) de metadados com confirmacao em grupo
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "disk.h"
+
+#define JOURNAL_MIN_SECTORS 8	//Menor regiao aceita para um diario
+
+//Tipo para representacao de um diario aberto
+typedef struct journal Journal;
+
+//Funcao que prepara a regiao de sectors setores, a partir do setor start do
+//disco d, para conter um diario vazio. Retorna 0 se bem sucedido ou -1,
+//caso contrario
+int journalFormat (Disk *d, unsigned long start, unsigned int sectors);
+
+//Funcao que abre o diario da regiao de sectors setores a partir do setor
+//start do disco d. As transacoes confirmadas que ainda nao estavam nos seus
+//lugares (p.ex. apos uma queda) sao refeitas antes do retorno. Retorna
+//ponteiro para o diario ou NULL em caso de falha
+Journal* journalOpen (Disk *d, unsigned long start, unsigned int sectors);
+
+//Funcao que grava nos seus lugares todas as alteracoes registradas no
+//diario e libera a memoria ocupada por ele. Retorna 0 se bem sucedido ou
+//-1, caso contrario
+int journalClose (Journal *j);
+
+//Funcao que registra, na transacao corrente, o novo conteudo (data) do
+//setor addr. O setor so' e' gravado no diario na confirmacao da transacao e
+//no seu lugar no checkpoint. Retorna 0 se bem sucedido ou -1, caso
+//contrario
+int journalWrite (Journal *j, unsigned long addr, const unsigned char *data);
+
+//Funcao que le count setores consecutivos a partir do setor addr para
+//data, com as alteracoes registradas no diario. Retorna 0 se bem sucedido
+//ou -1, caso contrario
+int journalRead (Journal *j, unsigned long addr, unsigned int count,
+                 unsigned char *data);
+
+//Funcao que descarta as alteracoes registradas para os count setores a
+//partir de addr, que passam a ser gravados diretamente no disco (p.ex.
+//blocos liberados e reaproveitados para dados). Retorna 0 se bem sucedido
+//ou -1, caso contrario
+int journalForget (Journal *j, unsigned long addr, unsigned int count);
+
+//Funcao que confirma a transacao corrente, gravando todas as suas
+//alteracoes no diario em uma unica escrita sequencial. Apos uma queda,
+//as transacoes confirmadas sao refeitas por inteiro. Retorna 0 se bem
+//sucedido ou -1, caso contrario
+int journalCommit (Journal *j);
+
+//Funcao que indica se a transacao corrente ja' ocupa mais de um quarto do
+//log. Como ela so' pode ser confirmada inteira, quem usa o diario deve
+//confirma'-la no fim de uma operacao antes que deixe de caber no log.
+//Retorna 1 se sim ou 0, caso contrario
+int journalNeedsCommit (Journal *j);
+
+//Funcao que grava nos seus lugares as alteracoes confirmadas, em ordem de
+//cilindro a partir da posicao atual das cabecas, liberando o diario.
+//Retorna 0 se bem sucedido ou -1, caso contrario
+int journalCheckpoint (Journal *j);
+
+#endif
@@ -0,0 +1,2235 @@
+/*
+*  lfs.c - Implementacao do sistema de arquivos LFS (log-structured)
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*  Dados e metadados sao gravados apenas no fim do log, em segmentos de
+*  varios cilindros escritos sequencialmente. Os i-nodes nao tem lugar
+*  fixo: o mapa de i-nodes, tambem gravado no log, diz onde esta' a versao
+*  mais recente de cada um, e as regioes de checkpoint dizem onde esta' o
+*  mapa. O limpador (cleaner) copia os blocos vivos de segmentos pouco
+*  ocupados para o fim do log, liberando-os para reuso. Cada disco montado
+*  tem o seu, em uma thread propria, e quem escreve so' limpa por conta
+*  propria quando restam apenas os segmentos reservados.
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lfs.h"
+#include "vfs.h"
+#include "inode.h"
+#include "util.h"
+#include "dcache.h"
+
+//Declaracoes globais
+#define LFS_ID 'L' // Identificador do LFS
+#define LFS_MAGIC 0x3153464C // "LFS1" em little endian
+#define LFS_VERSION 1
+#define LFS_SECTOR_SUPERBLOCK 1 // Setor do superbloco
+#define LFS_SECTOR_CHECKPOINT 2 // Primeira das duas regiões de checkpoint
+#define LFS_SECTORS_PER_INODE 8 // Um i-node para cada 8 setores do disco
+#define LFS_MAX_SECTORSPERBLOCK 64 // Maior bloco aceito (32 KiB)
+#define LFS_MAX_MOUNTS 4 // Discos montados simultaneamente
+
+#define LFS_SEGMENT_SECTORS 256 // Segmento mínimo: 4 cilindros
+#define LFS_MIN_SEGMENT_BLOCKS 16 // Blocos mínimos por segmento
+
+#define LFS_NDIRECT 6 // Endereços diretos no i-node (itens 0 a 5)
+#define LFS_SINDIRECT 6 // Item 6: bloco indireto simples
+#define LFS_DINDIRECT 7 // Item 7: bloco indireto duplo
+
+#define LFS_MAX_CACHED (MAX_FDS + 1024) // I-nodes mantidos em memória
+#define LFS_DCACHE_ENTRIES 1024 // Entradas de diretório em cache por disco
+
+// Limpeza: o limpador do disco acorda com menos de LFS_CLEAN_LOW segmentos
+// livres e vai até LFS_CLEAN_HIGH (proporcionalmente menos em discos
+// pequenos). Os LFS_RESERVED_SEGMENTS últimos ficam para o limpador e para
+// os metadados: com eles, quem escreve espera uma limpeza e, se ela não
+// liberar nada, a escrita falha
+#define LFS_CLEAN_LOW 6
+#define LFS_CLEAN_HIGH 10
+#define LFS_RESERVED_SEGMENTS 2
+#define LFS_MIN_SEGMENTS (LFS_CLEAN_HIGH + LFS_RESERVED_SEGMENTS)
+#define LFS_CLEAN_MAX_UTIL 0.8 // Segmentos mais cheios não compensam
+
+// Resumo de um segmento parcial: magic, número de blocos e sequência de
+// escrita, seguidos de um par (i-node, código) para cada bloco
+#define LFS_SUM_MAGIC 0x4D55534C // "LSUM"
+#define LFS_SUM_HEADER 3 // Inteiros do cabeçalho do resumo
+#define LFS_CODE_INODE 0xFFFFFFFF // Bloco de i-nodes (i-node 0)
+#define LFS_CODE_SINDIRECT 0xFFFFFFFE // Bloco indireto simples
+#define LFS_CODE_DINDIRECT 0xFFFFFFFD // Bloco indireto duplo
+#define LFS_CODE_LEAF 0x80000000 // Folha k do indireto duplo: código | k
+// Com i-node 0 e outro código, o bloco é o pedaço de mesmo número do mapa
+
+// Checkpoint: cabeçalho, endereços dos pedaços do mapa de i-nodes e tabela
+// de uso dos segmentos. A sequência é repetida no último inteiro da região
+// para detectar uma gravação interrompida
+#define LFS_CP_MAGIC 0x5043534C // "LSCP"
+#define LFS_CP_HEADER 6 // Inteiros do cabeçalho
+#define LFS_CP_SEGITEMS 3 // Inteiros por segmento: bytes vivos, idade, blocos
+
+// Posição de um i-node no log: setor * LFS_LOC_SLOTS + posição no setor
+#define LFS_LOC_SLOTS 8
+#define LFS_IMAP_NEW 0xFFFFFFFF // I-node alocado ainda não gravado no log
+
+#define LFS_SEG_FREE 0
+#define LFS_SEG_USED 1
+#define LFS_SEG_PENDING 2 // Sem dados vivos: livre após o próximo checkpoint
+
+// Entradas de diretório, no mesmo formato do MyFS: inteiro com o i-node,
+// 2 bytes de tamanho do registro, 1 byte de tamanho do nome e o nome
+#define LFS_DIRENT_HEADER 8
+#define LFS_DIRENT_ALIGN 4
+#define LFS_DIRENT_SIZE(nameLen) ((LFS_DIRENT_HEADER + (nameLen) + LFS_DIRENT_ALIGN - 1) & ~(LFS_DIRENT_ALIGN - 1))
+
+// Uso de um segmento
+typedef struct {
+	unsigned int liveBytes;		// Bytes ainda referenciados
+	unsigned int age;		// Sequência de escrita mais recente
+	unsigned int usedBlocks;	// Blocos gravados a partir do início
+	int state;
+} LFSSegment;
+
+// Sistema de arquivos montado
+typedef struct {
+	int used;
+	Disk *d;
+	unsigned int sectorsPerBlock;
+	unsigned int blockBytes;
+	unsigned int ptrsPerBlock;
+	unsigned int segBlocks;
+	unsigned int numSegments;
+	unsigned int segStart;		// Setor do primeiro segmento
+	unsigned int numInodes;
+	unsigned int cpSectors;		// Setores de cada região de checkpoint
+	unsigned int numChunks;		// Pedaços (blocos) do mapa de i-nodes
+	unsigned int inodesPerSector;	// Registros por setor de bloco de i-nodes
+	unsigned int sumEntries;	// Blocos por resumo de segmento parcial
+
+	unsigned int cpSeq;		// Sequência do último checkpoint
+	unsigned int writeSeq;		// Sequência de escrita dos segmentos parciais
+	unsigned int *imap;		// Posição de cada i-node (0: livre)
+	unsigned int *chunkAddr;	// Endereço de cada pedaço do mapa
+	unsigned char *chunkDirty;
+	LFSSegment *segs;
+	unsigned int freeSegs;
+	unsigned int cleanLow;		// Limites de limpeza para este disco
+	unsigned int cleanHigh;
+	unsigned int segCount;		// Segmentos abertos desde a montagem
+	unsigned int cleanMark;		// segCount da última limpeza
+	unsigned int freeInodes;
+	unsigned int inodeHint;
+
+	// Fim do log: o segmento corrente é montado em memória e gravado de
+	// uma vez quando enche (ou no checkpoint)
+	unsigned char *segBuf;
+	unsigned int headSeg;
+	unsigned int headBlock;		// Próximo bloco livre do segmento
+	unsigned int flushedBlock;	// Blocos anteriores já estão no disco
+	int sumBlock;			// Resumo do parcial aberto (-1: nenhum)
+	int cleaning;
+	pthread_t cleaner;		// Limpador em segundo plano
+	int cleanerOn;
+	int cleanerStop;
+	pthread_cond_t cleanWake;	// Há segmentos a limpar, ou parada
+
+	unsigned char *blockBuf;	// Leitura de arquivos
+	unsigned char *metaBuf;		// Blocos de i-nodes e do mapa
+	unsigned char *dirBuf;		// Operações em diretórios
+	DCache *dcache;			// Cache de nomes já resolvidos (pode ser NULL)
+} LFSSuper;
+
+// I-node em memória. Guarda as alterações ainda não gravadas no log: o
+// próprio i-node, seus blocos de ponteiros e o último bloco de dados escrito
+typedef struct {
+	int used;
+	int refs;			// Descritores e usos internos
+	LFSSuper *sb;
+	unsigned int num;
+	Inode *inode;
+	int dirty;
+	unsigned char *ind;		// Indireto simples carregado (ou NULL)
+	int indDirty;
+	unsigned char *dind;		// Indireto duplo carregado (ou NULL)
+	int dindDirty;
+	unsigned char **leaf;		// Folhas carregadas do indireto duplo
+	unsigned char *leafDirty;
+	unsigned char *tail;		// Último bloco de dados escrito
+	unsigned int tailBlock;
+	int tailValid;
+	int tailDirty;
+} LFSInode;
+
+// Arquivo aberto
+typedef struct {
+	int used;
+	Disk *d;
+	LFSInode *ci;
+	unsigned int cursor;
+} LFSFile;
+
+LFSSuper lfsMounts[LFS_MAX_MOUNTS];
+LFSInode lfsInodes[LFS_MAX_CACHED];
+LFSFile lfsFiles[MAX_FDS];
+
+// Concorrência: todas as funções do LFS, chamadas por várias threads, e os
+// limpadores dos discos montados são executados um de cada vez, com
+// lfsLock. O limpador só a libera enquanto lê o segmento que vai limpar
+pthread_mutex_t lfsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Lê o inteiro de 32 bits de índice idx de um bloco
+unsigned int __lfsGetU32(const unsigned char *block, unsigned int idx){
+	unsigned int value;
+	char2ul((unsigned char *)&block[idx * sizeof(unsigned int)], &value);
+	return value;
+}
+
+// Escreve o inteiro de 32 bits de índice idx de um bloco
+void __lfsSetU32(unsigned char *block, unsigned int idx, unsigned int value){
+	ul2char(value, &block[idx * sizeof(unsigned int)]);
+}
+
+// Retorna o superbloco montado em d ou, com d nulo, um slot livre
+LFSSuper *__lfsGetSuper(Disk *d){
+	for(int i = 0; i < LFS_MAX_MOUNTS; i++){
+		if(d ? (lfsMounts[i].used && lfsMounts[i].d == d) : !lfsMounts[i].used){
+			return &lfsMounts[i];
+		}
+	}
+	return NULL;
+}
+
+// Endereço (setor) do bloco blk do segmento seg
+unsigned int __lfsSegAddr(LFSSuper *sb, unsigned int seg, unsigned int blk){
+	return sb->segStart + (seg * sb->segBlocks + blk) * sb->sectorsPerBlock;
+}
+
+// Segmento que contém o setor addr, ou numSegments se fora da área de log
+unsigned int __lfsAddrSeg(LFSSuper *sb, unsigned int addr){
+	if(addr < sb->segStart){
+		return sb->numSegments;
+	}
+	unsigned int seg = (addr - sb->segStart) / (sb->segBlocks * sb->sectorsPerBlock);
+	return seg < sb->numSegments ? seg : sb->numSegments;
+}
+
+// Desconta bytes dos dados vivos do segmento do setor addr, substituído
+// por uma versão mais nova (ou liberado). Sem dados vivos, o segmento fica
+// livre no próximo checkpoint
+void __lfsKill(LFSSuper *sb, unsigned int addr, unsigned int bytes){
+	unsigned int seg = __lfsAddrSeg(sb, addr);
+	if(addr == 0 || seg >= sb->numSegments){
+		return;
+	}
+	LFSSegment *s = &sb->segs[seg];
+	s->liveBytes = s->liveBytes > bytes ? s->liveBytes - bytes : 0;
+	if(s->liveBytes == 0 && s->state == LFS_SEG_USED && seg != sb->headSeg){
+		s->state = LFS_SEG_PENDING;
+	}
+}
+
+// Retorna o bloco blk do segmento corrente, no buffer em memória
+unsigned char *__lfsHeadBlock(LFSSuper *sb, unsigned int blk){
+	return &sb->segBuf[blk * sb->blockBytes];
+}
+
+// Indica se o setor addr está no trecho do segmento corrente que ainda
+// não foi gravado no disco
+int __lfsUnflushed(LFSSuper *sb, unsigned int addr){
+	return addr >= __lfsSegAddr(sb, sb->headSeg, sb->flushedBlock) &&
+	       addr < __lfsSegAddr(sb, sb->headSeg, sb->headBlock);
+}
+
+// Lê o setor addr, do buffer do segmento corrente ou do disco
+int __lfsReadSector(LFSSuper *sb, unsigned int addr, unsigned char *data){
+	if(__lfsUnflushed(sb, addr)){
+		memcpy(data, &sb->segBuf[(addr - __lfsSegAddr(sb, sb->headSeg, 0)) * DISK_SECTORDATASIZE],
+		       DISK_SECTORDATASIZE);
+		return 0;
+	}
+	return diskReadSector(sb->d, addr, data);
+}
+
+// Lê count blocos consecutivos a partir do endereço addr. Retorna 0 ou -1
+int __lfsReadBlocks(LFSSuper *sb, unsigned int addr, unsigned int count, unsigned char *data){
+	unsigned int spb = sb->sectorsPerBlock;
+	if(!__lfsUnflushed(sb, addr) && !__lfsUnflushed(sb, addr + (count - 1) * spb)){
+		return diskReadSectors(sb->d, addr, count * spb, data);
+	}
+	for(unsigned int k = 0; k < count * spb; k++){
+		if(__lfsReadSector(sb, addr + k, &data[k * DISK_SECTORDATASIZE]) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Grava no disco, em uma única escrita, os blocos do segmento corrente
+// ainda só em memória. O segmento parcial aberto é fechado
+int __lfsWriteOut(LFSSuper *sb){
+	sb->sumBlock = -1;
+	if(sb->headBlock > sb->flushedBlock){
+		if(diskWriteSectors(sb->d, __lfsSegAddr(sb, sb->headSeg, sb->flushedBlock),
+		                    (sb->headBlock - sb->flushedBlock) * sb->sectorsPerBlock,
+		                    __lfsHeadBlock(sb, sb->flushedBlock)) < 0){
+			return -1;
+		}
+		sb->flushedBlock = sb->headBlock;
+	}
+	return 0;
+}
+
+// Grava o segmento corrente e passa o fim do log para o próximo segmento
+// livre, de preferência o seguinte no disco. Retorna 0 ou -1 se não houver
+// segmento livre
+int __lfsNextSegment(LFSSuper *sb){
+	if(__lfsWriteOut(sb) < 0){
+		return -1;
+	}
+
+	for(unsigned int k = 1; k < sb->numSegments; k++){
+		unsigned int seg = (sb->headSeg + k) % sb->numSegments;
+		if(sb->segs[seg].state != LFS_SEG_FREE){
+			continue;
+		}
+
+		LFSSegment *old = &sb->segs[sb->headSeg];
+		if(old->liveBytes == 0 && old->state == LFS_SEG_USED){
+			old->state = LFS_SEG_PENDING;
+		}
+		sb->headSeg = seg;
+
+		sb->segs[seg].state = LFS_SEG_USED;
+		sb->segs[seg].liveBytes = 0;
+		sb->segs[seg].usedBlocks = 0;
+		sb->segs[seg].age = sb->writeSeq;
+		sb->freeSegs--;
+		sb->segCount++;
+		sb->headBlock = 0;
+		sb->flushedBlock = 0;
+		return 0;
+	}
+	return -1;
+}
+
+// Acrescenta o bloco data ao fim do log, registrando no resumo do segmento
+// parcial o dono (inodeNum, code). live é a quantidade de bytes do bloco
+// em uso. Retorna o endereço do bloco, ou 0 se não houver espaço
+unsigned int __lfsAppend(LFSSuper *sb, const unsigned char *data, unsigned int inodeNum, unsigned int code, unsigned int live){
+
+	if(sb->sumBlock >= 0 && (__lfsGetU32(__lfsHeadBlock(sb, sb->sumBlock), 1) == sb->sumEntries ||
+	                         sb->headBlock >= sb->segBlocks)){
+		sb->sumBlock = -1;
+	}
+	if(sb->sumBlock < 0){
+		// Abre um segmento parcial, cujo primeiro bloco é o resumo
+		if(sb->headBlock + 2 > sb->segBlocks && __lfsNextSegment(sb) < 0){
+			return 0;
+		}
+		sb->sumBlock = sb->headBlock++;
+		unsigned char *sum = __lfsHeadBlock(sb, sb->sumBlock);
+		memset(sum, 0, sb->blockBytes);
+		__lfsSetU32(sum, 0, LFS_SUM_MAGIC);
+		__lfsSetU32(sum, 2, ++sb->writeSeq);
+	}
+
+	unsigned char *sum = __lfsHeadBlock(sb, sb->sumBlock);
+	unsigned int count = __lfsGetU32(sum, 1);
+	__lfsSetU32(sum, LFS_SUM_HEADER + 2 * count, inodeNum);
+	__lfsSetU32(sum, LFS_SUM_HEADER + 2 * count + 1, code);
+	__lfsSetU32(sum, 1, count + 1);
+
+	unsigned int blk = sb->headBlock++;
+	memcpy(__lfsHeadBlock(sb, blk), data, sb->blockBytes);
+
+	LFSSegment *s = &sb->segs[sb->headSeg];
+	s->usedBlocks = sb->headBlock;
+	s->liveBytes += live;
+	s->age = sb->writeSeq;
+	return __lfsSegAddr(sb, sb->headSeg, blk);
+}
+
+// Descarta um i-node em memória, sem gravar nada
+void __lfsDropInode(LFSInode *ci){
+	if(ci->leaf){
+		for(unsigned int k = 0; k < ci->sb->ptrsPerBlock; k++){
+			free(ci->leaf[k]);
+		}
+	}
+	free(ci->leaf);
+	free(ci->leafDirty);
+	free(ci->ind);
+	free(ci->dind);
+	free(ci->tail);
+	free(ci->inode);
+	memset(ci, 0, sizeof(LFSInode));
+}
+
+// Carrega em *buf o bloco de ponteiros de endereço addr, se ainda não
+// estiver em memória. Com create, um endereço 0 dá um bloco zerado.
+// Retorna o bloco ou NULL
+unsigned char *__lfsLoadPtrs(LFSSuper *sb, unsigned char **buf, unsigned int addr, int create){
+	if(*buf){
+		return *buf;
+	}
+	if(addr == 0 && !create){
+		return NULL;
+	}
+
+	unsigned char *data = malloc(sb->blockBytes);
+	if(!data){
+		return NULL;
+	}
+	if(addr == 0){
+		memset(data, 0, sb->blockBytes);
+	}
+	else if(__lfsReadBlocks(sb, addr, 1, data) < 0){
+		free(data);
+		return NULL;
+	}
+	*buf = data;
+	return data;
+}
+
+// Retorna a folha k do indireto duplo de ci, carregando-a (ou criando-a,
+// com create) se preciso. Retorna NULL se não existir ou em caso de falha
+unsigned char *__lfsLoadLeaf(LFSInode *ci, unsigned int k, int create){
+	LFSSuper *sb = ci->sb;
+	unsigned char *dind = __lfsLoadPtrs(sb, &ci->dind, inodeGetBlockAddr(ci->inode, LFS_DINDIRECT), create);
+	if(!dind){
+		return NULL;
+	}
+	if(!ci->leaf){
+		ci->leaf = calloc(sb->ptrsPerBlock, sizeof(unsigned char *));
+		ci->leafDirty = calloc(sb->ptrsPerBlock, 1);
+		if(!ci->leaf || !ci->leafDirty){
+			free(ci->leaf);
+			free(ci->leafDirty);
+			ci->leaf = NULL;
+			ci->leafDirty = NULL;
+			return NULL;
+		}
+	}
+	return __lfsLoadPtrs(sb, &ci->leaf[k], __lfsGetU32(dind, k), create);
+}
+
+// Retorna o endereço do bloco lógico blockNum do arquivo, ou 0 (buraco)
+unsigned int __lfsBmapGet(LFSInode *ci, unsigned int blockNum){
+	unsigned int ptrs = ci->sb->ptrsPerBlock;
+
+	if(blockNum < LFS_NDIRECT){
+		return inodeGetBlockAddr(ci->inode, blockNum);
+	}
+
+	blockNum -= LFS_NDIRECT;
+	if(blockNum < ptrs){
+		unsigned char *ind = __lfsLoadPtrs(ci->sb, &ci->ind, inodeGetBlockAddr(ci->inode, LFS_SINDIRECT), 0);
+		return ind ? __lfsGetU32(ind, blockNum) : 0;
+	}
+
+	blockNum -= ptrs;
+	if(blockNum / ptrs >= ptrs){
+		return 0;
+	}
+	unsigned char *leaf = __lfsLoadLeaf(ci, blockNum / ptrs, 0);
+	return leaf ? __lfsGetU32(leaf, blockNum % ptrs) : 0;
+}
+
+// Faz o bloco lógico blockNum do arquivo apontar para addr, descontando a
+// versão anterior. Os blocos de ponteiros alterados só vão para o log no
+// próximo descarregamento do i-node. Retorna 0 ou -1
+int __lfsBmapSet(LFSInode *ci, unsigned int blockNum, unsigned int addr){
+	LFSSuper *sb = ci->sb;
+	unsigned int ptrs = sb->ptrsPerBlock, old;
+
+	if(blockNum < LFS_NDIRECT){
+		old = inodeGetBlockAddr(ci->inode, blockNum);
+		inodeSetBlockAddr(ci->inode, blockNum, addr);
+		ci->dirty = 1;
+	}
+	else if(blockNum - LFS_NDIRECT < ptrs){
+		unsigned char *ind = __lfsLoadPtrs(sb, &ci->ind, inodeGetBlockAddr(ci->inode, LFS_SINDIRECT), 1);
+		if(!ind){
+			return -1;
+		}
+		old = __lfsGetU32(ind, blockNum - LFS_NDIRECT);
+		__lfsSetU32(ind, blockNum - LFS_NDIRECT, addr);
+		ci->indDirty = 1;
+	}
+	else{
+		blockNum -= LFS_NDIRECT + ptrs;
+		unsigned int k = blockNum / ptrs;
+		unsigned char *leaf = k < ptrs ? __lfsLoadLeaf(ci, k, 1) : NULL;
+		if(!leaf){
+			return -1;
+		}
+		old = __lfsGetU32(leaf, blockNum % ptrs);
+		__lfsSetU32(leaf, blockNum % ptrs, addr);
+		ci->leafDirty[k] = 1;
+	}
+
+	__lfsKill(sb, old, sb->blockBytes);
+	return 0;
+}
+
+// Grava no log o último bloco de dados escrito do arquivo. Retorna 0 ou -1
+int __lfsFlushTail(LFSInode *ci){
+	if(!ci->tailDirty){
+		return 0;
+	}
+
+	LFSSuper *sb = ci->sb;
+	unsigned int addr = __lfsAppend(sb, ci->tail, ci->num, ci->tailBlock, sb->blockBytes);
+	if(addr == 0){
+		return -1;
+	}
+	if(__lfsBmapSet(ci, ci->tailBlock, addr) < 0){
+		__lfsKill(sb, addr, sb->blockBytes);
+		return -1;
+	}
+	ci->tailDirty = 0;
+	return 0;
+}
+
+// Grava no log os blocos de ponteiros alterados do arquivo, das folhas do
+// indireto duplo para cima, atualizando os endereços no i-node
+int __lfsFlushPtrs(LFSInode *ci){
+	LFSSuper *sb = ci->sb;
+	unsigned int addr;
+
+	if(ci->leaf){
+		for(unsigned int k = 0; k < sb->ptrsPerBlock; k++){
+			if(!ci->leafDirty[k]){
+				continue;
+			}
+			addr = __lfsAppend(sb, ci->leaf[k], ci->num, LFS_CODE_LEAF | k, sb->blockBytes);
+			if(addr == 0){
+				return -1;
+			}
+			__lfsKill(sb, __lfsGetU32(ci->dind, k), sb->blockBytes);
+			__lfsSetU32(ci->dind, k, addr);
+			ci->leafDirty[k] = 0;
+			ci->dindDirty = 1;
+		}
+	}
+
+	if(ci->dindDirty){
+		addr = __lfsAppend(sb, ci->dind, ci->num, LFS_CODE_DINDIRECT, sb->blockBytes);
+		if(addr == 0){
+			return -1;
+		}
+		__lfsKill(sb, inodeGetBlockAddr(ci->inode, LFS_DINDIRECT), sb->blockBytes);
+		inodeSetBlockAddr(ci->inode, LFS_DINDIRECT, addr);
+		ci->dindDirty = 0;
+		ci->dirty = 1;
+	}
+
+	if(ci->indDirty){
+		addr = __lfsAppend(sb, ci->ind, ci->num, LFS_CODE_SINDIRECT, sb->blockBytes);
+		if(addr == 0){
+			return -1;
+		}
+		__lfsKill(sb, inodeGetBlockAddr(ci->inode, LFS_SINDIRECT), sb->blockBytes);
+		inodeSetBlockAddr(ci->inode, LFS_SINDIRECT, addr);
+		ci->indDirty = 0;
+		ci->dirty = 1;
+	}
+	return 0;
+}
+
+// Grava no log um bloco com os count i-nodes de batch e atualiza o mapa.
+// Cada setor do bloco guarda inodesPerSector registros e, ao fim, os
+// números dos i-nodes, usados pelo limpador. Retorna 0 ou -1
+int __lfsWriteInodeBlock(LFSSuper *sb, LFSInode **batch, unsigned int count){
+	unsigned int rec = inodeRecordSize(), ips = sb->inodesPerSector;
+	unsigned char *block = sb->metaBuf;
+
+	memset(block, 0, sb->blockBytes);
+	for(unsigned int j = 0; j < count; j++){
+		unsigned char *sector = &block[(j / ips) * DISK_SECTORDATASIZE];
+		inodeEncode(batch[j]->inode, &sector[(j % ips) * rec]);
+		__lfsSetU32(&sector[ips * rec], j % ips, batch[j]->num);
+	}
+
+	unsigned int addr = __lfsAppend(sb, block, 0, LFS_CODE_INODE, count * rec);
+	if(addr == 0){
+		return -1;
+	}
+
+	for(unsigned int j = 0; j < count; j++){
+		unsigned int num = batch[j]->num, old = sb->imap[num];
+		if(old != 0 && old != LFS_IMAP_NEW){
+			__lfsKill(sb, old / LFS_LOC_SLOTS, rec);
+		}
+		sb->imap[num] = (addr + j / ips) * LFS_LOC_SLOTS + j % ips;
+		sb->chunkDirty[num / sb->ptrsPerBlock] = 1;
+		batch[j]->dirty = 0;
+	}
+	return 0;
+}
+
+// Grava no log tudo o que está pendente nos i-nodes em memória de sb:
+// últimos blocos de dados, blocos de ponteiros e, agrupados em blocos de
+// i-nodes, os próprios i-nodes. Retorna 0 ou -1
+int __lfsFlushInodes(LFSSuper *sb){
+	LFSInode *batch[LFS_MAX_CACHED];
+	unsigned int count = 0;
+	unsigned int perBlock = sb->inodesPerSector * sb->sectorsPerBlock;
+
+	for(int i = 0; i < LFS_MAX_CACHED; i++){
+		LFSInode *ci = &lfsInodes[i];
+		if(!ci->used || ci->sb != sb){
+			continue;
+		}
+		if(__lfsFlushTail(ci) < 0 || __lfsFlushPtrs(ci) < 0){
+			return -1;
+		}
+	}
+
+	for(int i = 0; i < LFS_MAX_CACHED; i++){
+		LFSInode *ci = &lfsInodes[i];
+		if(!ci->used || ci->sb != sb || !ci->dirty){
+			continue;
+		}
+		batch[count++] = ci;
+		if(count == perBlock){
+			if(__lfsWriteInodeBlock(sb, batch, count) < 0){
+				return -1;
+			}
+			count = 0;
+		}
+	}
+	return count > 0 ? __lfsWriteInodeBlock(sb, batch, count) : 0;
+}
+
+// Indica se um i-node em memória tem alterações fora do log
+int __lfsInodeDirty(LFSInode *ci){
+	if(ci->dirty || ci->tailDirty || ci->indDirty || ci->dindDirty){
+		return 1;
+	}
+	for(unsigned int k = 0; ci->leaf && k < ci->sb->ptrsPerBlock; k++){
+		if(ci->leafDirty[k]){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Retorna uma entrada livre da tabela de i-nodes em memória, descartando
+// um i-node sem uso e sem alterações. Com a tabela cheia de alterações,
+// elas são antes gravadas no log
+LFSInode *__lfsInodeSlot(void){
+	for(int pass = 0; pass < 2; pass++){
+		LFSInode *victim = NULL;
+		for(int i = 0; i < LFS_MAX_CACHED; i++){
+			LFSInode *ci = &lfsInodes[i];
+			if(!ci->used){
+				return ci;
+			}
+			if(!victim && ci->refs == 0 && !__lfsInodeDirty(ci)){
+				victim = ci;
+			}
+		}
+		if(victim){
+			__lfsDropInode(victim);
+			return victim;
+		}
+		for(int i = 0; pass == 0 && i < LFS_MAX_MOUNTS; i++){
+			if(lfsMounts[i].used){
+				__lfsFlushInodes(&lfsMounts[i]);
+			}
+		}
+	}
+	return NULL;
+}
+
+// Retorna o i-node inodeNum de sb em memória, carregando-o a partir da
+// posição indicada no mapa se preciso. Deve ser liberado com
+// __lfsPutInode. Retorna NULL se o i-node estiver livre ou em caso de falha
+LFSInode *__lfsGetInode(LFSSuper *sb, unsigned int inodeNum){
+	if(inodeNum < 1 || inodeNum > sb->numInodes){
+		return NULL;
+	}
+
+	for(int i = 0; i < LFS_MAX_CACHED; i++){
+		if(lfsInodes[i].used && lfsInodes[i].sb == sb && lfsInodes[i].num == inodeNum){
+			lfsInodes[i].refs++;
+			return &lfsInodes[i];
+		}
+	}
+
+	unsigned int loc = sb->imap[inodeNum];
+	if(loc == 0 || loc == LFS_IMAP_NEW){
+		return NULL;
+	}
+
+	unsigned char sector[DISK_SECTORDATASIZE];
+	if(__lfsReadSector(sb, loc / LFS_LOC_SLOTS, sector) < 0){
+		return NULL;
+	}
+
+	LFSInode *ci = __lfsInodeSlot();
+	if(!ci){
+		return NULL;
+	}
+	ci->inode = inodeDecode(inodeNum, sb->d, &sector[(loc % LFS_LOC_SLOTS) * inodeRecordSize()]);
+	if(!ci->inode){
+		return NULL;
+	}
+	ci->used = 1;
+	ci->refs = 1;
+	ci->sb = sb;
+	ci->num = inodeNum;
+	return ci;
+}
+
+// Cria em memória o i-node inodeNum, recém-alocado, zerado e com
+// alterações. Retorna NULL em caso de falha
+LFSInode *__lfsNewInode(LFSSuper *sb, unsigned int inodeNum){
+	unsigned char record[DISK_SECTORDATASIZE];
+	LFSInode *ci = __lfsInodeSlot();
+	if(!ci){
+		return NULL;
+	}
+
+	memset(record, 0, sizeof(record));
+	ci->inode = inodeDecode(inodeNum, sb->d, record);
+	if(!ci->inode){
+		return NULL;
+	}
+	ci->used = 1;
+	ci->refs = 1;
+	ci->sb = sb;
+	ci->num = inodeNum;
+	ci->dirty = 1;
+	return ci;
+}
+
+// Aloca um i-node livre, que fica reservado até ser gravado no log.
+// Retorna o número ou 0
+unsigned int __lfsAllocInode(LFSSuper *sb){
+	for(unsigned int k = 0; k < sb->numInodes; k++){
+		unsigned int num = (sb->inodeHint + k) % sb->numInodes + 1;
+		if(sb->imap[num] == 0){
+			sb->imap[num] = LFS_IMAP_NEW;
+			sb->freeInodes--;
+			sb->inodeHint = num;
+			return num;
+		}
+	}
+	return 0;
+}
+
+// Desconta todos os blocos do arquivo (dados e ponteiros) e libera o
+// i-node no mapa. O i-node em memória é descartado
+void __lfsFreeInode(LFSInode *ci){
+	LFSSuper *sb = ci->sb;
+	unsigned int bb = sb->blockBytes, ptrs = sb->ptrsPerBlock;
+
+	for(unsigned int k = 0; k < LFS_NDIRECT; k++){
+		__lfsKill(sb, inodeGetBlockAddr(ci->inode, k), bb);
+	}
+
+	unsigned char *ind = __lfsLoadPtrs(sb, &ci->ind, inodeGetBlockAddr(ci->inode, LFS_SINDIRECT), 0);
+	for(unsigned int k = 0; ind && k < ptrs; k++){
+		__lfsKill(sb, __lfsGetU32(ind, k), bb);
+	}
+	__lfsKill(sb, inodeGetBlockAddr(ci->inode, LFS_SINDIRECT), bb);
+
+	unsigned char *dind = __lfsLoadPtrs(sb, &ci->dind, inodeGetBlockAddr(ci->inode, LFS_DINDIRECT), 0);
+	for(unsigned int k = 0; dind && k < ptrs; k++){
+		unsigned char *leaf = __lfsLoadLeaf(ci, k, 0);
+		for(unsigned int j = 0; leaf && j < ptrs; j++){
+			__lfsKill(sb, __lfsGetU32(leaf, j), bb);
+		}
+		__lfsKill(sb, __lfsGetU32(dind, k), bb);
+	}
+	__lfsKill(sb, inodeGetBlockAddr(ci->inode, LFS_DINDIRECT), bb);
+
+	// O número pode ser reaproveitado: descarta nomes do diretório
+	dcachePurgeDir(sb->dcache, ci->num);
+
+	unsigned int loc = sb->imap[ci->num];
+	if(loc != LFS_IMAP_NEW){
+		__lfsKill(sb, loc / LFS_LOC_SLOTS, inodeRecordSize());
+	}
+	sb->imap[ci->num] = 0;
+	sb->chunkDirty[ci->num / ptrs] = 1;
+	sb->freeInodes++;
+	__lfsDropInode(ci);
+}
+
+// Libera um uso de i-node em memória. Sem usos e sem entradas de
+// diretório, o i-node e seus blocos são liberados
+void __lfsPutInode(LFSInode *ci){
+	if(--ci->refs > 0){
+		return;
+	}
+	if(inodeGetRefCount(ci->inode) == 0){
+		__lfsFreeInode(ci);
+	}
+}
+
+// Grava no log os pedaços alterados do mapa de i-nodes. Retorna 0 ou -1
+int __lfsFlushImap(LFSSuper *sb){
+	unsigned int ptrs = sb->ptrsPerBlock;
+	for(unsigned int c = 0; c < sb->numChunks; c++){
+		if(!sb->chunkDirty[c]){
+			continue;
+		}
+		for(unsigned int k = 0; k < ptrs; k++){
+			unsigned int num = c * ptrs + k;
+			__lfsSetU32(sb->metaBuf, k, num <= sb->numInodes ? sb->imap[num] : 0);
+		}
+		unsigned int addr = __lfsAppend(sb, sb->metaBuf, 0, c, sb->blockBytes);
+		if(addr == 0){
+			return -1;
+		}
+		__lfsKill(sb, sb->chunkAddr[c], sb->blockBytes);
+		sb->chunkAddr[c] = addr;
+		sb->chunkDirty[c] = 0;
+	}
+	return 0;
+}
+
+// Grava um checkpoint: todas as alterações em memória vão para o log, o
+// segmento corrente vai para o disco e a região de checkpoint mais antiga
+// passa a apontar para o mapa de i-nodes e a descrever o uso dos
+// segmentos. Só então os segmentos sem dados vivos ficam livres. Após uma
+// queda, a montagem parte do último checkpoint completo. Retorna 0 ou -1
+int __lfsCheckpoint(LFSSuper *sb){
+	if(__lfsFlushInodes(sb) < 0 || __lfsFlushImap(sb) < 0 || __lfsWriteOut(sb) < 0){
+		return -1;
+	}
+
+	unsigned int bytes = sb->cpSectors * DISK_SECTORDATASIZE;
+	unsigned char *cp = calloc(1, bytes);
+	if(!cp){
+		return -1;
+	}
+
+	unsigned int seq = sb->cpSeq + 1;
+	__lfsSetU32(cp, 0, LFS_CP_MAGIC);
+	__lfsSetU32(cp, 1, seq);
+	__lfsSetU32(cp, 2, sb->headSeg);
+	__lfsSetU32(cp, 3, sb->headBlock);
+	__lfsSetU32(cp, 4, sb->writeSeq);
+	__lfsSetU32(cp, 5, sb->numChunks);
+	for(unsigned int c = 0; c < sb->numChunks; c++){
+		__lfsSetU32(cp, LFS_CP_HEADER + c, sb->chunkAddr[c]);
+	}
+	unsigned int base = LFS_CP_HEADER + sb->numChunks;
+	for(unsigned int s = 0; s < sb->numSegments; s++){
+		if(sb->segs[s].state == LFS_SEG_USED){
+			__lfsSetU32(cp, base + s * LFS_CP_SEGITEMS, sb->segs[s].liveBytes);
+			__lfsSetU32(cp, base + s * LFS_CP_SEGITEMS + 1, sb->segs[s].age);
+			__lfsSetU32(cp, base + s * LFS_CP_SEGITEMS + 2, sb->segs[s].usedBlocks);
+		}
+	}
+	__lfsSetU32(cp, bytes / sizeof(unsigned int) - 1, seq);
+
+	// As duas regiões se alternam: a anterior continua válida até o fim
+	unsigned int where = LFS_SECTOR_CHECKPOINT + (seq % 2) * sb->cpSectors;
+	int ret = diskWriteSectors(sb->d, where, sb->cpSectors, cp);
+	free(cp);
+	if(ret < 0){
+		return -1;
+	}
+
+	sb->cpSeq = seq;
+	for(unsigned int s = 0; s < sb->numSegments; s++){
+		if(sb->segs[s].state == LFS_SEG_PENDING){
+			sb->segs[s].state = LFS_SEG_FREE;
+			sb->segs[s].liveBytes = 0;
+			sb->segs[s].usedBlocks = 0;
+			sb->freeSegs++;
+		}
+	}
+	return 0;
+}
+
+// Copia para o fim do log, se ainda estiver em uso, o bloco data de
+// endereço addr, cujo dono no resumo é (inodeNum, code). Blocos de
+// ponteiros, i-nodes e pedaços do mapa são só marcados como alterados e
+// vão para o log no descarregamento seguinte. Retorna 0 ou -1
+int __lfsRelocate(LFSSuper *sb, unsigned int inodeNum, unsigned int code, unsigned int addr, unsigned char *data){
+
+	if(inodeNum == 0 && code == LFS_CODE_INODE){
+		unsigned int ips = sb->inodesPerSector;
+		for(unsigned int j = 0; j < ips * sb->sectorsPerBlock; j++){
+			unsigned char *sector = &data[(j / ips) * DISK_SECTORDATASIZE];
+			unsigned int num = __lfsGetU32(&sector[ips * inodeRecordSize()], j % ips);
+			unsigned int loc = (addr + j / ips) * LFS_LOC_SLOTS + j % ips;
+			if(num < 1 || num > sb->numInodes || sb->imap[num] != loc){
+				continue;
+			}
+			LFSInode *ci = __lfsGetInode(sb, num);
+			if(!ci){
+				return -1;
+			}
+			ci->dirty = 1;
+			__lfsPutInode(ci);
+		}
+		return 0;
+	}
+
+	if(inodeNum == 0){
+		if(code < sb->numChunks && sb->chunkAddr[code] == addr){
+			sb->chunkDirty[code] = 1;
+		}
+		return 0;
+	}
+
+	if(inodeNum > sb->numInodes || sb->imap[inodeNum] == 0){
+		return 0;
+	}
+	LFSInode *ci = __lfsGetInode(sb, inodeNum);
+	if(!ci){
+		return -1;
+	}
+
+	int ret = 0;
+	if(code == LFS_CODE_SINDIRECT){
+		if(inodeGetBlockAddr(ci->inode, LFS_SINDIRECT) == addr){
+			ret = __lfsLoadPtrs(sb, &ci->ind, addr, 0) ? 0 : -1;
+			ci->indDirty = 1;
+		}
+	}
+	else if(code == LFS_CODE_DINDIRECT){
+		if(inodeGetBlockAddr(ci->inode, LFS_DINDIRECT) == addr){
+			ret = __lfsLoadPtrs(sb, &ci->dind, addr, 0) ? 0 : -1;
+			ci->dindDirty = 1;
+		}
+	}
+	else if(code & LFS_CODE_LEAF){
+		unsigned int k = code & ~LFS_CODE_LEAF;
+		unsigned char *dind = __lfsLoadPtrs(sb, &ci->dind, inodeGetBlockAddr(ci->inode, LFS_DINDIRECT), 0);
+		if(k < sb->ptrsPerBlock && dind && __lfsGetU32(dind, k) == addr){
+			if(__lfsLoadLeaf(ci, k, 0)){
+				ci->leafDirty[k] = 1;
+			}
+			else{
+				ret = -1;
+			}
+		}
+	}
+	else if(__lfsBmapGet(ci, code) == addr){
+		unsigned int newAddr = __lfsAppend(sb, data, inodeNum, code, sb->blockBytes);
+		if(newAddr == 0 || __lfsBmapSet(ci, code, newAddr) < 0){
+			ret = -1;
+		}
+	}
+
+	__lfsPutInode(ci);
+	return ret;
+}
+
+// Limpa o segmento seg: lê o segmento inteiro de uma vez e percorre os
+// resumos dos seus segmentos parciais, copiando os blocos vivos para o fim
+// do log. Com unlocked diferente de 0, lfsLock fica livre durante a
+// leitura; se um checkpoint a liberar e o segmento puder ter sido
+// reaproveitado, nada é copiado. Retorna 0 ou -1
+int __lfsCleanSegment(LFSSuper *sb, unsigned int seg, int unlocked){
+	unsigned int used = sb->segs[seg].usedBlocks, bb = sb->blockBytes;
+	unsigned int cpSeq = sb->cpSeq;
+	unsigned char *buf = malloc(used * bb);
+	if(!buf){
+		return -1;
+	}
+	if(unlocked){
+		sb->cleaning = 0;
+		pthread_mutex_unlock(&lfsLock);
+	}
+	int loaded = diskReadSectors(sb->d, __lfsSegAddr(sb, seg, 0), used * sb->sectorsPerBlock, buf);
+	if(unlocked){
+		pthread_mutex_lock(&lfsLock);
+		sb->cleaning = 1;
+	}
+	if(loaded < 0 || sb->cpSeq != cpSeq){
+		free(buf);
+		return loaded < 0 ? -1 : 0;
+	}
+
+	int ret = 0;
+	unsigned int pos = 0;
+	while(ret == 0 && pos < used){
+		unsigned char *sum = &buf[pos * bb];
+		unsigned int count = __lfsGetU32(sum, 1);
+		if(__lfsGetU32(sum, 0) != LFS_SUM_MAGIC || count > sb->sumEntries || pos + 1 + count > used){
+			break;
+		}
+		for(unsigned int k = 0; ret == 0 && k < count; k++){
+			ret = __lfsRelocate(sb, __lfsGetU32(sum, LFS_SUM_HEADER + 2 * k),
+			                    __lfsGetU32(sum, LFS_SUM_HEADER + 2 * k + 1),
+			                    __lfsSegAddr(sb, seg, pos + 1 + k), &buf[(pos + 1 + k) * bb]);
+		}
+		pos += 1 + count;
+	}
+
+	free(buf);
+	return ret;
+}
+
+// Escolhe o segmento a limpar pelo critério custo-benefício do LFS: o
+// espaço liberado vezes a idade dos dados, dividido pelo custo de ler o
+// segmento e regravar o que está vivo. Retorna o segmento ou -1
+int __lfsPickVictim(LFSSuper *sb){
+	double capacity = (double)sb->segBlocks * sb->blockBytes, best = 0;
+	int victim = -1;
+
+	for(unsigned int s = 0; s < sb->numSegments; s++){
+		if(sb->segs[s].state != LFS_SEG_USED || s == sb->headSeg){
+			continue;
+		}
+		double u = sb->segs[s].liveBytes / capacity;
+		if(u >= LFS_CLEAN_MAX_UTIL){
+			continue;
+		}
+		double age = (double)(sb->writeSeq - sb->segs[s].age) + 1;
+		double score = (1 - u) * age / (1 + u);
+		if(score > best){
+			best = score;
+			victim = s;
+		}
+	}
+	return victim;
+}
+
+// Retorna o número de segmentos no estado state
+unsigned int __lfsCountSegs(LFSSuper *sb, int state){
+	unsigned int n = 0;
+	for(unsigned int s = 0; s < sb->numSegments; s++){
+		n += sb->segs[s].state == state;
+	}
+	return n;
+}
+
+// Verifica se restam menos de cleanLow segmentos livres e nenhuma limpeza
+// foi feita desde que o segmento corrente foi aberto
+int __lfsNeedsClean(LFSSuper *sb){
+	return sb->freeSegs < sb->cleanLow && sb->cleanMark != sb->segCount;
+}
+
+// Limpador de segmentos, executado pelo limpador do disco quando
+// __lfsNeedsClean e por quem escreve quando restam só os segmentos
+// reservados. Segmentos que já estão sem dados vivos só ficam livres com
+// um checkpoint, que é gravado antes de tudo. Depois, limpa até haver
+// cleanHigh, terminando com um checkpoint que libera os segmentos limpos.
+// Com unlocked diferente de 0, lfsLock fica livre durante a leitura de
+// cada segmento. Retorna 0 ou -1
+int __lfsClean(LFSSuper *sb, int unlocked){
+	if(sb->cleaning){
+		return 0;
+	}
+	sb->cleaning = 1;
+	sb->cleanMark = sb->segCount;
+
+	int ret = 0, cleaned = 0;
+	if(sb->freeSegs < sb->cleanLow && __lfsCountSegs(sb, LFS_SEG_PENDING) > 0 &&
+	   __lfsCheckpoint(sb) < 0){
+		ret = -1;
+	}
+	while(ret == 0 && !sb->cleanerStop){
+		// Os segmentos limpos aqui ficam livres no checkpoint do fim
+		unsigned int avail = sb->freeSegs + __lfsCountSegs(sb, LFS_SEG_PENDING);
+		if(avail >= sb->cleanHigh || sb->freeSegs < LFS_RESERVED_SEGMENTS){
+			break;
+		}
+
+		int victim = __lfsPickVictim(sb);
+		if(victim < 0){
+			break;
+		}
+		// Os blocos de ponteiros, i-nodes e o mapa também saem do segmento
+		if(__lfsCleanSegment(sb, victim, unlocked) < 0 || __lfsFlushInodes(sb) < 0 || __lfsFlushImap(sb) < 0){
+			ret = -1;
+			break;
+		}
+		cleaned++;
+		if(sb->segs[victim].state == LFS_SEG_USED){
+			break; // Ainda há referências: não insiste no mesmo segmento
+		}
+	}
+
+	if(cleaned > 0 && __lfsCheckpoint(sb) < 0){
+		ret = -1;
+	}
+	sb->cleaning = 0;
+	return ret;
+}
+
+// Limpador do disco montado sb. Dorme até que quem escreve o acorde com
+// __lfsNeedsClean e limpa até cleanHigh, liberando lfsLock durante as
+// leituras, para que as escritas continuem enquanto isso
+void *__lfsCleanerMain(void *arg){
+	LFSSuper *sb = arg;
+	pthread_mutex_lock(&lfsLock);
+	while(!sb->cleanerStop){
+		if(__lfsNeedsClean(sb)){
+			__lfsClean(sb, 1);
+		}
+		else{
+			pthread_cond_wait(&sb->cleanWake, &lfsLock);
+		}
+	}
+	pthread_mutex_unlock(&lfsLock);
+	return NULL;
+}
+
+// Inicia o limpador do disco montado sb. Sem ele, quem escreve limpa por
+// conta própria ao passar de cleanLow
+void __lfsStartCleaner(LFSSuper *sb){
+	sb->cleanerStop = 0;
+	pthread_cond_init(&sb->cleanWake, NULL);
+	sb->cleanerOn = pthread_create(&sb->cleaner, NULL, __lfsCleanerMain, sb) == 0;
+	if(!sb->cleanerOn){
+		pthread_cond_destroy(&sb->cleanWake);
+	}
+}
+
+// Para o limpador do disco montado sb, esperando a limpeza em curso. Chamada
+// com lfsLock, que fica livre durante a espera
+void __lfsStopCleaner(LFSSuper *sb){
+	if(!sb->cleanerOn){
+		return;
+	}
+	sb->cleanerStop = 1;
+	pthread_cond_signal(&sb->cleanWake);
+	pthread_mutex_unlock(&lfsLock);
+	pthread_join(sb->cleaner, NULL);
+	pthread_mutex_lock(&lfsLock);
+	pthread_cond_destroy(&sb->cleanWake);
+	sb->cleanerOn = 0;
+}
+
+// Lê o bloco lógico blockNum do arquivo para buf; buracos são lidos como
+// zeros. Retorna 0 ou -1
+int __lfsReadFileBlock(LFSInode *ci, unsigned int blockNum, unsigned char *buf){
+	if(ci->tailValid && ci->tailBlock == blockNum){
+		memcpy(buf, ci->tail, ci->sb->blockBytes);
+		return 0;
+	}
+	unsigned int addr = __lfsBmapGet(ci, blockNum);
+	if(addr == 0){
+		memset(buf, 0, ci->sb->blockBytes);
+		return 0;
+	}
+	return __lfsReadBlocks(ci->sb, addr, 1, buf);
+}
+
+// Lê até nbytes do arquivo a partir de offset. Blocos inteiros gravados
+// em sequência no log são lidos de uma vez. Retorna os bytes lidos ou -1
+int __lfsReadAt(LFSInode *ci, char *buf, unsigned int nbytes, unsigned int offset){
+	LFSSuper *sb = ci->sb;
+	unsigned int bb = sb->blockBytes, size = inodeGetFileSize(ci->inode);
+
+	if(offset >= size){
+		return 0;
+	}
+	if(nbytes > size - offset){
+		nbytes = size - offset;
+	}
+
+	unsigned int done = 0;
+	while(done < nbytes){
+		unsigned int pos = offset + done, blockNum = pos / bb, in = pos % bb;
+		unsigned int len = bb - in < nbytes - done ? bb - in : nbytes - done;
+
+		unsigned int addr = 0, count = 0;
+		if(in == 0 && len == bb && !(ci->tailValid && ci->tailBlock == blockNum)){
+			addr = __lfsBmapGet(ci, blockNum);
+		}
+		if(addr != 0){
+			count = 1;
+			while(done + (count + 1) * bb <= nbytes &&
+			      !(ci->tailValid && ci->tailBlock == blockNum + count) &&
+			      __lfsBmapGet(ci, blockNum + count) == addr + count * sb->sectorsPerBlock){
+				count++;
+			}
+			if(__lfsReadBlocks(sb, addr, count, (unsigned char *)&buf[done]) < 0){
+				return done > 0 ? (int)done : -1;
+			}
+			done += count * bb;
+			continue;
+		}
+
+		if(__lfsReadFileBlock(ci, blockNum, sb->blockBuf) < 0){
+			return done > 0 ? (int)done : -1;
+		}
+		memcpy(&buf[done], &sb->blockBuf[in], len);
+		done += len;
+	}
+	return done;
+}
+
+// Escreve nbytes de buf no arquivo a partir de offset. Os dados passam
+// pelo último bloco do arquivo em memória, que vai para o log quando outro
+// bloco é escrito. Retorna os bytes escritos ou -1
+int __lfsWriteAt(LFSInode *ci, const char *buf, unsigned int nbytes, unsigned int offset){
+	LFSSuper *sb = ci->sb;
+	unsigned int bb = sb->blockBytes, ptrs = sb->ptrsPerBlock;
+	unsigned long long maxSize = (LFS_NDIRECT + ptrs + (unsigned long long)ptrs * ptrs) * bb;
+
+	if(maxSize > 0xFFFFFFFFull){
+		maxSize = 0xFFFFFFFFull;
+	}
+	if(offset >= maxSize){
+		return nbytes > 0 ? -1 : 0;
+	}
+	if(nbytes > maxSize - offset){
+		nbytes = maxSize - offset;
+	}
+	if(!ci->tail && !(ci->tail = malloc(bb))){
+		return -1;
+	}
+
+	unsigned int done = 0;
+	while(done < nbytes){
+		// O limpador do disco trabalha enquanto as escritas seguem; quem
+		// escreve só espera uma limpeza com os segmentos reservados
+		if(sb->freeSegs <= LFS_RESERVED_SEGMENTS ||
+		   (__lfsNeedsClean(sb) && !sb->cleanerOn)){
+			__lfsClean(sb, 0);
+		}
+		else if(__lfsNeedsClean(sb)){
+			pthread_cond_signal(&sb->cleanWake);
+		}
+		if(sb->freeSegs <= LFS_RESERVED_SEGMENTS){
+			break; // Disco cheio
+		}
+
+		unsigned int pos = offset + done, blockNum = pos / bb, in = pos % bb;
+		unsigned int len = bb - in < nbytes - done ? bb - in : nbytes - done;
+
+		if(!ci->tailValid || ci->tailBlock != blockNum){
+			if(__lfsFlushTail(ci) < 0){
+				break;
+			}
+			ci->tailValid = 0;
+			// Um bloco sobrescrito por inteiro não precisa ser lido
+			if(len < bb && __lfsReadFileBlock(ci, blockNum, ci->tail) < 0){
+				break;
+			}
+			ci->tailBlock = blockNum;
+			ci->tailValid = 1;
+		}
+		memcpy(&ci->tail[in], &buf[done], len);
+		ci->tailDirty = 1;
+		done += len;
+	}
+
+	if(offset + done > inodeGetFileSize(ci->inode)){
+		inodeSetFileSize(ci->inode, offset + done);
+		ci->dirty = 1;
+	}
+	return done > 0 || nbytes == 0 ? (int)done : -1;
+}
+
+unsigned int __lfsDirentInode(unsigned char *leaf, unsigned int off){
+	return __lfsGetU32(leaf, off / sizeof(unsigned int));
+}
+
+unsigned int __lfsDirentRecLen(unsigned char *leaf, unsigned int off){
+	return leaf[off + 4] | (leaf[off + 5] << 8);
+}
+
+unsigned int __lfsDirentNameLen(unsigned char *leaf, unsigned int off){
+	return leaf[off + 6];
+}
+
+void __lfsDirentSetRecLen(unsigned char *leaf, unsigned int off, unsigned int recLen){
+	leaf[off + 4] = recLen & 0xFF;
+	leaf[off + 5] = (recLen >> 8) & 0xFF;
+}
+
+// Grava um registro na posição off de um bloco de diretório
+void __lfsDirentWrite(unsigned char *leaf, unsigned int off, unsigned int inodeNum,
+                      unsigned int recLen, const char *name, unsigned int nameLen){
+	__lfsSetU32(leaf, off / sizeof(unsigned int), inodeNum);
+	__lfsDirentSetRecLen(leaf, off, recLen);
+	leaf[off + 6] = nameLen;
+	leaf[off + 7] = 0;
+	memcpy(&leaf[off + LFS_DIRENT_HEADER], name, nameLen);
+}
+
+// Retorna a posição do registro seguinte ao de posição off, ou o tamanho
+// do bloco ao fim (ou se o encadeamento estiver corrompido)
+unsigned int __lfsDirentNext(LFSSuper *sb, unsigned char *leaf, unsigned int off){
+	unsigned int recLen = __lfsDirentRecLen(leaf, off);
+	if(recLen < LFS_DIRENT_HEADER || recLen % LFS_DIRENT_ALIGN || recLen > sb->blockBytes - off){
+		return sb->blockBytes;
+	}
+	return off + recLen;
+}
+
+// Busca name em um bloco de diretório. Retorna a posição do registro, ou
+// o tamanho do bloco se não achar. Em *prev fica a posição do anterior
+unsigned int __lfsLeafSearch(LFSSuper *sb, unsigned char *leaf, const char *name, unsigned int *prev){
+	unsigned int nameLen = strlen(name), last = sb->blockBytes;
+	for(unsigned int off = 0; off < sb->blockBytes; off = __lfsDirentNext(sb, leaf, off)){
+		if(__lfsDirentInode(leaf, off) != 0 && __lfsDirentNameLen(leaf, off) == nameLen &&
+		   memcmp(&leaf[off + LFS_DIRENT_HEADER], name, nameLen) == 0){
+			if(prev){
+				*prev = last;
+			}
+			return off;
+		}
+		last = off;
+	}
+	return sb->blockBytes;
+}
+
+// Insere (name -> inodeNum) em um bloco de diretório, no primeiro registro
+// com espaço sobrando ao fim. Retorna -1 se não houver espaço
+int __lfsLeafInsert(LFSSuper *sb, unsigned char *leaf, const char *name, unsigned int inodeNum){
+	unsigned int nameLen = strlen(name), need = LFS_DIRENT_SIZE(nameLen);
+	for(unsigned int off = 0; off < sb->blockBytes; off = __lfsDirentNext(sb, leaf, off)){
+		unsigned int recLen = __lfsDirentRecLen(leaf, off);
+		unsigned int used = __lfsDirentInode(leaf, off) ? LFS_DIRENT_SIZE(__lfsDirentNameLen(leaf, off)) : 0;
+		if(recLen >= used + need){
+			if(used > 0){
+				__lfsDirentSetRecLen(leaf, off, used);
+				off += used;
+				recLen -= used;
+			}
+			__lfsDirentWrite(leaf, off, inodeNum, recLen, name, nameLen);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Percorre as entradas de um bloco de diretório a partir da posição *pos,
+// avançando *pos. Retorna 1 e preenche inodeNum e name ao encontrar uma
+// entrada, ou 0 ao fim do bloco
+int __lfsLeafNext(LFSSuper *sb, unsigned char *leaf, unsigned int *pos, unsigned int *inodeNum, char *name){
+	while(*pos < sb->blockBytes){
+		unsigned int off = *pos;
+		*pos = __lfsDirentNext(sb, leaf, off);
+		if(__lfsDirentInode(leaf, off) != 0){
+			unsigned int nameLen = __lfsDirentNameLen(leaf, off);
+			*inodeNum = __lfsDirentInode(leaf, off);
+			memcpy(name, &leaf[off + LFS_DIRENT_HEADER], nameLen);
+			name[nameLen] = '\0';
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Busca name no diretório dir. Com lblk não nulo, o bloco lógico onde a
+// entrada está fica em *lblk e o bloco em sb->dirBuf. Retorna o número do
+// i-node ou 0 se não achar
+unsigned int __lfsDirFind(LFSInode *dir, const char *name, unsigned int *lblk){
+	LFSSuper *sb = dir->sb;
+	unsigned int blocks = inodeGetFileSize(dir->inode) / sb->blockBytes;
+	for(unsigned int b = 0; b < blocks; b++){
+		if(__lfsReadFileBlock(dir, b, sb->dirBuf) < 0){
+			return 0;
+		}
+		unsigned int off = __lfsLeafSearch(sb, sb->dirBuf, name, NULL);
+		if(off < sb->blockBytes){
+			if(lblk){
+				*lblk = b;
+			}
+			return __lfsDirentInode(sb->dirBuf, off);
+		}
+	}
+	return 0;
+}
+
+// Adiciona a entrada (name -> inodeNum) ao diretório dir, no primeiro
+// bloco com espaço ou em um novo bloco ao fim. Retorna 0 ou -1 em caso de
+// falha ou nome já existente
+int __lfsDirAdd(LFSInode *dir, const char *name, unsigned int inodeNum){
+	LFSSuper *sb = dir->sb;
+	unsigned int bb = sb->blockBytes, blocks = inodeGetFileSize(dir->inode) / bb;
+
+	if(name[0] == '\0' || strchr(name, '/') || strlen(name) > MAX_FILENAME_LENGTH ||
+	   __lfsDirFind(dir, name, NULL) != 0){
+		return -1;
+	}
+
+	for(unsigned int b = 0; b <= blocks; b++){
+		if(b == blocks){
+			memset(sb->dirBuf, 0, bb);
+			__lfsDirentWrite(sb->dirBuf, 0, 0, bb, "", 0);
+		}
+		else if(__lfsReadFileBlock(dir, b, sb->dirBuf) < 0){
+			return -1;
+		}
+		if(__lfsLeafInsert(sb, sb->dirBuf, name, inodeNum) == 0){
+			if(__lfsWriteAt(dir, (char *)sb->dirBuf, bb, b * bb) != (int)bb){
+				return -1;
+			}
+			dcacheInsert(sb->dcache, dir->num, name, inodeNum);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Remove name do diretório dir, juntando o espaço do registro ao
+// anterior. Retorna o número do i-node removido ou 0 se não achar
+unsigned int __lfsDirRemove(LFSInode *dir, const char *name){
+	LFSSuper *sb = dir->sb;
+	unsigned int lblk, prev;
+	unsigned int inodeNum = __lfsDirFind(dir, name, &lblk);
+	if(inodeNum == 0){
+		return 0;
+	}
+
+	unsigned int off = __lfsLeafSearch(sb, sb->dirBuf, name, &prev);
+	if(prev < sb->blockBytes){
+		__lfsDirentSetRecLen(sb->dirBuf, prev, __lfsDirentRecLen(sb->dirBuf, prev) + __lfsDirentRecLen(sb->dirBuf, off));
+	}
+	else{
+		__lfsSetU32(sb->dirBuf, off / sizeof(unsigned int), 0);
+	}
+	if(__lfsWriteAt(dir, (char *)sb->dirBuf, sb->blockBytes, lblk * sb->blockBytes) != (int)sb->blockBytes){
+		return 0;
+	}
+	dcacheInsert(sb->dcache, dir->num, name, 0);
+	return inodeNum;
+}
+
+// Indica se o diretório dir não tem entradas
+int __lfsDirIsEmpty(LFSInode *dir){
+	LFSSuper *sb = dir->sb;
+	unsigned int blocks = inodeGetFileSize(dir->inode) / sb->blockBytes, inodeNum;
+	char name[MAX_FILENAME_LENGTH + 1];
+	for(unsigned int b = 0; b < blocks; b++){
+		unsigned int pos = 0;
+		if(__lfsReadFileBlock(dir, b, sb->dirBuf) < 0 || __lfsLeafNext(sb, sb->dirBuf, &pos, &inodeNum, name)){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Busca name no diretório de i-node dirNum, passando pelo cache de nomes.
+// Retorna o i-node ou 0
+unsigned int __lfsLookup(LFSSuper *sb, unsigned int dirNum, const char *name){
+	unsigned int found = 0;
+	if(dcacheLookup(sb->dcache, dirNum, name, &found)){
+		return found;
+	}
+
+	LFSInode *dir = __lfsGetInode(sb, dirNum);
+	if(!dir){
+		return 0;
+	}
+	if(inodeGetFileType(dir->inode) == FILETYPE_DIR){
+		found = __lfsDirFind(dir, name, NULL);
+	}
+	dcacheInsert(sb->dcache, dirNum, name, found);
+	__lfsPutInode(dir);
+	return found;
+}
+
+// Resolve um caminho absoluto e retorna o i-node correspondente, ou 0 se
+// não existir
+unsigned int __lfsResolvePath(LFSSuper *sb, const char *path){
+	if(path[0] != '/'){
+		return 0; // O caminho deve ser absoluto
+	}
+
+	char pathCopy[MAX_FILENAME_LENGTH + 1];
+	strncpy(pathCopy, path, MAX_FILENAME_LENGTH);
+	pathCopy[MAX_FILENAME_LENGTH] = '\0';
+
+	unsigned int currentInode = 1; // Raiz é sempre 1
+	char *save;
+	char *token = strtok_r(pathCopy, "/", &save);
+	while(token != NULL){
+		currentInode = __lfsLookup(sb, currentInode, token);
+		if(currentInode == 0){
+			return 0;
+		}
+		token = strtok_r(NULL, "/", &save);
+	}
+	return currentInode;
+}
+
+// Resolve o diretório pai de um caminho absoluto, copiando o último
+// componente para name. Retorna o i-node do pai ou 0 se não existir
+unsigned int __lfsResolveParent(LFSSuper *sb, const char *path, char *name){
+	char pathCopy[MAX_FILENAME_LENGTH + 1];
+	strncpy(pathCopy, path, MAX_FILENAME_LENGTH);
+	pathCopy[MAX_FILENAME_LENGTH] = '\0';
+
+	// Ignora barras no final do caminho
+	size_t len = strlen(pathCopy);
+	while(len > 1 && pathCopy[len - 1] == '/'){
+		pathCopy[--len] = '\0';
+	}
+
+	char *slash = strrchr(pathCopy, '/');
+	if(!slash || slash[1] == '\0'){
+		return 0;
+	}
+
+	strcpy(name, slash + 1);
+	if(slash == pathCopy){
+		return 1; // Pai é a raiz
+	}
+	*slash = '\0';
+	return __lfsResolvePath(sb, pathCopy);
+}
+
+// Cria um i-node do tipo fileType e o liga ao diretório parentNum com o
+// nome name. Retorna o número do novo i-node ou 0 em caso de falha
+unsigned int __lfsCreate(LFSSuper *sb, unsigned int parentNum, const char *name, unsigned int fileType){
+	if(sb->freeSegs <= LFS_RESERVED_SEGMENTS){
+		return 0;
+	}
+
+	LFSInode *parent = __lfsGetInode(sb, parentNum);
+	if(!parent){
+		return 0;
+	}
+
+	unsigned int inodeNum = 0;
+	if(inodeGetFileType(parent->inode) == FILETYPE_DIR){
+		inodeNum = __lfsAllocInode(sb);
+	}
+
+	LFSInode *ci = inodeNum ? __lfsNewInode(sb, inodeNum) : NULL;
+	if(ci){
+		inodeSetFileType(ci->inode, fileType);
+		inodeSetFileSize(ci->inode, 0);
+		inodeSetOwner(ci->inode, 0);
+		inodeSetRefCount(ci->inode, 1);
+		if(__lfsDirAdd(parent, name, inodeNum) < 0){
+			inodeSetRefCount(ci->inode, 0);
+			inodeNum = 0;
+		}
+		__lfsPutInode(ci);
+	}
+	else if(inodeNum){
+		sb->imap[inodeNum] = 0;
+		sb->freeInodes++;
+		inodeNum = 0;
+	}
+
+	__lfsPutInode(parent);
+	return inodeNum;
+}
+
+// Valida um descritor e retorna o arquivo aberto correspondente, que deve
+// ser do tipo fileType
+LFSFile *__lfsGetHandle(int fd, unsigned int fileType){
+	if(fd < 1 || fd > MAX_FDS || !lfsFiles[fd - 1].used ||
+	   inodeGetFileType(lfsFiles[fd - 1].ci->inode) != fileType){
+		return NULL;
+	}
+	return &lfsFiles[fd - 1];
+}
+
+// Abre o caminho absoluto path com o tipo fileType, criando-o se não
+// existir, e retorna um descritor de arquivo, ou -1 em caso de falha
+int __lfsOpenPath(Disk *d, const char *path, unsigned int fileType){
+	LFSSuper *sb = d && path ? __lfsGetSuper(d) : NULL;
+	if(!sb){
+		return -1;
+	}
+
+	int slot = -1;
+	for(int i = 0; i < MAX_FDS && slot < 0; i++){
+		if(!lfsFiles[i].used){
+			slot = i;
+		}
+	}
+	if(slot < 0){
+		return -1;
+	}
+
+	unsigned int inodeNum = __lfsResolvePath(sb, path);
+	if(inodeNum == 0){
+		// Não existe: cria no diretório pai
+		char name[MAX_FILENAME_LENGTH + 1];
+		unsigned int parentNum = __lfsResolveParent(sb, path, name);
+		if(parentNum == 0){
+			return -1;
+		}
+		inodeNum = __lfsCreate(sb, parentNum, name, fileType);
+		if(inodeNum == 0){
+			return -1;
+		}
+	}
+
+	LFSInode *ci = __lfsGetInode(sb, inodeNum);
+	if(!ci){
+		return -1;
+	}
+	if(inodeGetFileType(ci->inode) != fileType){
+		__lfsPutInode(ci);
+		return -1;
+	}
+
+	lfsFiles[slot].used = 1;
+	lfsFiles[slot].d = d;
+	lfsFiles[slot].ci = ci;
+	lfsFiles[slot].cursor = 0;
+	return slot + 1; // FDs começam em 1
+}
+
+// Libera as estruturas em memória de um sistema de arquivos montado
+void __lfsFreeSuper(LFSSuper *sb){
+	for(int i = 0; i < LFS_MAX_CACHED; i++){
+		if(lfsInodes[i].used && lfsInodes[i].sb == sb){
+			__lfsDropInode(&lfsInodes[i]);
+		}
+	}
+	free(sb->imap);
+	free(sb->chunkAddr);
+	free(sb->chunkDirty);
+	free(sb->segs);
+	free(sb->segBuf);
+	free(sb->blockBuf);
+	free(sb->metaBuf);
+	free(sb->dirBuf);
+	dcacheDestroy(sb->dcache);
+	memset(sb, 0, sizeof(LFSSuper));
+}
+
+// Deriva a geometria do superbloco e aloca as estruturas em memória, com
+// todos os segmentos e i-nodes livres. Retorna 0 ou -1
+int __lfsInitSuper(Disk *d, LFSSuper *sb){
+	unsigned int bb = sb->sectorsPerBlock * DISK_SECTORDATASIZE;
+	sb->d = d;
+	sb->blockBytes = bb;
+	sb->ptrsPerBlock = bb / sizeof(unsigned int);
+	sb->numChunks = (sb->numInodes + 1 + sb->ptrsPerBlock - 1) / sb->ptrsPerBlock;
+	sb->inodesPerSector = DISK_SECTORDATASIZE / (inodeRecordSize() + sizeof(unsigned int));
+	sb->sumEntries = (bb / sizeof(unsigned int) - LFS_SUM_HEADER) / 2;
+	sb->sumBlock = -1;
+	sb->freeSegs = sb->numSegments;
+	sb->freeInodes = sb->numInodes;
+	sb->cleanLow = sb->numSegments / 8;
+	if(sb->cleanLow > LFS_CLEAN_LOW){
+		sb->cleanLow = LFS_CLEAN_LOW;
+	}
+	if(sb->cleanLow < LFS_RESERVED_SEGMENTS + 2){
+		sb->cleanLow = LFS_RESERVED_SEGMENTS + 2;
+	}
+	sb->cleanHigh = sb->cleanLow * LFS_CLEAN_HIGH / LFS_CLEAN_LOW;
+
+	sb->imap = calloc(sb->numInodes + 1, sizeof(unsigned int));
+	sb->chunkAddr = calloc(sb->numChunks, sizeof(unsigned int));
+	sb->chunkDirty = calloc(sb->numChunks, 1);
+	sb->segs = calloc(sb->numSegments, sizeof(LFSSegment));
+	sb->segBuf = malloc(sb->segBlocks * bb);
+	sb->blockBuf = malloc(bb);
+	sb->metaBuf = malloc(bb);
+	sb->dirBuf = malloc(bb);
+	sb->dcache = dcacheCreate(LFS_DCACHE_ENTRIES);
+	if(!sb->imap || !sb->chunkAddr || !sb->chunkDirty || !sb->segs || !sb->segBuf ||
+	   !sb->blockBuf || !sb->metaBuf || !sb->dirBuf){
+		__lfsFreeSuper(sb);
+		return -1;
+	}
+	sb->used = 1;
+	return 0;
+}
+
+// Lê uma região de checkpoint para cp. Retorna a sequência, ou 0 se a
+// região não tiver um checkpoint completo
+unsigned int __lfsReadCheckpoint(LFSSuper *sb, unsigned int where, unsigned char *cp){
+	unsigned int words = sb->cpSectors * DISK_SECTORDATASIZE / sizeof(unsigned int);
+	if(diskReadSectors(sb->d, where, sb->cpSectors, cp) < 0 ||
+	   __lfsGetU32(cp, 0) != LFS_CP_MAGIC || __lfsGetU32(cp, 1) != __lfsGetU32(cp, words - 1) ||
+	   __lfsGetU32(cp, 5) != sb->numChunks || __lfsGetU32(cp, 2) >= sb->numSegments ||
+	   __lfsGetU32(cp, 3) > sb->segBlocks){
+		return 0;
+	}
+	return __lfsGetU32(cp, 1);
+}
+
+// Carrega o superbloco do disco d e o último checkpoint completo: mapa de
+// i-nodes, uso dos segmentos e fim do log. Retorna 0 ou -1
+int __lfsReadSuper(Disk *d, LFSSuper *sb){
+	unsigned char sector[DISK_SECTORDATASIZE];
+	if(diskReadSector(d, LFS_SECTOR_SUPERBLOCK, sector) < 0 ||
+	   __lfsGetU32(sector, 0) != LFS_MAGIC || __lfsGetU32(sector, 1) != LFS_VERSION){
+		return -1;
+	}
+
+	memset(sb, 0, sizeof(LFSSuper));
+	sb->sectorsPerBlock = __lfsGetU32(sector, 2);
+	sb->segBlocks = __lfsGetU32(sector, 3);
+	sb->numSegments = __lfsGetU32(sector, 4);
+	sb->segStart = __lfsGetU32(sector, 5);
+	sb->numInodes = __lfsGetU32(sector, 6);
+	sb->cpSectors = __lfsGetU32(sector, 7);
+	if(sb->sectorsPerBlock == 0 || sb->sectorsPerBlock > LFS_MAX_SECTORSPERBLOCK ||
+	   sb->numSegments < LFS_MIN_SEGMENTS || sb->segBlocks < LFS_MIN_SEGMENT_BLOCKS ||
+	   sb->segStart + (unsigned long)sb->numSegments * sb->segBlocks * sb->sectorsPerBlock > diskGetNumSectors(d) ||
+	   __lfsInitSuper(d, sb) < 0){
+		return -1;
+	}
+
+	// Das duas regiões, vale o checkpoint completo mais recente
+	unsigned char *cp = malloc(2 * sb->cpSectors * DISK_SECTORDATASIZE);
+	if(!cp){
+		__lfsFreeSuper(sb);
+		return -1;
+	}
+	unsigned char *cpB = &cp[sb->cpSectors * DISK_SECTORDATASIZE];
+	unsigned int seqA = __lfsReadCheckpoint(sb, LFS_SECTOR_CHECKPOINT, cp);
+	unsigned int seqB = __lfsReadCheckpoint(sb, LFS_SECTOR_CHECKPOINT + sb->cpSectors, cpB);
+	if(seqA == 0 && seqB == 0){
+		free(cp);
+		__lfsFreeSuper(sb);
+		return -1;
+	}
+	unsigned char *last = seqA > seqB ? cp : cpB;
+
+	sb->cpSeq = __lfsGetU32(last, 1);
+	sb->headSeg = __lfsGetU32(last, 2);
+	sb->headBlock = __lfsGetU32(last, 3);
+	sb->flushedBlock = sb->headBlock;
+	sb->writeSeq = __lfsGetU32(last, 4);
+	for(unsigned int c = 0; c < sb->numChunks; c++){
+		sb->chunkAddr[c] = __lfsGetU32(last, LFS_CP_HEADER + c);
+	}
+	unsigned int base = LFS_CP_HEADER + sb->numChunks;
+	for(unsigned int s = 0; s < sb->numSegments; s++){
+		LFSSegment *seg = &sb->segs[s];
+		seg->liveBytes = __lfsGetU32(last, base + s * LFS_CP_SEGITEMS);
+		seg->age = __lfsGetU32(last, base + s * LFS_CP_SEGITEMS + 1);
+		seg->usedBlocks = __lfsGetU32(last, base + s * LFS_CP_SEGITEMS + 2);
+		if(seg->usedBlocks > 0 || s == sb->headSeg){
+			seg->state = seg->liveBytes > 0 || s == sb->headSeg ? LFS_SEG_USED : LFS_SEG_PENDING;
+			sb->freeSegs--;
+		}
+	}
+	free(cp);
+
+	// Mapa de i-nodes
+	for(unsigned int c = 0; c < sb->numChunks; c++){
+		if(sb->chunkAddr[c] == 0){
+			continue;
+		}
+		if(__lfsReadBlocks(sb, sb->chunkAddr[c], 1, sb->metaBuf) < 0){
+			__lfsFreeSuper(sb);
+			return -1;
+		}
+		for(unsigned int k = 0; k < sb->ptrsPerBlock; k++){
+			unsigned int num = c * sb->ptrsPerBlock + k;
+			if(num >= 1 && num <= sb->numInodes){
+				sb->imap[num] = __lfsGetU32(sb->metaBuf, k);
+				sb->freeInodes -= sb->imap[num] != 0;
+			}
+		}
+	}
+	return 0;
+}
+
+// lfsIsIdle com lfsLock obtida
+int __lfsIsIdle (Disk *d) {
+	for(int i = 0; i < MAX_FDS; i++){
+		if(lfsFiles[i].used && lfsFiles[i].d == d){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//Funcao para verificacao se o sistema de arquivos está ocioso, ou seja,
+//se nao ha quisquer descritores de arquivos em uso atualmente. Retorna
+//um positivo se ocioso ou, caso contrario, 0.
+int lfsIsIdle (Disk *d) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsIsIdle(d);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsFormat com lfsLock obtida
+int __lfsFormat (Disk *d, unsigned int blockSize) {
+
+	unsigned int spb = blockSize / DISK_SECTORDATASIZE;
+	if(!d || blockSize % DISK_SECTORDATASIZE != 0 || spb == 0 ||
+	   spb > LFS_MAX_SECTORSPERBLOCK || (spb & (spb - 1)) != 0 || __lfsGetSuper(d)){
+		return -1;
+	}
+
+	LFSSuper *sb = __lfsGetSuper(NULL);
+	if(!sb){
+		return -1;
+	}
+
+	// Layout: setor 0 reservado, superbloco, duas regiões de checkpoint e
+	// segmentos alinhados ao seu tamanho (múltiplo do cilindro)
+	unsigned int numSectors = diskGetNumSectors(d);
+	unsigned int segSectors = LFS_SEGMENT_SECTORS;
+	if(segSectors < LFS_MIN_SEGMENT_BLOCKS * spb){
+		segSectors = LFS_MIN_SEGMENT_BLOCKS * spb;
+	}
+	memset(sb, 0, sizeof(LFSSuper));
+	sb->sectorsPerBlock = spb;
+	sb->segBlocks = segSectors / spb;
+	sb->numInodes = numSectors / LFS_SECTORS_PER_INODE;
+
+	unsigned int ptrs = blockSize / sizeof(unsigned int);
+	unsigned int chunks = (sb->numInodes + 1 + ptrs - 1) / ptrs;
+	unsigned int cpBytes = (LFS_CP_HEADER + chunks + LFS_CP_SEGITEMS * (numSectors / segSectors) + 1) * sizeof(unsigned int);
+	sb->cpSectors = (cpBytes + DISK_SECTORDATASIZE - 1) / DISK_SECTORDATASIZE;
+	sb->segStart = (LFS_SECTOR_CHECKPOINT + 2 * sb->cpSectors + segSectors - 1) / segSectors * segSectors;
+	sb->numSegments = numSectors > sb->segStart ? (numSectors - sb->segStart) / segSectors : 0;
+	if(sb->numSegments < LFS_MIN_SEGMENTS || __lfsInitSuper(d, sb) < 0){
+		memset(sb, 0, sizeof(LFSSuper));
+		return -1;
+	}
+
+	// Invalida checkpoints de uma formatação anterior
+	unsigned char *zeros = calloc(2 * sb->cpSectors, DISK_SECTORDATASIZE);
+	unsigned char sector[DISK_SECTORDATASIZE];
+	memset(sector, 0, sizeof(sector));
+	__lfsSetU32(sector, 0, LFS_MAGIC);
+	__lfsSetU32(sector, 1, LFS_VERSION);
+	__lfsSetU32(sector, 2, sb->sectorsPerBlock);
+	__lfsSetU32(sector, 3, sb->segBlocks);
+	__lfsSetU32(sector, 4, sb->numSegments);
+	__lfsSetU32(sector, 5, sb->segStart);
+	__lfsSetU32(sector, 6, sb->numInodes);
+	__lfsSetU32(sector, 7, sb->cpSectors);
+	int ok = zeros && diskWriteSectors(d, LFS_SECTOR_CHECKPOINT, 2 * sb->cpSectors, zeros) == 0 &&
+	         diskWriteSector(d, LFS_SECTOR_SUPERBLOCK, sector) == 0;
+	free(zeros);
+
+	// O log começa no primeiro segmento, com a raiz (i-node 1) vazia
+	sb->headSeg = 0;
+	sb->segs[0].state = LFS_SEG_USED;
+	sb->freeSegs--;
+	sb->imap[1] = LFS_IMAP_NEW;
+	sb->freeInodes--;
+	sb->inodeHint = 1;
+	LFSInode *root = ok ? __lfsNewInode(sb, 1) : NULL;
+	if(root){
+		inodeSetFileType(root->inode, FILETYPE_DIR);
+		inodeSetFileSize(root->inode, 0);
+		inodeSetRefCount(root->inode, 1);
+		ok = __lfsCheckpoint(sb) == 0;
+		root->refs = 0;
+	}
+	else{
+		ok = 0;
+	}
+
+	int ret = ok ? (int)(sb->numSegments * sb->segBlocks) : -1;
+	__lfsFreeSuper(sb);
+	return ret;
+}
+
+//Funcao para formatacao de um disco com o LFS, com tamanho de blocos igual
+//a blockSize. O disco e' dividido em segmentos de pelo menos
+//LFS_SEGMENT_SECTORS setores, precedidos do superbloco e das duas regioes
+//de checkpoint. Retorna o numero total de blocos do log, se formatado com
+//sucesso. Caso contrario, retorna -1.
+//blockSize e' dado em bytes e deve corresponder a uma potencia de 2 de
+//setores, de 1 ate LFS_MAX_SECTORSPERBLOCK
+int lfsFormat (Disk *d, unsigned int blockSize) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsFormat(d, blockSize);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsSync com lfsLock obtida
+int __lfsSync (Disk *d) {
+	LFSSuper *sb = __lfsGetSuper(d);
+	if(!sb){
+		return -1;
+	}
+	return __lfsCheckpoint(sb);
+}
+
+//Funcao para sincronizacao do sistema de arquivos montado no disco d. Um
+//checkpoint grava no log todas as alteracoes pendentes e, por ultimo, a
+//regiao de checkpoint. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int lfsSync (Disk *d) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsSync(d);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsStatfs com lfsLock obtida
+int __lfsStatfs (Disk *d, FSStats *stats) {
+	LFSSuper *sb = __lfsGetSuper(d);
+	if(!sb || !stats){
+		return -1;
+	}
+
+	unsigned int freeBlocks = 0;
+	for(unsigned int s = 0; s < sb->numSegments; s++){
+		unsigned int live = (sb->segs[s].liveBytes + sb->blockBytes - 1) / sb->blockBytes;
+		freeBlocks += sb->segs[s].state == LFS_SEG_USED ? sb->segBlocks - live : sb->segBlocks;
+	}
+	stats->blockSize = sb->blockBytes;
+	stats->totalBlocks = sb->numSegments * sb->segBlocks;
+	stats->freeBlocks = freeBlocks;
+	stats->totalInodes = sb->numInodes;
+	stats->freeInodes = sb->freeInodes;
+	return 0;
+}
+
+//Funcao que preenche stats com as informacoes do sistema de arquivos
+//montado no disco d. Sao livres os blocos de segmentos livres e os que
+//o limpador pode recuperar nos demais. Retorna 0 caso bem sucedido, ou
+//-1 caso contrario.
+int lfsStatfs (Disk *d, FSStats *stats) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsStatfs(d, stats);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsxMount com lfsLock obtida
+int __lfsxMount (Disk *d, int x) {
+	if (!d) return 0;
+
+	if (x == 1) { // Montagem
+		if (__lfsGetSuper(d)) return 0; // Já montado
+
+		LFSSuper *sb = __lfsGetSuper(NULL);
+		if (!sb || __lfsReadSuper(d, sb) < 0) return 0;
+		__lfsStartCleaner(sb);
+		return 1;
+	}
+
+	if (x == 0) { // Desmontagem
+		LFSSuper *sb = __lfsGetSuper(d);
+		if (!sb) return 0;
+		__lfsStopCleaner(sb);
+		int ok = __lfsCheckpoint(sb) == 0;
+		for (int i = 0; i < MAX_FDS; i++) {
+			if (lfsFiles[i].used && lfsFiles[i].d == d) {
+				lfsFiles[i].used = 0;
+				lfsFiles[i].ci = NULL;
+			}
+		}
+		__lfsFreeSuper(sb);
+		return ok;
+	}
+
+	return 0;
+}
+
+//Funcao para montagem/desmontagem do LFS no disco d. Na montagem (x=1), o
+//ultimo checkpoint completo e' carregado. Na desmontagem (x=0), um
+//checkpoint persiste todas as alteracoes pendentes. Retorna um positivo
+//se a montagem ou desmontagem foi bem sucedida ou, caso contrario, 0.
+int lfsxMount (Disk *d, int x) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsxMount(d, x);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+//Funcao para abertura de um arquivo, a partir do caminho especificado
+//em path, no disco montado especificado em d, no modo Read/Write,
+//criando o arquivo se nao existir. Retorna um descritor de arquivo,
+//em caso de sucesso. Retorna -1, caso contrario.
+int lfsOpen (Disk *d, const char *path) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsOpenPath(d, path, FILETYPE_REGULAR);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsRead com lfsLock obtida
+int __lfsRead (int fd, char *buf, unsigned int nbytes) {
+	LFSFile *fh = __lfsGetHandle(fd, FILETYPE_REGULAR);
+	if(!fh || !buf){
+		return -1;
+	}
+	int ret = __lfsReadAt(fh->ci, buf, nbytes, fh->cursor);
+	if(ret > 0){
+		fh->cursor += ret;
+	}
+	return ret;
+}
+
+//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao atual do cursor, que avanca. Retorna o numero de
+//bytes efetivamente lidos em caso de sucesso ou -1, caso contrario.
+int lfsRead (int fd, char *buf, unsigned int nbytes) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsRead(fd, buf, nbytes);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsWrite com lfsLock obtida
+int __lfsWrite (int fd, const char *buf, unsigned int nbytes) {
+	LFSFile *fh = __lfsGetHandle(fd, FILETYPE_REGULAR);
+	if(!fh || !buf){
+		return -1;
+	}
+	int ret = __lfsWriteAt(fh->ci, buf, nbytes, fh->cursor);
+	if(ret > 0){
+		fh->cursor += ret;
+	}
+	return ret;
+}
+
+//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao atual do cursor, que avanca. Os dados vao para o
+//fim do log. Retorna o numero de bytes efetivamente escritos em caso de
+//sucesso ou -1, caso contrario
+int lfsWrite (int fd, const char *buf, unsigned int nbytes) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsWrite(fd, buf, nbytes);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsPread com lfsLock obtida
+int __lfsPread (int fd, char *buf, unsigned int nbytes, unsigned int offset) {
+	LFSFile *fh = __lfsGetHandle(fd, FILETYPE_REGULAR);
+	if(!fh || !buf){
+		return -1;
+	}
+	return __lfsReadAt(fh->ci, buf, nbytes, offset);
+}
+
+//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. O cursor do descritor nao e' alterado.
+//Retorna o numero de bytes efetivamente lidos em caso de sucesso ou -1,
+//caso contrario.
+int lfsPread (int fd, char *buf, unsigned int nbytes, unsigned int offset) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsPread(fd, buf, nbytes, offset);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsPwrite com lfsLock obtida
+int __lfsPwrite (int fd, const char *buf, unsigned int nbytes, unsigned int offset) {
+	LFSFile *fh = __lfsGetHandle(fd, FILETYPE_REGULAR);
+	if(!fh || !buf){
+		return -1;
+	}
+	return __lfsWriteAt(fh->ci, buf, nbytes, offset);
+}
+
+//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. O cursor do descritor nao e' alterado.
+//Retorna o numero de bytes efetivamente escritos em caso de sucesso ou
+//-1, caso contrario.
+int lfsPwrite (int fd, const char *buf, unsigned int nbytes, unsigned int offset) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsPwrite(fd, buf, nbytes, offset);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsClose com lfsLock obtida
+int __lfsClose (int fd) {
+	if(fd < 1 || fd > MAX_FDS || !lfsFiles[fd - 1].used){
+		return -1;
+	}
+
+	LFSFile *fh = &lfsFiles[fd - 1];
+	int ret = 0;
+	if(inodeGetRefCount(fh->ci->inode) > 0){
+		ret = __lfsFlushTail(fh->ci);
+		if(ret == 0){
+			free(fh->ci->tail);
+			fh->ci->tail = NULL;
+			fh->ci->tailValid = 0;
+		}
+	}
+	__lfsPutInode(fh->ci);
+	fh->used = 0;
+	fh->ci = NULL;
+	return ret;
+}
+
+//Funcao para fechar um arquivo, a partir de um descritor de arquivo
+//existente. O ultimo bloco escrito vai para o segmento em memoria; o disco
+//so' e' gravado quando o segmento enche ou no checkpoint. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario
+int lfsClose (int fd) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsClose(fd);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+//Funcao para abertura de um diretorio, a partir do caminho
+//especificado em path, no disco indicado por d, no modo Read/Write,
+//criando o diretorio se nao existir. Retorna um descritor de arquivo,
+//em caso de sucesso. Retorna -1, caso contrario.
+int lfsOpendir (Disk *d, const char *path) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsOpenPath(d, path, FILETYPE_DIR);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsReaddir com lfsLock obtida
+int __lfsReaddir (int fd, char *filename, unsigned int *inumber) {
+	LFSFile *fh = __lfsGetHandle(fd, FILETYPE_DIR);
+	if(!fh || !filename || !inumber){
+		return -1;
+	}
+
+	LFSSuper *sb = fh->ci->sb;
+	unsigned int bb = sb->blockBytes, size = inodeGetFileSize(fh->ci->inode);
+	while(fh->cursor < size){
+		unsigned int blockNum = fh->cursor / bb, pos = fh->cursor % bb;
+		if(__lfsReadFileBlock(fh->ci, blockNum, sb->dirBuf) < 0){
+			return -1;
+		}
+		int found = __lfsLeafNext(sb, sb->dirBuf, &pos, inumber, filename);
+		fh->cursor = blockNum * bb + pos;
+		if(found){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//Funcao para a leitura de um diretorio, identificado por um descritor
+//de arquivo existente. O nome da entrada na posicao atual do cursor e'
+//copiado para filename e o numero do seu inode para inumber. Retorna 1
+//se uma entrada foi lida, 0 se fim do diretorio ou -1 caso mal sucedido.
+int lfsReaddir (int fd, char *filename, unsigned int *inumber) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsReaddir(fd, filename, inumber);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsLink com lfsLock obtida
+int __lfsLink (int fd, const char *filename, unsigned int inumber) {
+	LFSFile *fh = __lfsGetHandle(fd, FILETYPE_DIR);
+	if(!fh || !filename){
+		return -1;
+	}
+
+	LFSInode *target = __lfsGetInode(fh->ci->sb, inumber);
+	if(!target){
+		return -1;
+	}
+
+	int ret = -1;
+	if(__lfsDirAdd(fh->ci, filename, inumber) == 0){
+		inodeSetRefCount(target->inode, inodeGetRefCount(target->inode) + 1);
+		target->dirty = 1;
+		ret = 0;
+	}
+	__lfsPutInode(target);
+	return ret;
+}
+
+//Funcao para adicionar uma entrada a um diretorio, identificado por um
+//descritor de arquivo existente. A nova entrada tera' o nome indicado
+//por filename e apontara' para o numero de i-node indicado por inumber.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int lfsLink (int fd, const char *filename, unsigned int inumber) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsLink(fd, filename, inumber);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsUnlink com lfsLock obtida
+int __lfsUnlink (int fd, const char *filename) {
+	LFSFile *fh = __lfsGetHandle(fd, FILETYPE_DIR);
+	if(!fh || !filename){
+		return -1;
+	}
+
+	unsigned int inodeNum = __lfsDirFind(fh->ci, filename, NULL);
+	LFSInode *target = inodeNum ? __lfsGetInode(fh->ci->sb, inodeNum) : NULL;
+	if(!target){
+		return -1;
+	}
+
+	// Um diretório só perde a última entrada que o referencia se vazio
+	unsigned int refs = inodeGetRefCount(target->inode);
+	if(inodeGetFileType(target->inode) == FILETYPE_DIR && refs <= 1 && !__lfsDirIsEmpty(target)){
+		__lfsPutInode(target);
+		return -1;
+	}
+
+	int ret = -1;
+	if(__lfsDirRemove(fh->ci, filename) == inodeNum){
+		// Sem entradas, o i-node é liberado ao perder o último uso
+		inodeSetRefCount(target->inode, refs > 0 ? refs - 1 : 0);
+		target->dirty = 1;
+		ret = 0;
+	}
+	__lfsPutInode(target);
+	return ret;
+}
+
+//Funcao para remover uma entrada existente em um diretorio,
+//identificado por um descritor de arquivo existente. A entrada e'
+//identificada pelo nome indicado em filename. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int lfsUnlink (int fd, const char *filename) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsUnlink(fd, filename);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+// lfsClosedir com lfsLock obtida
+int __lfsClosedir (int fd) {
+	if(!__lfsGetHandle(fd, FILETYPE_DIR)){
+		return -1;
+	}
+	return __lfsClose(fd);
+}
+
+//Funcao para fechar um diretorio, identificado por um descritor de
+//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int lfsClosedir (int fd) {
+	pthread_mutex_lock(&lfsLock);
+	int ret = __lfsClosedir(fd);
+	pthread_mutex_unlock(&lfsLock);
+	return ret;
+}
+
+//Funcao para instalar o LFS no S.O., registrando-o junto ao virtual FS
+//(vfs) ao lado do MyFS, com identificador proprio. Retorna um
+//identificador unico (slot), caso o sistema de arquivos tenha sido
+//registrado com sucesso. Caso contrario, retorna -1
+int installLFS (void) {
+
+	FSInfo *fsInfo = calloc(1, sizeof(FSInfo));
+	fsInfo->fsid = LFS_ID;
+	fsInfo->fsname = "LFS";
+	fsInfo->isidleFn = lfsIsIdle;
+	fsInfo->formatFn = lfsFormat;
+	fsInfo->xMountFn = lfsxMount;
+	fsInfo->openFn = lfsOpen;
+	fsInfo->readFn = lfsRead;
+	fsInfo->writeFn = lfsWrite;
+	fsInfo->closeFn = lfsClose;
+	fsInfo->preadFn = lfsPread;
+	fsInfo->pwriteFn = lfsPwrite;
+	fsInfo->opendirFn = lfsOpendir;
+	fsInfo->readdirFn = lfsReaddir;
+	fsInfo->linkFn = lfsLink;
+	fsInfo->unlinkFn = lfsUnlink;
+	fsInfo->closedirFn = lfsClosedir;
+	fsInfo->syncFn = lfsSync;
+	fsInfo->statfsFn = lfsStatfs;
+	fsInfo->concurrent = 1;
+
+	return vfsRegisterFS(fsInfo);
+}
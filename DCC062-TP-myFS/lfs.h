@@ -0,0 +1,24 @@
+/*
+*  lfs.h - Funcao que permite a instalacao do sistema de arquivos LFS
+*          (log-structured) no S.O.
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#ifndef LFS_H
+#define LFS_H
+
+#include "vfs.h"
+
+//Funcao para instalar o LFS no S.O., registrando-o junto ao virtual FS
+//(vfs) ao lado do MyFS, com identificador proprio. Retorna um
+//identificador unico (slot), caso o sistema de arquivos tenha sido
+//registrado com sucesso. Caso contrario, retorna -1
+int installLFS ( void );
+
+#endif
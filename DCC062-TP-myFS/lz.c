@@ -0,0 +1,181 @@
+/*
+*  lz.c - Compressao de dados sem perdas da familia LZ77, rapida e sem
+*         dependencias externas
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#include <string.h>
+#include "lz.h"
+
+//Os dados comprimidos sao uma sequencia de trechos, cada um com literais
+//(bytes copiados como estao) seguidos de uma repeticao de bytes ja
+//produzidos:
+//  byte 0:  4 bits altos: literais | 4 bits baixos: repeticao - LZ_MIN_MATCH
+//  [extensao do numero de literais]
+//  literais
+//  2 bytes: distancia da repeticao, little endian
+//  [extensao do tamanho da repeticao]
+//Um valor 15 no campo de 4 bits continua nos bytes de extensao seguintes,
+//somados enquanto valerem 255. O ultimo trecho so' tem literais
+#define LZ_MIN_MATCH 4		//Menor repeticao codificada
+#define LZ_MAX_OFFSET 65535	//Maior distancia de uma repeticao
+#define LZ_HASH_BITS 12		//Tabela de 4096 posicoes recentes
+#define LZ_FIELD_MAX 15		//Maior valor dos campos de 4 bits
+
+// Le 4 bytes de p como um inteiro, para comparacao e hash
+unsigned int __lzRead32 (const unsigned char *p) {
+	return (unsigned int)p[0] | (unsigned int)p[1] << 8 |
+	       (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+// Hash multiplicativo de 4 bytes para a tabela de posicoes
+unsigned int __lzHash (unsigned int v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Grava em dst, a partir de *op, a extensao de um campo de 4 bits que
+// chegou a LZ_FIELD_MAX. Retorna 0 ou -1 se faltar espaco
+int __lzPutLength (unsigned char *dst, unsigned int dstCap, unsigned int *op,
+                   unsigned int rest) {
+	while (rest >= 255) {
+		if (*op >= dstCap) return -1;
+		dst[(*op)++] = 255;
+		rest -= 255;
+	}
+	if (*op >= dstCap) return -1;
+	dst[(*op)++] = rest;
+	return 0;
+}
+
+// Grava em dst um trecho com litLen literais de lit e uma repeticao de
+// matchLen bytes a distancia offset (matchLen 0: ultimo trecho). Retorna
+// 0 ou -1 se faltar espaco
+int __lzEmit (unsigned char *dst, unsigned int dstCap, unsigned int *op,
+              const unsigned char *lit, unsigned int litLen,
+              unsigned int offset, unsigned int matchLen) {
+
+	unsigned int litField = litLen < LZ_FIELD_MAX ? litLen : LZ_FIELD_MAX;
+	unsigned int matchField = 0;
+	if (matchLen) {
+		matchField = matchLen - LZ_MIN_MATCH;
+		if (matchField > LZ_FIELD_MAX) matchField = LZ_FIELD_MAX;
+	}
+
+	if (*op >= dstCap) return -1;
+	dst[(*op)++] = litField << 4 | matchField;
+	if (litField == LZ_FIELD_MAX &&
+	    __lzPutLength(dst, dstCap, op, litLen - LZ_FIELD_MAX) < 0) return -1;
+
+	if (litLen > dstCap - *op) return -1;
+	memcpy(dst + *op, lit, litLen);
+	*op += litLen;
+
+	if (!matchLen) return 0;
+	if (dstCap - *op < 2) return -1;
+	dst[(*op)++] = offset & 0xFF;
+	dst[(*op)++] = offset >> 8;
+	if (matchField == LZ_FIELD_MAX &&
+	    __lzPutLength(dst, dstCap, op,
+	                  matchLen - LZ_MIN_MATCH - LZ_FIELD_MAX) < 0) return -1;
+	return 0;
+}
+
+// Le de src a extensao de um campo de 4 bits, somando-a a *value.
+// Retorna 0 ou -1 se src terminar antes
+int __lzGetLength (const unsigned char *src, unsigned int srcLen,
+                   unsigned int *ip, unsigned int *value) {
+	unsigned char b;
+	do {
+		if (*ip >= srcLen) return -1;
+		b = src[(*ip)++];
+		*value += b;
+	} while (b == 255);
+	return 0;
+}
+
+//Funcao que comprime os srcLen bytes de src (no maximo LZ_MAX_INPUT) para
+//dst, que tem capacidade para dstCap bytes. Retorna o tamanho dos dados
+//comprimidos ou 0 se eles nao couberem em dstCap
+unsigned int lzCompress (const unsigned char *src, unsigned int srcLen,
+                         unsigned char *dst, unsigned int dstCap) {
+
+	// Ultima posicao vista para cada hash. Posicoes nunca vistas valem 0,
+	// o que e' inofensivo: todo candidato e' conferido antes de usado
+	unsigned int table[1 << LZ_HASH_BITS];
+	unsigned int ip = 0, anchor = 0, op = 0;
+
+	if (srcLen > LZ_MAX_INPUT) return 0;
+	memset(table, 0, sizeof(table));
+
+	while (srcLen - ip >= LZ_MIN_MATCH) {
+		unsigned int v = __lzRead32(src + ip);
+		unsigned int h = __lzHash(v);
+		unsigned int cand = table[h];
+		table[h] = ip;
+
+		if (cand >= ip || ip - cand > LZ_MAX_OFFSET ||
+		    __lzRead32(src + cand) != v) {
+			ip++;
+			continue;
+		}
+
+		unsigned int len = LZ_MIN_MATCH;
+		while (ip + len < srcLen && src[cand + len] == src[ip + len]) len++;
+		if (__lzEmit(dst, dstCap, &op, src + anchor, ip - anchor,
+		             ip - cand, len) < 0) return 0;
+
+		// Registra o fim da repeticao, ajudando a proxima busca
+		ip += len;
+		anchor = ip;
+		if (srcLen - ip >= LZ_MIN_MATCH + 2)
+			table[__lzHash(__lzRead32(src + ip - 2))] = ip - 2;
+	}
+
+	if (__lzEmit(dst, dstCap, &op, src + anchor, srcLen - anchor, 0, 0) < 0)
+		return 0;
+	return op;
+}
+
+//Funcao que descomprime os srcLen bytes de src, produzidos por lzCompress,
+//para dst, que tem capacidade para dstCap bytes. Retorna o tamanho dos
+//dados descomprimidos ou -1 se src estiver corrompido ou nao couber em dst
+int lzDecompress (const unsigned char *src, unsigned int srcLen,
+                  unsigned char *dst, unsigned int dstCap) {
+
+	unsigned int ip = 0, op = 0;
+
+	while (ip < srcLen) {
+		unsigned int token = src[ip++];
+
+		unsigned int litLen = token >> 4;
+		if (litLen == LZ_FIELD_MAX &&
+		    __lzGetLength(src, srcLen, &ip, &litLen) < 0) return -1;
+		if (litLen > srcLen - ip || litLen > dstCap - op) return -1;
+		memcpy(dst + op, src + ip, litLen);
+		ip += litLen;
+		op += litLen;
+
+		if (ip == srcLen) break; // Ultimo trecho: so' literais
+
+		if (srcLen - ip < 2) return -1;
+		unsigned int offset = src[ip] | src[ip + 1] << 8;
+		ip += 2;
+		unsigned int matchLen = (token & LZ_FIELD_MAX) + LZ_MIN_MATCH;
+		if ((token & LZ_FIELD_MAX) == LZ_FIELD_MAX &&
+		    __lzGetLength(src, srcLen, &ip, &matchLen) < 0) return -1;
+		if (offset == 0 || offset > op || matchLen > dstCap - op) return -1;
+
+		// A repeticao pode sobrepor o que ela mesma produz: byte a byte
+		const unsigned char *from = dst + op - offset;
+		for (unsigned int k = 0; k < matchLen; k++) dst[op + k] = from[k];
+		op += matchLen;
+	}
+
+	return (int)op;
+}
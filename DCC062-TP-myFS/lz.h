@@ -0,0 +1,30 @@
+/*
+*  lz.h - Compressao de dados sem perdas da familia LZ77, rapida e sem
+*         dependencias externas
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+#define LZ_MAX_INPUT 65536	//Maior entrada aceita pela compressao
+
+//Funcao que comprime os srcLen bytes de src (no maximo LZ_MAX_INPUT) para
+//dst, que tem capacidade para dstCap bytes. Retorna o tamanho dos dados
+//comprimidos ou 0 se eles nao couberem em dstCap
+unsigned int lzCompress (const unsigned char *src, unsigned int srcLen,
+                         unsigned char *dst, unsigned int dstCap);
+
+//Funcao que descomprime os srcLen bytes de src, produzidos por lzCompress,
+//para dst, que tem capacidade para dstCap bytes. Retorna o tamanho dos
+//dados descomprimidos ou -1 se src estiver corrompido ou nao couber em dst
+int lzDecompress (const unsigned char *src, unsigned int srcLen,
+                  unsigned char *dst, unsigned int dstCap);
+
+#endif
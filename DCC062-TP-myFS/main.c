@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "myfs.h"
+#include "lfs.h"
 #include "vfs.h"
 #include "inode.h"
 
@@ -723,6 +724,7 @@ void mainMenuSelection (void) {
 int main (int argc, char* argv[]) {
 
 	installMyFS();
+	installLFS();
 
 	for (int a=0; a<MAX_CONNECTEDDISKS; a++)
 		disks[a] = NULL;
@@ -11,22 +11,269 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
 #include "myfs.h"
 #include "vfs.h"
 #include "inode.h"
 #include "util.h"
+#include "dcache.h"
+#include "journal.h"
+#include "lz.h"
+#include "rangelock.h"
 #include "string.h"
 
 //Declaracoes globais
 #define MYFS_ID 'M' // Identificador do MyFS
-#define SECTOR_FREE_BLOCK_MAP 1 // Setor para o índice do próximo bloco livre
-#define FIRST_DATA_BLOCK 100 // Setor onde começam os dados
+#define MYFS_MAGIC 0x5346794D // "MyFS" em little endian
+#define MYFS_VERSION 8
+#define SECTOR_SUPERBLOCK 1 // Setor do superbloco
+#define MYFS_SECTORS_PER_INODE 8 // Um i-node para cada 8 setores do disco
+#define MYFS_BITS_PER_SECTOR (DISK_SECTORDATASIZE * 8)
+#define MYFS_REF_BYTES 2 // Bytes por contador de referências de bloco
+#define MYFS_REFS_PER_SECTOR (DISK_SECTORDATASIZE / MYFS_REF_BYTES)
+#define MYFS_MAX_BLOCKREFS 0xFFFF
+#define MYFS_SECTORS_PER_JOURNAL 32 // Um setor de diário para cada 32 do disco
+#define MYFS_MAX_JOURNAL_SECTORS 2048
 
-//Estrutura para entrada de diretório
+#define MYFS_MAX_SECTORSPERBLOCK 64	// Maior bloco aceito (32 KiB)
+#define MYFS_MAX_MOUNTS 4		// Discos montados simultaneamente
+
+#define MYFS_NDIRECT 6		// Endereços diretos no i-node (itens 0 a 5)
+#define MYFS_SINDIRECT 6	// Item 6: bloco indireto simples
+#define MYFS_DINDIRECT 7	// Item 7: bloco indireto duplo
+
+#define MYFS_MAX_DIRTY_BYTES (128 * 1024) // Limite global de dados sujos: acima
+                                          // dele, quem escreve espera
+#define MYFS_DIRTY_RATIO 50	// Porcentagem do limite que acorda o descarregador
+#define MYFS_DIRTY_BACKGROUND (MYFS_MAX_DIRTY_BYTES / 100 * MYFS_DIRTY_RATIO)
+#define MYFS_FLUSH_INTERVAL 500	// Milissegundos entre descargas periódicas
+#define MYFS_FLUSH_BATCH 16	// I-nodes descarregados por lote
+#define MYFS_TABLE_CHUNK 256	// Entradas alocadas de uma vez nas tabelas
+#define MYFS_MAX_FDS 65536	// Descritores abertos simultaneamente
+#define MYFS_MAX_OPEN_INODES (MYFS_MAX_FDS + MYFS_TABLE_CHUNK) // Descritores e diretórios em uso
+#define MYFS_OPENINODE_BUCKETS 4096	// Baldes do índice de i-nodes abertos
+#define MYFS_DCACHE_ENTRIES 1024	// Entradas de diretório em cache por disco
+
+//Travas de uma operação sobre um descritor (__lockHandle)
+#define MYFS_LOCK_READ 0	// Consulta ao i-node: i-node compartilhado
+#define MYFS_LOCK_DATA 1	// Leitura e escrita: trechos travados por elas
+#define MYFS_LOCK_META 2	// Demais operações: disco exclusivo
+#define MYFS_IO_STEP (256 * 1024) // Bytes lidos ou gravados de cada vez com
+                                  // o i-node travado
+
+//Snapshots: versões somente leitura de toda a árvore, com nome. Os
+//registros dos snapshots ficam no setor do superbloco, após os seus campos
+#define MYFS_MAX_SNAPSHOTS 8
+#define MYFS_SNAPNAME_LENGTH 31
+#define MYFS_SNAP_OFFSET 128	// Posição dos registros no setor do superbloco
+#define MYFS_SNAP_RECORD (sizeof(unsigned int) + MYFS_SNAPNAME_LENGTH + 1)
+#define MYFS_SNAPDIR ".snap"	// Na raiz: acesso aos snapshots por nome
+#define MYFS_FILETYPE_SNAPTABLE 1 // I-node interno com a tabela de um snapshot
+
+//Compressão: arquivos com VFS_FLAG_COMPRESS são gravados em clusters de
+//blocos lógicos consecutivos, comprimidos juntos na descarga. Um cluster
+//comprimido ocupa uma sequência contígua de blocos, iniciada por um
+//cabeçalho com os tamanhos original e comprimido, e os demais blocos
+//lógicos do cluster são mapeados em MYFS_ZBLOCK. Clusters que não
+//encolhem ao menos um bloco são gravados como estão. Os atributos do
+//arquivo ficam no campo de permissões do i-node, que o MyFS não usa
+#define MYFS_CLUSTER_BYTES (16 * 1024)	// Tamanho mínimo de um cluster
+#define MYFS_MIN_CLUSTERBLOCKS 4	// Se couberem na entrada do compressor
+#define MYFS_MAX_CLUSTERBLOCKS (MYFS_CLUSTER_BYTES / DISK_SECTORDATASIZE)
+#define MYFS_ZBLOCK 0xFFFFFFFF	// Bloco lógico guardado no início do cluster
+#define MYFS_ZHEADER 8		// Cabeçalho de um cluster comprimido
+
+//Deduplicação: cada bloco gravado por um arquivo com VFS_FLAG_DEDUP tem
+//a sua impressão digital (hash de 128 bits do conteúdo) registrada numa
+//tabela com uma impressão por bloco da área de dados, mantida e gravada
+//como a de referências. Em memória, um índice hash leva da impressão ao
+//bloco. Um bloco cujo conteúdo já esteja no índice vira mais uma
+//referência ao existente, sem alocação nem escrita, e a cópia na escrita
+//dos blocos compartilhados faz o resto. Blocos no índice nunca são
+//regravados no lugar, de modo que a impressão vale enquanto o bloco
+//estiver em uso. Arquivos comprimidos não são deduplicados
+#define MYFS_PRINT_BYTES 16	// Bytes por impressão digital
+#define MYFS_PRINTS_PER_SECTOR (DISK_SECTORDATASIZE / MYFS_PRINT_BYTES)
+#define MYFS_NOPRINT 0xFFFFFFFF	// Impressão ausente do índice
+#define MYFS_FLAGS (VFS_FLAG_COMPRESS | VFS_FLAG_DEDUP) // Atributos aceitos
+
+//Fragmentos: o último bloco parcial de um arquivo regular não comprimido,
+//que é o arquivo inteiro quando ele é menor que um bloco, é guardado ao
+//fechar o arquivo como um fragmento de um bloco dividido com outros
+//arquivos, em vez de ocupar um bloco só seu. O fragmento é endereçado
+//pelo setor e pela posição dentro dele, no campo de grupo do i-node, que
+//o MyFS não usa; o tamanho vem do tamanho do arquivo. Os fragmentos dos
+//arquivos de um mesmo diretório são alocados em sequência no mesmo bloco,
+//e os blocos de fragmentos de um diretório, lado a lado. Um bloco de
+//fragmentos tem uma referência por fragmento e só volta a ser livre
+//quando todos saírem dele. Qualquer escrita no arquivo devolve o seu
+//fragmento a um bloco sujo comum. Um fragmento em uso nunca é alterado,
+//então a leitura de um fragmento traz junto os setores seguintes, com os
+//fragmentos dos arquivos vizinhos, que servem às leituras seguintes até
+//que um novo fragmento seja gravado
+#define MYFS_FRAG_UNIT 16	// Granularidade dos fragmentos, em bytes
+#define MYFS_FRAG_SHIFT 5	// Bits da posição (em unidades) no endereço
+#define MYFS_FRAG_GROUPS 8	// Diretórios com bloco de fragmentos aberto
+#define MYFS_FRAG_READAHEAD 32	// Setores lidos de uma vez com um fragmento
+
+//Registro de entrada de diretório, de tamanho variável. Os registros de
+//uma folha se encadeiam pelo tamanho de cada um até o fim do bloco:
+//  bytes 0-3: número do i-node (0 se o registro está livre)
+//  bytes 4-5: tamanho do registro, até o início do próximo
+//  byte 6:    tamanho do nome
+//  byte 7:    reservado
+//  bytes 8-:  nome, sem o \0 final
+#define DIRENT_HEADER 8
+#define DIRENT_ALIGN 4
+#define DIRENT_SIZE(nameLen) ((DIRENT_HEADER + (nameLen) + DIRENT_ALIGN - 1) & ~(DIRENT_ALIGN - 1))
+
+//Mapa de bits mantido em memória, com controle dos setores alterados
 typedef struct {
-	unsigned int inode;
-	char name[MAX_FILENAME_LENGTH + 1];
-} DirEntry;
+	unsigned int start;		// Primeiro setor do mapa no disco
+	unsigned int sectors;		// Setores ocupados pelo mapa
+	unsigned int count;		// Número de bits válidos
+	unsigned char *bits;		// Conteúdo do mapa
+	unsigned char *dirty;		// Setores a gravar (um byte por setor)
+} Bitmap;
+
+//Tabela de contadores de referência dos blocos de dados, mantida em
+//memória como o mapa de i-nodes. Um contador 0 indica bloco livre; acima
+//de 1, o bloco é compartilhado por arquivos clonados e só é alterado
+//depois de copiado (cópia na escrita). Blocos indiretos compartilhados
+//contam uma única referência por cópia, e não uma por bloco apontado
+typedef struct {
+	unsigned int start;		// Primeiro setor da tabela no disco
+	unsigned int sectors;		// Setores ocupados pela tabela
+	unsigned int count;		// Número de contadores válidos
+	unsigned char *refs;		// Contadores de 16 bits, little endian
+	unsigned char *dirty;		// Setores a gravar (um byte por setor)
+} RefTable;
+
+//Tabela de impressões digitais dos blocos de dados, gravada como a de
+//referências, e o índice hash em memória sobre ela. Uma impressão zerada
+//indica bloco fora do índice. Os baldes e o encadeamento guardam o número
+//do bloco mais 1, com 0 no fim da lista
+typedef struct {
+	unsigned int start;		// Primeiro setor da tabela no disco
+	unsigned int sectors;		// Setores ocupados pela tabela
+	unsigned int count;		// Número de impressões válidas
+	unsigned char *prints;		// MYFS_PRINT_BYTES por bloco
+	unsigned char *dirty;		// Setores a gravar (um byte por setor)
+	unsigned int numBuckets;	// Baldes do índice (potência de 2)
+	unsigned int *buckets;		// Primeiro bloco de cada balde
+	unsigned int *next;		// Próximo bloco do mesmo balde
+} PrintTable;
+
+//Snapshot do sistema de arquivos. Tirar um snapshot não copia nada: só
+//congela a árvore atual. Cada i-node alterado depois disso tem, antes da
+//primeira alteração, sua versão anterior preservada na tabela do snapshot
+//mais recente, um arquivo interno esparso indexado pelo número do i-node.
+//A versão preservada acrescenta uma referência aos blocos que aponta, e
+//a cópia na escrita dos blocos compartilhados faz o resto. Um i-node visto
+//por um snapshot é o da sua tabela, senão o dos snapshots seguintes, em
+//ordem de criação, e por fim o i-node atual
+typedef struct {
+	unsigned int table;		// I-node da tabela de versões preservadas
+	char name[MYFS_SNAPNAME_LENGTH + 1];
+} MyFSSnapshot;
+
+//Bloco de fragmentos em preenchimento de um diretório, mantido em memória.
+//O espaço de um bloco é ocupado em sequência e não é reaproveitado
+typedef struct {
+	unsigned int dir;		// Diretório dos arquivos do bloco
+	unsigned int addr;		// Endereço do bloco (0 = entrada livre)
+	unsigned int used;		// Bytes já ocupados por fragmentos
+	unsigned char *data;		// Conteúdo do bloco
+} FragGroup;
+
+//Superbloco de um disco montado. É lido uma única vez na montagem, mantido
+//em memória durante o uso e gravado de volta na sincronização e na
+//desmontagem, junto com a tabela de referências de blocos e o mapa de
+//i-nodes. Assim, a alocação e as consultas de estatísticas não fazem E/S.
+//Todos os metadados (superbloco, tabelas, i-nodes, blocos indiretos e de
+//diretórios) passam pelo diário, e só os dados dos arquivos vão direto
+//para os seus blocos
+typedef struct {
+	Disk *d;			// Disco montado (NULL = entrada livre)
+	unsigned int magic;		// MYFS_MAGIC
+	unsigned int version;		// MYFS_VERSION
+	unsigned int sectorsPerBlock;	// Setores por bloco do sistema de arquivos
+	unsigned int inodeStart;	// Primeiro setor da área de i-nodes
+	unsigned int inodeSectors;	// Setores da área de i-nodes
+	unsigned int numInodes;		// I-nodes disponíveis (1 a numInodes)
+	unsigned int dataStart;		// Primeiro setor da área de dados
+	unsigned int numBlocks;		// Blocos da área de dados
+	unsigned int freeBlocks;	// Blocos livres
+	unsigned int freeInodes;	// I-nodes livres
+	unsigned int blockHint;		// Onde começar a busca por blocos livres
+	unsigned int inodeHint;		// Onde começar a busca por i-nodes livres
+	RefTable blockRefs;		// Referências a cada bloco
+	PrintTable blockPrints;		// Impressões digitais dos blocos
+	Bitmap inodeMap;		// I-nodes em uso (bit n-1 = i-node n)
+	int dirty;			// Superbloco alterado desde a última gravação
+	DCache *dcache;			// Cache de nomes já resolvidos (pode ser NULL)
+	unsigned int snapGen;		// Muda a cada snapshot tirado
+	unsigned int numSnaps;		// Snapshots existentes (1 a numSnaps)
+	MyFSSnapshot snaps[MYFS_MAX_SNAPSHOTS]; // Em ordem de criação
+	unsigned int rootSnap;		// Snapshot montado como raiz (0 = atual)
+	unsigned int journalStart;	// Primeiro setor da região do diário
+	unsigned int journalSectors;	// Setores da região do diário
+	Journal *journal;		// Diário aberto (NULL na formatação)
+	unsigned int blockBytes;	// Bytes por bloco (derivado)
+	unsigned int ptrsPerBlock;	// Endereços por bloco indireto (derivado)
+	unsigned int clusterBlocks;	// Blocos por cluster comprimido (derivado)
+	FragGroup fragGroups[MYFS_FRAG_GROUPS]; // Por diretório, só em memória
+	unsigned char *fragCache;	// Setores lidos com o último fragmento
+	unsigned int fragCacheStart;	// Primeiro setor em fragCache
+	unsigned int fragCacheCount;	// Setores em fragCache (0 = vazio)
+	unsigned int numOpenFiles;	// Descritores abertos no disco
+	pthread_rwlock_t lock;		// Compartilhada nas operações sobre dados
+					// de arquivos abertos, exclusiva nas demais
+	pthread_mutex_t metaLock;	// Alocação, tabelas, i-nodes no disco,
+					// fragmentos e snapshots (recursiva)
+	unsigned int dirtyBytes;	// Bytes sujos dos i-nodes do disco
+	pthread_t flusher;		// Descarregador dos blocos sujos do disco
+	int flusherOn;			// flusher em execução
+	int flusherStop;		// Pedido de parada ao flusher
+	unsigned int numClosed;		// I-nodes fechados que esperam o flusher
+	pthread_cond_t flushWake;	// Acorda o flusher (com tableLock)
+} MyFSSuper;
+
+//Bloco lógico de arquivo com dados ainda não gravados. Não possui endereço
+//físico: o bloco só é alocado quando descarregado (alocação tardia)
+typedef struct {
+	unsigned int blockNum;		// Número do bloco dentro do arquivo
+	unsigned char *data;		// Conteúdo do bloco
+} DirtyBlock;
+
+//I-node em memória, compartilhado pelos descritores do mesmo arquivo
+typedef struct {
+	int refs;			// Descritores que usam o i-node (0 = livre)
+	MyFSSuper *sb;			// Disco montado em que o arquivo está
+	Inode *inode;			// Cópia do i-node lida na abertura
+	unsigned int size;		// Tamanho do arquivo, incluindo pendências
+	DirtyBlock *dirty;		// Blocos sujos, ordenados por blockNum
+	unsigned int numDirty;
+	unsigned int capDirty;
+	unsigned int gen;		// Muda a cada escrita no arquivo
+	unsigned int snap;		// Snapshot de que é a versão (0 = atual)
+	unsigned int cowGen;		// snapGen em que a versão anterior já
+					// estava preservada
+	unsigned int parent;		// Diretório pelo qual foi aberto (0 = não
+					// se sabe), onde ficam seus fragmentos
+	unsigned int slot;		// Posição na tabela de i-nodes abertos
+	unsigned int next;		// Próximo do mesmo balde do índice ou, se
+					// livre, da lista (posição + 1; 0 = fim)
+	pthread_rwlock_t lock;		// Compartilhada na consulta, exclusiva
+					// na alteração do mapa, dos blocos sujos
+					// e do tamanho
+	RangeLock *ioRanges;		// Trechos em leitura ou escrita
+	RangeLock *locks;		// Travas de trechos dos descritores
+	int closed;			// Fechado com blocos sujos: a referência
+					// restante é do descarregador
+} MyOpenInode;
 
 //Estrutura interna pra gerenciar arquivos abertos
 typedef struct {
@@ -34,273 +281,5421 @@ typedef struct {
 	unsigned int inodeNum;	// Numero do Inode associado
 	unsigned int cursor;		// Posicao atual do cursor no arquivo(em bytes)
 	Disk *d;								// Disco em que o arquivo está
+	MyOpenInode *oi;				// I-node aberto associado
+	unsigned char *buf;			// Último bloco lido pelo descritor
+	unsigned int bufBlock;		// Número do bloco em buf
+	unsigned int bufGen;		// Valor de oi->gen quando buf foi lido
+	int bufValid;
+	unsigned int slot;		// Posição na tabela (descritor - 1)
+	unsigned int nextFree;		// Próximo descritor livre (posição + 1; 0 = fim)
+	pthread_mutex_t lock;		// Cursor e buffer, só enquanto são usados
+	unsigned long owner;		// Dono das travas consultivas (oi->locks)
+					// do descritor, único entre todas as aberturas
 } MyFileHandle;
 
-MyFileHandle openFiles[MAX_FDS];  //Tabela de arquivos abertos
+//Contexto para consulta e alteração do mapa de blocos de um i-node. Mantém
+//em memória o bloco indireto duplo e o bloco indireto folha em uso, para que
+//acessos sequenciais não releiam o mesmo bloco a cada endereço. Todo
+//contexto iniciado com __bmapInit deve ser encerrado com __bmapDone
+typedef struct {
+	Inode *inode;
+	MyFSSuper *sb;
+	unsigned int addr[2];		// [0]: indireto duplo | [1]: folha
+	int dirty[2];
+	unsigned char *data[2];
+} BlockMap;
 
-// Retorna o próximo setor livre e atualiza o contador do disco
-unsigned int __allocBlock(Disk *d) {
+//As tabelas de arquivos e de i-nodes abertos crescem sob demanda, um bloco
+//de MYFS_TABLE_CHUNK entradas por vez. As entradas nunca mudam de lugar,
+//então ponteiros para elas continuam válidos. As livres formam uma lista
+//e os i-nodes abertos são achados por um índice hash, de modo que abrir e
+//fechar não percorrem as tabelas
+MyFSSuper mounts[MYFS_MAX_MOUNTS]; //Discos montados
+MyFileHandle *fileChunks[MYFS_MAX_FDS / MYFS_TABLE_CHUNK];  //Tabela de arquivos abertos
+unsigned int numFileSlots = 0;  //Entradas já alocadas na tabela de arquivos
+unsigned int freeFiles = 0;  //Primeiro descritor livre (posição + 1; 0 = nenhum)
+MyOpenInode *inodeChunks[MYFS_MAX_OPEN_INODES / MYFS_TABLE_CHUNK];  //Tabela de i-nodes abertos
+unsigned int numInodeSlots = 0;  //Entradas já alocadas na tabela de i-nodes
+unsigned int freeOpenInodes = 0;  //Primeira entrada livre (posição + 1; 0 = nenhuma)
+unsigned int openInodeHash[MYFS_OPENINODE_BUCKETS];  //Índice dos i-nodes abertos
+unsigned int dirtyBytesTotal = 0; //Bytes sujos em todos os i-nodes
+unsigned long nextOwner = 1; //Próximo dono de travas de trechos (abertura ou E/S)
 
-	unsigned char buffer[DISK_SECTORDATASIZE];
-	unsigned int nextFree;
+//Concorrência: operações sobre os dados de arquivos abertos (leitura,
+//escrita, posicionamento) travam o disco de forma compartilhada. Leituras
+//e escritas travam o seu trecho do arquivo (ioRanges), compartilhado na
+//leitura e exclusivo na escrita, e avançam de MYFS_IO_STEP em MYFS_IO_STEP
+//bytes com o i-node aberto travado, compartilhado na leitura e exclusivo
+//na escrita. Assim, arquivos diferentes, e trechos diferentes de um
+//arquivo, são lidos e escritos em paralelo, e operações sobre trechos
+//sobrepostos acontecem uma depois da outra. O descritor só fica travado
+//enquanto o cursor ou o seu buffer de leitura são usados, não durante a
+//E/S, então quem o compartilha também lê e escreve em paralelo. As demais
+//operações (abrir, fechar, diretórios, snapshots, sincronização) travam o
+//disco de forma exclusiva. O descarregador de cada disco grava os blocos
+//sujos com o disco travado de forma compartilhada e cada i-node, de forma
+//exclusiva. O estado do disco que arquivos diferentes compartilham
+//(alocação, tabelas, setores de i-nodes, fragmentos e snapshots) é
+//protegido por metaLock, e as tabelas globais abaixo, por tableLock. O
+//diário e o disco têm travas próprias. Ordem: sb->lock, oi->ioRanges,
+//oi->lock, fh->lock, sb->metaLock, tableLock. Montagem e desmontagem são
+//serializadas pelo VFS
 
-	if(diskReadSector(d, SECTOR_FREE_BLOCK_MAP, buffer) < 0){
-		return 0;
+//Tabelas de arquivos e i-nodes abertos e dirtyBytesTotal
+pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+//dirtyBytesTotal diminuiu (esperada com tableLock)
+pthread_cond_t dirtyCond = PTHREAD_COND_INITIALIZER;
+
+// Retorna os parâmetros do disco montado d, ou NULL se não montado
+MyFSSuper *__getSuper(Disk *d) {
+	for(int i = 0; i < MYFS_MAX_MOUNTS; i++){
+		if(mounts[i].d == d){
+			return &mounts[i];
+		}
 	}
+	return NULL;
+}
+
+// Prepara as travas do superbloco sb, que duram enquanto ele existir
+void __initSuperLocks(MyFSSuper *sb) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&sb->metaLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_rwlock_init(&sb->lock, NULL);
+	pthread_cond_init(&sb->flushWake, NULL);
+}
 
-	char2ul(buffer, &nextFree);
+// Trava o estado compartilhado do disco montado sb (metaLock)
+void __metaLock(MyFSSuper *sb) {
+	pthread_mutex_lock(&sb->metaLock);
+}
 
-	// Verifica se o disco encheu
-	if(nextFree >= diskGetNumSectors(d)){
-		return 0;
-	}
+// Libera a trava obtida por __metaLock
+void __metaUnlock(MyFSSuper *sb) {
+	pthread_mutex_unlock(&sb->metaLock);
+}
 
-	// Atualiza o próximo livre
-	unsigned int newNextFree = nextFree + 1;
-	ul2char(newNextFree, buffer);
-	diskWriteSector(d, SECTOR_FREE_BLOCK_MAP, buffer);
+// Retorna a entrada de posição slot da tabela de arquivos abertos
+MyFileHandle *__fileAt(unsigned int slot) {
+	return &fileChunks[slot / MYFS_TABLE_CHUNK][slot % MYFS_TABLE_CHUNK];
+}
 
-	return nextFree;
+// Retorna a entrada de posição slot da tabela de i-nodes abertos
+MyOpenInode *__openInodeAt(unsigned int slot) {
+	return &inodeChunks[slot / MYFS_TABLE_CHUNK][slot % MYFS_TABLE_CHUNK];
 }
 
-// Busca um inode pelo nome dentro de um diretório pai
-// Retorna o numero do inode se achar, ou 0 se não achar
-unsigned int __findInodeInDir(Disk *d, unsigned int parentInodeNum, const char *name){
+// Acrescenta um bloco de entradas livres à tabela de arquivos abertos.
+// Retorna 0 ou -1 se a tabela estiver no limite ou faltar memória
+int __growFiles(void) {
+	if(numFileSlots >= MYFS_MAX_FDS){
+		return -1;
+	}
+	MyFileHandle *chunk = calloc(MYFS_TABLE_CHUNK, sizeof(MyFileHandle));
+	if(!chunk){
+		return -1;
+	}
+	fileChunks[numFileSlots / MYFS_TABLE_CHUNK] = chunk;
+	// Empilhadas do fim para o início: os descritores menores saem antes
+	for(unsigned int k = MYFS_TABLE_CHUNK; k-- > 0; ){
+		pthread_mutex_init(&chunk[k].lock, NULL);
+		chunk[k].slot = numFileSlots + k;
+		chunk[k].nextFree = freeFiles;
+		freeFiles = numFileSlots + k + 1;
+	}
+	numFileSlots += MYFS_TABLE_CHUNK;
+	return 0;
+}
 
-	Inode *parent = inodeLoad(parentInodeNum, d);
-	if(!parent){
-		return 0;
+// Acrescenta um bloco de entradas livres à tabela de i-nodes abertos.
+// Retorna 0 ou -1 se a tabela estiver no limite ou faltar memória
+int __growOpenInodes(void) {
+	if(numInodeSlots >= MYFS_MAX_OPEN_INODES){
+		return -1;
 	}
+	MyOpenInode *chunk = calloc(MYFS_TABLE_CHUNK, sizeof(MyOpenInode));
+	if(!chunk){
+		return -1;
+	}
+	inodeChunks[numInodeSlots / MYFS_TABLE_CHUNK] = chunk;
+	for(unsigned int k = MYFS_TABLE_CHUNK; k-- > 0; ){
+		pthread_rwlock_init(&chunk[k].lock, NULL);
+		chunk[k].slot = numInodeSlots + k;
+		chunk[k].next = freeOpenInodes;
+		freeOpenInodes = numInodeSlots + k + 1;
+	}
+	numInodeSlots += MYFS_TABLE_CHUNK;
+	return 0;
+}
+
+// Retorna o balde do índice de i-nodes abertos da versão snap do i-node
+// inodeNum
+unsigned int __openInodeBucket(unsigned int snap, unsigned int inodeNum) {
+	return ((inodeNum * 2654435761u) ^ snap) % MYFS_OPENINODE_BUCKETS;
+}
+
+// Retorna o bit i de um mapa
+int __bitmapGet(Bitmap *map, unsigned int i) {
+	return (map->bits[i / 8] >> (i % 8)) & 1;
+}
 
-	unsigned int numBlocks = inodeGetFileSize(parent) / DISK_SECTORDATASIZE;
-	if(inodeGetFileSize(parent) % DISK_SECTORDATASIZE != 0){
-		numBlocks++;
+// Altera o bit i de um mapa, marcando seu setor para gravação
+void __bitmapSet(Bitmap *map, unsigned int i, int value) {
+	if(value){
+		map->bits[i / 8] |= 1 << (i % 8);
+	}
+	else{
+		map->bits[i / 8] &= ~(1 << (i % 8));
 	}
+	map->dirty[i / MYFS_BITS_PER_SECTOR] = 1;
+}
 
-	unsigned char buffer[DISK_SECTORDATASIZE];
-	DirEntry *entry;
+// Reserva a memória de um mapa com count bits a partir do setor start
+int __bitmapInit(Bitmap *map, unsigned int start, unsigned int count) {
+	map->start = start;
+	map->count = count;
+	map->sectors = (count + MYFS_BITS_PER_SECTOR - 1) / MYFS_BITS_PER_SECTOR;
+	map->bits = calloc(map->sectors, DISK_SECTORDATASIZE);
+	map->dirty = calloc(map->sectors, 1);
+	return (map->bits && map->dirty) ? 0 : -1;
+}
 
-	for(unsigned int i = 0; i < numBlocks; i++){
-		unsigned int blockAddr = inodeGetBlockAddr(parent, i);
-		if(blockAddr == 0){
-			continue;
+// Libera a memória de um mapa
+void __bitmapFree(Bitmap *map) {
+	free(map->bits);
+	free(map->dirty);
+	map->bits = map->dirty = NULL;
+}
+
+// Lê do disco os sectors setores de uma tabela de metadados
+int __metaLoad(Disk *d, unsigned int start, unsigned int sectors, unsigned char *data) {
+	for(unsigned int s = 0; s < sectors; s++){
+		if(diskReadSector(d, start + s, &data[s * DISK_SECTORDATASIZE]) < 0){
+			return -1;
 		}
+	}
+	return 0;
+}
 
-		if(diskReadSector(d, blockAddr, buffer) == 0){
-			entry = (DirEntry *)buffer;
-			if(entry->inode != 0 && strcmp(entry->name, name) == 0){
-				free(parent);
-				return entry->inode;
+// Grava count setores de metadados a partir de addr. Com o diário aberto,
+// as alterações só são registradas nele; sem diário (na formatação), vão
+// direto para o disco
+int __writeMeta(MyFSSuper *sb, unsigned int addr, unsigned int count, unsigned char *data) {
+	if(!sb->journal){
+		return diskWriteSectors(sb->d, addr, count, data);
+	}
+	for(unsigned int s = 0; s < count; s++){
+		if(journalWrite(sb->journal, addr + s, &data[s * DISK_SECTORDATASIZE]) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Grava os setores alterados de uma tabela de metadados
+int __metaStore(MyFSSuper *sb, unsigned int start, unsigned int sectors,
+                unsigned char *data, unsigned char *dirty) {
+	for(unsigned int s = 0; s < sectors; s++){
+		if(dirty[s]){
+			if(__writeMeta(sb, start + s, 1, &data[s * DISK_SECTORDATASIZE]) < 0){
+				return -1;
 			}
+			dirty[s] = 0;
 		}
+	}
+	return 0;
+}
+
+// Lê um mapa do disco
+int __bitmapLoad(Disk *d, Bitmap *map) {
+	return __metaLoad(d, map->start, map->sectors, map->bits);
+}
+
+// Grava os setores alterados de um mapa
+int __bitmapStore(MyFSSuper *sb, Bitmap *map) {
+	return __metaStore(sb, map->start, map->sectors, map->bits, map->dirty);
+}
+
+// Retorna o contador i de uma tabela de referências
+unsigned int __refsGet(RefTable *table, unsigned int i) {
+	return table->refs[i * MYFS_REF_BYTES] | (table->refs[i * MYFS_REF_BYTES + 1] << 8);
+}
+
+// Altera o contador i de uma tabela de referências, marcando seu setor
+// para gravação
+void __refsSet(RefTable *table, unsigned int i, unsigned int value) {
+	table->refs[i * MYFS_REF_BYTES] = value & 0xFF;
+	table->refs[i * MYFS_REF_BYTES + 1] = (value >> 8) & 0xFF;
+	table->dirty[i / MYFS_REFS_PER_SECTOR] = 1;
+}
+
+// Reserva a memória de uma tabela com count contadores a partir do setor
+// start
+int __refsInit(RefTable *table, unsigned int start, unsigned int count) {
+	table->start = start;
+	table->count = count;
+	table->sectors = (count + MYFS_REFS_PER_SECTOR - 1) / MYFS_REFS_PER_SECTOR;
+	table->refs = calloc(table->sectors, DISK_SECTORDATASIZE);
+	table->dirty = calloc(table->sectors, 1);
+	return (table->refs && table->dirty) ? 0 : -1;
+}
+
+// Libera a memória de uma tabela de referências
+void __refsFree(RefTable *table) {
+	free(table->refs);
+	free(table->dirty);
+	table->refs = table->dirty = NULL;
+}
 
+// Indica se os count bytes de data são todos zero
+int __isZero(const unsigned char *data, unsigned int count){
+	for(unsigned int i = 0; i < count; i++){
+		if(data[i] != 0){
+			return 0;
+		}
 	}
+	return 1;
+}
 
-	free(parent);
-	return 0;
+// Rotação de 64 bits para a esquerda
+unsigned long long __rotl64(unsigned long long x, int r) {
+	return (x << r) | (x >> (64 - r));
 }
 
-// Resolve um caminho e retorna o inode correspondente
-// Retorna 0 se não existir
-unsigned int __resolvePath(Disk *d, const char *path){
+// Mistura final de 64 bits do MurmurHash3
+unsigned long long __fmix64(unsigned long long k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
 
-	if(path[0] != '/'){
-		return 0; // O caminho deve ser absoluto
+// Lê 8 bytes little endian de p
+unsigned long long __getU64(const unsigned char *p) {
+	unsigned long long v = 0;
+	for(int k = 7; k >= 0; k--){
+		v = (v << 8) | p[k];
 	}
+	return v;
+}
+
+// Calcula a impressão digital dos len bytes de data (múltiplo de 16) com o
+// MurmurHash3 x64 de 128 bits, escrevendo-a em print. Uma impressão zerada
+// é trocada por outra, pois indica bloco fora do índice
+void __fingerprint(const unsigned char *data, unsigned int len, unsigned char *print) {
+	const unsigned long long c1 = 0x87c37b91114253d5ULL;
+	const unsigned long long c2 = 0x4cf5ad432745937fULL;
+	unsigned long long h1 = 0, h2 = 0;
 
-	if(strcmp(path, "/") == 0){
-		return 1; // Raiz é sempre 1
+	for(unsigned int i = 0; i + 16 <= len; i += 16){
+		unsigned long long k1 = __getU64(&data[i]);
+		unsigned long long k2 = __getU64(&data[i + 8]);
+		k1 *= c1; k1 = __rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = __rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = __rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = __rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = __fmix64(h1);
+	h2 = __fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+	if(h1 == 0 && h2 == 0){
+		h1 = 1;
 	}
 
-	char pathCopy[MAX_FILENAME_LENGTH + 1];
-	strncpy(pathCopy, path, MAX_FILENAME_LENGTH);
+	for(int k = 0; k < 8; k++){
+		print[k] = (h1 >> (8 * k)) & 0xFF;
+		print[8 + k] = (h2 >> (8 * k)) & 0xFF;
+	}
+}
+
+// Retorna a impressão do bloco i de uma tabela de impressões
+unsigned char *__printsGet(PrintTable *table, unsigned int i) {
+	return &table->prints[i * MYFS_PRINT_BYTES];
+}
 
-	unsigned int currentInode = 1;
-	char *token = strtok(pathCopy, "/");
+// Retorna o balde do índice para a impressão print
+unsigned int __printsBucket(PrintTable *table, const unsigned char *print) {
+	unsigned int h = print[0] | (print[1] << 8) | (print[2] << 16) | ((unsigned int)print[3] << 24);
+	return h & (table->numBuckets - 1);
+}
 
-	while(token != NULL){
-		unsigned int nextInode = __findInodeInDir(d, currentInode, token);
-		if(nextInode == 0){
-			return 0; // Não achou parte do caminho
+// Retorna o bloco com a impressão print ou MYFS_NOPRINT se ela não estiver
+// no índice
+unsigned int __printsFind(PrintTable *table, const unsigned char *print) {
+	unsigned int i = table->buckets[__printsBucket(table, print)];
+	while(i != 0){
+		if(memcmp(__printsGet(table, i - 1), print, MYFS_PRINT_BYTES) == 0){
+			return i - 1;
 		}
+		i = table->next[i - 1];
+	}
+	return MYFS_NOPRINT;
+}
 
-		currentInode = nextInode;
-		token = strtok(NULL, "/");
+// Liga o bloco i, que já tem sua impressão na tabela, ao índice
+void __printsLink(PrintTable *table, unsigned int i) {
+	unsigned int b = __printsBucket(table, __printsGet(table, i));
+	table->next[i] = table->buckets[b];
+	table->buckets[b] = i + 1;
+}
+
+// Retira o bloco i do índice e zera a sua impressão, marcando seu setor
+// para gravação
+void __printsRemove(PrintTable *table, unsigned int i) {
+	unsigned char *print = __printsGet(table, i);
+	if(__isZero(print, MYFS_PRINT_BYTES)){
+		return;
+	}
+	unsigned int *link = &table->buckets[__printsBucket(table, print)];
+	while(*link != 0 && *link != i + 1){
+		link = &table->next[*link - 1];
+	}
+	if(*link != 0){
+		*link = table->next[i];
 	}
+	table->next[i] = 0;
+	memset(print, 0, MYFS_PRINT_BYTES);
+	table->dirty[i / MYFS_PRINTS_PER_SECTOR] = 1;
+}
 
-	return currentInode;
+// Registra print como a impressão do bloco i. Um outro bloco com a mesma
+// impressão sai do índice, e o mais recente passa a ser o compartilhado
+void __printsAdd(PrintTable *table, unsigned int i, const unsigned char *print) {
+	unsigned int other = __printsFind(table, print);
+	if(other != MYFS_NOPRINT){
+		__printsRemove(table, other);
+	}
+	__printsRemove(table, i);
+	memcpy(__printsGet(table, i), print, MYFS_PRINT_BYTES);
+	table->dirty[i / MYFS_PRINTS_PER_SECTOR] = 1;
+	__printsLink(table, i);
 }
 
-//Funcao para verificacao se o sistema de arquivos está ocioso, ou seja,
-//se nao ha quisquer descritores de arquivos em uso atualmente. Retorna
-//um positivo se ocioso ou, caso contrario, 0.
-int myFSIsIdle (Disk *d) {
+// Reserva a memória de uma tabela com count impressões a partir do setor
+// start, com o índice vazio
+int __printsInit(PrintTable *table, unsigned int start, unsigned int count) {
+	table->start = start;
+	table->count = count;
+	table->sectors = (count + MYFS_PRINTS_PER_SECTOR - 1) / MYFS_PRINTS_PER_SECTOR;
+	table->numBuckets = 16;
+	while(table->numBuckets < count){
+		table->numBuckets <<= 1;
+	}
+	table->prints = calloc(table->sectors, DISK_SECTORDATASIZE);
+	table->dirty = calloc(table->sectors, 1);
+	table->buckets = calloc(table->numBuckets, sizeof(unsigned int));
+	table->next = calloc(count ? count : 1, sizeof(unsigned int));
+	return (table->prints && table->dirty && table->buckets && table->next) ? 0 : -1;
+}
 
-	for(int i = 0; i<MAX_FDS; i++){
-		if(openFiles[i].used && openFiles[i].d == d)
-			return 0;
+// Monta o índice a partir das impressões lidas do disco. Impressões de
+// blocos livres, que podem ter ficado de uma queda, são descartadas
+void __printsIndex(PrintTable *table, RefTable *refs) {
+	for(unsigned int i = 0; i < table->count; i++){
+		unsigned char *print = __printsGet(table, i);
+		if(__isZero(print, MYFS_PRINT_BYTES)){
+			continue;
+		}
+		if(__refsGet(refs, i) == 0){
+			memset(print, 0, MYFS_PRINT_BYTES);
+			table->dirty[i / MYFS_PRINTS_PER_SECTOR] = 1;
+			continue;
+		}
+		__printsLink(table, i);
 	}
+}
 
-	return 1;
+// Libera a memória de uma tabela de impressões
+void __printsFree(PrintTable *table) {
+	free(table->prints);
+	free(table->dirty);
+	free(table->buckets);
+	free(table->next);
+	table->prints = table->dirty = NULL;
+	table->buckets = table->next = NULL;
 }
 
-//Funcao para formatacao de um disco com o novo sistema de arquivos
-//com tamanho de blocos igual a blockSize. Retorna o numero total de
-//blocos disponiveis no disco, se formatado com sucesso. Caso contrario,
-//retorna -1.
-int myFSFormat (Disk *d, unsigned int blockSize) {
-	
-	//Inicializa o setor de mapa de bits (Next Free Block)
-	unsigned char buffer[DISK_SECTORDATASIZE];
-	unsigned int firstDataBlock = FIRST_DATA_BLOCK;
+// Calcula os campos derivados do superbloco. Retorna -1 se o conteúdo
+// lido não corresponder a um MyFS válido
+int __superDerive(MyFSSuper *sb) {
+	unsigned int spb = sb->sectorsPerBlock;
+	if(sb->magic != MYFS_MAGIC || sb->version != MYFS_VERSION ||
+	   spb == 0 || spb > MYFS_MAX_SECTORSPERBLOCK || (spb & (spb - 1)) != 0 ||
+	   sb->inodeStart != inodeAreaBeginSector() ||
+	   sb->numInodes > sb->inodeSectors * inodeNumInodesPerSector() ||
+	   sb->numSnaps > MYFS_MAX_SNAPSHOTS){
+		return -1;
+	}
+	sb->blockBytes = spb * DISK_SECTORDATASIZE;
+	sb->ptrsPerBlock = sb->blockBytes / sizeof(unsigned int);
+	sb->clusterBlocks = MYFS_CLUSTER_BYTES / sb->blockBytes;
+	if(sb->clusterBlocks < MYFS_MIN_CLUSTERBLOCKS){
+		sb->clusterBlocks = MYFS_MIN_CLUSTERBLOCKS;
+	}
+	if(sb->clusterBlocks > LZ_MAX_INPUT / sb->blockBytes){
+		sb->clusterBlocks = LZ_MAX_INPUT / sb->blockBytes;
+	}
+	return 0;
+}
 
-	// Limpa o buffer com zeros
-	memset(buffer, 0, DISK_SECTORDATASIZE);
+// Converte o superbloco de/para sua representação em disco. toDisk != 0
+// copia sb para sector; caso contrário, copia sector para sb
+void __superSerialize(MyFSSuper *sb, unsigned char *sector, int toDisk) {
+	unsigned int *fields[] = {
+		&sb->magic, &sb->version, &sb->sectorsPerBlock,
+		&sb->inodeStart, &sb->inodeSectors, &sb->numInodes,
+		&sb->blockRefs.start, &sb->blockRefs.sectors,
+		&sb->inodeMap.start, &sb->inodeMap.sectors,
+		&sb->dataStart, &sb->numBlocks,
+		&sb->freeBlocks, &sb->freeInodes,
+		&sb->blockHint, &sb->inodeHint,
+		&sb->snapGen, &sb->numSnaps,
+		&sb->journalStart, &sb->journalSectors,
+		&sb->blockPrints.start, &sb->blockPrints.sectors
+	};
+	for(unsigned int f = 0; f < sizeof(fields) / sizeof(fields[0]); f++){
+		if(toDisk){
+			ul2char(*fields[f], &sector[f * sizeof(unsigned int)]);
+		}
+		else{
+			char2ul(&sector[f * sizeof(unsigned int)], fields[f]);
+		}
+	}
+
+	for(unsigned int k = 0; k < MYFS_MAX_SNAPSHOTS; k++){
+		unsigned char *record = &sector[MYFS_SNAP_OFFSET + k * MYFS_SNAP_RECORD];
+		MyFSSnapshot *snap = &sb->snaps[k];
+		if(toDisk){
+			ul2char(snap->table, record);
+			memcpy(record + sizeof(unsigned int), snap->name, MYFS_SNAPNAME_LENGTH + 1);
+		}
+		else{
+			char2ul(record, &snap->table);
+			memcpy(snap->name, record + sizeof(unsigned int), MYFS_SNAPNAME_LENGTH + 1);
+			snap->name[MYFS_SNAPNAME_LENGTH] = '\0';
+		}
+	}
+}
 
-	ul2char(firstDataBlock, buffer);
-	if(diskWriteSector(d, SECTOR_FREE_BLOCK_MAP, buffer) < 0){
+// Grava o superbloco e os setores alterados das tabelas de referências e
+// de impressões e do mapa de i-nodes
+int __writeSuper(MyFSSuper *sb) {
+	if(__metaStore(sb, sb->blockRefs.start, sb->blockRefs.sectors,
+	               sb->blockRefs.refs, sb->blockRefs.dirty) < 0 ||
+	   __metaStore(sb, sb->blockPrints.start, sb->blockPrints.sectors,
+	               sb->blockPrints.prints, sb->blockPrints.dirty) < 0 ||
+	   __bitmapStore(sb, &sb->inodeMap) < 0){
 		return -1;
 	}
+	if(sb->dirty){
+		unsigned char sector[DISK_SECTORDATASIZE];
+		memset(sector, 0, DISK_SECTORDATASIZE);
+		__superSerialize(sb, sector, 1);
+		if(__writeMeta(sb, SECTOR_SUPERBLOCK, 1, sector) < 0){
+			return -1;
+		}
+		sb->dirty = 0;
+	}
+	return 0;
+}
 
-	// Cria o Inode raiz (Inode 1)
-	Inode *root = inodeCreate(1, d);
-	if(!root){
+// Libera a memória associada a um superbloco, levando as alterações
+// pendentes no diário aos seus lugares
+void __freeSuper(MyFSSuper *sb) {
+	if(sb->journal){
+		journalClose(sb->journal);
+		sb->journal = NULL;
+	}
+	__refsFree(&sb->blockRefs);
+	__printsFree(&sb->blockPrints);
+	__bitmapFree(&sb->inodeMap);
+	for(unsigned int g = 0; g < MYFS_FRAG_GROUPS; g++){
+		free(sb->fragGroups[g].data);
+	}
+	memset(sb->fragGroups, 0, sizeof(sb->fragGroups));
+	free(sb->fragCache);
+	sb->fragCache = NULL;
+	sb->fragCacheCount = 0;
+	dcacheDestroy(sb->dcache);
+	sb->dcache = NULL;
+	sb->d = NULL;
+}
+
+// Lê o superbloco, as tabelas de referências e de impressões e o mapa de
+// i-nodes de d para sb, montando o índice de impressões. Retorna 0 ou -1
+// se o disco não contiver um MyFS válido
+int __readSuper(Disk *d, MyFSSuper *sb) {
+
+	unsigned char sector[DISK_SECTORDATASIZE];
+
+	if(diskReadSector(d, SECTOR_SUPERBLOCK, sector) < 0){
 		return -1;
 	}
 
-	inodeSetFileType(root, FILETYPE_DIR);
-	inodeSetFileSize(root, 0);
-	inodeSetOwner(root, 0); // Usuário root
-	inodeSave(root);
-	free(root);
+	__superSerialize(sb, sector, 0);
+	if(__superDerive(sb) < 0){
+		return -1;
+	}
 
-	// Cria inodes vazios para depois
-	unsigned int inodesPerSector = inodeNumInodesPerSector();
-	unsigned int inodeAreaSectors = FIRST_DATA_BLOCK - inodeAreaBeginSector();
-	unsigned int numInodesToInit = inodesPerSector * inodeAreaSectors;
-	for(unsigned int i = 2; i <= numInodesToInit; i++){
-		Inode *inode = inodeCreate(i, d);
-		if(!inode){
-			// Continua mesmo se falhar em criar algum inode
-			continue;
-		}
-		// Deixa o inode limpo/vazio (já é feito por inodeCreate e inodeClear)
-		free(inode);
+	// Refaz as transações do diário que não chegaram aos seus lugares, o
+	// que pode incluir o próprio superbloco. A região do diário não muda
+	sb->journal = journalOpen(d, sb->journalStart, sb->journalSectors);
+	if(!sb->journal){
+		return -1;
+	}
+	if(diskReadSector(d, SECTOR_SUPERBLOCK, sector) < 0){
+		journalClose(sb->journal);
+		sb->journal = NULL;
+		return -1;
+	}
+	__superSerialize(sb, sector, 0);
+	if(__superDerive(sb) < 0){
+		journalClose(sb->journal);
+		sb->journal = NULL;
+		return -1;
+	}
+
+	sb->d = d;
+	sb->dirty = 0;
+	sb->rootSnap = 0;
+	if(__refsInit(&sb->blockRefs, sb->blockRefs.start, sb->numBlocks) < 0 ||
+	   __printsInit(&sb->blockPrints, sb->blockPrints.start, sb->numBlocks) < 0 ||
+	   __bitmapInit(&sb->inodeMap, sb->inodeMap.start, sb->numInodes) < 0 ||
+	   __metaLoad(d, sb->blockRefs.start, sb->blockRefs.sectors, sb->blockRefs.refs) < 0 ||
+	   __metaLoad(d, sb->blockPrints.start, sb->blockPrints.sectors, sb->blockPrints.prints) < 0 ||
+	   __bitmapLoad(d, &sb->inodeMap) < 0){
+		__freeSuper(sb);
+		return -1;
 	}
-	
-	// Retorna numero total de blocos (estimado)
-	return diskGetNumSectors(d) - firstDataBlock;
+	__printsIndex(&sb->blockPrints, &sb->blockRefs);
+
+	// Sem memória para o cache, os nomes são sempre buscados no disco
+	sb->dcache = dcacheCreate(MYFS_DCACHE_ENTRIES);
+	return 0;
 }
 
-// Função auxiliar para encontrar slot livre
-int __findFreeSlot(void) {
-    for (int i = 0; i < MAX_FDS; i++) {
-        if (!openFiles[i].used) {
-            return i;
-        }
-    }
-    return -1;
+// Converte o número de um bloco da área de dados em endereço (setor)
+unsigned int __blockAddr(MyFSSuper *sb, unsigned int block) {
+	return sb->dataStart + block * sb->sectorsPerBlock;
 }
 
-//Funcao para montagem/desmontagem do sistema de arquivos, se possível.
-//Na montagem (x=1) e' a chance de se fazer inicializacoes, como carregar
-//o superbloco na memoria. Na desmontagem (x=0), quaisquer dados pendentes
-//de gravacao devem ser persistidos no disco. Retorna um positivo se a
-//montagem ou desmontagem foi bem sucedida ou, caso contrario, 0.
-int myFSxMount(Disk *d, int x) {
-    if (!d) return 0;
+// Converte o endereço (setor) de um bloco em seu número na área de dados
+unsigned int __blockIndex(MyFSSuper *sb, unsigned int addr) {
+	return (addr - sb->dataStart) / sb->sectorsPerBlock;
+}
 
-    if (x == 1) { // Montagem
-        // Inicializa tabela de arquivos abertos
-        for (int i = 0; i < MAX_FDS; i++) {
-            openFiles[i].used = 0;
-        }
-        return 1;
-    }
+// Lê count blocos contíguos, a partir do endereço addr, para data, com as
+// alterações ainda no diário
+int __readBlocks(MyFSSuper *sb, unsigned int addr, unsigned int count, unsigned char *data) {
+	if(!sb->journal){
+		return diskReadSectors(sb->d, addr, count * sb->sectorsPerBlock, data);
+	}
+	return journalRead(sb->journal, addr, count * sb->sectorsPerBlock, data);
+}
 
-    if (x == 0) { // Desmontagem
-        return 1;
-    }
+// Grava os dados de arquivo data em count blocos contíguos, a partir do
+// endereço addr, direto no disco. Imagens dos blocos no diário, de quando
+// guardavam metadados, são descartadas
+int __writeBlocks(MyFSSuper *sb, unsigned int addr, unsigned int count, unsigned char *data) {
+	if(diskWriteSectors(sb->d, addr, count * sb->sectorsPerBlock, data) < 0){
+		return -1;
+	}
+	return sb->journal ? journalForget(sb->journal, addr, count * sb->sectorsPerBlock) : 0;
+}
 
-    return 0;
+// Lê o bloco de endereço addr (primeiro setor do bloco) para data
+int __readBlock(MyFSSuper *sb, unsigned int addr, unsigned char *data) {
+	return __readBlocks(sb, addr, 1, data);
 }
 
-//Funcao para abertura de um arquivo, a partir do caminho especificado
-//em path, no disco montado especificado em d, no modo Read/Write,
-//criando o arquivo se nao existir. Retorna um descritor de arquivo,
-//em caso de sucesso. Retorna -1, caso contrario.
-int myFSOpen(Disk *d, const char *path) {
-    if (!d || !path) return -1;
-    
-    // Encontra algum slot livre
-    int slot = __findFreeSlot();
-    if (slot < 0) return -1;
-    
-    // Busca um inode livre (começando do 2, pq 1 é a raiz)
-    unsigned int inodeNum = inodeFindFreeInode(2, d);
-    if (inodeNum == 0) return -1;
-    
-    // Cria o inode
-    Inode *inode = inodeCreate(inodeNum, d);
-    if (!inode) return -1;
-    
-    // Configura como arquivo regular
-    inodeSetFileType(inode, FILETYPE_REGULAR);
-    inodeSetFileSize(inode, 0);
-    inodeSetOwner(inode, 0);
-    inodeSetRefCount(inode, 1);
-    
-    // Salva o inode
-    if (inodeSave(inode) < 0) {
-        free(inode);
-        return -1;
-    }
-    free(inode);
-    
-    // Configura o file handle
-    openFiles[slot].used = 1;
-    openFiles[slot].inodeNum = inodeNum;
-    openFiles[slot].cursor = 0;
-    openFiles[slot].d = d;
-    
-    return slot + 1; // FDs começam em 1
-}
-	
-//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
-//existente. Os dados devem ser lidos a partir da posicao atual do cursor
-//e copiados para buf. Terao tamanho maximo de nbytes. Ao fim, o cursor
-//deve ter posicao atualizada para que a proxima operacao ocorra a partir
-//do próximo byte apos o ultimo lido. Retorna o numero de bytes
-//efetivamente lidos em caso de sucesso ou -1, caso contrario.
-int myFSRead (int fd, char *buf, unsigned int nbytes) {
-	return -1;
+// Grava data no bloco de endereço addr (primeiro setor do bloco)
+int __writeBlock(MyFSSuper *sb, unsigned int addr, unsigned char *data) {
+	return __writeBlocks(sb, addr, 1, data);
 }
 
-//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
-//existente. Os dados de buf sao copiados para o disco a partir da posição
-//atual do cursor e terao tamanho maximo de nbytes. Ao fim, o cursor deve
-//ter posicao atualizada para que a proxima operacao ocorra a partir do
-//proximo byte apos o ultimo escrito. Retorna o numero de bytes
-//efetivamente escritos em caso de sucesso ou -1, caso contrario
-int myFSWrite (int fd, const char *buf, unsigned int nbytes) {
-	return -1;
+// Grava o bloco de metadados data (indireto, de diretório ou de tabela de
+// snapshot) no bloco de endereço addr, através do diário
+int __writeMetaBlock(MyFSSuper *sb, unsigned int addr, unsigned char *data) {
+	return __writeMeta(sb, addr, sb->sectorsPerBlock, data);
 }
 
-//Funcao para fechar um arquivo, a partir de um descritor de arquivo
-//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
-int myFSClose (int fd) {
-	return -1;
+// Retorna o setor da área de i-nodes com o i-node inodeNum e escreve em
+// *offset a posição do i-node dentro dele
+unsigned int __inodeSector(MyFSSuper *sb, unsigned int inodeNum, unsigned int *offset) {
+	*offset = (inodeNum - 1) % inodeNumInodesPerSector() * inodeRecordSize();
+	return sb->inodeStart + (inodeNum - 1) / inodeNumInodesPerSector();
 }
 
-//Funcao para instalar seu sistema de arquivos no S.O., registrando-o junto
-//ao virtual FS (vfs). Retorna um identificador unico (slot), caso
-//o sistema de arquivos tenha sido registrado com sucesso.
-//Caso contrario, retorna -1
-int installMyFS (void) {
-	
-	FSInfo *fsInfo = malloc(sizeof(FSInfo));
+// Lê o i-node inodeNum, com as alterações ainda no diário. Retorna NULL em
+// caso de falha
+Inode *__loadInode(MyFSSuper *sb, unsigned int inodeNum) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int offset;
+	if(inodeNum < 1 || inodeNum > sb->numInodes ||
+	   journalRead(sb->journal, __inodeSector(sb, inodeNum, &offset), 1, sector) < 0){
+		return NULL;
+	}
+	return inodeDecode(inodeNum, sb->d, &sector[offset]);
+}
+
+// Lê os count i-nodes de numbers, em ordem crescente, para inodes (NULL nos
+// que falharem), lendo uma única vez cada setor. Retorna quantos foram lidos
+unsigned int __loadInodes(MyFSSuper *sb, const unsigned int *numbers, unsigned int count,
+                          Inode **inodes) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int current = 0, loaded = 0, offset;
+	for(unsigned int k = 0; k < count; k++){
+		inodes[k] = NULL;
+		if(numbers[k] < 1 || numbers[k] > sb->numInodes){
+			continue;
+		}
+		unsigned int addr = __inodeSector(sb, numbers[k], &offset);
+		if(addr != current){
+			current = 0;
+			if(journalRead(sb->journal, addr, 1, sector) < 0){
+				continue;
+			}
+			current = addr;
+		}
+		inodes[k] = inodeDecode(numbers[k], sb->d, &sector[offset]);
+		if(inodes[k]){
+			loaded++;
+		}
+	}
+	return loaded;
+}
+
+// Grava o registro record (inodeRecordSize() bytes) do i-node inodeNum
+// através do diário. Retorna 0 ou -1
+int __writeInodeRecord(MyFSSuper *sb, unsigned int inodeNum, const unsigned char *record) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int offset;
+	unsigned int addr = __inodeSector(sb, inodeNum, &offset);
+	// O setor tem outros i-nodes: leitura e escrita não podem se intercalar
+	// com as de outro arquivo
+	__metaLock(sb);
+	int ret = journalRead(sb->journal, addr, 1, sector);
+	if(ret == 0){
+		memcpy(&sector[offset], record, inodeRecordSize());
+		ret = journalWrite(sb->journal, addr, sector);
+	}
+	__metaUnlock(sb);
+	return ret;
+}
+
+// Grava o i-node inode através do diário. Retorna 0 ou -1
+int __saveInode(MyFSSuper *sb, Inode *inode) {
+	unsigned char record[DISK_SECTORDATASIZE];
+	inodeEncode(inode, record);
+	return __writeInodeRecord(sb, inodeGetNumber(inode), record);
+}
+
+// Zera no disco o i-node inodeNum. Retorna 0 ou -1
+int __clearInode(MyFSSuper *sb, unsigned int inodeNum) {
+	unsigned char record[DISK_SECTORDATASIZE];
+	memset(record, 0, inodeRecordSize());
+	return __writeInodeRecord(sb, inodeNum, record);
+}
+
+// Cria o i-node vazio inodeNum, já gravado. Retorna NULL em caso de falha
+Inode *__newInode(MyFSSuper *sb, unsigned int inodeNum) {
+	unsigned char record[DISK_SECTORDATASIZE];
+	memset(record, 0, inodeRecordSize());
+	Inode *inode = inodeDecode(inodeNum, sb->d, record);
+	if(inode && __saveInode(sb, inode) < 0){
+		free(inode);
+		return NULL;
+	}
+	return inode;
+}
+
+// Retorna os atributos (VFS_FLAG_*) do i-node inode
+unsigned int __inodeFlags(Inode *inode) {
+	return inodeGetPermission(inode) & MYFS_FLAGS;
+}
+
+// Altera os atributos (VFS_FLAG_*) do i-node inode, sem salvá-lo
+void __setInodeFlags(Inode *inode, unsigned int flags) {
+	inodeSetPermission(inode, (inodeGetPermission(inode) & ~MYFS_FLAGS) | flags);
+}
+
+// Aloca até count blocos contíguos, procurando a partir da dica de
+// alocação a primeira sequência livre com count blocos. Se não houver, usa
+// a maior sequência livre encontrada. Retorna o endereço do primeiro bloco
+// e escreve em *got quantos blocos foram obtidos, ou retorna 0 se o disco
+// estiver cheio. Não faz E/S
+unsigned int __allocBlocks(MyFSSuper *sb, unsigned int count, unsigned int *got) {
+
+	unsigned int bestStart = 0, bestLen = 0;
+	unsigned int n = sb->numBlocks;
+
+	*got = 0;
+	if(count == 0){
+		return 0;
+	}
+	__metaLock(sb);
+	if(sb->freeBlocks == 0){
+		__metaUnlock(sb);
+		return 0;
+	}
+
+	unsigned int b = sb->blockHint < n ? sb->blockHint : 0;
+	for(unsigned int scanned = 0; scanned < n && bestLen < count; ){
+		if(__refsGet(&sb->blockRefs, b) != 0){
+			b = (b + 1) % n;
+			scanned++;
+			continue;
+		}
+		// Mede a sequência livre que começa em b (sem dar a volta no disco)
+		unsigned int len = 0;
+		while(b + len < n && len < count && __refsGet(&sb->blockRefs, b + len) == 0){
+			len++;
+		}
+		if(len > bestLen){
+			bestStart = b;
+			bestLen = len;
+		}
+		scanned += len;
+		b = (b + len) % n;
+	}
+
+	for(unsigned int k = 0; k < bestLen; k++){
+		__refsSet(&sb->blockRefs, bestStart + k, 1);
+	}
+	sb->freeBlocks -= bestLen;
+	sb->blockHint = (bestStart + bestLen) % n;
+	sb->dirty = 1;
+	__metaUnlock(sb);
+
+	*got = bestLen;
+	return __blockAddr(sb, bestStart);
+}
+
+// Retorna um bloco livre, ou 0 se o disco estiver cheio
+unsigned int __allocBlock(MyFSSuper *sb) {
+	unsigned int got;
+	return __allocBlocks(sb, 1, &got);
+}
+
+// Retorna o número de referências ao bloco de endereço addr (0 = livre)
+unsigned int __blockRefs(MyFSSuper *sb, unsigned int addr) {
+	unsigned int block = __blockIndex(sb, addr);
+	if(addr < sb->dataStart || block >= sb->numBlocks){
+		return 0;
+	}
+	__metaLock(sb);
+	unsigned int refs = __refsGet(&sb->blockRefs, block);
+	__metaUnlock(sb);
+	return refs;
+}
+
+// Indica se o bloco de endereço addr é compartilhado e, portanto, precisa
+// ser copiado antes de alterado
+int __blockShared(MyFSSuper *sb, unsigned int addr) {
+	return __blockRefs(sb, addr) > 1;
+}
+
+// Retorna o endereço do fragmento com o fim do arquivo regular inode
+// (0 = sem fragmento)
+unsigned int __inodeTail(Inode *inode) {
+	return inodeGetFileType(inode) == FILETYPE_REGULAR ? inodeGetGroupOwner(inode) : 0;
+}
+
+// Altera o endereço do fragmento do i-node inode, sem salvá-lo
+void __setInodeTail(Inode *inode, unsigned int frag) {
+	inodeSetGroupOwner(inode, frag);
+}
+
+// Retorna o setor em que começa o fragmento frag
+unsigned int __fragSector(unsigned int frag) {
+	return frag >> MYFS_FRAG_SHIFT;
+}
+
+// Retorna a posição do fragmento frag dentro do seu primeiro setor
+unsigned int __fragOffset(unsigned int frag) {
+	return (frag & ((1 << MYFS_FRAG_SHIFT) - 1)) * MYFS_FRAG_UNIT;
+}
+
+// Retorna o endereço do bloco de fragmentos que contém o fragmento frag
+unsigned int __fragBlock(MyFSSuper *sb, unsigned int frag) {
+	unsigned int sector = __fragSector(frag);
+	return sector - (sector - sb->dataStart) % sb->sectorsPerBlock;
+}
+
+// Fecha o bloco de fragmentos em preenchimento de endereço addr, que
+// acabou de ser liberado, se houver
+void __fragGroupsForget(MyFSSuper *sb, unsigned int addr) {
+	for(unsigned int g = 0; g < MYFS_FRAG_GROUPS; g++){
+		if(sb->fragGroups[g].addr == addr){
+			sb->fragGroups[g].addr = 0;
+		}
+	}
+}
+
+// Indica se o bloco de endereço addr está no índice de impressões e,
+// portanto, não pode ser regravado no lugar
+int __blockPrinted(MyFSSuper *sb, unsigned int addr) {
+	__metaLock(sb);
+	int printed = __blockRefs(sb, addr) != 0 &&
+	              !__isZero(__printsGet(&sb->blockPrints, __blockIndex(sb, addr)), MYFS_PRINT_BYTES);
+	__metaUnlock(sb);
+	return printed;
+}
+
+// Acrescenta uma referência ao bloco em uso de endereço addr. Retorna 0
+// ou -1 se o bloco estiver livre ou o contador no limite
+int __refBlock(MyFSSuper *sb, unsigned int addr) {
+	__metaLock(sb);
+	unsigned int refs = __blockRefs(sb, addr);
+	if(refs > 0 && refs < MYFS_MAX_BLOCKREFS){
+		__refsSet(&sb->blockRefs, __blockIndex(sb, addr), refs + 1);
+	}
+	__metaUnlock(sb);
+	return refs > 0 && refs < MYFS_MAX_BLOCKREFS ? 0 : -1;
+}
+
+// Devolve uma referência ao bloco de endereço addr, que volta a ser livre,
+// e sai do índice de impressões, quando não houver mais referências.
+// Retorna as referências restantes
+unsigned int __freeBlock(MyFSSuper *sb, unsigned int addr) {
+	__metaLock(sb);
+	unsigned int refs = __blockRefs(sb, addr);
+	if(refs == 0){
+		__metaUnlock(sb);
+		return 0;
+	}
+	__refsSet(&sb->blockRefs, __blockIndex(sb, addr), refs - 1);
+	if(refs == 1){
+		__printsRemove(&sb->blockPrints, __blockIndex(sb, addr));
+		__fragGroupsForget(sb, addr);
+		sb->freeBlocks++;
+		sb->dirty = 1;
+	}
+	__metaUnlock(sb);
+	return refs - 1;
+}
+
+// Indica se addr, lido de um mapa de blocos, é o endereço de um bloco no
+// disco, e não um buraco nem um bloco lógico guardado em um cluster
+// comprimido
+int __hasBlock(unsigned int addr) {
+	return addr != 0 && addr != MYFS_ZBLOCK;
+}
+
+// Procura um i-node livre no mapa de i-nodes a partir da dica de alocação
+// e o marca como usado. Retorna o numero do inode ou 0 se não houver
+unsigned int __allocInode(MyFSSuper *sb) {
+
+	unsigned int found = 0;
+	__metaLock(sb);
+	unsigned int i = sb->inodeHint < sb->numInodes ? sb->inodeHint : 0;
+	for(unsigned int scanned = 0; scanned < sb->numInodes && sb->freeInodes > 0; scanned++){
+		if(!__bitmapGet(&sb->inodeMap, i)){
+			__bitmapSet(&sb->inodeMap, i, 1);
+			sb->freeInodes--;
+			sb->inodeHint = (i + 1) % sb->numInodes;
+			sb->dirty = 1;
+			found = i + 1;
+			break;
+		}
+		i = (i + 1) % sb->numInodes;
+	}
+	__metaUnlock(sb);
+
+	return found;
+}
+
+// Devolve ao mapa de i-nodes o i-node de número inodeNum
+void __freeInode(MyFSSuper *sb, unsigned int inodeNum) {
+	if(inodeNum < 1 || inodeNum > sb->numInodes){
+		return;
+	}
+	__metaLock(sb);
+	if(__bitmapGet(&sb->inodeMap, inodeNum - 1)){
+		__bitmapSet(&sb->inodeMap, inodeNum - 1, 0);
+		sb->freeInodes++;
+		sb->dirty = 1;
+	}
+	__metaUnlock(sb);
+}
+
+// Inicializa o contexto de mapa de blocos de um i-node
+void __bmapInit(BlockMap *bm, Inode *inode, MyFSSuper *sb) {
+	bm->inode = inode;
+	bm->sb = sb;
+	bm->addr[0] = bm->addr[1] = 0;
+	bm->dirty[0] = bm->dirty[1] = 0;
+	bm->data[0] = bm->data[1] = NULL;
+}
+
+// Grava o bloco indireto do nível indicado, se alterado
+int __bmapWriteBack(BlockMap *bm, int level) {
+	if(bm->dirty[level]){
+		if(__writeMetaBlock(bm->sb, bm->addr[level], bm->data[level]) < 0){
+			return -1;
+		}
+		bm->dirty[level] = 0;
+	}
+	return 0;
+}
+
+// Prepara o buffer do nível indicado para receber outro bloco indireto
+int __bmapEvict(BlockMap *bm, int level) {
+	if(__bmapWriteBack(bm, level) < 0){
+		return -1;
+	}
+	bm->addr[level] = 0;
+	if(!bm->data[level]){
+		bm->data[level] = malloc(bm->sb->blockBytes);
+		if(!bm->data[level]){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Carrega no nível indicado o bloco indireto de endereço addr
+int __bmapLoad(BlockMap *bm, int level, unsigned int addr) {
+	if(bm->addr[level] == addr){
+		return 0;
+	}
+	if(__bmapEvict(bm, level) < 0 ||
+	   __readBlock(bm->sb, addr, bm->data[level]) < 0){
+		return -1;
+	}
+	bm->addr[level] = addr;
+	return 0;
+}
+
+// Aloca um bloco indireto zerado e o carrega no nível indicado
+unsigned int __bmapNewIndirect(BlockMap *bm, int level) {
+	if(__bmapEvict(bm, level) < 0){
+		return 0;
+	}
+	unsigned int addr = __allocBlock(bm->sb);
+	if(addr == 0){
+		return 0;
+	}
+	memset(bm->data[level], 0, bm->sb->blockBytes);
+	bm->addr[level] = addr;
+	bm->dirty[level] = 1;
+	return addr;
+}
+
+// Garante que o bloco indireto carregado no nível indicado pertence só a
+// este i-node, trocando-o por uma cópia se for compartilhado. A cópia
+// acrescenta uma referência a cada bloco apontado. Retorna o endereço do
+// bloco, que muda se copiado e deve então ser gravado no pai, ou 0
+unsigned int __bmapUnshare(BlockMap *bm, int level) {
+
+	MyFSSuper *sb = bm->sb;
+	unsigned int old = bm->addr[level];
+	if(!__blockShared(sb, old)){
+		return old;
+	}
+
+	unsigned int addr = __allocBlock(sb);
+	if(addr == 0){
+		return 0;
+	}
+	for(unsigned int k = 0; k < sb->ptrsPerBlock; k++){
+		unsigned int child;
+		char2ul(&bm->data[level][k * sizeof(unsigned int)], &child);
+		if(__hasBlock(child) && __refBlock(sb, child) < 0){
+			// Desfaz as referências já acrescentadas
+			while(k-- > 0){
+				char2ul(&bm->data[level][k * sizeof(unsigned int)], &child);
+				if(__hasBlock(child)){
+					__freeBlock(sb, child);
+				}
+			}
+			__freeBlock(sb, addr);
+			return 0;
+		}
+	}
+
+	__freeBlock(sb, old);
+	bm->addr[level] = addr;
+	bm->dirty[level] = 1;
+	return addr;
+}
+
+// Retorna o endereço físico do bloco lógico blockNum, ou 0 se não mapeado
+unsigned int __bmapGet(BlockMap *bm, unsigned int blockNum) {
+
+	unsigned int addr;
+	unsigned int ptrs = bm->sb->ptrsPerBlock;
+
+	if(blockNum < MYFS_NDIRECT){
+		return inodeGetBlockAddr(bm->inode, blockNum);
+	}
+
+	blockNum -= MYFS_NDIRECT;
+	if(blockNum < ptrs){
+		unsigned int leaf = inodeGetBlockAddr(bm->inode, MYFS_SINDIRECT);
+		if(leaf == 0 || __bmapLoad(bm, 1, leaf) < 0){
+			return 0;
+		}
+		char2ul(&bm->data[1][blockNum * sizeof(unsigned int)], &addr);
+		return addr;
+	}
+
+	blockNum -= ptrs;
+	if(blockNum / ptrs >= ptrs){
+		return 0;
+	}
+
+	unsigned int root = inodeGetBlockAddr(bm->inode, MYFS_DINDIRECT);
+	if(root == 0 || __bmapLoad(bm, 0, root) < 0){
+		return 0;
+	}
+	unsigned int leaf;
+	char2ul(&bm->data[0][(blockNum / ptrs) * sizeof(unsigned int)], &leaf);
+	if(leaf == 0 || __bmapLoad(bm, 1, leaf) < 0){
+		return 0;
+	}
+	char2ul(&bm->data[1][(blockNum % ptrs) * sizeof(unsigned int)], &addr);
+	return addr;
+}
+
+// Retorna o próximo bloco lógico após blockNum que pode estar mapeado.
+// Blocos sob um bloco indireto inexistente são buracos e são pulados sem
+// consulta. Retorna UINT_MAX se nenhum bloco posterior pode estar mapeado
+unsigned int __bmapNextMapped(BlockMap *bm, unsigned int blockNum) {
+
+	unsigned int ptrs = bm->sb->ptrsPerBlock;
+	if(blockNum < MYFS_NDIRECT){
+		return blockNum + 1;
+	}
+
+	unsigned int rel = blockNum - MYFS_NDIRECT;
+	if(rel < ptrs){
+		if(inodeGetBlockAddr(bm->inode, MYFS_SINDIRECT) == 0){
+			return MYFS_NDIRECT + ptrs;
+		}
+		return blockNum + 1;
+	}
+
+	rel -= ptrs;
+	unsigned int root = inodeGetBlockAddr(bm->inode, MYFS_DINDIRECT);
+	if(rel / ptrs >= ptrs || root == 0 || __bmapLoad(bm, 0, root) < 0){
+		return UINT_MAX;
+	}
+	unsigned int leaf;
+	char2ul(&bm->data[0][(rel / ptrs) * sizeof(unsigned int)], &leaf);
+	if(leaf == 0){
+		return MYFS_NDIRECT + ptrs + (rel / ptrs + 1) * ptrs;
+	}
+	return blockNum + 1;
+}
+
+// Associa o bloco lógico blockNum ao endereço físico addr, alocando blocos
+// indiretos quando necessário. O i-node em si não é salvo aqui
+int __bmapSet(BlockMap *bm, unsigned int blockNum, unsigned int addr) {
+
+	unsigned int ptrs = bm->sb->ptrsPerBlock;
+
+	if(blockNum < MYFS_NDIRECT){
+		return inodeSetBlockAddr(bm->inode, blockNum, addr);
+	}
+
+	blockNum -= MYFS_NDIRECT;
+	if(blockNum < ptrs){
+		unsigned int leaf = inodeGetBlockAddr(bm->inode, MYFS_SINDIRECT);
+		if(leaf == 0){
+			leaf = __bmapNewIndirect(bm, 1);
+			if(leaf == 0){
+				return -1;
+			}
+			inodeSetBlockAddr(bm->inode, MYFS_SINDIRECT, leaf);
+		}
+		else{
+			unsigned int own;
+			if(__bmapLoad(bm, 1, leaf) < 0 || (own = __bmapUnshare(bm, 1)) == 0){
+				return -1;
+			}
+			inodeSetBlockAddr(bm->inode, MYFS_SINDIRECT, own);
+		}
+		ul2char(addr, &bm->data[1][blockNum * sizeof(unsigned int)]);
+		bm->dirty[1] = 1;
+		return 0;
+	}
+
+	blockNum -= ptrs;
+	if(blockNum / ptrs >= ptrs){
+		return -1; // Arquivo excede o tamanho máximo
+	}
+
+	unsigned int root = inodeGetBlockAddr(bm->inode, MYFS_DINDIRECT);
+	if(root == 0){
+		root = __bmapNewIndirect(bm, 0);
+		if(root == 0){
+			return -1;
+		}
+		inodeSetBlockAddr(bm->inode, MYFS_DINDIRECT, root);
+	}
+	else{
+		if(__bmapLoad(bm, 0, root) < 0 || (root = __bmapUnshare(bm, 0)) == 0){
+			return -1;
+		}
+		inodeSetBlockAddr(bm->inode, MYFS_DINDIRECT, root);
+	}
+
+	unsigned int slot = (blockNum / ptrs) * sizeof(unsigned int);
+	unsigned int leaf;
+	char2ul(&bm->data[0][slot], &leaf);
+	if(leaf == 0){
+		leaf = __bmapNewIndirect(bm, 1);
+		if(leaf == 0){
+			return -1;
+		}
+		ul2char(leaf, &bm->data[0][slot]);
+		bm->dirty[0] = 1;
+	}
+	else{
+		unsigned int own;
+		if(__bmapLoad(bm, 1, leaf) < 0 || (own = __bmapUnshare(bm, 1)) == 0){
+			return -1;
+		}
+		if(own != leaf){
+			ul2char(own, &bm->data[0][slot]);
+			bm->dirty[0] = 1;
+		}
+	}
+	ul2char(addr, &bm->data[1][(blockNum % ptrs) * sizeof(unsigned int)]);
+	bm->dirty[1] = 1;
+	return 0;
+}
+
+// Indica se o bloco lógico blockNum, de endereço físico addr, é
+// compartilhado, seja diretamente ou por estar sob um bloco indireto
+// compartilhado. Um bloco compartilhado não pode ser alterado no lugar
+int __bmapShared(BlockMap *bm, unsigned int blockNum, unsigned int addr) {
+
+	MyFSSuper *sb = bm->sb;
+	if(__blockShared(sb, addr)){
+		return 1;
+	}
+	if(blockNum < MYFS_NDIRECT){
+		return 0;
+	}
+
+	blockNum -= MYFS_NDIRECT;
+	if(blockNum < sb->ptrsPerBlock){
+		return __blockShared(sb, inodeGetBlockAddr(bm->inode, MYFS_SINDIRECT));
+	}
+
+	blockNum -= sb->ptrsPerBlock;
+	unsigned int root = inodeGetBlockAddr(bm->inode, MYFS_DINDIRECT);
+	if(__blockShared(sb, root)){
+		return 1;
+	}
+	unsigned int leaf = 0;
+	if(root != 0 && __bmapLoad(bm, 0, root) == 0){
+		char2ul(&bm->data[0][(blockNum / sb->ptrsPerBlock) * sizeof(unsigned int)], &leaf);
+	}
+	return __blockShared(sb, leaf);
+}
+
+// Associa o bloco lógico blockNum ao endereço addr, como __bmapSet, e
+// devolve a referência ao bloco que ele ocupava antes, se houver. Usada
+// na cópia na escrita de blocos de dados compartilhados
+int __bmapReplace(BlockMap *bm, unsigned int blockNum, unsigned int addr) {
+	unsigned int old = __bmapGet(bm, blockNum);
+	if(__bmapSet(bm, blockNum, addr) < 0){
+		return -1;
+	}
+	if(__hasBlock(old)){
+		__freeBlock(bm->sb, old);
+	}
+	return 0;
+}
+
+// Grava os blocos indiretos alterados e libera os buffers do contexto
+// Retorna 0 ou -1 em caso de falha
+int __bmapDone(BlockMap *bm) {
+	int ret = 0;
+	for(int level = 0; level < 2; level++){
+		if(bm->data[level] && __bmapWriteBack(bm, level) < 0){
+			ret = -1;
+		}
+		free(bm->data[level]);
+		bm->data[level] = NULL;
+		bm->addr[level] = 0;
+	}
+	return ret;
+}
+
+// Libera os blocos indiretos e de dados apontados por um bloco indireto
+// de endereço addr. depth 1 indica que as entradas apontam para dados.
+// Um bloco indireto compartilhado só perde a referência: os blocos que
+// ele aponta continuam em uso pelas outras cópias
+void __freeIndirect(MyFSSuper *sb, unsigned int addr, int depth) {
+	if(__blockShared(sb, addr)){
+		__freeBlock(sb, addr);
+		return;
+	}
+	unsigned char *data = malloc(sb->blockBytes);
+	if(data && __readBlock(sb, addr, data) == 0){
+		for(unsigned int k = 0; k < sb->ptrsPerBlock; k++){
+			unsigned int child;
+			char2ul(&data[k * sizeof(unsigned int)], &child);
+			if(!__hasBlock(child)){
+				continue;
+			}
+			if(depth > 1){
+				__freeIndirect(sb, child, depth - 1);
+			}
+			else{
+				__freeBlock(sb, child);
+			}
+		}
+	}
+	free(data);
+	__freeBlock(sb, addr);
+}
+
+// Devolve ao alocador todos os blocos de um i-node, e seu fragmento, e zera
+// seu mapa de blocos. O i-node não é salvo aqui
+void __freeInodeBlocks(MyFSSuper *sb, Inode *inode) {
+	if(__inodeTail(inode) != 0){
+		__freeBlock(sb, __fragBlock(sb, __inodeTail(inode)));
+		__setInodeTail(inode, 0);
+	}
+	for(unsigned int k = 0; k < MYFS_NDIRECT; k++){
+		unsigned int addr = inodeGetBlockAddr(inode, k);
+		if(__hasBlock(addr)){
+			__freeBlock(sb, addr);
+		}
+		inodeSetBlockAddr(inode, k, 0);
+	}
+	if(inodeGetBlockAddr(inode, MYFS_SINDIRECT) != 0){
+		__freeIndirect(sb, inodeGetBlockAddr(inode, MYFS_SINDIRECT), 1);
+	}
+	if(inodeGetBlockAddr(inode, MYFS_DINDIRECT) != 0){
+		__freeIndirect(sb, inodeGetBlockAddr(inode, MYFS_DINDIRECT), 2);
+	}
+	inodeSetBlockAddr(inode, MYFS_SINDIRECT, 0);
+	inodeSetBlockAddr(inode, MYFS_DINDIRECT, 0);
+}
+
+// Acrescenta uma referência a cada bloco apontado pelo próprio i-node e
+// ao bloco do seu fragmento. Retorna 0 ou -1, sem alterar nenhum
+// contador, em caso de falha
+int __refInodeBlocks(MyFSSuper *sb, Inode *inode){
+	unsigned int tail = __inodeTail(inode);
+	if(tail != 0 && __refBlock(sb, __fragBlock(sb, tail)) < 0){
+		return -1;
+	}
+	unsigned int numAddrs = inodeNumBlockAddresses();
+	for(unsigned int k = 0; k < numAddrs; k++){
+		unsigned int addr = inodeGetBlockAddr(inode, k);
+		if(__hasBlock(addr) && __refBlock(sb, addr) < 0){
+			// Desfaz as referências já acrescentadas
+			while(k-- > 0){
+				if(__hasBlock(inodeGetBlockAddr(inode, k))){
+					__freeBlock(sb, inodeGetBlockAddr(inode, k));
+				}
+			}
+			if(tail != 0){
+				__freeBlock(sb, __fragBlock(sb, tail));
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Lê para record o registro do i-node inodeNum na tabela do snapshot snap.
+// Retorna 1 se o snapshot preserva uma versão do i-node, 0 se não, ou -1
+int __snapReadRecord(MyFSSuper *sb, unsigned int snap, unsigned int inodeNum, unsigned char *record){
+
+	unsigned int size = inodeRecordSize();
+	unsigned long pos = (unsigned long)(inodeNum - 1) * size;
+	Inode *table = __loadInode(sb, sb->snaps[snap - 1].table);
+	unsigned char *block = malloc(sb->blockBytes);
+	int ret = -1;
+	if(!table || !block){
+		goto out;
+	}
+
+	ret = 0;
+	BlockMap bm;
+	__bmapInit(&bm, table, sb);
+	unsigned int addr = pos < inodeGetFileSize(table) ? __bmapGet(&bm, pos / sb->blockBytes) : 0;
+	if(addr != 0){
+		if(__readBlock(sb, addr, block) < 0){
+			ret = -1;
+		}
+		else{
+			// Registros preservados têm o número do i-node: nunca são nulos
+			memcpy(record, block + pos % sb->blockBytes, size);
+			for(unsigned int k = 0; k < size && ret == 0; k++){
+				ret = record[k] != 0;
+			}
+		}
+	}
+	__bmapDone(&bm);
+
+out:
+	free(block);
+	free(table);
+	return ret;
+}
+
+// Grava record como registro do i-node inodeNum na tabela do snapshot
+// snap, alocando o bloco da tabela se necessário. Retorna 0 ou -1
+int __snapWriteRecord(MyFSSuper *sb, unsigned int snap, unsigned int inodeNum, unsigned char *record){
+
+	unsigned int size = inodeRecordSize();
+	unsigned long pos = (unsigned long)(inodeNum - 1) * size;
+	unsigned int lblk = pos / sb->blockBytes;
+	Inode *table = __loadInode(sb, sb->snaps[snap - 1].table);
+	unsigned char *block = malloc(sb->blockBytes);
+	int ret = -1;
+	if(!table || !block){
+		goto out;
+	}
+
+	BlockMap bm;
+	__bmapInit(&bm, table, sb);
+	unsigned int addr = pos < inodeGetFileSize(table) ? __bmapGet(&bm, lblk) : 0;
+	if(addr == 0){
+		memset(block, 0, sb->blockBytes);
+		addr = __allocBlock(sb);
+		if(addr != 0 && __bmapSet(&bm, lblk, addr) < 0){
+			__freeBlock(sb, addr);
+			addr = 0;
+		}
+	}
+	else if(__readBlock(sb, addr, block) < 0){
+		addr = 0;
+	}
+
+	if(addr != 0){
+		memcpy(block + pos % sb->blockBytes, record, size);
+		ret = __writeMetaBlock(sb, addr, block);
+	}
+	if(__bmapDone(&bm) < 0){
+		ret = -1;
+	}
+	if(ret == 0 && pos + size > inodeGetFileSize(table)){
+		// A tabela cresce até o último registro (a área antes é buraco)
+		inodeSetFileSize(table, (lblk + 1) * sb->blockBytes);
+	}
+	if(ret == 0){
+		ret = __saveInode(sb, table);
+	}
+
+out:
+	free(block);
+	free(table);
+	return ret;
+}
+
+// Carrega a versão do i-node inodeNum vista pelo snapshot snap: a
+// preservada nele ou em um snapshot posterior, ou a atual. Retorna NULL
+// em caso de falha
+Inode *__snapLoadInode(MyFSSuper *sb, unsigned int snap, unsigned int inodeNum){
+
+	unsigned char *record = malloc(inodeRecordSize());
+	if(!record){
+		return NULL;
+	}
+
+	Inode *inode = NULL;
+	int found = 0;
+	for(unsigned int id = snap; id <= sb->numSnaps && !found; id++){
+		found = __snapReadRecord(sb, id, inodeNum, record);
+		if(found < 0){
+			free(record);
+			return NULL;
+		}
+	}
+
+	inode = found ? inodeDecode(inodeNum, sb->d, record) : __loadInode(sb, inodeNum);
+	free(record);
+	return inode;
+}
+
+// Preserva no snapshot mais recente a versão atual do i-node inodeNum,
+// como gravada no disco, se ainda não preservada. Deve ser chamada antes
+// da primeira alteração do i-node, ou dos seus blocos, desde o snapshot.
+// Retorna 0 ou -1
+int __snapPreserve(MyFSSuper *sb, unsigned int inodeNum){
+
+	if(sb->numSnaps == 0){
+		return 0;
+	}
+
+	unsigned char *record = malloc(inodeRecordSize());
+	Inode *inode = NULL;
+	int ret = -1;
+	if(!record){
+		goto out;
+	}
+
+	int found = __snapReadRecord(sb, sb->numSnaps, inodeNum, record);
+	if(found != 0){
+		ret = found < 0 ? -1 : 0;
+		goto out;
+	}
+
+	inode = __loadInode(sb, inodeNum);
+	if(!inode){
+		goto out;
+	}
+	if(inodeGetFileType(inode) == MYFS_FILETYPE_SNAPTABLE){
+		ret = 0; // Tabelas de snapshot não fazem parte da árvore
+		goto out;
+	}
+
+	// A versão preservada passa a referenciar os blocos do i-node
+	if(__refInodeBlocks(sb, inode) < 0){
+		goto out;
+	}
+	inodeEncode(inode, record);
+	ret = __snapWriteRecord(sb, sb->numSnaps, inodeNum, record);
+	if(ret < 0){
+		__freeInodeBlocks(sb, inode);
+	}
+
+out:
+	free(inode);
+	free(record);
+	return ret;
+}
+
+// Indica se os dados do arquivo aberto oi são gravados comprimidos
+int __compressed(MyOpenInode *oi){
+	return inodeGetFileType(oi->inode) == FILETYPE_REGULAR &&
+	       (__inodeFlags(oi->inode) & VFS_FLAG_COMPRESS);
+}
+
+// Indica se os blocos gravados pelo arquivo aberto oi são deduplicados
+int __deduplicated(MyOpenInode *oi){
+	return inodeGetFileType(oi->inode) == FILETYPE_REGULAR && !__compressed(oi) &&
+	       (__inodeFlags(oi->inode) & VFS_FLAG_DEDUP);
+}
+
+// Lê para data os count blocos de endereços addrs, com uma única
+// transferência para cada sequência contígua no disco. Buracos são lidos
+// como zeros. Retorna 0 ou -1
+int __readAddrs(MyFSSuper *sb, const unsigned int *addrs, unsigned int count, unsigned char *data){
+	for(unsigned int k = 0; k < count; ){
+		unsigned char *dest = data + (unsigned long)k * sb->blockBytes;
+		if(!__hasBlock(addrs[k])){
+			memset(dest, 0, sb->blockBytes);
+			k++;
+			continue;
+		}
+		unsigned int run = 1;
+		while(k + run < count && addrs[k + run] == addrs[k] + run * sb->sectorsPerBlock){
+			run++;
+		}
+		if(__readBlocks(sb, addrs[k], run, dest) < 0){
+			return -1;
+		}
+		k += run;
+	}
+	return 0;
+}
+
+// Lê para data (clusterBlocks blocos) o conteúdo do cluster que começa no
+// bloco lógico first de um arquivo de tamanho size, descomprimindo-o se
+// preciso. Buracos e o que passa do fim do arquivo são lidos como zeros.
+// Retorna 0 ou -1
+int __loadCluster(MyFSSuper *sb, BlockMap *bm, unsigned int first, unsigned int size, unsigned char *data){
+
+	unsigned int clusterBytes = sb->clusterBlocks * sb->blockBytes;
+	unsigned int addrs[MYFS_MAX_CLUSTERBLOCKS];
+	unsigned int stored = 0;
+	int compressed = 0;
+
+	memset(data, 0, clusterBytes);
+	if((unsigned long)first * sb->blockBytes >= size){
+		return 0;
+	}
+	for(unsigned int k = 0; k < sb->clusterBlocks; k++){
+		addrs[k] = __bmapGet(bm, first + k);
+		if(addrs[k] == MYFS_ZBLOCK){
+			compressed = 1;
+		}
+		else if(addrs[k] != 0 && !compressed){
+			stored = k + 1;
+		}
+	}
+	if(!compressed){
+		return __readAddrs(sb, addrs, sb->clusterBlocks, data);
+	}
+
+	// Os blocos com os dados comprimidos vêm antes dos marcados
+	unsigned int storedBytes = stored * sb->blockBytes;
+	unsigned char *z = stored ? malloc(storedBytes) : NULL;
+	unsigned int rawLen, zLen;
+	int ret = -1;
+	if(z && __readAddrs(sb, addrs, stored, z) == 0){
+		char2ul(z, &rawLen);
+		char2ul(z + sizeof(unsigned int), &zLen);
+		if(rawLen <= clusterBytes && zLen <= storedBytes - MYFS_ZHEADER &&
+		   lzDecompress(z + MYFS_ZHEADER, zLen, data, rawLen) == (int)rawLen){
+			ret = 0;
+		}
+	}
+	free(z);
+	return ret;
+}
+
+// Busca a posição do bloco blockNum entre os blocos sujos de um i-node
+// aberto. Retorna o índice, se presente, ou -1 com a posição de inserção
+// escrita em *pos
+int __findDirty(MyOpenInode *oi, unsigned int blockNum, unsigned int *pos){
+
+	unsigned int lo = 0, hi = oi->numDirty;
+
+	while(lo < hi){
+		unsigned int mid = (lo + hi) / 2;
+		if(oi->dirty[mid].blockNum < blockNum){
+			lo = mid + 1;
+		}
+		else{
+			hi = mid;
+		}
+	}
+
+	*pos = lo;
+	if(lo < oi->numDirty && oi->dirty[lo].blockNum == blockNum){
+		return lo;
+	}
+	return -1;
+}
+
+// Garante espaço para mais count blocos sujos no i-node aberto oi.
+// Retorna 0 ou -1
+int __reserveDirty(MyOpenInode *oi, unsigned int count){
+	if(oi->numDirty + count <= oi->capDirty){
+		return 0;
+	}
+	unsigned int cap = oi->capDirty ? 2 * oi->capDirty : 16;
+	while(cap < oi->numDirty + count){
+		cap *= 2;
+	}
+	DirtyBlock *dirty = realloc(oi->dirty, cap * sizeof(DirtyBlock));
+	if(!dirty){
+		return -1;
+	}
+	oi->dirty = dirty;
+	oi->capDirty = cap;
+	return 0;
+}
+
+// Insere o bloco sujo blockNum, de conteúdo data, na posição pos dos
+// blocos sujos de oi, que já deve ter espaço reservado
+void __insertDirty(MyOpenInode *oi, unsigned int pos, unsigned int blockNum, unsigned char *data){
+	memmove(&oi->dirty[pos + 1], &oi->dirty[pos],
+	        (oi->numDirty - pos) * sizeof(DirtyBlock));
+	oi->dirty[pos].blockNum = blockNum;
+	oi->dirty[pos].data = data;
+	pthread_mutex_lock(&tableLock);
+	oi->numDirty++;
+	oi->sb->dirtyBytes += oi->sb->blockBytes;
+	dirtyBytesTotal += oi->sb->blockBytes;
+	if(dirtyBytesTotal > MYFS_DIRTY_BACKGROUND){
+		pthread_cond_signal(&oi->sb->flushWake);
+	}
+	pthread_mutex_unlock(&tableLock);
+}
+
+// Como __getDirtyBlock, para arquivos comprimidos, cujos clusters só são
+// gravados inteiros: o cluster do bloco blockNum vai todo para a memória,
+// com o seu conteúdo atual. Assim, um cluster nunca tem só parte dos seus
+// blocos sujos. Retorna o buffer do bloco ou NULL
+unsigned char *__getDirtyCluster(MyOpenInode *oi, BlockMap *bm, unsigned int blockNum){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int first = blockNum - blockNum % sb->clusterBlocks;
+	unsigned char *blocks[MYFS_MAX_CLUSTERBLOCKS];
+	unsigned char *cluster = malloc(sb->clusterBlocks * sb->blockBytes);
+	unsigned int k = 0;
+
+	if(cluster && __reserveDirty(oi, sb->clusterBlocks) == 0 &&
+	   __loadCluster(sb, bm, first, oi->size, cluster) == 0){
+		for(; k < sb->clusterBlocks && (blocks[k] = malloc(sb->blockBytes)); k++){
+			memcpy(blocks[k], cluster + k * sb->blockBytes, sb->blockBytes);
+		}
+	}
+	free(cluster);
+	if(k < sb->clusterBlocks){
+		while(k-- > 0){
+			free(blocks[k]);
+		}
+		return NULL;
+	}
+
+	for(k = 0; k < sb->clusterBlocks; k++){
+		unsigned int pos;
+		__findDirty(oi, first + k, &pos);
+		__insertDirty(oi, pos, first + k, blocks[k]);
+	}
+	return blocks[blockNum - first];
+}
+
+// Retorna o buffer em memória do bloco blockNum, criando-o se necessário.
+// Quando criado com fill != 0, o conteúdo atual do bloco é lido do disco
+// (se o bloco já existir); caso contrário o buffer começa zerado
+unsigned char *__getDirtyBlock(MyOpenInode *oi, BlockMap *bm, unsigned int blockNum, int fill){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int pos;
+	int idx = __findDirty(oi, blockNum, &pos);
+	oi->gen++; // O chamador vai alterar o bloco
+	if(idx >= 0){
+		return oi->dirty[idx].data;
+	}
+	if(__compressed(oi)){
+		return __getDirtyCluster(oi, bm, blockNum);
+	}
+
+	if(__reserveDirty(oi, 1) < 0){
+		return NULL;
+	}
+
+	unsigned char *data = malloc(sb->blockBytes);
+	if(!data){
+		return NULL;
+	}
+
+	unsigned int addr = 0;
+	if(fill && (unsigned long)blockNum * sb->blockBytes < oi->size){
+		addr = __bmapGet(bm, blockNum);
+	}
+	if(addr == 0){
+		memset(data, 0, sb->blockBytes);
+	}
+	else if(__readBlock(sb, addr, data) < 0){
+		free(data);
+		return NULL;
+	}
+
+	__insertDirty(oi, pos, blockNum, data);
+	return data;
+}
+
+// Libera os blocos sujos de um i-node aberto sem gravá-los
+void __discardDirty(MyOpenInode *oi){
+	for(unsigned int i = 0; i < oi->numDirty; i++){
+		free(oi->dirty[i].data);
+	}
+	pthread_mutex_lock(&tableLock);
+	oi->sb->dirtyBytes -= oi->numDirty * oi->sb->blockBytes;
+	dirtyBytesTotal -= oi->numDirty * oi->sb->blockBytes;
+	oi->numDirty = 0;
+	pthread_cond_broadcast(&dirtyCond);
+	pthread_mutex_unlock(&tableLock);
+}
+
+// Indica se o bloco lógico blockNum, de endereço físico addr, precisa de
+// um novo endereço para ser gravado: ainda não mapeado, compartilhado ou
+// no índice de impressões
+int __needsNewBlock(BlockMap *bm, unsigned int blockNum, unsigned int addr){
+	return addr == 0 || __bmapShared(bm, blockNum, addr) || __blockPrinted(bm->sb, addr);
+}
+
+// Indica se o bloco de endereço addr guarda o conteúdo data. A impressão
+// digital não é criptográfica, então blocos de mesma impressão são
+// comparados antes de serem compartilhados. Sem memória, responde que não
+int __sameContent(MyFSSuper *sb, unsigned int addr, const unsigned char *data){
+	unsigned char *block = malloc(sb->blockBytes);
+	int same = block && __readBlock(sb, addr, block) == 0 &&
+	           memcmp(block, data, sb->blockBytes) == 0;
+	free(block);
+	return same;
+}
+
+// Grava o bloco lógico blockNum de um arquivo com deduplicação, de
+// conteúdo data. Um bloco zerado vira buraco, e um conteúdo já presente no
+// índice de impressões passa a ser compartilhado, sem escrita. Senão, o
+// bloco é gravado e registrado no índice. Retorna 0 ou -1
+int __dedupBlock(MyOpenInode *oi, BlockMap *bm, unsigned int blockNum, unsigned char *data){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int addr = __bmapGet(bm, blockNum);
+	if(__isZero(data, sb->blockBytes)){
+		return addr != 0 ? __bmapReplace(bm, blockNum, 0) : 0;
+	}
+
+	unsigned char print[MYFS_PRINT_BYTES];
+	__fingerprint(data, sb->blockBytes, print);
+	// A busca, a conferência e a nova referência são feitas juntas: outro
+	// arquivo não pode liberar o bloco achado entre elas
+	__metaLock(sb);
+	unsigned int found = __printsFind(&sb->blockPrints, print);
+	unsigned int dup = found != MYFS_NOPRINT ? __blockAddr(sb, found) : 0;
+	if(dup != 0 && !__sameContent(sb, dup, data)){
+		dup = 0; // Colisão da impressão: o conteúdo ganha uma nova cópia
+	}
+	int shared = dup != 0 && dup != addr && __refBlock(sb, dup) == 0;
+	__metaUnlock(sb);
+	if(dup != 0 && dup == addr){
+		return 0; // O bloco já guarda esse conteúdo
+	}
+	if(shared){
+		if(__bmapReplace(bm, blockNum, dup) < 0){
+			__freeBlock(sb, dup);
+			return -1;
+		}
+		return 0;
+	}
+	// Sem cópia no índice ou com o contador dela no limite, o conteúdo
+	// ganha uma nova cópia
+
+	if(__needsNewBlock(bm, blockNum, addr)){
+		addr = __allocBlock(sb);
+		if(addr == 0){
+			return -1;
+		}
+		if(__writeBlock(sb, addr, data) < 0 || __bmapReplace(bm, blockNum, addr) < 0){
+			__freeBlock(sb, addr);
+			return -1;
+		}
+	}
+	else if(__writeBlock(sb, addr, data) < 0){
+		return -1;
+	}
+	__metaLock(sb);
+	__printsAdd(&sb->blockPrints, __blockIndex(sb, addr), print);
+	__metaUnlock(sb);
+	return 0;
+}
+
+// Grava os blocos sujos de um i-node aberto. Só aqui os blocos novos
+// recebem endereço físico: cada sequência de blocos lógicos consecutivos
+// ainda sem endereço, ou compartilhados com um clone, é alocada de uma
+// vez, de forma contígua. Com deduplicação, cada bloco é tratado por
+// __dedupBlock. Retorna 0 ou -1
+int __flushBlocks(MyOpenInode *oi, BlockMap *bm){
+
+	MyFSSuper *sb = oi->sb;
+	int dedup = __deduplicated(oi);
+	int ret = 0;
+
+	unsigned int i = 0;
+	while(i < oi->numDirty && ret == 0){
+		unsigned int blockNum = oi->dirty[i].blockNum;
+		unsigned int addr = __bmapGet(bm, blockNum);
+
+		if(dedup){
+			ret = __dedupBlock(oi, bm, blockNum, oi->dirty[i].data);
+			i++;
+			continue;
+		}
+
+		if(!__needsNewBlock(bm, blockNum, addr)){
+			// Bloco já existente e exclusivo: sobrescrita no mesmo lugar
+			if(__writeBlock(sb, addr, oi->dirty[i].data) < 0){
+				ret = -1;
+			}
+			i++;
+			continue;
+		}
+
+		// Conta os blocos consecutivos que também precisam de endereço
+		unsigned int run = 1;
+		while(i + run < oi->numDirty &&
+		      oi->dirty[i + run].blockNum == blockNum + run &&
+		      __needsNewBlock(bm, blockNum + run, __bmapGet(bm, blockNum + run))){
+			run++;
+		}
+
+		while(run > 0 && ret == 0){
+			unsigned int got;
+			unsigned int first = __allocBlocks(sb, run, &got);
+			if(first == 0){
+				ret = -1;
+				break;
+			}
+			for(unsigned int k = 0; k < got; k++, i++){
+				unsigned int blockAddr = first + k * sb->sectorsPerBlock;
+				if(__writeBlock(sb, blockAddr, oi->dirty[i].data) < 0 ||
+				   __bmapReplace(bm, oi->dirty[i].blockNum, blockAddr) < 0){
+					ret = -1;
+					break;
+				}
+			}
+			run -= got;
+		}
+	}
+
+	return ret;
+}
+
+// Grava no arquivo aberto oi o cluster que começa no bloco lógico first,
+// cujo conteúdo está em data, com len bytes antes do fim do arquivo. Se
+// comprimido o cluster ocupar menos blocos, ele vai para uma sequência
+// contígua de blocos novos. Senão, é gravado como está: blocos exclusivos
+// são sobrescritos no lugar e blocos zerados viram buracos. Os blocos que
+// o cluster deixa de usar são devolvidos. z é uma área de trabalho do
+// tamanho do cluster. Retorna 0 ou -1
+int __writeCluster(MyOpenInode *oi, BlockMap *bm, unsigned int first,
+                   unsigned char *data, unsigned int len, unsigned char *z){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int bb = sb->blockBytes;
+	unsigned int used = (len + bb - 1) / bb;	// Blocos com dados
+	unsigned int need = used;			// Blocos se comprimido
+
+	if(used > 1){
+		unsigned int zLen = lzCompress(data, len, z + MYFS_ZHEADER,
+		                               (used - 1) * bb - MYFS_ZHEADER);
+		if(zLen > 0){
+			need = (MYFS_ZHEADER + zLen + bb - 1) / bb;
+			ul2char(len, z);
+			ul2char(zLen, z + sizeof(unsigned int));
+			memset(z + MYFS_ZHEADER + zLen, 0, need * bb - MYFS_ZHEADER - zLen);
+		}
+	}
+
+	if(need < used){
+		unsigned int got;
+		unsigned int addr = __allocBlocks(sb, need, &got);
+		if(addr != 0 && got == need){
+			if(__writeBlocks(sb, addr, need, z) < 0){
+				for(unsigned int k = 0; k < need; k++){
+					__freeBlock(sb, addr + k * sb->sectorsPerBlock);
+				}
+				return -1;
+			}
+			for(unsigned int k = 0; k < sb->clusterBlocks; k++){
+				if(__bmapReplace(bm, first + k, k < need ? addr + k * sb->sectorsPerBlock : MYFS_ZBLOCK) < 0){
+					return -1;
+				}
+			}
+			return 0;
+		}
+		// Sem espaço contíguo para o cluster comprimido: vai como está
+		for(unsigned int k = 0; k < got; k++){
+			__freeBlock(sb, addr + k * sb->sectorsPerBlock);
+		}
+	}
+
+	for(unsigned int k = 0; k < sb->clusterBlocks; ){
+		unsigned char *block = data + k * bb;
+		unsigned int old = __bmapGet(bm, first + k);
+		if(k >= used || __isZero(block, bb)){
+			if(old != 0 && __bmapReplace(bm, first + k, 0) < 0){
+				return -1;
+			}
+			k++;
+			continue;
+		}
+		if(__hasBlock(old) && !__needsNewBlock(bm, first + k, old)){
+			if(__writeBlock(sb, old, block) < 0){
+				return -1;
+			}
+			k++;
+			continue;
+		}
+
+		// Sequência de blocos com dados que precisam de endereço novo
+		unsigned int run = 1;
+		while(k + run < used && !__isZero(block + run * bb, bb)){
+			unsigned int next = __bmapGet(bm, first + k + run);
+			if(__hasBlock(next) && !__needsNewBlock(bm, first + k + run, next)){
+				break;
+			}
+			run++;
+		}
+		unsigned int addr = __allocBlocks(sb, run, &run);
+		if(addr == 0 || __writeBlocks(sb, addr, run, block) < 0){
+			for(unsigned int j = 0; j < run; j++){
+				__freeBlock(sb, addr + j * sb->sectorsPerBlock);
+			}
+			return -1;
+		}
+		for(unsigned int j = 0; j < run; j++, k++){
+			if(__bmapReplace(bm, first + k, addr + j * sb->sectorsPerBlock) < 0){
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// Grava os blocos sujos de um arquivo comprimido, um cluster por vez.
+// Cada cluster sujo está inteiro na memória. Retorna 0 ou -1
+int __flushClusters(MyOpenInode *oi, BlockMap *bm){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int clusterBytes = sb->clusterBlocks * sb->blockBytes;
+	unsigned char *data = malloc(2 * clusterBytes);
+	if(!data){
+		return -1;
+	}
+
+	int ret = 0;
+	unsigned int i = 0;
+	while(i < oi->numDirty && ret == 0){
+		unsigned int first = oi->dirty[i].blockNum - oi->dirty[i].blockNum % sb->clusterBlocks;
+		memset(data, 0, clusterBytes);
+		for(; i < oi->numDirty && oi->dirty[i].blockNum < first + sb->clusterBlocks; i++){
+			memcpy(data + (oi->dirty[i].blockNum - first) * sb->blockBytes,
+			       oi->dirty[i].data, sb->blockBytes);
+		}
+
+		unsigned long start = (unsigned long)first * sb->blockBytes;
+		unsigned int len = 0;
+		if(start < oi->size){
+			len = oi->size - start < clusterBytes ? oi->size - start : clusterBytes;
+		}
+		ret = __writeCluster(oi, bm, first, data, len, data + clusterBytes);
+	}
+
+	free(data);
+	return ret;
+}
+
+// Descarrega os blocos sujos de um i-node aberto, alocando os blocos
+// novos, e atualiza o tamanho do arquivo no i-node uma única vez.
+// Retorna 0 ou -1
+int __flushOpenInode(MyOpenInode *oi){
+
+	MyFSSuper *sb = oi->sb;
+	if(oi->snap){
+		return 0; // Versões de snapshots nunca são alteradas
+	}
+
+	BlockMap bm;
+	__bmapInit(&bm, oi->inode, sb);
+	int ret = __compressed(oi) ? __flushClusters(oi, &bm) : __flushBlocks(oi, &bm);
+
+	if(__bmapDone(&bm) < 0){
+		ret = -1;
+	}
+	if(ret == 0){
+		__discardDirty(oi);
+		inodeSetFileSize(oi->inode, oi->size);
+	}
+
+	if(__saveInode(sb, oi->inode) < 0){
+		ret = -1;
+	}
+	return ret;
+}
+
+// Quando os descarregadores não dão conta da pressão de memória, descarrega
+// o i-node aberto com mais blocos sujos até que o total volte ao limite.
+// Chamada sem travas: um i-node em uso por outra operação não é esperado,
+// e a descarga para
+void __relieveMemoryPressure(void){
+	for(;;){
+		MyOpenInode *victim = NULL;
+		pthread_mutex_lock(&tableLock);
+		for(unsigned int i = 0; i < numInodeSlots && dirtyBytesTotal > MYFS_MAX_DIRTY_BYTES; i++){
+			MyOpenInode *oi = __openInodeAt(i);
+			if(oi->refs > 0 && oi->numDirty > 0 && (!victim ||
+			   oi->numDirty * oi->sb->blockBytes > victim->numDirty * victim->sb->blockBytes)){
+				victim = oi;
+			}
+		}
+		// Com o disco travado, o i-node escolhido não pode ser fechado
+		if(victim && pthread_rwlock_tryrdlock(&victim->sb->lock) != 0){
+			victim = NULL;
+		}
+		if(victim && pthread_rwlock_trywrlock(&victim->lock) != 0){
+			pthread_rwlock_unlock(&victim->sb->lock);
+			victim = NULL;
+		}
+		pthread_mutex_unlock(&tableLock);
+		if(!victim){
+			return;
+		}
+
+		MyFSSuper *sb = victim->sb;
+		int ret = __flushOpenInode(victim);
+		pthread_rwlock_unlock(&victim->lock);
+		pthread_rwlock_unlock(&sb->lock);
+		if(ret < 0){
+			return;
+		}
+	}
+}
+
+// Retorna a versão do snapshot snap (0 = atual) do i-node aberto de
+// número inodeNum, sem tomar referência, ou NULL
+MyOpenInode *__findOpenInode(MyFSSuper *sb, unsigned int snap, unsigned int inodeNum){
+	unsigned int i = openInodeHash[__openInodeBucket(snap, inodeNum)];
+	while(i != 0){
+		MyOpenInode *oi = __openInodeAt(i - 1);
+		if(oi->sb == sb && oi->snap == snap && inodeGetNumber(oi->inode) == inodeNum){
+			return oi;
+		}
+		i = oi->next;
+	}
+	return NULL;
+}
+
+// Retira o i-node aberto oi, que deixou de ser usado, do índice e o devolve
+// à lista de entradas livres
+void __unlinkOpenInode(MyOpenInode *oi){
+	unsigned int *link = &openInodeHash[__openInodeBucket(oi->snap, inodeGetNumber(oi->inode))];
+	while(*link != oi->slot + 1){
+		link = &__openInodeAt(*link - 1)->next;
+	}
+	*link = oi->next;
+	oi->next = freeOpenInodes;
+	freeOpenInodes = oi->slot + 1;
+}
+
+// Obtém a versão do snapshot snap (0 = atual) do i-node aberto
+// correspondente a inodeNum, carregando-a do disco se ainda não estiver
+// aberta. Retorna NULL em caso de falha
+MyOpenInode *__getSnapInode(MyFSSuper *sb, unsigned int snap, unsigned int inodeNum){
+
+	pthread_mutex_lock(&tableLock);
+	MyOpenInode *oi = __findOpenInode(sb, snap, inodeNum);
+	if(oi){
+		oi->refs++;
+	}
+	int full = !oi && freeOpenInodes == 0 && __growOpenInodes() < 0;
+	pthread_mutex_unlock(&tableLock);
+	if(oi || full){
+		return oi;
+	}
+
+	Inode *inode = snap ? __snapLoadInode(sb, snap, inodeNum) : __loadInode(sb, inodeNum);
+	RangeLock *ioRanges = rangeLockCreate();
+	RangeLock *locks = rangeLockCreate();
+	if(!inode || !ioRanges || !locks){
+		free(inode);
+		rangeLockDestroy(ioRanges);
+		rangeLockDestroy(locks);
+		return NULL;
+	}
+
+	// A carga pode ter usado entradas livres: a lista é consultada agora
+	pthread_mutex_lock(&tableLock);
+	if(freeOpenInodes == 0 && __growOpenInodes() < 0){
+		pthread_mutex_unlock(&tableLock);
+		free(inode);
+		rangeLockDestroy(ioRanges);
+		rangeLockDestroy(locks);
+		return NULL;
+	}
+	MyOpenInode *freeSlot = __openInodeAt(freeOpenInodes - 1);
+	freeOpenInodes = freeSlot->next;
+	unsigned int bucket = __openInodeBucket(snap, inodeNum);
+	freeSlot->next = openInodeHash[bucket];
+	openInodeHash[bucket] = freeSlot->slot + 1;
+
+	freeSlot->refs = 1;
+	freeSlot->sb = sb;
+	freeSlot->inode = inode;
+	freeSlot->size = inodeGetFileSize(inode);
+	freeSlot->dirty = NULL;
+	freeSlot->numDirty = 0;
+	freeSlot->capDirty = 0;
+	freeSlot->gen = 0;
+	freeSlot->snap = snap;
+	freeSlot->cowGen = 0;
+	freeSlot->parent = 0;
+	freeSlot->ioRanges = ioRanges;
+	freeSlot->locks = locks;
+	freeSlot->closed = 0;
+	pthread_mutex_unlock(&tableLock);
+	return freeSlot;
+}
+
+// Obtém o i-node aberto correspondente a inodeNum, na versão atual
+MyOpenInode *__getOpenInode(MyFSSuper *sb, unsigned int inodeNum){
+	return __getSnapInode(sb, 0, inodeNum);
+}
+
+// Prepara o i-node aberto oi para ser alterado, preservando sua versão
+// anterior no snapshot mais recente na primeira alteração desde que ele
+// foi tirado. Versões de snapshots são somente leitura. Retorna 0 ou -1
+int __cowInode(MyOpenInode *oi){
+	MyFSSuper *sb = oi->sb;
+	if(oi->snap){
+		return -1;
+	}
+	// As tabelas dos snapshots são de todos os arquivos
+	int ret = 0;
+	__metaLock(sb);
+	if(oi->cowGen != sb->snapGen){
+		ret = __snapPreserve(sb, inodeGetNumber(oi->inode));
+		if(ret == 0){
+			oi->cowGen = sb->snapGen;
+		}
+	}
+	__metaUnlock(sb);
+	return ret < 0 ? -1 : 0;
+}
+
+// Retorna o número do bloco lógico guardado no fragmento do arquivo
+// aberto oi, ou UINT_MAX se o arquivo não tiver fragmento
+unsigned int __tailBlock(MyOpenInode *oi){
+	if(__inodeTail(oi->inode) == 0){
+		return UINT_MAX;
+	}
+	return (oi->size - 1) / oi->sb->blockBytes;
+}
+
+// Lê count setores a partir de sector para data, considerando o diário.
+// Retorna 0 ou -1
+int __readSectors(MyFSSuper *sb, unsigned int sector, unsigned int count, unsigned char *data){
+	int ret = sb->journal ? journalRead(sb->journal, sector, count, data) :
+	                        diskReadSectors(sb->d, sector, count, data);
+	return ret < 0 ? -1 : 0;
+}
+
+// __readFragment com metaLock já obtido
+int __readFragmentLocked(MyFSSuper *sb, unsigned int frag, unsigned int len, unsigned char *data){
+
+	unsigned int sector = __fragSector(frag);
+	unsigned int block = __fragBlock(sb, frag);
+	unsigned int pos = (sector - block) * DISK_SECTORDATASIZE + __fragOffset(frag);
+	for(unsigned int g = 0; g < MYFS_FRAG_GROUPS; g++){
+		if(sb->fragGroups[g].addr == block){
+			memcpy(data, sb->fragGroups[g].data + pos, len);
+			return 0;
+		}
+	}
+
+	unsigned int count = (__fragOffset(frag) + len + DISK_SECTORDATASIZE - 1) / DISK_SECTORDATASIZE;
+	if(sb->fragCacheCount > 0 && sector >= sb->fragCacheStart &&
+	   sector + count <= sb->fragCacheStart + sb->fragCacheCount){
+		memcpy(data, sb->fragCache + (sector - sb->fragCacheStart) * DISK_SECTORDATASIZE +
+		       __fragOffset(frag), len);
+		return 0;
+	}
+
+	if(!sb->fragCache){
+		sb->fragCache = malloc(MYFS_FRAG_READAHEAD * DISK_SECTORDATASIZE);
+	}
+	unsigned int ahead = MYFS_FRAG_READAHEAD;
+	if(ahead > diskGetNumSectors(sb->d) - sector){
+		ahead = diskGetNumSectors(sb->d) - sector;
+	}
+	if(!sb->fragCache || count > ahead){
+		// Fragmento maior que a leitura antecipada: só os seus setores
+		unsigned char *sectors = malloc(count * DISK_SECTORDATASIZE);
+		if(!sectors){
+			return -1;
+		}
+		int ret = __readSectors(sb, sector, count, sectors);
+		if(ret == 0){
+			memcpy(data, sectors + __fragOffset(frag), len);
+		}
+		free(sectors);
+		return ret;
+	}
+
+	sb->fragCacheCount = 0;
+	if(__readSectors(sb, sector, ahead, sb->fragCache) < 0){
+		return -1;
+	}
+	sb->fragCacheStart = sector;
+	sb->fragCacheCount = ahead;
+	memcpy(data, sb->fragCache + __fragOffset(frag), len);
+	return 0;
+}
+
+// Lê para data os len bytes do fragmento frag: da memória, se o bloco do
+// fragmento ainda estiver em preenchimento ou se o fragmento tiver vindo
+// com a leitura de outro, ou do disco, junto com os setores seguintes.
+// Retorna 0 ou -1
+int __readFragment(MyFSSuper *sb, unsigned int frag, unsigned int len, unsigned char *data){
+	// Os grupos de fragmentos e a leitura antecipada são de todo o disco
+	__metaLock(sb);
+	int ret = __readFragmentLocked(sb, frag, len, data);
+	__metaUnlock(sb);
+	return ret;
+}
+
+// Grava os len bytes de data como um novo fragmento no bloco de
+// fragmentos do diretório dir. Sem espaço nele, começa outro, logo depois
+// do anterior. Só os setores do fragmento são gravados. Retorna o endereço
+// do fragmento ou 0
+unsigned int __writeFragment(MyFSSuper *sb, unsigned int dir, const unsigned char *data, unsigned int len){
+
+	unsigned int need = (len + MYFS_FRAG_UNIT - 1) / MYFS_FRAG_UNIT * MYFS_FRAG_UNIT;
+	FragGroup *g = &sb->fragGroups[dir % MYFS_FRAG_GROUPS];
+
+	if(g->addr != 0 && g->dir == dir && g->used + need <= sb->blockBytes){
+		if(__refBlock(sb, g->addr) < 0){
+			return 0;
+		}
+	}
+	else{
+		if(!g->data){
+			g->data = malloc(sb->blockBytes);
+			if(!g->data){
+				return 0;
+			}
+		}
+		if(g->addr != 0 && g->dir == dir){
+			sb->blockHint = (__blockIndex(sb, g->addr) + 1) % sb->numBlocks;
+		}
+		// A referência do bloco alocado é a do primeiro fragmento
+		unsigned int addr = __allocBlock(sb);
+		if(addr == 0){
+			return 0;
+		}
+		if(addr + sb->sectorsPerBlock > (UINT_MAX >> MYFS_FRAG_SHIFT)){
+			__freeBlock(sb, addr); // Além do que o endereço alcança
+			return 0;
+		}
+		g->dir = dir;
+		g->addr = addr;
+		g->used = 0;
+		memset(g->data, 0, sb->blockBytes);
+	}
+
+	unsigned int first = g->used / DISK_SECTORDATASIZE;
+	unsigned int count = (g->used + need + DISK_SECTORDATASIZE - 1) / DISK_SECTORDATASIZE - first;
+	unsigned int addr = g->addr;
+	memcpy(g->data + g->used, data, len);
+	if(addr + first < sb->fragCacheStart + sb->fragCacheCount &&
+	   addr + first + count > sb->fragCacheStart){
+		sb->fragCacheCount = 0; // O setor lido antes não tinha o fragmento
+	}
+	if(diskWriteSectors(sb->d, addr + first, count, g->data + first * DISK_SECTORDATASIZE) < 0 ||
+	   (sb->journal && journalForget(sb->journal, addr + first, count) < 0)){
+		__freeBlock(sb, addr);
+		return 0;
+	}
+
+	unsigned int frag = (addr + first) << MYFS_FRAG_SHIFT |
+	                    (g->used % DISK_SECTORDATASIZE) / MYFS_FRAG_UNIT;
+	g->used += need;
+	return frag;
+}
+
+// Guarda como fragmento o último bloco do arquivo aberto oi, se ele for
+// parcial e estiver em memória, devolvendo o bloco que ele ocupava. Sem
+// espaço para o fragmento, o bloco é gravado como os demais. Retorna 0
+// ou -1
+int __packTail(MyOpenInode *oi){
+
+	MyFSSuper *sb = oi->sb;
+	if(oi->snap || inodeGetFileType(oi->inode) != FILETYPE_REGULAR || __compressed(oi) ||
+	   __inodeTail(oi->inode) != 0 || oi->size % sb->blockBytes == 0){
+		return 0;
+	}
+	unsigned int last = oi->size / sb->blockBytes;
+	unsigned int len = oi->size % sb->blockBytes;
+	if((len + MYFS_FRAG_UNIT - 1) / MYFS_FRAG_UNIT * MYFS_FRAG_UNIT >= sb->blockBytes){
+		return 0; // O fragmento não economizaria nada
+	}
+	unsigned int pos;
+	int idx = __findDirty(oi, last, &pos);
+	if(idx < 0 || __cowInode(oi) < 0){
+		return 0;
+	}
+
+	unsigned int frag = __writeFragment(sb, oi->parent, oi->dirty[idx].data, len);
+	if(frag == 0){
+		return 0;
+	}
+	BlockMap bm;
+	__bmapInit(&bm, oi->inode, sb);
+	int ret = __bmapGet(&bm, last) != 0 ? __bmapReplace(&bm, last, 0) : 0;
+	if(__bmapDone(&bm) < 0){
+		ret = -1;
+	}
+	if(ret < 0){
+		__freeBlock(sb, __fragBlock(sb, frag));
+		return -1;
+	}
+
+	__setInodeTail(oi->inode, frag);
+	free(oi->dirty[idx].data);
+	memmove(&oi->dirty[idx], &oi->dirty[idx + 1], (oi->numDirty - idx - 1) * sizeof(DirtyBlock));
+	pthread_mutex_lock(&tableLock);
+	oi->numDirty--;
+	sb->dirtyBytes -= sb->blockBytes;
+	dirtyBytesTotal -= sb->blockBytes;
+	pthread_cond_broadcast(&dirtyCond);
+	pthread_mutex_unlock(&tableLock);
+	return 0;
+}
+
+// Devolve o fragmento do arquivo aberto oi a um bloco sujo comum, antes
+// de uma escrita no arquivo. Retorna 0 ou -1
+int __unpackTail(MyOpenInode *oi, BlockMap *bm){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int frag = __inodeTail(oi->inode);
+	if(frag == 0){
+		return 0;
+	}
+	unsigned int last = __tailBlock(oi);
+	unsigned int len = oi->size - last * sb->blockBytes;
+	unsigned char *tail = malloc(len);
+	if(!tail){
+		return -1;
+	}
+	unsigned char *data = NULL;
+	if(__readFragment(sb, frag, len, tail) == 0){
+		data = __getDirtyBlock(oi, bm, last, 0);
+	}
+	if(data){
+		memcpy(data, tail, len);
+		__freeBlock(sb, __fragBlock(sb, frag));
+		__setInodeTail(oi->inode, 0);
+	}
+	free(tail);
+	return data ? 0 : -1;
+}
+
+// Devolve uma referência a um i-node aberto. Na última referência, um
+// arquivo que não possui mais entradas de diretório tem seus dados
+// pendentes descartados, sem nunca ter alocado blocos para eles
+void __putOpenInode(MyOpenInode *oi){
+
+	pthread_mutex_lock(&tableLock);
+	unsigned int refs = --oi->refs;
+	pthread_mutex_unlock(&tableLock);
+	if(refs > 0){
+		return;
+	}
+
+	// Se a versão anterior não puder ser preservada para o snapshot, o
+	// i-node não é liberado
+	if(!oi->snap && inodeGetRefCount(oi->inode) == 0 && __cowInode(oi) == 0){
+		// O número pode ser reaproveitado: descarta nomes do diretório
+		dcachePurgeDir(oi->sb->dcache, inodeGetNumber(oi->inode));
+		__freeInodeBlocks(oi->sb, oi->inode);
+		__clearInode(oi->sb, inodeGetNumber(oi->inode));
+		__freeInode(oi->sb, inodeGetNumber(oi->inode));
+	}
+
+	__discardDirty(oi);
+	free(oi->dirty);
+	oi->dirty = NULL;
+	oi->capDirty = 0;
+	pthread_mutex_lock(&tableLock);
+	__unlinkOpenInode(oi);
+	pthread_mutex_unlock(&tableLock);
+	free(oi->inode);
+	oi->inode = NULL;
+	rangeLockDestroy(oi->ioRanges);
+	rangeLockDestroy(oi->locks);
+	oi->ioRanges = NULL;
+	oi->locks = NULL;
+}
+
+// Conclui o fechamento do i-node aberto oi pelo último descritor: o fim do
+// arquivo pode ir para um fragmento e os blocos sujos vão para o disco.
+// Nada é gravado para um arquivo sem entradas de diretório. Retorna 0 ou -1
+int __finishClose(MyOpenInode *oi){
+	if(inodeGetRefCount(oi->inode) == 0){
+		return 0;
+	}
+	int ret = __packTail(oi);
+	if(__flushOpenInode(oi) < 0){
+		ret = -1;
+	}
+	return ret;
+}
+
+// Devolve a referência do descarregador ao i-node aberto oi, fechado com
+// blocos sujos. Com o disco travado de forma exclusiva
+void __releaseClosed(MyOpenInode *oi){
+	pthread_mutex_lock(&tableLock);
+	oi->closed = 0;
+	oi->sb->numClosed--;
+	pthread_mutex_unlock(&tableLock);
+	__putOpenInode(oi);
+}
+
+// Retorna o número de entradas já alocadas na tabela de i-nodes abertos
+unsigned int __openInodeSlots(void){
+	pthread_mutex_lock(&tableLock);
+	unsigned int n = numInodeSlots;
+	pthread_mutex_unlock(&tableLock);
+	return n;
+}
+
+// Retorna o i-node aberto de posição slot, se estiver em uso no disco sb,
+// ou NULL
+MyOpenInode *__openInodeIn(MyFSSuper *sb, unsigned int slot){
+	pthread_mutex_lock(&tableLock);
+	MyOpenInode *oi = __openInodeAt(slot);
+	if(oi->refs == 0 || oi->sb != sb){
+		oi = NULL;
+	}
+	pthread_mutex_unlock(&tableLock);
+	return oi;
+}
+
+// Valida um descritor e retorna o arquivo aberto correspondente
+MyFileHandle *__getHandle(int fd){
+	pthread_mutex_lock(&tableLock);
+	MyFileHandle *fh = NULL;
+	if(fd >= 1 && (unsigned int)fd <= numFileSlots && __fileAt(fd - 1)->used){
+		fh = __fileAt(fd - 1);
+	}
+	pthread_mutex_unlock(&tableLock);
+	return fh;
+}
+
+// Retorna o disco do descritor fd, se ele for o do arquivo aberto fh
+// (NULL se fd tiver sido fechado ou reaproveitado)
+Disk *__handleDisk(int fd, MyFileHandle *fh){
+	pthread_mutex_lock(&tableLock);
+	Disk *d = fh->used && fh->slot + 1 == (unsigned int)fd ? fh->d : NULL;
+	pthread_mutex_unlock(&tableLock);
+	return d;
+}
+
+// Confirma no diário os metadados do disco montado sb, travado de forma
+// exclusiva, como a sincronização, mas sem descarregar os arquivos.
+// Retorna 0 ou -1
+int __commitMeta(MyFSSuper *sb){
+	return __writeSuper(sb) == 0 && journalCommit(sb->journal) == 0 ? 0 : -1;
+}
+
+// Trava o disco montado d para uma operação do tipo mode (MYFS_LOCK_*):
+// de forma exclusiva em MYFS_LOCK_META, compartilhada nos demais. Retorna
+// o superbloco travado ou NULL se d não estiver montado
+MyFSSuper *__lockSuper(Disk *d, int mode) {
+	MyFSSuper *sb = d ? __getSuper(d) : NULL;
+	if(!sb){
+		return NULL;
+	}
+	if(mode == MYFS_LOCK_META){
+		pthread_rwlock_wrlock(&sb->lock);
+		// Nenhuma operação está pela metade, então a transação corrente
+		// pode ser confirmada antes que deixe de caber no diário. Se
+		// falhar, a operação segue e tenta de novo na próxima
+		if(journalNeedsCommit(sb->journal)){
+			__commitMeta(sb);
+		}
+	}
+	else{
+		pthread_rwlock_rdlock(&sb->lock);
+	}
+	return sb;
+}
+
+// Libera a trava obtida por __lockSuper (nada se sb for NULL)
+void __unlockSuper(MyFSSuper *sb) {
+	if(sb){
+		pthread_rwlock_unlock(&sb->lock);
+	}
+}
+
+// Trava, para uma operação do tipo mode (MYFS_LOCK_*), o disco do
+// descritor fd. Em MYFS_LOCK_READ, trava também o descritor e o i-node
+// aberto, de forma compartilhada; em MYFS_LOCK_DATA, a leitura ou escrita
+// trava o seu trecho e o i-node, e o descritor só enquanto usa o cursor ou
+// o buffer. Retorna o arquivo aberto ou NULL se fd não for válido
+MyFileHandle *__lockHandle(int fd, int mode){
+	MyFileHandle *fh = __getHandle(fd);
+	Disk *d = fh ? __handleDisk(fd, fh) : NULL;
+	MyFSSuper *sb = __lockSuper(d, mode);
+	if(!sb){
+		return NULL;
+	}
+	// O descritor pode ter sido fechado enquanto o disco era esperado
+	if(__handleDisk(fd, fh) != d){
+		__unlockSuper(sb);
+		return NULL;
+	}
+	if(mode == MYFS_LOCK_READ){
+		pthread_rwlock_rdlock(&fh->oi->lock);
+		pthread_mutex_lock(&fh->lock);
+	}
+	return fh;
+}
+
+// Libera as travas obtidas por __lockHandle para fh e mode
+void __unlockHandle(MyFileHandle *fh, int mode){
+	MyFSSuper *sb = fh->oi->sb;
+	if(mode == MYFS_LOCK_READ){
+		pthread_mutex_unlock(&fh->lock);
+		pthread_rwlock_unlock(&fh->oi->lock);
+	}
+	__unlockSuper(sb);
+}
+
+// Trava de forma exclusiva o disco do descritor fd. Retorna o superbloco
+// travado ou NULL se fd não for válido
+MyFSSuper *__lockFd(int fd){
+	MyFileHandle *fh = __lockHandle(fd, MYFS_LOCK_META);
+	return fh ? fh->oi->sb : NULL;
+}
+
+// Retorna o bloco blockNum do arquivo aberto em fh, mantido no buffer do
+// descritor. Leituras sequenciais pequenas consultam o disco uma única vez
+// por bloco; qualquer escrita no arquivo invalida o buffer. Buracos são
+// lidos como zeros, e o último bloco, se guardado em fragmento, vem dele.
+// Retorna NULL em caso de falha
+unsigned char *__readBuffered(MyFileHandle *fh, BlockMap *bm, unsigned int blockNum){
+
+	MyOpenInode *oi = fh->oi;
+	MyFSSuper *sb = oi->sb;
+	if(fh->bufValid && fh->bufBlock == blockNum && fh->bufGen == oi->gen){
+		return fh->buf;
+	}
+
+	if(!fh->buf){
+		fh->buf = malloc(sb->blockBytes);
+		if(!fh->buf){
+			return NULL;
+		}
+	}
+
+	fh->bufValid = 0;
+	unsigned int addr = __bmapGet(bm, blockNum);
+	if(blockNum == __tailBlock(oi)){
+		unsigned int len = oi->size - blockNum * sb->blockBytes;
+		memset(fh->buf + len, 0, sb->blockBytes - len);
+		if(__readFragment(sb, __inodeTail(oi->inode), len, fh->buf) < 0){
+			return NULL;
+		}
+	}
+	else if(addr == 0){
+		memset(fh->buf, 0, sb->blockBytes);
+	}
+	else if(__readBlock(sb, addr, fh->buf) < 0){
+		return NULL;
+	}
+
+	fh->bufValid = 1;
+	fh->bufBlock = blockNum;
+	fh->bufGen = oi->gen;
+	return fh->buf;
+}
+
+// Retorna o cluster que começa no bloco lógico first do arquivo comprimido
+// aberto em fh, mantido descomprimido no buffer do descritor como em
+// __readBuffered. Retorna NULL em caso de falha
+unsigned char *__readCluster(MyFileHandle *fh, BlockMap *bm, unsigned int first){
+
+	MyOpenInode *oi = fh->oi;
+	MyFSSuper *sb = oi->sb;
+	if(fh->bufValid && fh->bufBlock == first && fh->bufGen == oi->gen){
+		return fh->buf;
+	}
+
+	if(!fh->buf){
+		fh->buf = malloc(sb->clusterBlocks * sb->blockBytes);
+		if(!fh->buf){
+			return NULL;
+		}
+	}
+
+	fh->bufValid = 0;
+	if(__loadCluster(sb, bm, first, oi->size, fh->buf) < 0){
+		return NULL;
+	}
+
+	fh->bufValid = 1;
+	fh->bufBlock = first;
+	fh->bufGen = oi->gen;
+	return fh->buf;
+}
+
+// Lê até count blocos inteiros do arquivo, a partir do bloco blockNum,
+// diretamente para data, sem cópia intermediária. O bloco blockNum não
+// pode ter dados pendentes. Blocos contíguos no disco são lidos em uma
+// única transferência e buracos viram zeros. Retorna quantos blocos foram
+// lidos (ao menos 1), ou 0 em caso de falha
+unsigned int __readDirect(MyOpenInode *oi, BlockMap *bm, unsigned int blockNum,
+                          unsigned int count, unsigned char *data){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int pos;
+	unsigned int addr = __bmapGet(bm, blockNum);
+
+	// Estende a sequência enquanto os blocos seguem a mesma disposição
+	unsigned int run = 1;
+	while(run < count && __findDirty(oi, blockNum + run, &pos) < 0){
+		unsigned int next = __bmapGet(bm, blockNum + run);
+		if(addr == 0 ? next != 0 : next != addr + run * sb->sectorsPerBlock){
+			break;
+		}
+		run++;
+	}
+
+	if(addr == 0){
+		memset(data, 0, (unsigned long)run * sb->blockBytes);
+	}
+	else if(__readBlocks(sb, addr, run, data) < 0){
+		return 0;
+	}
+	return run;
+}
+
+// Grava até count blocos inteiros no arquivo, a partir do bloco blockNum,
+// diretamente de data. Um bloco com dados pendentes recebe a cópia em
+// memória; os demais vão ao disco sem cópia intermediária, sobrescrevendo
+// blocos exclusivos no lugar ou alocando de uma vez uma sequência contígua
+// para blocos novos ou compartilhados. Retorna quantos blocos foram
+// gravados (ao menos 1), ou 0 em caso de falha
+unsigned int __writeDirect(MyOpenInode *oi, BlockMap *bm, unsigned int blockNum,
+                           unsigned int count, const unsigned char *data){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int pos;
+	int idx = __findDirty(oi, blockNum, &pos);
+	oi->gen++;
+	if(idx >= 0){
+		memcpy(oi->dirty[idx].data, data, sb->blockBytes);
+		return 1;
+	}
+
+	unsigned int addr = __bmapGet(bm, blockNum);
+	int relocate = __needsNewBlock(bm, blockNum, addr);
+	unsigned int run = 1;
+	while(run < count && __findDirty(oi, blockNum + run, &pos) < 0){
+		unsigned int next = __bmapGet(bm, blockNum + run);
+		if(relocate ? !__needsNewBlock(bm, blockNum + run, next) :
+		   next != addr + run * sb->sectorsPerBlock || __needsNewBlock(bm, blockNum + run, next)){
+			break;
+		}
+		run++;
+	}
+
+	if(relocate){
+		addr = __allocBlocks(sb, run, &run);
+		if(addr == 0){
+			return 0;
+		}
+		for(unsigned int k = 0; k < run; k++){
+			if(__bmapReplace(bm, blockNum + k, addr + k * sb->sectorsPerBlock) < 0){
+				// Devolve os blocos ainda não ligados ao arquivo
+				for(; k < run; k++){
+					__freeBlock(sb, addr + k * sb->sectorsPerBlock);
+				}
+				return 0;
+			}
+		}
+	}
+
+	if(__writeBlocks(sb, addr, run, (unsigned char *)data) < 0){
+		return 0;
+	}
+	return run;
+}
+
+// Indica se o bloco lógico blockNum de um arquivo aberto tem dados, em
+// memória, no disco ou em fragmento. Os demais blocos são buracos, lidos
+// como zeros
+int __blockHasData(MyOpenInode *oi, BlockMap *bm, unsigned int blockNum){
+	unsigned int pos;
+	return __findDirty(oi, blockNum, &pos) >= 0 || __bmapGet(bm, blockNum) != 0 ||
+	       blockNum == __tailBlock(oi);
+}
+
+// Retorna a posição do primeiro byte com dados do arquivo aberto oi a
+// partir de offset, ou -1 se só houver buracos até o fim do arquivo
+long __seekData(MyOpenInode *oi, unsigned int offset){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int last = (oi->size - 1) / sb->blockBytes;
+	unsigned int blockNum = offset / sb->blockBytes;
+	long found = -1;
+
+	BlockMap bm;
+	__bmapInit(&bm, oi->inode, sb);
+	while(blockNum <= last){
+		if(__blockHasData(oi, &bm, blockNum)){
+			found = (long)blockNum * sb->blockBytes;
+			break;
+		}
+
+		// Salta até o próximo bloco mapeado, pendente em memória ou em
+		// fragmento
+		unsigned int pos, next = __bmapNextMapped(&bm, blockNum);
+		__findDirty(oi, blockNum + 1, &pos);
+		if(pos < oi->numDirty && oi->dirty[pos].blockNum < next){
+			next = oi->dirty[pos].blockNum;
+		}
+		if(__tailBlock(oi) > blockNum && __tailBlock(oi) < next){
+			next = __tailBlock(oi);
+		}
+		blockNum = next;
+	}
+	__bmapDone(&bm);
+
+	return found >= 0 && found < offset ? (long)offset : found;
+}
+
+// Retorna a posição do primeiro byte de um buraco do arquivo aberto oi a
+// partir de offset. O fim do arquivo conta como buraco
+long __seekHole(MyOpenInode *oi, unsigned int offset){
+
+	MyFSSuper *sb = oi->sb;
+	unsigned int last = (oi->size - 1) / sb->blockBytes;
+	unsigned int blockNum = offset / sb->blockBytes;
+
+	BlockMap bm;
+	__bmapInit(&bm, oi->inode, sb);
+	while(blockNum <= last && __blockHasData(oi, &bm, blockNum)){
+		blockNum++;
+	}
+	__bmapDone(&bm);
+
+	if(blockNum > last){
+		return oi->size;
+	}
+	long hole = (long)blockNum * sb->blockBytes;
+	return hole < offset ? (long)offset : hole;
+}
+
+// Libera o descritor fh, junto com seu buffer de leitura, devolvendo-o à
+// lista de descritores livres
+void __releaseHandle(MyFileHandle *fh){
+	MyFSSuper *sb = __getSuper(fh->d);
+	if(sb && sb->numOpenFiles > 0){
+		sb->numOpenFiles--;
+	}
+	free(fh->buf);
+	fh->buf = NULL;
+	fh->bufValid = 0;
+	pthread_mutex_lock(&tableLock);
+	fh->used = 0;
+	fh->oi = NULL;
+	fh->nextFree = freeFiles;
+	freeFiles = fh->slot + 1;
+	pthread_mutex_unlock(&tableLock);
+}
+
+// Função auxiliar para encontrar slot livre: o que a próxima abertura vai
+// ocupar, aumentando a tabela se não houver nenhum. Retorna -1 se a
+// tabela estiver no limite
+int __findFreeSlot(void) {
+    pthread_mutex_lock(&tableLock);
+    int slot = (freeFiles == 0 && __growFiles() < 0) ? -1 : (int)freeFiles - 1;
+    pthread_mutex_unlock(&tableLock);
+    return slot;
+}
+
+// Ocupa um descritor livre para o i-node aberto oi, do disco d, e o
+// retorna, ou NULL se a tabela estiver no limite. Outra abertura, em
+// outro disco, pode ter ocupado o apontado por __findFreeSlot
+MyFileHandle *__claimSlot(Disk *d, MyOpenInode *oi, unsigned int inodeNum) {
+    pthread_mutex_lock(&tableLock);
+    MyFileHandle *fh = NULL;
+    if (freeFiles != 0 || __growFiles() == 0) {
+        fh = __fileAt(freeFiles - 1);
+        freeFiles = fh->nextFree;
+        fh->inodeNum = inodeNum;
+        fh->cursor = 0;
+        fh->d = d;
+        fh->oi = oi;
+        fh->buf = NULL;
+        fh->bufValid = 0;
+        fh->owner = nextOwner++;
+        fh->used = 1;
+    }
+    pthread_mutex_unlock(&tableLock);
+    return fh;
+}
+
+// Lê o inteiro de 32 bits de índice idx de um bloco
+unsigned int __getU32(unsigned char *block, unsigned int idx){
+	unsigned int value;
+	char2ul(&block[idx * sizeof(unsigned int)], &value);
+	return value;
+}
+
+// Escreve o inteiro de 32 bits de índice idx de um bloco
+void __setU32(unsigned char *block, unsigned int idx, unsigned int value){
+	ul2char(value, &block[idx * sizeof(unsigned int)]);
+}
+
+// Hash de nomes de entradas de diretório (FNV-1a de 32 bits)
+unsigned int __dirHash(const char *name){
+	unsigned int hash = 2166136261u;
+	for(; *name; name++){
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	}
+	return hash;
+}
+
+// Lê o bloco lógico lblk de um diretório. Retorna 0 ou -1
+int __dirReadBlock(MyOpenInode *dir, BlockMap *bm, unsigned int lblk, unsigned char *buf){
+	unsigned int addr = __bmapGet(bm, lblk);
+	if(addr == 0){
+		return -1;
+	}
+	return __readBlock(dir->sb, addr, buf);
+}
+
+// Grava o bloco lógico lblk de um diretório. Um bloco compartilhado é
+// gravado em um bloco novo, que passa a ocupar seu lugar. Retorna 0 ou -1
+int __dirWriteBlock(MyOpenInode *dir, BlockMap *bm, unsigned int lblk, unsigned char *buf){
+	unsigned int addr = __bmapGet(bm, lblk);
+	if(addr == 0){
+		return -1;
+	}
+	if(__bmapShared(bm, lblk, addr)){
+		unsigned int copy = __allocBlock(dir->sb);
+		if(copy == 0){
+			return -1;
+		}
+		if(__bmapReplace(bm, lblk, copy) < 0){
+			__freeBlock(dir->sb, copy);
+			return -1;
+		}
+		addr = copy;
+		if(__saveInode(dir->sb, dir->inode) < 0){
+			return -1;
+		}
+	}
+	return __writeMetaBlock(dir->sb, addr, buf);
+}
+
+// Acrescenta um bloco ao fim de um diretório, escrevendo em *lblk seu
+// número lógico. O i-node do diretório é salvo pelo chamador
+int __dirNewBlock(MyOpenInode *dir, BlockMap *bm, unsigned int *lblk){
+	unsigned int addr = __allocBlock(dir->sb);
+	*lblk = dir->size / dir->sb->blockBytes;
+	if(addr == 0){
+		return -1;
+	}
+	if(__bmapSet(bm, *lblk, addr) < 0){
+		__freeBlock(dir->sb, addr);
+		return -1;
+	}
+	dir->size += dir->sb->blockBytes;
+	inodeSetFileSize(dir->inode, dir->size);
+	return 0;
+}
+
+//Diretórios usam um índice por hash dos nomes, no espírito da htree do
+//ext3. Um diretório pequeno ocupa um único bloco folha, pesquisado
+//linearmente. Quando esse bloco enche, o bloco 0 passa a ser a raiz de
+//uma árvore de nós de índice, cujas entradas (hash, bloco) ordenadas por
+//hash apontam para nós do nível seguinte e, no último nível, para as
+//folhas. Cada folha guarda as entradas cujo hash está entre o seu hash
+//no índice e o da entrada seguinte, de modo que uma busca lê um bloco
+//por nível da árvore, independentemente do tamanho do diretório
+#define DX_MAGIC 0xFFFFFFFF	// Primeiro inteiro de um nó de índice
+#define DX_ITEM_COUNT 1		// Número de entradas do nó
+#define DX_ITEM_DEPTH 2		// Na raiz: níveis de índice até as folhas
+#define DX_HEADER_ITEMS 4	// Inteiros do cabeçalho de um nó
+#define DX_MAX_DEPTH 8
+#define DX_MAX_RETRIES (2 * DX_MAX_DEPTH + 2)
+
+// Indica se um bloco de diretório é um nó de índice
+int __dxIsIndex(unsigned char *block){
+	return __getU32(block, 0) == DX_MAGIC;
+}
+
+// Número máximo de entradas em um nó de índice
+unsigned int __dxLimit(MyFSSuper *sb){
+	return (sb->blockBytes / sizeof(unsigned int) - DX_HEADER_ITEMS) / 2;
+}
+
+unsigned int __dxCount(unsigned char *node){
+	return __getU32(node, DX_ITEM_COUNT);
+}
+
+unsigned int __dxHash(unsigned char *node, unsigned int i){
+	return __getU32(node, DX_HEADER_ITEMS + 2 * i);
+}
+
+unsigned int __dxChild(unsigned char *node, unsigned int i){
+	return __getU32(node, DX_HEADER_ITEMS + 2 * i + 1);
+}
+
+// Inicializa um nó de índice vazio
+void __dxInit(MyFSSuper *sb, unsigned char *node, unsigned int depth){
+	memset(node, 0, sb->blockBytes);
+	__setU32(node, 0, DX_MAGIC);
+	__setU32(node, DX_ITEM_DEPTH, depth);
+}
+
+// Retorna a posição da entrada de um nó de índice que cobre hash
+unsigned int __dxSearch(unsigned char *node, unsigned int hash){
+	unsigned int lo = 1, hi = __dxCount(node);
+	while(lo < hi){
+		unsigned int mid = (lo + hi) / 2;
+		if(__dxHash(node, mid) <= hash){
+			lo = mid + 1;
+		}
+		else{
+			hi = mid;
+		}
+	}
+	return lo - 1;
+}
+
+// Insere a entrada (hash, child) em um nó de índice com espaço livre
+void __dxInsert(unsigned char *node, unsigned int hash, unsigned int child){
+	unsigned int count = __dxCount(node);
+	unsigned int pos = count > 0 ? __dxSearch(node, hash) + 1 : 0;
+	memmove(&node[(DX_HEADER_ITEMS + 2 * (pos + 1)) * sizeof(unsigned int)],
+	        &node[(DX_HEADER_ITEMS + 2 * pos) * sizeof(unsigned int)],
+	        (count - pos) * 2 * sizeof(unsigned int));
+	__setU32(node, DX_HEADER_ITEMS + 2 * pos, hash);
+	__setU32(node, DX_HEADER_ITEMS + 2 * pos + 1, child);
+	__setU32(node, DX_ITEM_COUNT, count + 1);
+}
+
+unsigned int __direntInode(unsigned char *leaf, unsigned int off){
+	return __getU32(leaf, off / sizeof(unsigned int));
+}
+
+unsigned int __direntRecLen(unsigned char *leaf, unsigned int off){
+	return leaf[off + 4] | (leaf[off + 5] << 8);
+}
+
+unsigned int __direntNameLen(unsigned char *leaf, unsigned int off){
+	return leaf[off + 6];
+}
+
+void __direntSetRecLen(unsigned char *leaf, unsigned int off, unsigned int recLen){
+	leaf[off + 4] = recLen & 0xFF;
+	leaf[off + 5] = (recLen >> 8) & 0xFF;
+}
+
+// Grava um registro na posição off de uma folha
+void __direntWrite(unsigned char *leaf, unsigned int off, unsigned int inodeNum,
+                   unsigned int recLen, const char *name, unsigned int nameLen){
+	__setU32(leaf, off / sizeof(unsigned int), inodeNum);
+	__direntSetRecLen(leaf, off, recLen);
+	leaf[off + 6] = nameLen;
+	leaf[off + 7] = 0;
+	memcpy(&leaf[off + DIRENT_HEADER], name, nameLen);
+}
+
+// Retorna a posição do registro seguinte ao de posição off, ou o tamanho
+// do bloco ao fim da folha (ou se o encadeamento estiver corrompido)
+unsigned int __direntNext(MyFSSuper *sb, unsigned char *leaf, unsigned int off){
+	unsigned int recLen = __direntRecLen(leaf, off);
+	if(recLen < DIRENT_HEADER || recLen % DIRENT_ALIGN || recLen > sb->blockBytes - off){
+		return sb->blockBytes;
+	}
+	return off + recLen;
+}
+
+// Inicializa uma folha vazia: um único registro livre ocupa o bloco todo
+void __leafInit(MyFSSuper *sb, unsigned char *leaf){
+	memset(leaf, 0, sb->blockBytes);
+	__direntWrite(leaf, 0, 0, sb->blockBytes, "", 0);
+}
+
+// Busca name em uma folha. Retorna a posição do registro, ou o tamanho do
+// bloco se não achar. Em *prev fica a posição do registro anterior
+unsigned int __leafSearch(MyFSSuper *sb, unsigned char *leaf, const char *name, unsigned int *prev){
+	unsigned int nameLen = strlen(name), last = sb->blockBytes;
+	for(unsigned int off = 0; off < sb->blockBytes; off = __direntNext(sb, leaf, off)){
+		if(__direntInode(leaf, off) != 0 && __direntNameLen(leaf, off) == nameLen &&
+		   memcmp(&leaf[off + DIRENT_HEADER], name, nameLen) == 0){
+			if(prev){
+				*prev = last;
+			}
+			return off;
+		}
+		last = off;
+	}
+	return sb->blockBytes;
+}
+
+// Busca name em uma folha. Retorna o número do i-node ou 0
+unsigned int __leafFind(MyFSSuper *sb, unsigned char *leaf, const char *name){
+	unsigned int off = __leafSearch(sb, leaf, name, NULL);
+	return off < sb->blockBytes ? __direntInode(leaf, off) : 0;
+}
+
+// Insere (name -> inodeNum) em uma folha, no primeiro registro com espaço
+// sobrando ao fim. Retorna -1 se não houver espaço
+int __leafInsert(MyFSSuper *sb, unsigned char *leaf, const char *name, unsigned int inodeNum){
+	unsigned int nameLen = strlen(name), need = DIRENT_SIZE(nameLen);
+	for(unsigned int off = 0; off < sb->blockBytes; off = __direntNext(sb, leaf, off)){
+		unsigned int recLen = __direntRecLen(leaf, off);
+		unsigned int used = __direntInode(leaf, off) ? DIRENT_SIZE(__direntNameLen(leaf, off)) : 0;
+		if(recLen >= used + need){
+			if(used > 0){
+				// Divide o registro, ficando o novo com a sobra
+				__direntSetRecLen(leaf, off, used);
+				off += used;
+				recLen -= used;
+			}
+			__direntWrite(leaf, off, inodeNum, recLen, name, nameLen);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Remove name de uma folha, juntando o espaço do registro ao anterior.
+// Retorna o número do i-node removido ou 0 se não achar
+unsigned int __leafRemove(MyFSSuper *sb, unsigned char *leaf, const char *name){
+	unsigned int prev, off = __leafSearch(sb, leaf, name, &prev);
+	if(off >= sb->blockBytes){
+		return 0;
+	}
+
+	unsigned int inodeNum = __direntInode(leaf, off);
+	if(prev < sb->blockBytes){
+		__direntSetRecLen(leaf, prev, __direntRecLen(leaf, prev) + __direntRecLen(leaf, off));
+	}
+	else{
+		__setU32(leaf, off / sizeof(unsigned int), 0);
+	}
+	return inodeNum;
+}
+
+// Percorre as entradas de uma folha a partir da posição *pos, avançando
+// *pos. Retorna 1 e preenche inodeNum e name (se não nulos) ao encontrar
+// uma entrada, ou 0 ao fim da folha
+int __leafNext(MyFSSuper *sb, unsigned char *leaf, unsigned int *pos, unsigned int *inodeNum, char *name){
+	while(*pos < sb->blockBytes){
+		unsigned int off = *pos;
+		*pos = __direntNext(sb, leaf, off);
+		if(__direntInode(leaf, off) != 0){
+			unsigned int nameLen = __direntNameLen(leaf, off);
+			if(inodeNum){
+				*inodeNum = __direntInode(leaf, off);
+			}
+			if(name){
+				memcpy(name, &leaf[off + DIRENT_HEADER], nameLen);
+				name[nameLen] = '\0';
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Entrada de diretório em memória, usada na divisão de folhas
+typedef struct {
+	unsigned int hash;
+	unsigned int inode;
+	char name[MAX_FILENAME_LENGTH + 1];
+} DirRecord;
+
+int __dirRecordCmp(const void *a, const void *b){
+	unsigned int ha = ((const DirRecord *)a)->hash;
+	unsigned int hb = ((const DirRecord *)b)->hash;
+	return (ha > hb) - (ha < hb);
+}
+
+// Divide a folha cheia leaf (bloco lógico leafBlk) do diretório, incluindo
+// nela a nova entrada (name -> inodeNum). As entradas de hash menor ficam
+// em leaf; as demais vão para um bloco novo, cujo hash inicial é escrito
+// em *splitHash e número lógico em *newBlk. Retorna 0, ou -1 se não for
+// possível dividir (todas as entradas com o mesmo hash) ou gravar
+int __dirSplitLeaf(MyOpenInode *dir, BlockMap *bm, unsigned char *leaf, unsigned int leafBlk,
+                   const char *name, unsigned int inodeNum,
+                   unsigned int *splitHash, unsigned int *newBlk){
+
+	MyFSSuper *sb = dir->sb;
+	unsigned int max = sb->blockBytes / 8 + 1, count = 0, pos = 0;
+	DirRecord *recs = malloc(max * sizeof(DirRecord));
+	unsigned char *other = malloc(sb->blockBytes);
+	int ret = -1;
+
+	if(!recs || !other){
+		goto out;
+	}
+
+	while(count < max - 1 && __leafNext(sb, leaf, &pos, &recs[count].inode, recs[count].name)){
+		recs[count].hash = __dirHash(recs[count].name);
+		count++;
+	}
+	recs[count].inode = inodeNum;
+	strcpy(recs[count].name, name);
+	recs[count].hash = __dirHash(name);
+	count++;
+	qsort(recs, count, sizeof(DirRecord), __dirRecordCmp);
+
+	// Ponto de divisão na metade dos bytes ocupados, sem separar entradas
+	// de mesmo hash
+	unsigned int total = 0, half = 0, median = 1;
+	for(unsigned int k = 0; k < count; k++){
+		total += DIRENT_SIZE(strlen(recs[k].name));
+	}
+	half = DIRENT_SIZE(strlen(recs[0].name));
+	while(median < count - 1 && half < total / 2){
+		half += DIRENT_SIZE(strlen(recs[median].name));
+		median++;
+	}
+	unsigned int mid = median;
+	while(mid < count && recs[mid].hash == recs[mid - 1].hash){
+		mid++;
+	}
+	if(mid == count){
+		mid = median;
+		while(mid > 0 && recs[mid].hash == recs[mid - 1].hash){
+			mid--;
+		}
+		if(mid == 0){
+			goto out;
+		}
+	}
+
+	__leafInit(sb, leaf);
+	__leafInit(sb, other);
+	for(unsigned int k = 0; k < count; k++){
+		if(__leafInsert(sb, k < mid ? leaf : other, recs[k].name, recs[k].inode) < 0){
+			goto out;
+		}
+	}
+
+	if(__dirNewBlock(dir, bm, newBlk) < 0 ||
+	   __dirWriteBlock(dir, bm, *newBlk, other) < 0 ||
+	   __dirWriteBlock(dir, bm, leafBlk, leaf) < 0){
+		goto out;
+	}
+	*splitHash = recs[mid].hash;
+	ret = 0;
+
+out:
+	free(recs);
+	free(other);
+	return ret;
+}
+
+// Divide o nó de índice cheio do nível level do caminho path, abrindo
+// espaço no pai. Na raiz, a árvore ganha um nível: as entradas da raiz
+// passam para um nó novo, do qual a raiz vira a única entrada
+int __dxSplitNode(MyOpenInode *dir, BlockMap *bm, unsigned int *path, unsigned int level,
+                  unsigned char *root, unsigned char *node){
+
+	MyFSSuper *sb = dir->sb;
+	unsigned int newBlk;
+
+	if(level == 0){
+		unsigned int depth = __getU32(root, DX_ITEM_DEPTH);
+		if(depth >= DX_MAX_DEPTH || __dirNewBlock(dir, bm, &newBlk) < 0){
+			return -1;
+		}
+		memcpy(node, root, sb->blockBytes);
+		__setU32(node, DX_ITEM_DEPTH, 0);
+		__dxInit(sb, root, depth + 1);
+		__dxInsert(root, 0, newBlk);
+		if(__dirWriteBlock(dir, bm, newBlk, node) < 0 ||
+		   __dirWriteBlock(dir, bm, 0, root) < 0){
+			return -1;
+		}
+		return 0;
+	}
+
+	// O pai precisa de espaço para a entrada do novo nó
+	if(__dirReadBlock(dir, bm, path[level - 1], node) < 0){
+		return -1;
+	}
+	if(__dxCount(node) >= __dxLimit(sb)){
+		return __dxSplitNode(dir, bm, path, level - 1, root, node);
+	}
+
+	unsigned char *upper = malloc(sb->blockBytes);
+	if(!upper){
+		return -1;
+	}
+
+	int ret = -1;
+	if(__dirReadBlock(dir, bm, path[level], node) == 0 &&
+	   __dirNewBlock(dir, bm, &newBlk) == 0){
+		unsigned int count = __dxCount(node), mid = count / 2;
+		unsigned int sep = __dxHash(node, mid);
+		__dxInit(sb, upper, 0);
+		for(unsigned int k = mid; k < count; k++){
+			__dxInsert(upper, __dxHash(node, k), __dxChild(node, k));
+		}
+		__setU32(node, DX_ITEM_COUNT, mid);
+		if(__dirWriteBlock(dir, bm, path[level], node) == 0 &&
+		   __dirWriteBlock(dir, bm, newBlk, upper) == 0){
+			// Atualiza o pai (a raiz já está em memória)
+			unsigned char *parent = level - 1 == 0 ? root : node;
+			if(parent == root || __dirReadBlock(dir, bm, path[level - 1], parent) == 0){
+				__dxInsert(parent, sep, newBlk);
+				ret = __dirWriteBlock(dir, bm, path[level - 1], parent);
+			}
+		}
+	}
+
+	free(upper);
+	return ret;
+}
+
+// Desce o índice do diretório até a folha que deve conter name, lendo-a
+// em block e escrevendo seu número lógico em *lblk. Retorna 0 ou -1
+int __dirFindLeaf(MyOpenInode *dir, BlockMap *bm, const char *name, unsigned char *block, unsigned int *lblk){
+
+	*lblk = 0;
+	if(dir->size == 0 || __dirReadBlock(dir, bm, 0, block) < 0){
+		return -1;
+	}
+
+	if(__dxIsIndex(block)){
+		unsigned int hash = __dirHash(name);
+		unsigned int depth = __getU32(block, DX_ITEM_DEPTH);
+		for(unsigned int level = 0; level < depth; level++){
+			*lblk = __dxChild(block, __dxSearch(block, hash));
+			if(__dirReadBlock(dir, bm, *lblk, block) < 0){
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// Busca name no diretório aberto dir. Retorna o número do i-node ou 0
+unsigned int __dirLookup(MyOpenInode *dir, const char *name){
+
+	MyFSSuper *sb = dir->sb;
+	unsigned char *block = malloc(sb->blockBytes);
+	if(!block){
+		return 0;
+	}
+
+	BlockMap bm;
+	__bmapInit(&bm, dir->inode, sb);
+
+	unsigned int lblk, found = 0;
+	if(__dirFindLeaf(dir, &bm, name, block, &lblk) == 0){
+		found = __leafFind(sb, block, name);
+	}
+
+	__bmapDone(&bm);
+	free(block);
+	return found;
+}
+
+// Remove name do diretório aberto dir. O espaço do registro fica para
+// novas entradas da mesma folha. Retorna o número do i-node removido ou 0
+unsigned int __dirRemove(MyOpenInode *dir, const char *name){
+
+	MyFSSuper *sb = dir->sb;
+	if(__cowInode(dir) < 0){
+		return 0;
+	}
+	unsigned char *block = malloc(sb->blockBytes);
+	if(!block){
+		return 0;
+	}
+
+	BlockMap bm;
+	__bmapInit(&bm, dir->inode, sb);
+
+	unsigned int lblk, removed = 0;
+	if(__dirFindLeaf(dir, &bm, name, block, &lblk) == 0){
+		removed = __leafRemove(sb, block, name);
+		if(removed && __dirWriteBlock(dir, &bm, lblk, block) < 0){
+			removed = 0;
+		}
+	}
+
+	__bmapDone(&bm);
+	free(block);
+	if(removed){
+		dcacheInsert(sb->dcache, inodeGetNumber(dir->inode), name, 0);
+	}
+	return removed;
+}
+
+// Indica se o diretório aberto dir não possui entradas
+int __dirIsEmpty(MyOpenInode *dir){
+
+	MyFSSuper *sb = dir->sb;
+	unsigned char *block = malloc(sb->blockBytes);
+	if(!block){
+		return 0;
+	}
+
+	BlockMap bm;
+	__bmapInit(&bm, dir->inode, sb);
+
+	int empty = 1;
+	for(unsigned int lblk = 0; empty && lblk < dir->size / sb->blockBytes; lblk++){
+		unsigned int pos = 0;
+		if(__dirReadBlock(dir, &bm, lblk, block) < 0){
+			empty = 0;
+		}
+		else if(!__dxIsIndex(block) && __leafNext(sb, block, &pos, NULL, NULL)){
+			empty = 0;
+		}
+	}
+
+	__bmapDone(&bm);
+	free(block);
+	return empty;
+}
+
+// Adiciona a entrada (name -> inodeNum) ao diretório aberto dir. O nome
+// MYFS_SNAPDIR é reservado na raiz. Retorna 0, ou -1 se o nome já existir
+// ou em caso de falha
+int __dirAdd(MyOpenInode *dir, const char *name, unsigned int inodeNum){
+
+	MyFSSuper *sb = dir->sb;
+	if((inodeGetNumber(dir->inode) == 1 && strcmp(name, MYFS_SNAPDIR) == 0) ||
+	   __dirLookup(dir, name) != 0 || __cowInode(dir) < 0){
+		return -1;
+	}
+
+	unsigned char *root = malloc(sb->blockBytes);
+	unsigned char *block = malloc(sb->blockBytes);
+	if(!root || !block){
+		free(root);
+		free(block);
+		return -1;
+	}
+
+	BlockMap bm;
+	__bmapInit(&bm, dir->inode, sb);
+	int ret = -1;
+	unsigned int lblk;
+
+	if(dir->size == 0){
+		// Diretório vazio: o bloco 0 é a única folha
+		__leafInit(sb, block);
+		if(__dirNewBlock(dir, &bm, &lblk) == 0 &&
+		   __leafInsert(sb, block, name, inodeNum) == 0){
+			ret = __dirWriteBlock(dir, &bm, lblk, block);
+		}
+		goto out;
+	}
+
+	if(__dirReadBlock(dir, &bm, 0, root) < 0){
+		goto out;
+	}
+
+	if(!__dxIsIndex(root)){
+		if(__leafInsert(sb, root, name, inodeNum) == 0){
+			ret = __dirWriteBlock(dir, &bm, 0, root);
+			goto out;
+		}
+		// Folha única cheia: move-a para um bloco novo e cria a raiz
+		if(__dirNewBlock(dir, &bm, &lblk) < 0 ||
+		   __dirWriteBlock(dir, &bm, lblk, root) < 0){
+			goto out;
+		}
+		__dxInit(sb, root, 1);
+		__dxInsert(root, 0, lblk);
+		if(__dirWriteBlock(dir, &bm, 0, root) < 0){
+			goto out;
+		}
+	}
+
+	unsigned int hash = __dirHash(name);
+	for(int attempt = 0; attempt < DX_MAX_RETRIES; attempt++){
+		// Desce da raiz até a folha, registrando os nós visitados
+		unsigned int path[DX_MAX_DEPTH + 1];
+		unsigned int depth = __getU32(root, DX_ITEM_DEPTH);
+		unsigned int level;
+		path[0] = 0;
+		memcpy(block, root, sb->blockBytes);
+		for(level = 0; level < depth; level++){
+			path[level + 1] = __dxChild(block, __dxSearch(block, hash));
+			if(__dirReadBlock(dir, &bm, path[level + 1], block) < 0){
+				goto out;
+			}
+		}
+
+		if(__leafInsert(sb, block, name, inodeNum) == 0){
+			ret = __dirWriteBlock(dir, &bm, path[depth], block);
+			goto out;
+		}
+
+		// Folha cheia: garante espaço no nó pai antes de dividi-la
+		unsigned char *parent = root;
+		if(depth > 1){
+			parent = malloc(sb->blockBytes);
+			if(!parent || __dirReadBlock(dir, &bm, path[depth - 1], parent) < 0){
+				free(parent);
+				goto out;
+			}
+		}
+		if(__dxCount(parent) >= __dxLimit(sb)){
+			if(parent != root){
+				free(parent);
+			}
+			if(__dxSplitNode(dir, &bm, path, depth - 1, root, block) < 0 ||
+			   __dirReadBlock(dir, &bm, 0, root) < 0){
+				goto out;
+			}
+			continue;
+		}
+
+		unsigned int splitHash, newBlk;
+		if(__dirSplitLeaf(dir, &bm, block, path[depth], name, inodeNum, &splitHash, &newBlk) == 0){
+			__dxInsert(parent, splitHash, newBlk);
+			ret = __dirWriteBlock(dir, &bm, path[depth - 1], parent);
+		}
+		if(parent != root){
+			free(parent);
+		}
+		goto out;
+	}
+
+out:
+	if(__bmapDone(&bm) < 0 || __saveInode(dir->sb, dir->inode) < 0){
+		ret = -1;
+	}
+	free(root);
+	free(block);
+	if(ret == 0){
+		dcacheInsert(sb->dcache, inodeGetNumber(dir->inode), name, inodeNum);
+	}
+	return ret;
+}
+
+// Busca um inode pelo nome dentro de um diretório pai, na versão do
+// snapshot snap (0 = atual). Retorna o numero do inode se achar, ou 0 se
+// não achar. Na versão atual, o resultado, inclusive a ausência do nome,
+// fica no cache de dentries
+unsigned int __findInodeInDir(MyFSSuper *sb, unsigned int snap, unsigned int parentInodeNum, const char *name){
+
+	unsigned int found = 0;
+	if(!snap && dcacheLookup(sb->dcache, parentInodeNum, name, &found)){
+		return found;
+	}
+
+	MyOpenInode *parent = __getSnapInode(sb, snap, parentInodeNum);
+	if(!parent){
+		return 0;
+	}
+
+	if(inodeGetFileType(parent->inode) == FILETYPE_DIR){
+		found = __dirLookup(parent, name);
+	}
+	if(!snap){
+		dcacheInsert(sb->dcache, parentInodeNum, name, found);
+	}
+
+	__putOpenInode(parent);
+	return found;
+}
+
+// Retorna o número (1 a numSnaps) do snapshot de nome name, ou 0
+unsigned int __findSnapshot(MyFSSuper *sb, const char *name){
+	for(unsigned int k = 0; k < sb->numSnaps; k++){
+		if(strcmp(sb->snaps[k].name, name) == 0){
+			return k + 1;
+		}
+	}
+	return 0;
+}
+
+// Adiciona a entrada (name -> inodeNum) ao diretório pai
+// Retorna 0 ou -1 em caso de falha ou nome já existente
+int __addDirEntry(MyFSSuper *sb, unsigned int parentInodeNum, const char *name, unsigned int inodeNum){
+
+	if(name[0] == '\0' || strchr(name, '/') || strlen(name) > MAX_FILENAME_LENGTH){
+		return -1;
+	}
+
+	MyOpenInode *parent = __getOpenInode(sb, parentInodeNum);
+	if(!parent){
+		return -1;
+	}
+
+	int ret = -1;
+	if(inodeGetFileType(parent->inode) == FILETYPE_DIR){
+		ret = __dirAdd(parent, name, inodeNum);
+	}
+
+	__putOpenInode(parent);
+	return ret;
+}
+
+// Resolve um caminho e retorna o inode correspondente. Caminhos relativos
+// partem do diretório de i-node start, da versão *snap (0 = atual); com
+// start 0, só são aceitos caminhos absolutos, que partem da raiz montada.
+// Na raiz da versão atual, MYFS_SNAPDIR/nome leva à raiz do snapshot
+// nome. A versão do i-node encontrado é escrita em *snap. Retorna 0 se
+// não existir
+unsigned int __resolvePath(MyFSSuper *sb, unsigned int *snap, unsigned int start, const char *path){
+
+	if(path[0] == '/'){
+		start = 1; // Raiz é sempre 1
+		*snap = sb->rootSnap;
+	}
+	else if(start == 0){
+		return 0; // O caminho deve ser absoluto
+	}
+
+	char pathCopy[MAX_FILENAME_LENGTH + 1];
+	strncpy(pathCopy, path, MAX_FILENAME_LENGTH);
+	pathCopy[MAX_FILENAME_LENGTH] = '\0';
+
+	unsigned int currentInode = start;
+	char *save;
+	char *token = strtok_r(pathCopy, "/", &save);
+
+	while(token != NULL){
+		unsigned int nextInode;
+		if(*snap == 0 && currentInode == 1 && strcmp(token, MYFS_SNAPDIR) == 0){
+			// O componente seguinte é o nome do snapshot
+			token = strtok_r(NULL, "/", &save);
+			*snap = token ? __findSnapshot(sb, token) : 0;
+			nextInode = *snap ? 1 : 0;
+		}
+		else{
+			nextInode = __findInodeInDir(sb, *snap, currentInode, token);
+		}
+		if(nextInode == 0){
+			return 0; // Não achou parte do caminho
+		}
+
+		currentInode = nextInode;
+		token = strtok_r(NULL, "/", &save);
+	}
+
+	return currentInode;
+}
+
+// Resolve o diretório pai de um caminho, copiando o último componente
+// para name. Caminhos relativos partem do diretório de i-node start, e a
+// versão do pai é escrita em *snap, como em __resolvePath. Retorna o
+// inode do pai ou 0 se não existir
+unsigned int __resolveParent(MyFSSuper *sb, unsigned int *snap, unsigned int start, const char *path, char *name){
+
+	char pathCopy[MAX_FILENAME_LENGTH + 1];
+	strncpy(pathCopy, path, MAX_FILENAME_LENGTH);
+	pathCopy[MAX_FILENAME_LENGTH] = '\0';
+
+	// Ignora barras no final do caminho
+	size_t len = strlen(pathCopy);
+	while(len > 1 && pathCopy[len - 1] == '/'){
+		pathCopy[--len] = '\0';
+	}
+
+	char *slash = strrchr(pathCopy, '/');
+	if(!slash){
+		// Um único componente relativo: o pai é o próprio start
+		if(start == 0 || pathCopy[0] == '\0'){
+			return 0;
+		}
+		strcpy(name, pathCopy);
+		return start;
+	}
+	if(slash[1] == '\0'){
+		return 0;
+	}
+
+	strcpy(name, slash + 1);
+	if(slash == pathCopy){
+		*snap = sb->rootSnap;
+		return 1; // Pai é a raiz
+	}
+
+	*slash = '\0';
+	return __resolvePath(sb, snap, start, pathCopy);
+}
+
+// Cria um i-node do tipo fileType e o liga ao diretório parentNum com o
+// nome name. O novo i-node herda os atributos do diretório. Retorna o
+// número do novo i-node ou 0 em caso de falha
+unsigned int __createInode(MyFSSuper *sb, unsigned int parentNum, const char *name, unsigned int fileType){
+
+	// O pai fica aberto até a entrada ser adicionada
+	MyOpenInode *parent = __getOpenInode(sb, parentNum);
+	if (!parent) return 0;
+
+	// Busca um inode livre no mapa de i-nodes
+	unsigned int inodeNum = __allocInode(sb);
+	if (inodeNum == 0) goto fail;
+
+	// Para o snapshot mais recente, o i-node continua livre
+	if (__snapPreserve(sb, inodeNum) < 0) {
+		__freeInode(sb, inodeNum);
+		goto fail;
+	}
+
+	// Cria o inode
+	Inode *inode = __newInode(sb, inodeNum);
+	if (!inode) {
+		__freeInode(sb, inodeNum);
+		goto fail;
+	}
+
+	inodeSetFileType(inode, fileType);
+	inodeSetFileSize(inode, 0);
+	inodeSetOwner(inode, 0);
+	inodeSetRefCount(inode, 1);
+	__setInodeFlags(inode, __inodeFlags(parent->inode));
+
+	// Salva o inode
+	if (__saveInode(sb, inode) < 0 || __addDirEntry(sb, parentNum, name, inodeNum) < 0) {
+		__clearInode(sb, inodeNum);
+		free(inode);
+		__freeInode(sb, inodeNum);
+		goto fail;
+	}
+
+	free(inode);
+	__putOpenInode(parent);
+	return inodeNum;
+
+fail:
+	__putOpenInode(parent);
+	return 0;
+}
+
+// Abre o caminho path com o tipo fileType, criando-o se não existir, e
+// retorna um descritor de arquivo, ou -1 em caso de falha. Caminhos
+// relativos partem do diretório de i-node start (0: não aceitos), da
+// versão snap. Nada é criado em snapshots
+int __openPath(Disk *d, unsigned int snap, unsigned int start, const char *path, unsigned int fileType){
+
+	if (!d || !path) return -1;
+
+	MyFSSuper *sb = __getSuper(d);
+	if (!sb) return -1;
+
+	// Garante um slot livre
+	if (__findFreeSlot() < 0) return -1;
+
+	unsigned int inodeSnap = snap;
+	unsigned int inodeNum = __resolvePath(sb, &inodeSnap, start, path);
+
+	// O pai é necessário para criar o arquivo e, para arquivos regulares,
+	// indica onde ficam os seus fragmentos
+	char name[MAX_FILENAME_LENGTH + 1];
+	unsigned int parentSnap = snap, parentNum = 0;
+	if (inodeNum == 0 || fileType == FILETYPE_REGULAR) {
+		parentNum = __resolveParent(sb, &parentSnap, start, path, name);
+	}
+	if (inodeNum == 0) {
+		// Não existe: cria no diretório pai
+		if (parentNum == 0 || parentSnap != 0) return -1;
+
+		inodeSnap = 0;
+		inodeNum = __createInode(sb, parentNum, name, fileType);
+		if (inodeNum == 0) return -1;
+	}
+
+	MyOpenInode *oi = __getSnapInode(sb, inodeSnap, inodeNum);
+	if (!oi) return -1;
+	if (inodeGetFileType(oi->inode) != fileType) {
+		__putOpenInode(oi);
+		return -1;
+	}
+	if (parentNum != 0 && parentSnap == 0) {
+		oi->parent = parentNum;
+	}
+
+	// Configura o file handle
+	MyFileHandle *fh = __claimSlot(d, oi, inodeNum);
+	if (!fh) {
+		__putOpenInode(oi);
+		return -1;
+	}
+	sb->numOpenFiles++;
+
+	return fh->slot + 1; // FDs começam em 1
+}
+
+// Faz o i-node dst compartilhar os blocos e o fragmento de src, copiando
+// só os endereços do próprio i-node e acrescentando uma referência a cada
+// um. Os blocos indiretos levam consigo, sem E/S, todos os blocos que
+// apontam. O i-node dst não é salvo aqui. Retorna 0 ou -1
+int __shareBlocks(MyFSSuper *sb, Inode *src, Inode *dst){
+	if(__refInodeBlocks(sb, src) < 0){
+		return -1;
+	}
+	for(unsigned int k = 0; k < inodeNumBlockAddresses(); k++){
+		inodeSetBlockAddr(dst, k, inodeGetBlockAddr(src, k));
+	}
+	__setInodeTail(dst, __inodeTail(src));
+	return 0;
+}
+
+// Valida um descritor de arquivo do tipo fileType e retorna o arquivo
+// aberto correspondente
+MyFileHandle *__getTypedHandle(int fd, unsigned int fileType){
+	MyFileHandle *fh = __getHandle(fd);
+	if(!fh || inodeGetFileType(fh->oi->inode) != fileType){
+		return NULL;
+	}
+	return fh;
+}
+
+// Lê do diretório aberto em fh até max entradas a partir do cursor, que
+// guarda a posição em bytes da próxima entrada no diretório. Os blocos de
+// índice são ignorados. Retorna o número de entradas lidas ou -1
+int __readdirEntries(MyFileHandle *fh, VFSDirEntry *entries, unsigned int max){
+
+	MyOpenInode *dir = fh->oi;
+	MyFSSuper *sb = dir->sb;
+	unsigned char *block = malloc(sb->blockBytes);
+	if(!block){
+		return -1;
+	}
+
+	BlockMap bm;
+	__bmapInit(&bm, dir->inode, sb);
+
+	unsigned int count = 0;
+	int failed = 0;
+	while(count < max && fh->cursor < dir->size){
+		unsigned int lblk = fh->cursor / sb->blockBytes;
+		unsigned int pos = fh->cursor % sb->blockBytes;
+		if(__dirReadBlock(dir, &bm, lblk, block) < 0){
+			failed = 1;
+			break;
+		}
+
+		if(!__dxIsIndex(block)){
+			while(count < max &&
+			      __leafNext(sb, block, &pos, &entries[count].inumber, entries[count].name)){
+				entries[count].fileType = 0;
+				entries[count].fileSize = 0;
+				count++;
+			}
+		}
+		else{
+			pos = sb->blockBytes;
+		}
+		fh->cursor = lblk * sb->blockBytes + pos;
+	}
+
+	__bmapDone(&bm);
+	free(block);
+	return (failed && count == 0) ? -1 : (int)count;
+}
+
+// Referência de uma entrada lida ao seu i-node, para ordenar a leitura
+typedef struct {
+	unsigned int inodeNum;
+	unsigned int index;	// Posição da entrada no vetor do chamador
+} InodeRef;
+
+int __inodeRefCmp(const void *a, const void *b){
+	unsigned int na = ((const InodeRef *)a)->inodeNum;
+	unsigned int nb = ((const InodeRef *)b)->inodeNum;
+	return (na > nb) - (na < nb);
+}
+
+// Preenche o tipo e o tamanho de count entradas lidas de um diretório da
+// versão snap. I-nodes abertos são consultados em memória; os demais são
+// lidos em ordem de número, lendo cada setor da área de i-nodes uma única
+// vez. Em snapshots, cada i-node é buscado nas tabelas. Retorna 0 ou -1
+int __readdirAttrs(MyFSSuper *sb, unsigned int snap, VFSDirEntry *entries, unsigned int count){
+
+	if(snap){
+		for(unsigned int k = 0; k < count; k++){
+			Inode *inode = __snapLoadInode(sb, snap, entries[k].inumber);
+			if(!inode){
+				return -1;
+			}
+			entries[k].fileType = inodeGetFileType(inode);
+			entries[k].fileSize = inodeGetFileSize(inode);
+			free(inode);
+		}
+		return 0;
+	}
+
+	InodeRef *refs = malloc(count * sizeof(InodeRef));
+	unsigned int *numbers = malloc(count * sizeof(unsigned int));
+	Inode **inodes = malloc(count * sizeof(Inode *));
+	int ret = -1;
+	if(!refs || !numbers || !inodes){
+		goto out;
+	}
+
+	unsigned int n = 0;
+	for(unsigned int k = 0; k < count; k++){
+		MyOpenInode *oi = __findOpenInode(sb, 0, entries[k].inumber);
+		if(oi){
+			entries[k].fileType = inodeGetFileType(oi->inode);
+			entries[k].fileSize = oi->size;
+		}
+		else{
+			refs[n].inodeNum = entries[k].inumber;
+			refs[n].index = k;
+			n++;
+		}
+	}
+
+	// Todos abertos: nada a ler do disco
+	if(n == 0){
+		ret = 0;
+		goto out;
+	}
+
+	qsort(refs, n, sizeof(InodeRef), __inodeRefCmp);
+	for(unsigned int j = 0; j < n; j++){
+		numbers[j] = refs[j].inodeNum;
+	}
+
+	ret = __loadInodes(sb, numbers, n, inodes) == n ? 0 : -1;
+	for(unsigned int j = 0; j < n; j++){
+		if(inodes[j]){
+			entries[refs[j].index].fileType = inodeGetFileType(inodes[j]);
+			entries[refs[j].index].fileSize = inodeGetFileSize(inodes[j]);
+			free(inodes[j]);
+		}
+	}
+
+out:
+	free(refs);
+	free(numbers);
+	free(inodes);
+	return ret;
+}
+
+// Lê até nbytes do arquivo aberto em fh, a partir da posição offset, para
+// buf, usando o contexto de mapa de blocos bm. Retorna o número de bytes
+// lidos, que só é menor que nbytes no fim do arquivo ou em caso de falha
+unsigned int __readRange(MyFileHandle *fh, BlockMap *bm, char *buf, unsigned int nbytes, unsigned int offset){
+
+	MyOpenInode *oi = fh->oi;
+	MyFSSuper *sb = oi->sb;
+	if(offset >= oi->size){
+		return 0;
+	}
+	if(nbytes > oi->size - offset){
+		nbytes = oi->size - offset;
+	}
+
+	unsigned int done = 0;
+	while(done < nbytes){
+		unsigned int blockNum = (offset + done) / sb->blockBytes;
+		unsigned int inBlock = (offset + done) % sb->blockBytes;
+		unsigned int chunk = sb->blockBytes - inBlock;
+		if(chunk > nbytes - done){
+			chunk = nbytes - done;
+		}
+
+		// Dados pendentes em memória têm precedência sobre o disco
+		unsigned int pos;
+		int idx = __findDirty(oi, blockNum, &pos);
+		if(idx >= 0){
+			memcpy(buf + done, oi->dirty[idx].data + inBlock, chunk);
+		}
+		else if(__compressed(oi)){
+			// Clusters comprimidos são lidos e descomprimidos inteiros
+			unsigned int first = blockNum - blockNum % sb->clusterBlocks;
+			pthread_mutex_lock(&fh->lock);
+			unsigned char *cluster = __readCluster(fh, bm, first);
+			if(cluster){
+				memcpy(buf + done, cluster + (blockNum - first) * sb->blockBytes + inBlock, chunk);
+			}
+			pthread_mutex_unlock(&fh->lock);
+			if(!cluster){
+				break;
+			}
+		}
+		else if(chunk == sb->blockBytes){
+			// Blocos inteiros vão do disco direto para buf
+			unsigned int n = __readDirect(oi, bm, blockNum, (nbytes - done) / sb->blockBytes,
+			                              (unsigned char *)buf + done);
+			if(n == 0){
+				break;
+			}
+			chunk = n * sb->blockBytes;
+		}
+		else{
+			pthread_mutex_lock(&fh->lock);
+			unsigned char *block = __readBuffered(fh, bm, blockNum);
+			if(block){
+				memcpy(buf + done, block + inBlock, chunk);
+			}
+			pthread_mutex_unlock(&fh->lock);
+			if(!block){
+				break;
+			}
+		}
+
+		done += chunk;
+	}
+
+	return done;
+}
+
+// Retorna o fim do trecho de uma leitura ou escrita dos iovcnt buffers
+// de iov a partir da posição offset
+unsigned long __ioEnd(const VFSIOVec *iov, int iovcnt, unsigned int offset){
+	unsigned long end = offset;
+	for(int i = 0; i < iovcnt; i++){
+		end += iov[i].len;
+	}
+	return end;
+}
+
+// Retorna um novo dono para as travas de ioRanges de uma leitura ou
+// escrita. Cada chamada tem o seu: com o dono do descritor, chamadas
+// simultâneas pelo mesmo descritor não esperariam umas pelas outras
+unsigned long __ioOwner(void){
+	pthread_mutex_lock(&tableLock);
+	unsigned long owner = nextOwner++;
+	pthread_mutex_unlock(&tableLock);
+	return owner;
+}
+
+// Lê do arquivo aberto em fh, a partir da posição offset, para os iovcnt
+// buffers de iov, em sequência. O trecho fica travado até o fim; o i-node,
+// a cada MYFS_IO_STEP bytes, com um contexto de mapa de blocos. Retorna o
+// número de bytes lidos, 0 no fim do arquivo, ou -1
+int __readAtV(MyFileHandle *fh, const VFSIOVec *iov, int iovcnt, unsigned int offset){
+
+	MyOpenInode *oi = fh->oi;
+	unsigned long end = __ioEnd(iov, iovcnt, offset);
+	unsigned long owner = __ioOwner();
+	if(end > offset &&
+	   rangeLockAcquire(oi->ioRanges, owner, offset, end, RANGELOCK_SHARED, 1) != 0){
+		return -1;
+	}
+
+	unsigned int done = 0;
+	int eof = 0, failed = 0;
+	for(int i = 0; i < iovcnt && !eof; i++){
+		for(unsigned int pos = 0; pos < iov[i].len; ){
+			unsigned int len = iov[i].len - pos < MYFS_IO_STEP ? iov[i].len - pos : MYFS_IO_STEP;
+			pthread_rwlock_rdlock(&oi->lock);
+			BlockMap bm;
+			__bmapInit(&bm, oi->inode, oi->sb);
+			unsigned int n = __readRange(fh, &bm, (char *)iov[i].base + pos, len, offset + done);
+			__bmapDone(&bm);
+			failed = n == 0 && done == 0 && offset < oi->size;
+			pthread_rwlock_unlock(&oi->lock);
+			done += n;
+			pos += n;
+			if(n < len){
+				eof = 1;
+				break;
+			}
+		}
+	}
+
+	if(end > offset){
+		rangeLockRelease(oi->ioRanges, owner, offset, end);
+	}
+	return failed ? -1 : (int)done;
+}
+
+// Lê até nbytes do arquivo aberto em fh, a partir da posição offset, para
+// buf. Retorna o número de bytes lidos, 0 no fim do arquivo, ou -1
+int __readAt(MyFileHandle *fh, char *buf, unsigned int nbytes, unsigned int offset){
+	VFSIOVec iov = { buf, nbytes };
+	return __readAtV(fh, &iov, 1, offset);
+}
+
+// Grava até nbytes de buf no arquivo aberto em fh, a partir da posição
+// offset, usando o contexto de mapa de blocos bm. Trechos parciais de
+// bloco ficam em memória, sem bloco físico, até serem descarregados;
+// blocos inteiros são gravados direto a partir de buf, exceto em arquivos
+// comprimidos ou com deduplicação. Retorna o número de bytes gravados,
+// menor que nbytes só em caso de falha
+unsigned int __writeRange(MyOpenInode *oi, BlockMap *bm, const char *buf, unsigned int nbytes, unsigned int offset){
+
+	MyFSSuper *sb = oi->sb;
+	if(nbytes > UINT_MAX - offset){
+		nbytes = UINT_MAX - offset;
+	}
+
+	unsigned int done = 0;
+	while(done < nbytes){
+		unsigned int blockNum = (offset + done) / sb->blockBytes;
+		unsigned int inBlock = (offset + done) % sb->blockBytes;
+		unsigned int chunk = sb->blockBytes - inBlock;
+		if(chunk > nbytes - done){
+			chunk = nbytes - done;
+		}
+
+		if(chunk == sb->blockBytes && !__compressed(oi) && !__deduplicated(oi)){
+			// Blocos inteiros vão de buf direto para o disco
+			unsigned int n = __writeDirect(oi, bm, blockNum, (nbytes - done) / sb->blockBytes,
+			                               (const unsigned char *)buf + done);
+			if(n == 0){
+				break;
+			}
+			chunk = n * sb->blockBytes;
+		}
+		else{
+			// Bordas parciais, e tudo em arquivos comprimidos ou com
+			// deduplicação, ficam em memória até a descarga
+			unsigned char *data = __getDirtyBlock(oi, bm, blockNum, chunk < sb->blockBytes);
+			if(!data){
+				break;
+			}
+			memcpy(data + inBlock, buf + done, chunk);
+		}
+
+		done += chunk;
+		if(offset + done > oi->size){
+			oi->size = offset + done;
+		}
+	}
+
+	return done;
+}
+
+// Grava até len bytes de buf no i-node aberto oi, a partir da posição
+// offset, com o i-node travado de forma exclusiva. Retorna o número de
+// bytes gravados, menor que len só em caso de falha
+unsigned int __writeStep(MyOpenInode *oi, const char *buf, unsigned int len, unsigned int offset){
+
+	unsigned int n = 0;
+	pthread_rwlock_wrlock(&oi->lock);
+	if(__cowInode(oi) == 0){
+		BlockMap bm;
+		__bmapInit(&bm, oi->inode, oi->sb);
+		if(__unpackTail(oi, &bm) == 0){
+			n = __writeRange(oi, &bm, buf, len, offset);
+		}
+		__bmapDone(&bm);
+	}
+	pthread_rwlock_unlock(&oi->lock);
+	return n;
+}
+
+// Grava no arquivo aberto em fh, a partir da posição offset, o conteúdo
+// dos iovcnt buffers de iov, em sequência. O trecho fica travado até o
+// fim; o i-node, a cada MYFS_IO_STEP bytes. Retorna o número de bytes
+// gravados ou -1
+int __writeAtV(MyFileHandle *fh, const VFSIOVec *iov, int iovcnt, unsigned int offset){
+
+	MyOpenInode *oi = fh->oi;
+	unsigned long end = __ioEnd(iov, iovcnt, offset);
+	unsigned long owner = __ioOwner();
+	if(end > offset &&
+	   rangeLockAcquire(oi->ioRanges, owner, offset, end, RANGELOCK_EXCLUSIVE, 1) != 0){
+		return -1;
+	}
+
+	unsigned int done = 0, wanted = 0;
+	int stop = 0;
+	for(int i = 0; i < iovcnt && !stop; i++){
+		wanted += iov[i].len;
+		for(unsigned int pos = 0; pos < iov[i].len; ){
+			unsigned int len = iov[i].len - pos < MYFS_IO_STEP ? iov[i].len - pos : MYFS_IO_STEP;
+			unsigned int n = __writeStep(oi, (const char *)iov[i].base + pos, len, offset + done);
+			done += n;
+			pos += n;
+			if(n < len){
+				stop = 1;
+				break;
+			}
+		}
+	}
+
+	if(end > offset){
+		rangeLockRelease(oi->ioRanges, owner, offset, end);
+	}
+	return (done == 0 && wanted > 0) ? -1 : (int)done;
+}
+
+// Grava até nbytes de buf no arquivo aberto em fh, a partir da posição
+// offset. Retorna o número de bytes gravados ou -1
+int __writeAt(MyFileHandle *fh, const char *buf, unsigned int nbytes, unsigned int offset){
+	VFSIOVec iov = { (void *)buf, nbytes };
+	return __writeAtV(fh, &iov, 1, offset);
+}
+
+// myFSSync com o disco sb já travado
+int __syncSuper(MyFSSuper *sb) {
+	int ret = 0;
+	for(unsigned int i = 0, n = __openInodeSlots(); i < n; i++){
+		MyOpenInode *oi = __openInodeIn(sb, i);
+		if(!oi){
+			continue;
+		}
+		// Os fechados que esperavam o descarregador são concluídos aqui
+		int flushed = oi->closed && oi->refs == 1 ? __finishClose(oi) : __flushOpenInode(oi);
+		if(flushed < 0){
+			ret = -1;
+		}
+		else if(oi->closed){
+			__releaseClosed(oi);
+		}
+	}
+
+	if(__writeSuper(sb) < 0 || journalCommit(sb->journal) < 0){
+		ret = -1;
+	}
+	return ret;
+}
+
+// I-node com blocos sujos em um lote do descarregador, com o cilindro em
+// que os seus dados tendem a ser gravados
+typedef struct {
+	MyOpenInode *oi;
+	unsigned long cyl;	// Somado ao número de cilindros se já ficou
+				// para trás da cabeça do disco
+} FlushRef;
+
+int __flushRefCmp(const void *a, const void *b){
+	unsigned long ca = ((const FlushRef *)a)->cyl;
+	unsigned long cb = ((const FlushRef *)b)->cyl;
+	return (ca > cb) - (ca < cb);
+}
+
+// Retorna o cilindro em que os blocos sujos do i-node aberto oi tendem a
+// ser gravados: o do seu primeiro bloco ou, se ainda não tiver blocos, o de
+// onde a alocação de blocos continua
+unsigned long __flushCylinder(MyOpenInode *oi){
+	MyFSSuper *sb = oi->sb;
+	pthread_rwlock_rdlock(&oi->lock);
+	unsigned int addr = inodeGetBlockAddr(oi->inode, 0);
+	pthread_rwlock_unlock(&oi->lock);
+	if(addr == 0){
+		__metaLock(sb);
+		addr = __blockAddr(sb, sb->blockHint < sb->numBlocks ? sb->blockHint : 0);
+		__metaUnlock(sb);
+	}
+	unsigned long cyl = 0;
+	diskAddrToCylinder(sb->d, addr, &cyl);
+	return cyl;
+}
+
+// Descarrega os i-nodes abertos do disco sb que têm blocos sujos, em lotes
+// de até MYFS_FLUSH_BATCH. Cada lote é gravado em ordem de cilindro a partir
+// da cabeça do disco, de modo que a cabeça o percorre em um só sentido. Com
+// all igual a 0, para quando o total de dados sujos volta ao limiar de
+// MYFS_DIRTY_RATIO. O disco só fica travado, de forma compartilhada, durante
+// cada lote. Retorna 0 ou -1
+int __flushSuper(MyFSSuper *sb, int all){
+	int ret = 0;
+	unsigned int next = 0;
+	while(ret == 0){
+		FlushRef refs[MYFS_FLUSH_BATCH];
+		unsigned int n = 0;
+		// Com o disco travado, os i-nodes do lote não podem ser fechados
+		pthread_rwlock_rdlock(&sb->lock);
+		pthread_mutex_lock(&tableLock);
+		for(; next < numInodeSlots && n < MYFS_FLUSH_BATCH &&
+		      (all || dirtyBytesTotal > MYFS_DIRTY_BACKGROUND); next++){
+			MyOpenInode *oi = __openInodeAt(next);
+			if(oi->refs > 0 && oi->sb == sb && oi->numDirty > 0){
+				refs[n++].oi = oi;
+			}
+		}
+		pthread_mutex_unlock(&tableLock);
+		if(n == 0){
+			pthread_rwlock_unlock(&sb->lock);
+			break;
+		}
+
+		unsigned long head = diskGetCurrentCylinder(sb->d);
+		for(unsigned int k = 0; k < n; k++){
+			refs[k].cyl = __flushCylinder(refs[k].oi);
+			if(refs[k].cyl < head){
+				refs[k].cyl += diskGetNumCylinders(sb->d);
+			}
+		}
+		qsort(refs, n, sizeof(FlushRef), __flushRefCmp);
+
+		for(unsigned int k = 0; k < n && ret == 0; k++){
+			pthread_rwlock_wrlock(&refs[k].oi->lock);
+			ret = __flushOpenInode(refs[k].oi);
+			pthread_rwlock_unlock(&refs[k].oi->lock);
+		}
+		pthread_rwlock_unlock(&sb->lock);
+	}
+	return ret;
+}
+
+// Conclui os fechamentos do disco sb deixados com o descarregador. O fim
+// de cada arquivo e os seus blocos sujos vão para o disco com ele travado
+// de forma compartilhada, como em __flushSuper; só a devolução das
+// referências, que libera os i-nodes abertos, o trava de forma exclusiva.
+// Um arquivo reaberto nesse meio tempo fica com quem o reabriu. Depois de
+// uma falha, o i-node espera a próxima vez. Retorna 0 ou -1
+int __flushClosed(MyFSSuper *sb){
+	int ret = 0;
+	// Com o disco travado, nenhum deles pode ser reaberto
+	pthread_rwlock_rdlock(&sb->lock);
+	for(unsigned int i = 0, n = __openInodeSlots(); i < n; i++){
+		MyOpenInode *oi = __openInodeIn(sb, i);
+		if(oi && oi->closed && oi->refs == 1){
+			pthread_rwlock_wrlock(&oi->lock);
+			if(__finishClose(oi) < 0){
+				ret = -1;
+			}
+			pthread_rwlock_unlock(&oi->lock);
+		}
+	}
+	pthread_rwlock_unlock(&sb->lock);
+
+	pthread_rwlock_wrlock(&sb->lock);
+	for(unsigned int i = 0, n = __openInodeSlots(); i < n; i++){
+		MyOpenInode *oi = __openInodeIn(sb, i);
+		if(oi && oi->closed && (oi->refs > 1 || oi->numDirty == 0 ||
+		                        inodeGetRefCount(oi->inode) == 0)){
+			__releaseClosed(oi);
+		}
+	}
+	pthread_rwlock_unlock(&sb->lock);
+	return ret;
+}
+
+// Devolve as referências do descarregador que ainda restam no disco sb,
+// descartando os blocos sujos que não puderam ser gravados. Na
+// desmontagem, depois de __syncSuper
+void __dropClosed(MyFSSuper *sb){
+	for(unsigned int i = 0, n = __openInodeSlots(); i < n; i++){
+		MyOpenInode *oi = __openInodeIn(sb, i);
+		if(oi && oi->closed){
+			__releaseClosed(oi);
+		}
+	}
+}
+
+// Preenche deadline com o instante daqui a ms milissegundos
+void __deadline(struct timespec *deadline, unsigned int ms){
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += ms / 1000;
+	deadline->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if(deadline->tv_nsec >= 1000000000L){
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+// __commitMeta travando o disco montado sb, de forma exclusiva
+int __commitSuper(MyFSSuper *sb){
+	pthread_rwlock_wrlock(&sb->lock);
+	int ret = __commitMeta(sb);
+	pthread_rwlock_unlock(&sb->lock);
+	return ret;
+}
+
+// Descarregador do disco montado sb. A cada MYFS_FLUSH_INTERVAL
+// milissegundos, descarrega todos os blocos sujos do disco e confirma os
+// metadados no diário. Antes disso, acorda quando os dados sujos passam do
+// limiar de MYFS_DIRTY_RATIO e descarrega até voltar a ele, confirmando os
+// metadados se a transação corrente já ocupa muito do diário, e quando um
+// arquivo é fechado com blocos sujos, concluindo o fechamento. Depois de
+// uma falha, só volta no intervalo
+void *__flusherMain(void *arg){
+	MyFSSuper *sb = arg;
+	int failed = 0;
+	pthread_mutex_lock(&tableLock);
+	while(!sb->flusherStop){
+		struct timespec deadline;
+		__deadline(&deadline, MYFS_FLUSH_INTERVAL);
+		int timedOut = 0;
+		while(!sb->flusherStop && !timedOut &&
+		      (failed || ((sb->dirtyBytes == 0 || dirtyBytesTotal <= MYFS_DIRTY_BACKGROUND) &&
+		                  sb->numClosed == 0))){
+			timedOut = pthread_cond_timedwait(&sb->flushWake, &tableLock, &deadline) == ETIMEDOUT;
+		}
+		if(sb->flusherStop){
+			break;
+		}
+		pthread_mutex_unlock(&tableLock);
+		failed = __flushClosed(sb) < 0;
+		if(__flushSuper(sb, timedOut) < 0){
+			failed = 1;
+		}
+		if(!failed && (timedOut || journalNeedsCommit(sb->journal))){
+			failed = __commitSuper(sb) < 0;
+		}
+		pthread_mutex_lock(&tableLock);
+	}
+	pthread_mutex_unlock(&tableLock);
+	return NULL;
+}
+
+// Inicia o descarregador do disco montado sb. Sem ele, quem escreve
+// descarrega por conta própria ao atingir o limite
+void __startFlusher(MyFSSuper *sb){
+	sb->dirtyBytes = 0;
+	sb->numClosed = 0;
+	sb->flusherStop = 0;
+	sb->flusherOn = pthread_create(&sb->flusher, NULL, __flusherMain, sb) == 0;
+}
+
+// Para o descarregador do disco montado sb, esperando a descarga em curso
+void __stopFlusher(MyFSSuper *sb){
+	if(!sb->flusherOn){
+		return;
+	}
+	pthread_mutex_lock(&tableLock);
+	sb->flusherStop = 1;
+	pthread_cond_signal(&sb->flushWake);
+	pthread_mutex_unlock(&tableLock);
+	pthread_join(sb->flusher, NULL);
+	sb->flusherOn = 0;
+}
+
+// Segura quem escreve enquanto os dados sujos estão acima de
+// MYFS_MAX_DIRTY_BYTES, até que os descarregadores os tragam de volta. Se
+// nenhum deles avança em MYFS_FLUSH_INTERVAL milissegundos, quem escreve
+// descarrega por conta própria. Chamada sem travas
+void __throttleWriter(void){
+	int stalled = 0;
+	pthread_mutex_lock(&tableLock);
+	while(dirtyBytesTotal > MYFS_MAX_DIRTY_BYTES && !stalled){
+		for(int i = 0; i < MYFS_MAX_MOUNTS; i++){
+			pthread_cond_signal(&mounts[i].flushWake);
+		}
+		struct timespec deadline;
+		__deadline(&deadline, MYFS_FLUSH_INTERVAL);
+		stalled = pthread_cond_timedwait(&dirtyCond, &tableLock, &deadline) == ETIMEDOUT;
+	}
+	pthread_mutex_unlock(&tableLock);
+	if(stalled){
+		__relieveMemoryPressure();
+	}
+}
+
+//Funcao para verificacao se o sistema de arquivos está ocioso, ou seja,
+//se nao ha quisquer descritores de arquivos em uso atualmente. Retorna
+//um positivo se ocioso ou, caso contrario, 0.
+int myFSIsIdle (Disk *d) {
+
+	MyFSSuper *sb = __getSuper(d);
+	return !sb || sb->numOpenFiles == 0;
+}
+
+//Funcao para formatacao de um disco com o novo sistema de arquivos
+//com tamanho de blocos igual a blockSize. Retorna o numero total de
+//blocos disponiveis no disco, se formatado com sucesso. Caso contrario,
+//retorna -1.
+//blockSize e' dado em bytes e deve corresponder a uma potencia de 2 de
+//setores, de 1 ate MYFS_MAX_SECTORSPERBLOCK
+int myFSFormat (Disk *d, unsigned int blockSize) {
+
+	unsigned int spb = blockSize / DISK_SECTORDATASIZE;
+	if(blockSize % DISK_SECTORDATASIZE != 0 || spb == 0 ||
+	   spb > MYFS_MAX_SECTORSPERBLOCK || (spb & (spb - 1)) != 0){
+		return -1;
+	}
+
+	// Layout: setor 0 reservado, superbloco, i-nodes, referências de blocos,
+	// mapa de i-nodes, impressões digitais dos blocos, diário e área de
+	// dados alinhada ao tamanho do bloco.
+	// O diário fica entre os metadados e os dados, perto de ambos
+	MyFSSuper sb;
+	memset(&sb, 0, sizeof(sb));
+	sb.d = d;
+	sb.magic = MYFS_MAGIC;
+	sb.version = MYFS_VERSION;
+	sb.sectorsPerBlock = spb;
+	sb.inodeStart = inodeAreaBeginSector();
+	sb.inodeSectors = diskGetNumSectors(d) / MYFS_SECTORS_PER_INODE /
+	                  inodeNumInodesPerSector();
+	if(sb.inodeSectors == 0){
+		return -1;
+	}
+	sb.numInodes = sb.inodeSectors * inodeNumInodesPerSector();
+
+	unsigned int mapStart = sb.inodeStart + sb.inodeSectors;
+	unsigned int inodeMapSectors = (sb.numInodes + MYFS_BITS_PER_SECTOR - 1) /
+	                               MYFS_BITS_PER_SECTOR;
+	// As tabelas de referências e de impressões são dimensionadas pelo
+	// disco inteiro, o que basta para cobrir a área de dados que vem depois
+	unsigned int blockRefSectors = (diskGetNumSectors(d) / spb +
+	                                MYFS_REFS_PER_SECTOR - 1) / MYFS_REFS_PER_SECTOR;
+	unsigned int printStart = mapStart + blockRefSectors + inodeMapSectors;
+	unsigned int printSectors = (diskGetNumSectors(d) / spb +
+	                             MYFS_PRINTS_PER_SECTOR - 1) / MYFS_PRINTS_PER_SECTOR;
+	sb.journalStart = printStart + printSectors;
+	sb.journalSectors = diskGetNumSectors(d) / MYFS_SECTORS_PER_JOURNAL;
+	if(sb.journalSectors > MYFS_MAX_JOURNAL_SECTORS){
+		sb.journalSectors = MYFS_MAX_JOURNAL_SECTORS;
+	}
+	if(sb.journalSectors < JOURNAL_MIN_SECTORS){
+		sb.journalSectors = JOURNAL_MIN_SECTORS;
+	}
+	unsigned int metaEnd = sb.journalStart + sb.journalSectors;
+	sb.dataStart = (metaEnd + spb - 1) / spb * spb;
+	if(diskGetNumSectors(d) < sb.dataStart + spb){
+		return -1;
+	}
+	sb.numBlocks = (diskGetNumSectors(d) - sb.dataStart) / spb;
+	sb.freeBlocks = sb.numBlocks;
+	sb.freeInodes = sb.numInodes;
+
+	if(__superDerive(&sb) < 0 ||
+	   __refsInit(&sb.blockRefs, mapStart, sb.numBlocks) < 0 ||
+	   __printsInit(&sb.blockPrints, printStart, sb.numBlocks) < 0 ||
+	   __bitmapInit(&sb.inodeMap, mapStart + blockRefSectors, sb.numInodes) < 0){
+		__freeSuper(&sb);
+		return -1;
+	}
+
+	// Zera a área de i-nodes. Um i-node só passa a existir quando alocado
+	// e criado com inodeCreate
+	unsigned char buffer[DISK_SECTORDATASIZE];
+	memset(buffer, 0, DISK_SECTORDATASIZE);
+	for(unsigned int s = 0; s < sb.inodeSectors; s++){
+		if(diskWriteSector(d, sb.inodeStart + s, buffer) < 0){
+			__freeSuper(&sb);
+			return -1;
+		}
+	}
+
+	// Sem diário aberto, a formatação grava tudo direto nos lugares
+	if(journalFormat(d, sb.journalStart, sb.journalSectors) < 0){
+		__freeSuper(&sb);
+		return -1;
+	}
+
+	// Cria o Inode raiz (Inode 1)
+	__bitmapSet(&sb.inodeMap, 0, 1);
+	sb.freeInodes--;
+	sb.inodeHint = 1;
+
+	Inode *root = inodeCreate(1, d);
+	if(!root){
+		__freeSuper(&sb);
+		return -1;
+	}
+
+	inodeSetFileType(root, FILETYPE_DIR);
+	inodeSetFileSize(root, 0);
+	inodeSetOwner(root, 0); // Usuário root
+	inodeSetRefCount(root, 1);
+	inodeSave(root);
+	free(root);
+
+	// Grava o superbloco e as tabelas inteiras
+	memset(sb.blockRefs.dirty, 1, sb.blockRefs.sectors);
+	memset(sb.blockPrints.dirty, 1, sb.blockPrints.sectors);
+	memset(sb.inodeMap.dirty, 1, sb.inodeMap.sectors);
+	sb.dirty = 1;
+	int ret = __writeSuper(&sb);
+	__freeSuper(&sb);
+	if(ret < 0){
+		return -1;
+	}
+
+	// Retorna numero total de blocos
+	return sb.numBlocks;
+}
+
+//Funcao para sincronizacao do sistema de arquivos montado no disco d,
+//descarregando os dados pendentes de todos os arquivos abertos e gravando
+//o superbloco. Os metadados alterados desde a última sincronização, de
+//todas as operações, são confirmados juntos no diário, em uma única
+//escrita sequencial. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSSync (Disk *d) {
+	MyFSSuper *sb = __lockSuper(d, MYFS_LOCK_META);
+	int ret = sb ? __syncSuper(sb) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+//Funcao que preenche stats com as informacoes do sistema de arquivos
+//montado no disco d, a partir do superbloco em memoria. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario.
+int myFSStatfs (Disk *d, FSStats *stats) {
+	MyFSSuper *sb = stats ? __lockSuper(d, MYFS_LOCK_READ) : NULL;
+	if(!sb){
+		return -1;
+	}
+	__metaLock(sb);
+	stats->blockSize = sb->blockBytes;
+	stats->totalBlocks = sb->numBlocks;
+	stats->freeBlocks = sb->freeBlocks;
+	stats->totalInodes = sb->numInodes;
+	stats->freeInodes = sb->freeInodes;
+	__metaUnlock(sb);
+	__unlockSuper(sb);
+	return 0;
+}
+
+// myFSSnapshot com o disco já travado
+int __myFSSnapshot (Disk *d, const char *name) {
+
+	MyFSSuper *sb = __getSuper(d);
+	if(!sb || sb->rootSnap || !name || name[0] == '\0' || strchr(name, '/') ||
+	   strlen(name) > MYFS_SNAPNAME_LENGTH || __findSnapshot(sb, name) ||
+	   sb->numSnaps == MYFS_MAX_SNAPSHOTS){
+		return -1;
+	}
+
+	// O snapshot inclui tudo que já foi escrito
+	if(__syncSuper(sb) < 0){
+		return -1;
+	}
+
+	// A tabela de versões preservadas começa vazia (só buracos)
+	unsigned int tableNum = __allocInode(sb);
+	if(tableNum == 0){
+		return -1;
+	}
+	Inode *table = __newInode(sb, tableNum);
+	if(!table){
+		__freeInode(sb, tableNum);
+		return -1;
+	}
+	inodeSetFileType(table, MYFS_FILETYPE_SNAPTABLE);
+	inodeSetRefCount(table, 1);
+	int ret = __saveInode(sb, table);
+	free(table);
+	if(ret < 0){
+		__freeInode(sb, tableNum);
+		return -1;
+	}
+
+	MyFSSnapshot *snap = &sb->snaps[sb->numSnaps++];
+	snap->table = tableNum;
+	memset(snap->name, 0, sizeof(snap->name));
+	strcpy(snap->name, name);
+	sb->snapGen++;
+	sb->dirty = 1;
+	return __writeSuper(sb);
+}
+
+//Funcao para criacao de um snapshot, de nome name, do sistema de arquivos
+//montado no disco d. Os dados pendentes sao persistidos e a arvore atual e'
+//congelada, sem copia: blocos e i-nodes so' sao copiados quando alterados
+//depois. O snapshot e' acessivel, somente para leitura, em /.snap/name.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSSnapshot (Disk *d, const char *name) {
+	MyFSSuper *sb = __lockSuper(d, MYFS_LOCK_META);
+	int ret = sb ? __myFSSnapshot(d, name) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// Remove o snapshot snap, liberando as versões preservadas que nenhum
+// outro snapshot usa. Uma versão ausente do snapshot anterior é vista por
+// ele através desta tabela e, por isso, é transferida para a dele, com as
+// referências que carrega. Retorna 0 ou -1
+int __snapDelete(MyFSSuper *sb, unsigned int snap){
+
+	unsigned int size = inodeRecordSize();
+	unsigned char *block = malloc(sb->blockBytes);
+	unsigned char *prev = malloc(size);
+	Inode *table = __loadInode(sb, sb->snaps[snap - 1].table);
+	int ret = -1;
+	if(!block || !prev || !table){
+		goto out;
+	}
+
+	ret = 0;
+	BlockMap bm;
+	__bmapInit(&bm, table, sb);
+	unsigned int lastBlock = inodeGetFileSize(table) / sb->blockBytes;
+	for(unsigned int lblk = 0; lblk < lastBlock && ret == 0; ){
+		unsigned int addr = __bmapGet(&bm, lblk);
+		if(addr == 0){
+			lblk = __bmapNextMapped(&bm, lblk);
+			continue;
+		}
+		if(__readBlock(sb, addr, block) < 0){
+			ret = -1;
+			break;
+		}
+		for(unsigned int off = 0; off + size <= sb->blockBytes && ret == 0; off += size){
+			unsigned char *record = block + off;
+			unsigned int inodeNum = ((unsigned long)lblk * sb->blockBytes + off) / size + 1;
+			int used = 0;
+			for(unsigned int k = 0; k < size && !used; k++){
+				used = record[k] != 0;
+			}
+			if(!used){
+				continue;
+			}
+
+			int found = snap > 1 ? __snapReadRecord(sb, snap - 1, inodeNum, prev) : 1;
+			if(found < 0){
+				ret = -1;
+			}
+			else if(!found){
+				ret = __snapWriteRecord(sb, snap - 1, inodeNum, record);
+			}
+			else{
+				Inode *inode = inodeDecode(inodeNum, sb->d, record);
+				if(!inode){
+					ret = -1;
+				}
+				else{
+					__freeInodeBlocks(sb, inode);
+					free(inode);
+				}
+			}
+		}
+		lblk++;
+	}
+	__bmapDone(&bm);
+
+	if(ret == 0){
+		__freeInodeBlocks(sb, table);
+		__clearInode(sb, sb->snaps[snap - 1].table);
+		__freeInode(sb, sb->snaps[snap - 1].table);
+		memmove(&sb->snaps[snap - 1], &sb->snaps[snap],
+		        (sb->numSnaps - snap) * sizeof(MyFSSnapshot));
+		sb->numSnaps--;
+		memset(&sb->snaps[sb->numSnaps], 0, sizeof(MyFSSnapshot));
+		sb->dirty = 1;
+		ret = __writeSuper(sb);
+	}
+
+out:
+	free(block);
+	free(prev);
+	free(table);
+	return ret;
+}
+
+// myFSDeleteSnapshot com o disco já travado
+int __myFSDeleteSnapshot (Disk *d, const char *name) {
+
+	MyFSSuper *sb = __getSuper(d);
+	if(!sb || sb->rootSnap || !name){
+		return -1;
+	}
+	unsigned int snap = __findSnapshot(sb, name);
+	if(snap == 0){
+		return -1;
+	}
+
+	// Os snapshots seguintes mudam de número
+	for(unsigned int i = 0, n = __openInodeSlots(); i < n; i++){
+		MyOpenInode *oi = __openInodeIn(sb, i);
+		if(oi && oi->snap){
+			return -1;
+		}
+	}
+	return __snapDelete(sb, snap);
+}
+
+//Funcao para remocao do snapshot de nome name do sistema de arquivos
+//montado no disco d, liberando os blocos e i-nodes preservados apenas por
+//ele. Nao pode haver arquivos ou diretorios de snapshots abertos. Retorna 0
+//caso bem sucedido, ou -1 caso contrario.
+int myFSDeleteSnapshot (Disk *d, const char *name) {
+	MyFSSuper *sb = __lockSuper(d, MYFS_LOCK_META);
+	int ret = sb ? __myFSDeleteSnapshot(d, name) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+//Funcao para montagem/desmontagem do sistema de arquivos, se possível.
+//Na montagem (x=1) e' a chance de se fazer inicializacoes, como carregar
+//o superbloco na memoria. Na desmontagem (x=0), quaisquer dados pendentes
+//de gravacao devem ser persistidos no disco. Retorna um positivo se a
+//montagem ou desmontagem foi bem sucedida ou, caso contrario, 0.
+int myFSxMount(Disk *d, int x) {
+    if (!d) return 0;
+
+    if (x == 1) { // Montagem
+        if (__getSuper(d)) return 0; // Já montado
+
+        // Carrega o superbloco, as referências de blocos e o mapa de i-nodes
+        MyFSSuper *sb = __getSuper(NULL);
+        if (!sb || __readSuper(d, sb) < 0) return 0;
+        __startFlusher(sb);
+
+        // Inicializa tabela de arquivos abertos
+        for (unsigned int i = 0; i < numFileSlots; i++) {
+            if (__fileAt(i)->used && __fileAt(i)->d == d) {
+                __releaseHandle(__fileAt(i));
+            }
+        }
+        sb->numOpenFiles = 0;
+        return 1;
+    }
+
+    if (x == 0) { // Desmontagem
+        MyFSSuper *sb = __getSuper(d);
+        if (!sb) return 0;
+        __stopFlusher(sb);
+        int ok = __syncSuper(sb) == 0 && journalCheckpoint(sb->journal) == 0;
+        __dropClosed(sb);
+        __freeSuper(sb);
+        return ok;
+    }
+
+    return 0;
+}
+
+//Funcao para montagem, somente para leitura, do snapshot de nome name do
+//sistema de arquivos do disco d, cuja raiz passa a ser a raiz do snapshot.
+//A desmontagem e' feita como a de qualquer montagem. Retorna um positivo se
+//a montagem foi bem sucedida ou, caso contrario, 0.
+int myFSxMountSnapshot (Disk *d, const char *name) {
+	if (!d || !name || !myFSxMount(d, 1)) return 0;
+
+	MyFSSuper *sb = __getSuper(d);
+	sb->rootSnap = __findSnapshot(sb, name);
+	if (sb->rootSnap == 0) {
+		myFSxMount(d, 0);
+		return 0;
+	}
+	return 1;
+}
+
+//Funcao para abertura de um arquivo, a partir do caminho especificado
+//em path, no disco montado especificado em d, no modo Read/Write,
+//criando o arquivo se nao existir. Retorna um descritor de arquivo,
+//em caso de sucesso. Retorna -1, caso contrario.
+int myFSOpen(Disk *d, const char *path) {
+	MyFSSuper *sb = __lockSuper(d, MYFS_LOCK_META);
+	int ret = sb ? __openPath(d, 0, 0, path, FILETYPE_REGULAR) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// Reserva, para uma leitura ou escrita de até nbytes pelo cursor de fh, o
+// trecho que começa no cursor, que já passa para o fim dele. Operações
+// simultâneas no mesmo descritor usam trechos seguidos sem que ele fique
+// travado durante a E/S. Retorna o início do trecho
+unsigned int __cursorReserve(MyFileHandle *fh, unsigned int *nbytes){
+	pthread_mutex_lock(&fh->lock);
+	unsigned int offset = fh->cursor;
+	if(*nbytes > UINT_MAX - offset){
+		*nbytes = UINT_MAX - offset;
+	}
+	fh->cursor = offset + *nbytes;
+	pthread_mutex_unlock(&fh->lock);
+	return offset;
+}
+
+// Devolve a parte não usada do trecho de nbytes reservado em offset por
+// __cursorReserve, do qual a operação transferiu ret bytes (-1 = nenhum).
+// Se outra operação já reservou o trecho seguinte, o cursor fica onde está
+void __cursorRelease(MyFileHandle *fh, unsigned int offset, unsigned int nbytes, int ret){
+	pthread_mutex_lock(&fh->lock);
+	if(fh->cursor == offset + nbytes){
+		fh->cursor = offset + (ret > 0 ? (unsigned int)ret : 0);
+	}
+	pthread_mutex_unlock(&fh->lock);
+}
+
+//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
+//existente. Os dados devem ser lidos a partir da posicao atual do cursor
+//e copiados para buf. Terao tamanho maximo de nbytes. Ao fim, o cursor
+//deve ter posicao atualizada para que a proxima operacao ocorra a partir
+//do próximo byte apos o ultimo lido. Retorna o numero de bytes
+//efetivamente lidos em caso de sucesso ou -1, caso contrario.
+int myFSRead (int fd, char *buf, unsigned int nbytes) {
+
+	MyFileHandle *fh = buf ? __lockHandle(fd, MYFS_LOCK_DATA) : NULL;
+	if(!fh){
+		return -1;
+	}
+
+	unsigned int offset = __cursorReserve(fh, &nbytes);
+	int ret = __readAt(fh, buf, nbytes, offset);
+	__cursorRelease(fh, offset, nbytes, ret);
+	__unlockHandle(fh, MYFS_LOCK_DATA);
+	return ret;
+}
+
+//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
+//existente. Os dados de buf sao copiados para o disco a partir da posição
+//atual do cursor e terao tamanho maximo de nbytes. Ao fim, o cursor deve
+//ter posicao atualizada para que a proxima operacao ocorra a partir do
+//proximo byte apos o ultimo escrito. Retorna o numero de bytes
+//efetivamente escritos em caso de sucesso ou -1, caso contrario
+int myFSWrite (int fd, const char *buf, unsigned int nbytes) {
+
+	MyFileHandle *fh = buf ? __lockHandle(fd, MYFS_LOCK_DATA) : NULL;
+	if(!fh){
+		return -1;
+	}
+
+	unsigned int offset = __cursorReserve(fh, &nbytes);
+	int ret = __writeAt(fh, buf, nbytes, offset);
+	__cursorRelease(fh, offset, nbytes, ret);
+	__unlockHandle(fh, MYFS_LOCK_DATA);
+	__throttleWriter();
+	return ret;
+}
+
+//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. Os dados sao copiados para buf e terao
+//tamanho maximo de nbytes. O cursor do descritor nao e' alterado. Retorna
+//o numero de bytes efetivamente lidos em caso de sucesso ou -1, caso
+//contrario.
+int myFSPread (int fd, char *buf, unsigned int nbytes, unsigned int offset) {
+
+	MyFileHandle *fh = buf ? __lockHandle(fd, MYFS_LOCK_DATA) : NULL;
+	if(!fh){
+		return -1;
+	}
+	int ret = __readAt(fh, buf, nbytes, offset);
+	__unlockHandle(fh, MYFS_LOCK_DATA);
+	return ret;
+}
+
+//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. Os dados de buf sao copiados para o disco e
+//terao tamanho maximo de nbytes. O cursor do descritor nao e' alterado.
+//Retorna o numero de bytes efetivamente escritos em caso de sucesso ou -1,
+//caso contrario.
+int myFSPwrite (int fd, const char *buf, unsigned int nbytes, unsigned int offset) {
+
+	MyFileHandle *fh = buf ? __lockHandle(fd, MYFS_LOCK_DATA) : NULL;
+	if(!fh){
+		return -1;
+	}
+	int ret = __writeAt(fh, buf, nbytes, offset);
+	__unlockHandle(fh, MYFS_LOCK_DATA);
+	__throttleWriter();
+	return ret;
+}
+
+//Funcao para a leitura vetorial de um arquivo, a partir de um descritor de
+//arquivo existente. Os dados sao lidos a partir da posicao atual do cursor
+//e distribuidos, em ordem, pelos iovcnt buffers de iov. Ao fim, o cursor
+//avanca o numero de bytes lidos. Retorna o numero de bytes efetivamente
+//lidos em caso de sucesso ou -1, caso contrario.
+int myFSReadv (int fd, const VFSIOVec *iov, int iovcnt) {
+
+	MyFileHandle *fh = iov && iovcnt >= 0 ? __lockHandle(fd, MYFS_LOCK_DATA) : NULL;
+	if(!fh){
+		return -1;
+	}
+
+	unsigned long total = __ioEnd(iov, iovcnt, 0);
+	unsigned int nbytes = total < UINT_MAX ? (unsigned int)total : UINT_MAX;
+	unsigned int offset = __cursorReserve(fh, &nbytes);
+	int ret = __readAtV(fh, iov, iovcnt, offset);
+	__cursorRelease(fh, offset, nbytes, ret);
+	__unlockHandle(fh, MYFS_LOCK_DATA);
+	return ret;
+}
+
+//Funcao para a escrita vetorial de um arquivo, a partir de um descritor de
+//arquivo existente. O conteudo dos iovcnt buffers de iov e' gravado, em
+//ordem, a partir da posicao atual do cursor. Ao fim, o cursor avanca o
+//numero de bytes escritos. Retorna o numero de bytes efetivamente escritos
+//em caso de sucesso ou -1, caso contrario.
+int myFSWritev (int fd, const VFSIOVec *iov, int iovcnt) {
+
+	MyFileHandle *fh = iov && iovcnt >= 0 ? __lockHandle(fd, MYFS_LOCK_DATA) : NULL;
+	if(!fh){
+		return -1;
+	}
+
+	unsigned long total = __ioEnd(iov, iovcnt, 0);
+	unsigned int nbytes = total < UINT_MAX ? (unsigned int)total : UINT_MAX;
+	unsigned int offset = __cursorReserve(fh, &nbytes);
+	int ret = __writeAtV(fh, iov, iovcnt, offset);
+	__cursorRelease(fh, offset, nbytes, ret);
+	__unlockHandle(fh, MYFS_LOCK_DATA);
+	__throttleWriter();
+	return ret;
+}
+
+//Funcao para reposicionar o cursor de um arquivo, a partir de um descritor
+//de arquivo existente. A nova posicao e' offset somado 'a referencia
+//indicada por whence: o inicio do arquivo (VFS_SEEK_SET), o cursor atual
+//(VFS_SEEK_CUR) ou o fim do arquivo (VFS_SEEK_END). Com VFS_SEEK_DATA e
+//VFS_SEEK_HOLE, a nova posicao e' o primeiro byte com dados ou de um
+//buraco a partir de offset. Retorna a nova posicao em caso de sucesso ou
+//-1, caso contrario.
+long myFSLseek (int fd, long offset, int whence) {
+
+	MyFileHandle *fh = __lockHandle(fd, MYFS_LOCK_READ);
+	if(!fh){
+		return -1;
+	}
+
+	MyOpenInode *oi = fh->oi;
+	long pos;
+	switch(whence){
+		case VFS_SEEK_SET:
+			pos = offset;
+			break;
+		case VFS_SEEK_CUR:
+			pos = (long)fh->cursor + offset;
+			break;
+		case VFS_SEEK_END:
+			pos = (long)oi->size + offset;
+			break;
+		case VFS_SEEK_DATA:
+		case VFS_SEEK_HOLE:
+			// Não há dados nem buracos além do fim do arquivo
+			if(offset < 0 || offset >= (long)oi->size){
+				pos = -1;
+				break;
+			}
+			pos = whence == VFS_SEEK_DATA ? __seekData(oi, offset) : __seekHole(oi, offset);
+			break;
+		default:
+			pos = -1;
+	}
+
+	if(pos < 0 || pos > (long)UINT_MAX){
+		pos = -1;
+	}
+	else{
+		fh->cursor = (unsigned int)pos;
+	}
+	__unlockHandle(fh, MYFS_LOCK_READ);
+	return pos;
+}
+
+// myFSClone com o disco já travado
+int __myFSClone (int fd, const char *path) {
+
+	MyFileHandle *fh = __getTypedHandle(fd, FILETYPE_REGULAR);
+	if(!fh || !path){
+		return -1;
+	}
+
+	MyFSSuper *sb = fh->oi->sb;
+	char name[MAX_FILENAME_LENGTH + 1];
+	unsigned int snap = 0;
+	if(__findFreeSlot() < 0 || __resolvePath(sb, &snap, 0, path) != 0){
+		return -1;
+	}
+	unsigned int parentNum = __resolveParent(sb, &snap, 0, path, name);
+	if(parentNum == 0 || snap != 0){
+		return -1;
+	}
+
+	// Dados pendentes do original vão ao disco para serem compartilhados
+	if(__flushOpenInode(fh->oi) < 0){
+		return -1;
+	}
+
+	unsigned int inodeNum = __createInode(sb, parentNum, name, FILETYPE_REGULAR);
+	if(inodeNum == 0){
+		return -1;
+	}
+	MyOpenInode *clone = __getOpenInode(sb, inodeNum);
+	if(!clone){
+		return -1;
+	}
+
+	// O clone herda também o formato dos dados do original
+	int ret = __shareBlocks(sb, fh->oi->inode, clone->inode);
+	if(ret == 0){
+		__setInodeFlags(clone->inode, __inodeFlags(fh->oi->inode));
+		clone->size = fh->oi->size;
+		inodeSetFileSize(clone->inode, clone->size);
+		ret = __saveInode(sb, clone->inode);
+	}
+	__putOpenInode(clone);
+	if(ret < 0){
+		return -1;
+	}
+
+	return __openPath(fh->d, 0, 0, path, FILETYPE_REGULAR);
+}
+
+//Funcao para clonagem de um arquivo, a partir de um descritor de arquivo
+//existente. Cria o arquivo indicado pelo caminho absoluto path, que nao
+//pode existir, com o mesmo conteudo, compartilhando os blocos de dados do
+//original: so' o i-node do clone e' gravado. Blocos compartilhados sao
+//copiados apenas quando um dos arquivos os altera. Retorna um descritor
+//para o clone, em caso de sucesso. Retorna -1, caso contrario.
+int myFSClone (int fd, const char *path) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSClone(fd, path) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+//Funcao que copia para flags os atributos (VFS_FLAG_*) do arquivo ou
+//diretorio identificado por um descritor existente. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int myFSGetFlags (int fd, unsigned int *flags) {
+	MyFileHandle *fh = flags ? __lockHandle(fd, MYFS_LOCK_READ) : NULL;
+	if(!fh){
+		return -1;
+	}
+	*flags = __inodeFlags(fh->oi->inode);
+	__unlockHandle(fh, MYFS_LOCK_READ);
+	return 0;
+}
+
+// myFSSetFlags com o disco já travado
+int __myFSSetFlags (int fd, unsigned int flags) {
+
+	MyFileHandle *fh = __getHandle(fd);
+	if(!fh || (flags & ~MYFS_FLAGS)){
+		return -1;
+	}
+
+	MyOpenInode *oi = fh->oi;
+	unsigned int old = __inodeFlags(oi->inode);
+	if(old == flags){
+		return 0;
+	}
+	if(inodeGetFileType(oi->inode) == FILETYPE_REGULAR &&
+	   ((old ^ flags) & VFS_FLAG_COMPRESS) && oi->size > 0){
+		return -1;
+	}
+	if(__cowInode(oi) < 0){
+		return -1;
+	}
+
+	// Os buffers de leitura dos descritores dependem do formato
+	__setInodeFlags(oi->inode, flags);
+	pthread_mutex_lock(&tableLock);
+	for(unsigned int i = 0; i < numFileSlots; i++){
+		MyFileHandle *other = __fileAt(i);
+		if(other->used && other->oi == oi){
+			free(other->buf);
+			other->buf = NULL;
+			other->bufValid = 0;
+		}
+	}
+	pthread_mutex_unlock(&tableLock);
+	return __saveInode(oi->sb, oi->inode);
+}
+
+//Funcao que altera os atributos (VFS_FLAG_*) do arquivo ou diretorio
+//identificado por um descritor existente. Arquivos e diretorios criados
+//depois em um diretorio herdam seus atributos. Um arquivo regular so'
+//pode ligar ou desligar a compressao enquanto esta vazio, ja que os dados
+//gravados mantem seu formato. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario.
+int myFSSetFlags (int fd, unsigned int flags) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSSetFlags(fd, flags) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSClose com o disco já travado
+int __myFSClose (int fd) {
+
+	MyFileHandle *fh = __getHandle(fd);
+	if(!fh){
+		return -1;
+	}
+
+	// No último descritor, com blocos sujos, o i-node aberto fica com o
+	// descarregador, que conclui o fechamento (__flushClosed). Sem ele, o
+	// fechamento é concluído aqui
+	MyOpenInode *oi = fh->oi;
+	MyFSSuper *sb = oi->sb;
+	int ret = 0, later = 0;
+	if(oi->refs == 1 && oi->numDirty > 0 && inodeGetRefCount(oi->inode) > 0){
+		if(sb->flusherOn){
+			pthread_mutex_lock(&tableLock);
+			oi->closed = 1;
+			sb->numClosed++;
+			pthread_cond_signal(&sb->flushWake);
+			pthread_mutex_unlock(&tableLock);
+			later = 1;
+		}
+		else{
+			ret = __finishClose(oi);
+		}
+	}
+
+	rangeLockReleaseAll(oi->locks, fh->owner);
+	if(!later){
+		__putOpenInode(oi);
+	}
+	__releaseHandle(fh);
+	return ret;
+}
+
+// Retorna o fim do trecho de len bytes a partir de offset (len 0: até o
+// fim do arquivo, mesmo que ele cresça)
+unsigned long __lockEnd(unsigned int offset, unsigned int len){
+	return len ? (unsigned long)offset + len : RANGELOCK_END;
+}
+
+//Funcao que trava, de forma consultiva, o trecho de len bytes a partir de
+//offset (len 0: ate' o fim do arquivo) do arquivo identificado por um
+//descritor existente. type e' VFS_LOCK_SHARED ou VFS_LOCK_EXCLUSIVE, somado
+//a VFS_LOCK_NOWAIT para nao esperar por travas de outros descritores. As
+//travas nao impedem leituras e escritas e sao liberadas com o descritor.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSLockRange (int fd, unsigned int offset, unsigned int len, int type) {
+
+	int wait = !(type & VFS_LOCK_NOWAIT);
+	type &= ~VFS_LOCK_NOWAIT;
+	if(type != VFS_LOCK_SHARED && type != VFS_LOCK_EXCLUSIVE){
+		return -1;
+	}
+	type = type == VFS_LOCK_EXCLUSIVE ? RANGELOCK_EXCLUSIVE : RANGELOCK_SHARED;
+	unsigned long end = __lockEnd(offset, len);
+
+	MyFileHandle *fh = __lockHandle(fd, MYFS_LOCK_READ);
+	if(!fh){
+		return -1;
+	}
+	MyOpenInode *oi = fh->oi;
+	unsigned long owner = fh->owner;
+	int ret = rangeLockAcquire(oi->locks, owner, offset, end, type, 0);
+	if(ret != 1 || !wait){
+		__unlockHandle(fh, MYFS_LOCK_READ);
+		return ret == 0 ? 0 : -1;
+	}
+
+	// A espera é feita sem travas, para que quem tem o trecho possa
+	// liberá-lo, até fechando o descritor. A referência extra mantém o
+	// i-node aberto enquanto isso
+	pthread_mutex_lock(&tableLock);
+	oi->refs++;
+	pthread_mutex_unlock(&tableLock);
+	Disk *d = fh->d;
+	__unlockHandle(fh, MYFS_LOCK_READ);
+	ret = rangeLockAcquire(oi->locks, owner, offset, end, type, 1);
+
+	// Se o descritor foi fechado durante a espera, a trava não tem dono
+	MyFSSuper *sb = __lockSuper(d, MYFS_LOCK_META);
+	if(ret == 0 && (__handleDisk(fd, fh) != d || fh->owner != owner)){
+		rangeLockRelease(oi->locks, owner, offset, end);
+		ret = -1;
+	}
+	__putOpenInode(oi);
+	__unlockSuper(sb);
+	return ret == 0 ? 0 : -1;
+}
+
+//Funcao que libera as travas do descritor existente fd no trecho de len
+//bytes a partir de offset (len 0: ate' o fim do arquivo), mesmo que so' em
+//parte dele. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSUnlockRange (int fd, unsigned int offset, unsigned int len) {
+	MyFileHandle *fh = __lockHandle(fd, MYFS_LOCK_READ);
+	if(!fh){
+		return -1;
+	}
+	int ret = rangeLockRelease(fh->oi->locks, fh->owner, offset, __lockEnd(offset, len));
+	__unlockHandle(fh, MYFS_LOCK_READ);
+	return ret;
+}
+
+//Funcao para fechar um arquivo, a partir de um descritor de arquivo
+//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
+int myFSClose (int fd) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSClose(fd) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+//Funcao para abertura de um diretorio, a partir do caminho
+//especificado em path, no disco indicado por d, no modo Read/Write,
+//criando o diretorio se nao existir. Retorna um descritor de arquivo,
+//em caso de sucesso. Retorna -1, caso contrario.
+int myFSOpendir (Disk *d, const char *path) {
+	MyFSSuper *sb = __lockSuper(d, MYFS_LOCK_META);
+	int ret = sb ? __openPath(d, 0, 0, path, FILETYPE_DIR) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSOpenAt com o disco já travado
+int __myFSOpenAt (int dirfd, const char *path) {
+	MyFileHandle *dir = __getTypedHandle(dirfd, FILETYPE_DIR);
+	if(!dir){
+		return -1;
+	}
+	return __openPath(dir->d, dir->oi->snap, inodeGetNumber(dir->oi->inode), path, FILETYPE_REGULAR);
+}
+
+//Funcao para abertura de um arquivo, a partir do caminho path relativo ao
+//diretorio identificado pelo descritor dirfd, no modo Read/Write, criando
+//o arquivo se nao existir. Caminhos absolutos ignoram dirfd. Retorna um
+//descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
+int myFSOpenAt (int dirfd, const char *path) {
+	MyFSSuper *sb = __lockFd(dirfd);
+	int ret = sb ? __myFSOpenAt(dirfd, path) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSOpendirAt com o disco já travado
+int __myFSOpendirAt (int dirfd, const char *path) {
+	MyFileHandle *dir = __getTypedHandle(dirfd, FILETYPE_DIR);
+	if(!dir){
+		return -1;
+	}
+	return __openPath(dir->d, dir->oi->snap, inodeGetNumber(dir->oi->inode), path, FILETYPE_DIR);
+}
+
+//Funcao para abertura de um diretorio, a partir do caminho path relativo
+//ao diretorio identificado pelo descritor dirfd, no modo Read/Write,
+//criando o diretorio se nao existir. Caminhos absolutos ignoram dirfd.
+//Retorna um descritor de arquivo, em caso de sucesso. Retorna -1, caso
+//contrario.
+int myFSOpendirAt (int dirfd, const char *path) {
+	MyFSSuper *sb = __lockFd(dirfd);
+	int ret = sb ? __myFSOpendirAt(dirfd, path) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSReaddir com o disco já travado
+int __myFSReaddir (int fd, char *filename, unsigned int *inumber) {
+
+	MyFileHandle *fh = __getTypedHandle(fd, FILETYPE_DIR);
+	if(!fh || !filename || !inumber){
+		return -1;
+	}
+
+	VFSDirEntry entry;
+	int ret = __readdirEntries(fh, &entry, 1);
+	if(ret == 1){
+		strcpy(filename, entry.name);
+		*inumber = entry.inumber;
+	}
+	return ret;
+}
+
+//Funcao para a leitura de um diretorio, identificado por um descritor
+//de arquivo existente. Os dados lidos correspondem a uma entrada de
+//diretorio na posicao atual do cursor no diretorio. O nome da entrada
+//e' copiado para filename, como uma string terminada em \0 (max 255+1).
+//O numero do inode correspondente 'a entrada e' copiado para inumber.
+//Retorna 1 se uma entrada foi lida, 0 se fim do diretorio ou -1 caso
+//mal sucedido.
+int myFSReaddir (int fd, char *filename, unsigned int *inumber) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSReaddir(fd, filename, inumber) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSReaddirPlus com o disco já travado
+int __myFSReaddirPlus (int fd, VFSDirEntry *entries, unsigned int maxEntries, int withAttrs) {
+
+	MyFileHandle *fh = __getTypedHandle(fd, FILETYPE_DIR);
+	if(!fh || !entries){
+		return -1;
+	}
+
+	// Em caso de falha, o cursor volta para as entradas serem relidas
+	unsigned int cursor = fh->cursor;
+	int count = __readdirEntries(fh, entries, maxEntries);
+	if(count > 0 && withAttrs && __readdirAttrs(fh->oi->sb, fh->oi->snap, entries, count) < 0){
+		fh->cursor = cursor;
+		return -1;
+	}
+	return count;
+}
+
+//Funcao para a leitura em lote de um diretorio, identificado por um
+//descritor de arquivo existente. Copia para entries ate' maxEntries
+//entradas a partir da posicao atual do cursor no diretorio, avancando-o.
+//Se withAttrs for diferente de 0, inclui o tipo e o tamanho de cada
+//entrada, lidos do seu i-node. Retorna o numero de entradas lidas, 0 se
+//fim do diretorio ou -1 caso mal sucedido.
+int myFSReaddirPlus (int fd, VFSDirEntry *entries, unsigned int maxEntries, int withAttrs) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSReaddirPlus(fd, entries, maxEntries, withAttrs) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSLink com o disco já travado
+int __myFSLink (int fd, const char *filename, unsigned int inumber) {
+
+	MyFileHandle *fh = __getTypedHandle(fd, FILETYPE_DIR);
+	if(!fh || !filename){
+		return -1;
+	}
+
+	MyFSSuper *sb = fh->oi->sb;
+	if(fh->oi->snap || filename[0] == '\0' || strchr(filename, '/') || strlen(filename) > MAX_FILENAME_LENGTH ||
+	   inumber < 1 || inumber > sb->numInodes || !__bitmapGet(&sb->inodeMap, inumber - 1)){
+		return -1;
+	}
+
+	MyOpenInode *target = __getOpenInode(sb, inumber);
+	if(!target){
+		return -1;
+	}
+
+	int ret = -1;
+	if(__cowInode(target) == 0 && __dirAdd(fh->oi, filename, inumber) == 0){
+		inodeSetRefCount(target->inode, inodeGetRefCount(target->inode) + 1);
+		ret = __saveInode(sb, target->inode);
+	}
+
+	__putOpenInode(target);
+	return ret;
+}
+
+//Funcao para adicionar uma entrada a um diretorio, identificado por um
+//descritor de arquivo existente. A nova entrada tera' o nome indicado
+//por filename e apontara' para o numero de i-node indicado por inumber.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSLink (int fd, const char *filename, unsigned int inumber) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSLink(fd, filename, inumber) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSUnlink com o disco já travado
+int __myFSUnlink (int fd, const char *filename) {
+
+	MyFileHandle *fh = __getTypedHandle(fd, FILETYPE_DIR);
+	if(!fh || !filename || fh->oi->snap){
+		return -1;
+	}
+
+	unsigned int inodeNum = __dirLookup(fh->oi, filename);
+	if(inodeNum == 0){
+		return -1;
+	}
+
+	MyOpenInode *target = __getOpenInode(fh->oi->sb, inodeNum);
+	if(!target){
+		return -1;
+	}
+
+	// Um diretório só perde a última entrada que o referencia se vazio
+	unsigned int refs = inodeGetRefCount(target->inode);
+	if(inodeGetFileType(target->inode) == FILETYPE_DIR && refs <= 1 && !__dirIsEmpty(target)){
+		__putOpenInode(target);
+		return -1;
+	}
+
+	int ret = -1;
+	if(__cowInode(target) == 0 && __dirRemove(fh->oi, filename) == inodeNum){
+		// Sem entradas, o i-node é liberado ao perder a última referência
+		inodeSetRefCount(target->inode, refs > 0 ? refs - 1 : 0);
+		ret = __saveInode(target->sb, target->inode);
+	}
+
+	__putOpenInode(target);
+	return ret;
+}
+
+//Funcao para remover uma entrada existente em um diretorio,
+//identificado por um descritor de arquivo existente. A entrada e'
+//identificada pelo nome indicado em filename. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int myFSUnlink (int fd, const char *filename) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSUnlink(fd, filename) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+// myFSClosedir com o disco já travado
+int __myFSClosedir (int fd) {
+
+	if(!__getTypedHandle(fd, FILETYPE_DIR)){
+		return -1;
+	}
+	return __myFSClose(fd);
+}
+
+//Funcao para fechar um diretorio, identificado por um descritor de
+//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSClosedir (int fd) {
+	MyFSSuper *sb = __lockFd(fd);
+	int ret = sb ? __myFSClosedir(fd) : -1;
+	__unlockSuper(sb);
+	return ret;
+}
+
+//Funcao para instalar seu sistema de arquivos no S.O., registrando-o junto
+//ao virtual FS (vfs). Retorna um identificador unico (slot), caso
+//o sistema de arquivos tenha sido registrado com sucesso.
+//Caso contrario, retorna -1
+int installMyFS (void) {
+
+	// As travas de cada disco servem a todas as suas montagens
+	for(int i = 0; i < MYFS_MAX_MOUNTS; i++){
+		__initSuperLocks(&mounts[i]);
+	}
+
+	FSInfo *fsInfo = calloc(1, sizeof(FSInfo));
 	fsInfo->fsid = MYFS_ID;
 	fsInfo->fsname = "MyFS";
+	fsInfo->concurrent = 1;
 	fsInfo->isidleFn = myFSIsIdle;
 	fsInfo->formatFn = myFSFormat;
 	fsInfo->xMountFn = myFSxMount;
@@ -308,6 +5703,29 @@ int installMyFS (void) {
 	fsInfo->readFn = myFSRead;
 	fsInfo->writeFn = myFSWrite;
 	fsInfo->closeFn = myFSClose;
+	fsInfo->preadFn = myFSPread;
+	fsInfo->pwriteFn = myFSPwrite;
+	fsInfo->readvFn = myFSReadv;
+	fsInfo->writevFn = myFSWritev;
+	fsInfo->lseekFn = myFSLseek;
+	fsInfo->cloneFn = myFSClone;
+	fsInfo->getflagsFn = myFSGetFlags;
+	fsInfo->setflagsFn = myFSSetFlags;
+	fsInfo->lockrangeFn = myFSLockRange;
+	fsInfo->unlockrangeFn = myFSUnlockRange;
+	fsInfo->opendirFn = myFSOpendir;
+	fsInfo->openatFn = myFSOpenAt;
+	fsInfo->opendiratFn = myFSOpendirAt;
+	fsInfo->readdirFn = myFSReaddir;
+	fsInfo->readdirplusFn = myFSReaddirPlus;
+	fsInfo->linkFn = myFSLink;
+	fsInfo->unlinkFn = myFSUnlink;
+	fsInfo->closedirFn = myFSClosedir;
+	fsInfo->syncFn = myFSSync;
+	fsInfo->statfsFn = myFSStatfs;
+	fsInfo->snapshotFn = myFSSnapshot;
+	fsInfo->delsnapshotFn = myFSDeleteSnapshot;
+	fsInfo->xMountSnapshotFn = myFSxMountSnapshot;
 
 	return vfsRegisterFS(fsInfo);
 }
@@ -0,0 +1,204 @@
+/*
+*  rangelock.c - Travas de trechos (intervalos de bytes) de um arquivo
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "rangelock.h"
+
+//Trava de um trecho, concedida ou em espera. As travas concedidas de um
+//mesmo dono nunca se sobrepoem
+typedef struct range {
+	unsigned long start;		// Primeiro byte do trecho
+	unsigned long end;		// Byte seguinte ao ultimo
+	unsigned long owner;
+	int exclusive;
+	int granted;			// 0: em espera
+	unsigned long ticket;		// Ordem de chegada do pedido
+	struct range *next;
+} Range;
+
+struct rangeLock {
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;		// Alguma trava foi liberada ou trocada
+	Range *ranges;			// Concedidas e em espera, sem ordem
+	unsigned long nextTicket;
+};
+
+// Verifica se os trechos de a e b se sobrepoem
+int __rangeOverlaps (Range *a, Range *b) {
+	return a->start < b->end && b->start < a->end;
+}
+
+// Verifica se o pedido r precisa esperar: um trecho sobreposto de outro
+// dono, concedido ou pedido antes, conflita com ele. Quem ja' tem parte do
+// trecho so' espera as travas concedidas, ou trocar o tipo da sua trava
+// esperaria quem espera por ela
+int __rangeBlocked (RangeLock *rl, Range *r) {
+	int holder = 0;
+	for (Range *e = rl->ranges; e && !holder; e = e->next) {
+		holder = e != r && e->granted && e->owner == r->owner && __rangeOverlaps(e, r);
+	}
+	for (Range *e = rl->ranges; e; e = e->next) {
+		if (e != r && e->owner != r->owner && __rangeOverlaps(e, r) &&
+		    (e->exclusive || r->exclusive) &&
+		    (e->granted || (!holder && e->ticket < r->ticket))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Retira [start, end) das travas concedidas ao dono owner, exceto keep. Uma
+// trava que contem o trecho com sobra dos dois lados e' dividida usando
+// *spare, que e' consumido (NULL). Como as travas de um dono nao se
+// sobrepoem, no maximo uma precisa ser dividida
+void __rangeCut (RangeLock *rl, unsigned long owner, unsigned long start,
+                 unsigned long end, Range *keep, Range **spare) {
+	Range **link = &rl->ranges;
+	while (*link) {
+		Range *e = *link;
+		if (e == keep || !e->granted || e->owner != owner ||
+		    e->end <= start || end <= e->start) {
+			link = &e->next;
+			continue;
+		}
+		if (e->start < start && end < e->end) {
+			Range *tail = *spare;
+			*spare = NULL;
+			*tail = *e;
+			tail->start = end;
+			e->end = start;
+			e->next = tail;
+			return;
+		}
+		if (e->start < start) {
+			e->end = start;
+		}
+		else if (end < e->end) {
+			e->start = end;
+		}
+		else {
+			*link = e->next;
+			free(e);
+			continue;
+		}
+		link = &e->next;
+	}
+}
+
+//Funcao que cria um conjunto de travas vazio. Retorna ponteiro para ele ou
+//NULL se nao houver memoria suficiente
+RangeLock* rangeLockCreate (void) {
+	RangeLock *rl = malloc(sizeof(RangeLock));
+	if (!rl) return NULL;
+	pthread_mutex_init(&rl->mutex, NULL);
+	pthread_cond_init(&rl->changed, NULL);
+	rl->ranges = NULL;
+	rl->nextTicket = 0;
+	return rl;
+}
+
+//Funcao que libera um conjunto de travas, que nao pode ter travas em uso
+//nem em espera
+void rangeLockDestroy (RangeLock *rl) {
+	if (!rl) return;
+	while (rl->ranges) {
+		Range *e = rl->ranges;
+		rl->ranges = e->next;
+		free(e);
+	}
+	pthread_cond_destroy(&rl->changed);
+	pthread_mutex_destroy(&rl->mutex);
+	free(rl);
+}
+
+//Funcao que trava, para o dono owner, o trecho [start, end) com o tipo
+//type (RANGELOCK_*). Pedidos conflitantes sao atendidos na ordem de
+//chegada. As travas do dono no trecho sao substituidas pela nova, o que
+//permite trocar o tipo de uma trava. Com wait igual a 0, nao espera.
+//Retorna 0 se o trecho foi travado, 1 se teria que esperar (wait igual a
+//0) ou -1 em caso de falha
+int rangeLockAcquire (RangeLock *rl, unsigned long owner, unsigned long start,
+                      unsigned long end, int type, int wait) {
+
+	if (!rl || owner == 0 || start >= end) return -1;
+	Range *r = malloc(sizeof(Range));
+	Range *spare = malloc(sizeof(Range));
+	if (!r || !spare) {
+		free(r);
+		free(spare);
+		return -1;
+	}
+	r->start = start;
+	r->end = end;
+	r->owner = owner;
+	r->exclusive = type == RANGELOCK_EXCLUSIVE;
+	r->granted = 0;
+
+	pthread_mutex_lock(&rl->mutex);
+	r->ticket = rl->nextTicket++;
+	r->next = rl->ranges;
+	rl->ranges = r;
+	while (__rangeBlocked(rl, r)) {
+		if (!wait) {
+			rl->ranges = r->next; // Nada entrou na frente de r
+			pthread_mutex_unlock(&rl->mutex);
+			free(r);
+			free(spare);
+			return 1;
+		}
+		pthread_cond_wait(&rl->changed, &rl->mutex);
+	}
+
+	// Uma trava exclusiva trocada por compartilhada libera quem espera
+	__rangeCut(rl, owner, start, end, r, &spare);
+	r->granted = 1;
+	pthread_cond_broadcast(&rl->changed);
+	pthread_mutex_unlock(&rl->mutex);
+	free(spare);
+	return 0;
+}
+
+//Funcao que libera as travas do dono owner no trecho [start, end), mesmo
+//que so' em parte dele. Retorna 0 caso bem sucedido, ou -1 caso contrario
+int rangeLockRelease (RangeLock *rl, unsigned long owner, unsigned long start,
+                      unsigned long end) {
+
+	if (!rl || start >= end) return -1;
+	Range *spare = malloc(sizeof(Range));
+	if (!spare) return -1;
+
+	pthread_mutex_lock(&rl->mutex);
+	__rangeCut(rl, owner, start, end, NULL, &spare);
+	pthread_cond_broadcast(&rl->changed);
+	pthread_mutex_unlock(&rl->mutex);
+	free(spare);
+	return 0;
+}
+
+//Funcao que libera todas as travas do dono owner
+void rangeLockReleaseAll (RangeLock *rl, unsigned long owner) {
+	if (!rl) return;
+	pthread_mutex_lock(&rl->mutex);
+	Range **link = &rl->ranges;
+	while (*link) {
+		Range *e = *link;
+		if (e->granted && e->owner == owner) {
+			*link = e->next;
+			free(e);
+		}
+		else {
+			link = &e->next;
+		}
+	}
+	pthread_cond_broadcast(&rl->changed);
+	pthread_mutex_unlock(&rl->mutex);
+}
@@ -0,0 +1,50 @@
+/*
+*  rangelock.h - Travas de trechos (intervalos de bytes) de um arquivo
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*
+*/
+
+#ifndef RANGELOCK_H
+#define RANGELOCK_H
+
+#define RANGELOCK_SHARED 0	//Trava compartilhada: leitura
+#define RANGELOCK_EXCLUSIVE 1	//Trava exclusiva: escrita
+#define RANGELOCK_END (~0UL)	//Fim de um trecho que vai ate' o fim do arquivo
+
+//Tipo para representacao das travas de trechos de um arquivo. Cada trava
+//pertence a um dono (um numero diferente de 0, escolhido por quem trava).
+//Travas de donos diferentes sobre trechos sobrepostos so' convivem se
+//forem ambas compartilhadas; as de um mesmo dono nunca conflitam entre si
+typedef struct rangeLock RangeLock;
+
+//Funcao que cria um conjunto de travas vazio. Retorna ponteiro para ele ou
+//NULL se nao houver memoria suficiente
+RangeLock* rangeLockCreate (void);
+
+//Funcao que libera um conjunto de travas, que nao pode ter travas em uso
+//nem em espera
+void rangeLockDestroy (RangeLock *rl);
+
+//Funcao que trava, para o dono owner, o trecho [start, end) com o tipo
+//type (RANGELOCK_*). Pedidos conflitantes sao atendidos na ordem de
+//chegada. As travas do dono no trecho sao substituidas pela nova, o que
+//permite trocar o tipo de uma trava. Com wait igual a 0, nao espera.
+//Retorna 0 se o trecho foi travado, 1 se teria que esperar (wait igual a
+//0) ou -1 em caso de falha
+int rangeLockAcquire (RangeLock *rl, unsigned long owner, unsigned long start,
+                      unsigned long end, int type, int wait);
+
+//Funcao que libera as travas do dono owner no trecho [start, end), mesmo
+//que so' em parte dele. Retorna 0 caso bem sucedido, ou -1 caso contrario
+int rangeLockRelease (RangeLock *rl, unsigned long owner, unsigned long start,
+                      unsigned long end);
+
+//Funcao que libera todas as travas do dono owner
+void rangeLockReleaseAll (RangeLock *rl, unsigned long owner);
+
+#endif
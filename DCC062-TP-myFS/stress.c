@@ -0,0 +1,190 @@
+/*
+*  stress.c - Teste de carga: leitura de arquivos diferentes por varias
+*             threads ao mesmo tempo
+*
+*  Autor: SUPER_PROGRAMADORES C
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*  Formata um disco com o MyFS, cria um arquivo por thread e mede, para 1,
+*  2, 4, ... threads, a vazao total de leituras em que cada thread le so' o
+*  seu arquivo, pelo seu descritor. Em "buffer", as leituras ficam dentro
+*  de um bloco ja' lido e medem so' as travas do VFS e do MyFS; em "disco",
+*  percorrem o arquivo e dependem do disco simulado, que tem uma unica
+*  cabeca. Compilado sem main.c:
+*
+*    gcc -O2 -o stress stress.c disk.c inode.c util.c vfs.c myfs.c lfs.c \
+*        journal.c rangelock.c dcache.c lz.c -lpthread
+*
+*    ./stress disco.dsk [cilindros] [max. threads] [segundos por medida]
+*
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "myfs.h"
+#include "vfs.h"
+
+#define STRESS_MAX_THREADS 64
+#define STRESS_FILE_SIZE (256 * 1024)	//Tamanho de cada arquivo
+#define STRESS_BLOCK_SIZE 4096		//Bloco do MyFS formatado
+#define STRESS_SMALL_READ 512		//Leituras dentro de um bloco
+#define STRESS_LARGE_READ (32 * 1024)	//Leituras que percorrem o arquivo
+
+//Trabalho de uma thread em uma medida
+typedef struct {
+	int index;			//Arquivo /stress<index>
+	int large;			//0: modo "buffer", 1: modo "disco"
+	struct timespec deadline;	//Fim da medida
+	unsigned long long bytes;	//Bytes lidos
+	int failed;
+} Worker;
+
+//Funcao interna que retorna o instante atual em segundos
+double __stressNow (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Funcao interna que verifica se o instante deadline ja' passou
+int __stressExpired (const struct timespec *deadline) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec > deadline->tv_sec ||
+	       (ts.tv_sec == deadline->tv_sec && ts.tv_nsec >= deadline->tv_nsec);
+}
+
+//Funcao interna executada por cada thread: le o seu arquivo ate' o fim
+//da medida
+void *__stressWorker (void *arg) {
+	Worker *w = arg;
+	char path[32], buf[STRESS_LARGE_READ];
+	sprintf (path, "/stress%d", w->index);
+	int fd = vfsOpen (path);
+	if (fd <= 0) {
+		w->failed = 1;
+		return NULL;
+	}
+
+	unsigned int offset = 0;
+	while (!__stressExpired (&w->deadline)) {
+		unsigned int len = w->large ? STRESS_LARGE_READ : STRESS_SMALL_READ;
+		int n = vfsPread (fd, buf, len, offset);
+		if (n != (int)len) {
+			w->failed = 1;
+			break;
+		}
+		w->bytes += n;
+		offset = w->large ? (offset + len) % STRESS_FILE_SIZE
+		                  : (offset + len) % STRESS_BLOCK_SIZE;
+	}
+	vfsClose (fd);
+	return NULL;
+}
+
+//Funcao interna que mede, com threads threads durante seconds segundos,
+//a vazao total em MiB/s. Retorna -1 em caso de falha
+double __stressRun (int threads, int large, double seconds) {
+	Worker workers[STRESS_MAX_THREADS];
+	pthread_t ids[STRESS_MAX_THREADS];
+	struct timespec deadline;
+	clock_gettime (CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += (time_t)seconds;
+	deadline.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	double start = __stressNow ();
+	int started = 0, failed = 0;
+	for (int t = 0; t < threads; t++) {
+		workers[t].index = t;
+		workers[t].large = large;
+		workers[t].deadline = deadline;
+		workers[t].bytes = 0;
+		workers[t].failed = 0;
+		if (pthread_create (&ids[t], NULL, __stressWorker, &workers[t]) != 0)
+			break;
+		started++;
+	}
+
+	unsigned long long bytes = 0;
+	for (int t = 0; t < started; t++) {
+		pthread_join (ids[t], NULL);
+		bytes += workers[t].bytes;
+		failed |= workers[t].failed;
+	}
+	double elapsed = __stressNow () - start;
+	if (started < threads || failed || elapsed <= 0) return -1;
+	return bytes / elapsed / (1024.0 * 1024.0);
+}
+
+int main (int argc, char* argv[]) {
+
+	if (argc < 2) {
+		fprintf (stderr, "Uso: %s disco.dsk [cilindros] [max. threads] "
+		         "[segundos por medida]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	unsigned long cylinders = argc > 2 ? strtoul (argv[2], NULL, 10) : 200;
+	int maxThreads = argc > 3 ? atoi (argv[3]) : 8;
+	double seconds = argc > 4 ? atof (argv[4]) : 2;
+	if (maxThreads < 1 || maxThreads > STRESS_MAX_THREADS || seconds <= 0) {
+		fprintf (stderr, "!! Stress: parametros invalidos\n");
+		return EXIT_FAILURE;
+	}
+
+	vfsInit ();
+	installMyFS ();
+	Disk *d = NULL;
+	if (diskCreateRawDisk (argv[1], cylinders) == -1 ||
+	    !(d = diskConnect (0, argv[1])) ||
+	    vfsFormat (d, STRESS_BLOCK_SIZE, 'M') < 0 ||
+	    vfsMountRoot (d, 'M') < 0) {
+		fprintf (stderr, "!! Stress: nao foi possivel preparar o disco\n");
+		return EXIT_FAILURE;
+	}
+
+	// Um arquivo por thread, todos ja' no disco antes das medidas
+	char *data = malloc (STRESS_FILE_SIZE);
+	for (int t = 0; data && t < maxThreads; t++) {
+		char path[32];
+		sprintf (path, "/stress%d", t);
+		memset (data, 'a' + t % 26, STRESS_FILE_SIZE);
+		int fd = vfsOpen (path);
+		if (fd <= 0 || vfsWrite (fd, data, STRESS_FILE_SIZE) != STRESS_FILE_SIZE) {
+			fprintf (stderr, "!! Stress: falha ao criar %s\n", path);
+			return EXIT_FAILURE;
+		}
+		vfsClose (fd);
+	}
+	free (data);
+	vfsSync ();
+
+	const char *modes[2] = { "buffer", "disco" };
+	for (int large = 0; large < 2; large++) {
+		printf ("-- Modo %s\n   threads      MiB/s   aceleracao\n", modes[large]);
+		double base = 0;
+		for (int threads = 1; threads <= maxThreads; threads *= 2) {
+			double rate = __stressRun (threads, large, seconds);
+			if (rate < 0) {
+				printf ("!! Stress: falha com %d threads\n", threads);
+				break;
+			}
+			if (threads == 1) base = rate;
+			printf ("   %7d %10.2f %11.2fx\n", threads, rate,
+			        base > 0 ? rate / base : 0);
+			fflush (stdout);
+		}
+	}
+
+	vfsUnmountRoot ();
+	diskDisconnect (d);
+	return EXIT_SUCCESS;
+}
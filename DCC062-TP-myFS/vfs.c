@@ -11,15 +11,61 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "vfs.h"
 #include "inode.h"
 
 #define MAX_INSTALLED_FS 4
+#define VFS_AIO_WORKERS 4	//Threads que executam os pedidos assincronos
+
+#define VFS_AIO_PENDING 0
+#define VFS_AIO_RUNNING 1
+#define VFS_AIO_CANCELLED 2	//Pendente, sera' concluido com -1
+
+//Pedido de leitura ou escrita assincrona
+typedef struct vfs_aio_req {
+	int fd;
+	int write;		// 0: leitura
+	char *buf;
+	unsigned int nbytes;
+	unsigned int offset;
+	VFSAioFn fn;
+	VFSAioQueue *queue;
+	void *tag;
+	int result;
+	int state;		// VFS_AIO_*
+	struct vfs_aio_req *next;
+} VFSAioReq;
+
+struct vfs_aio_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t ready;		// Nova conclusao na fila
+	VFSAioReq *head, *tail;		// Concluidos, na ordem de conclusao
+	unsigned int outstanding;	// Pedidos com a fila ainda nao retirados
+};
 
 FSInfo* installedFSInfo[MAX_INSTALLED_FS];
 Disk* rootDisk;
 FSInfo* rootFS;
 
+//Trava compartilhada pelas chamadas ao sistema de arquivos raiz e exclusiva
+//na montagem, na desmontagem, no registro e nas chamadas a sistemas de
+//arquivos que nao aceitam concorrencia
+pthread_rwlock_t vfsLock = PTHREAD_RWLOCK_INITIALIZER;
+
+//Pedidos assincronos pendentes e em andamento, sem ordem. As threads os
+//atendem como um elevador sobre (descritor, posicao): cada uma pega o
+//proximo pedido depois do ultimo iniciado, voltando ao primeiro no fim, de
+//modo que pedidos vizinhos de um mesmo arquivo saem juntos
+pthread_mutex_t aioMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t aioWork = PTHREAD_COND_INITIALIZER;	// Novo pedido
+pthread_cond_t aioDone = PTHREAD_COND_INITIALIZER;	// Pedido concluido
+VFSAioReq *aioReqs = NULL;
+int aioWorkers = 0;
+int aioLastFd = 0;		// Ultimo pedido iniciado
+unsigned int aioLastOffset = 0;
+
 //Funcao interna para a obtencao do FSInfo correspondente a um fsId
 FSInfo* __vfsGetFSInfo (char fsId) {
         FSInfo *fsInfo = NULL;
@@ -33,6 +79,28 @@ FSInfo* __vfsGetFSInfo (char fsId) {
 	return fsInfo;
 }
 
+//Funcao interna que trava o VFS para uma chamada ao sistema de arquivos
+//raiz, de forma exclusiva se ele nao aceitar concorrencia. Retorna o
+//FSInfo da raiz, a ser liberado com __vfsLeave, ou NULL (sem trava) se
+//nao houver raiz montada
+FSInfo* __vfsEnter (void) {
+	pthread_rwlock_rdlock (&vfsLock);
+	if ( rootDisk && rootFS && !rootFS->concurrent ) {
+		pthread_rwlock_unlock (&vfsLock);
+		pthread_rwlock_wrlock (&vfsLock);
+	}
+	if ( !rootDisk || !rootFS ) {
+		pthread_rwlock_unlock (&vfsLock);
+		return NULL;
+	}
+	return rootFS;
+}
+
+//Funcao interna que libera a trava obtida por __vfsEnter
+void __vfsLeave (void) {
+	pthread_rwlock_unlock (&vfsLock);
+}
+
 //Funcao para inicializacao do sistema de arquivos virtual
 void vfsInit ( void ) {
 	for (int i=0; i<MAX_INSTALLED_FS; i++)
@@ -45,23 +113,49 @@ void vfsInit ( void ) {
 //unica do sistema (Unix-like). Retorna 0 caso bem sucedido e -1 em contrario
 int vfsMountRoot (Disk *d, char fsId) {
 	if ( !d ) return -1;
+	pthread_rwlock_wrlock (&vfsLock);
+	int ret = -1;
 	rootFS = __vfsGetFSInfo (fsId);
-	if ( !rootFS ) return -1;
-	if ( !rootFS->xMountFn (d, 1) ) return -1;
-	rootDisk = d;
-	return 0;
+	if ( rootFS && rootFS->xMountFn (d, 1) ) {
+		rootDisk = d;
+		ret = 0;
+	}
+	pthread_rwlock_unlock (&vfsLock);
+	return ret;
+}
+
+//Funcao para a montagem, somente para leitura, do snapshot de nome name do
+//sistema de arquivos do disco d, como raiz da arvore unica do sistema.
+//Retorna 0 caso bem sucedido e -1 em contrario
+int vfsMountRootSnapshot (Disk *d, char fsId, const char *name) {
+	if ( !d || !name ) return -1;
+	pthread_rwlock_wrlock (&vfsLock);
+	int ret = -1;
+	//Uma raiz ja' montada nao e' substituida, e rootFS so' muda com sucesso
+	FSInfo* fs = rootDisk ? NULL : __vfsGetFSInfo (fsId);
+	if ( fs && fs->xMountSnapshotFn && fs->xMountSnapshotFn (d, name) ) {
+		rootFS = fs;
+		rootDisk = d;
+		ret = 0;
+	}
+	pthread_rwlock_unlock (&vfsLock);
+	return ret;
 }
 
 //Funcao para a desmontagem do sistema de arquivos. Nao podem haver arquivos
 //ou diretorios abertos para a desmontagem. Retorna 0 caso bem sucedido e -1
 //caso contrario
 int vfsUnmountRoot ( void ) {
-	if ( !rootDisk || !rootFS ) return -1;
-	if ( !rootFS->isidleFn (rootDisk) ) return -1;
-	if ( !rootFS->xMountFn (rootDisk, 0) ) return -1;
-	rootFS = NULL;
-	rootDisk = NULL;
-	return 0;
+	pthread_rwlock_wrlock (&vfsLock);
+	int ret = -1;
+	if ( rootDisk && rootFS && rootFS->isidleFn (rootDisk) &&
+	     rootFS->xMountFn (rootDisk, 0) ) {
+		rootFS = NULL;
+		rootDisk = NULL;
+		ret = 0;
+	}
+	pthread_rwlock_unlock (&vfsLock);
+	return ret;
 }
 
 //Funcao para formatacao de um disco com o sistema de arquivos indicado pelo
@@ -71,9 +165,11 @@ int vfsUnmountRoot ( void ) {
 int vfsFormat (Disk *d, unsigned int blockSize, char fsId) {
 	FSInfo *fsInfo = NULL;
 	if ( !d ) return -1;
+	pthread_rwlock_wrlock (&vfsLock);
 	fsInfo = __vfsGetFSInfo (fsId);
-	if ( !fsInfo ) return -1;
-	return fsInfo->formatFn (d, blockSize);
+	int ret = ( fsInfo ? fsInfo->formatFn (d, blockSize) : -1 );
+	pthread_rwlock_unlock (&vfsLock);
+	return ret;
 }
 
 //Funcao para abertura de um arquivo, a partir do caminho especificado em path,
@@ -81,8 +177,11 @@ int vfsFormat (Disk *d, unsigned int blockSize, char fsId) {
 //arquivo, em caso de sucesso. Retorna -1, caso contrario.
 //Descritores de arquivo se iniciam em 1
 int vfsOpen (const char *path) {
-	if ( !rootDisk || !rootFS ) return -1;
-	return rootFS->openFn (rootDisk, path);
+	FSInfo *fs = __vfsEnter ();
+	if ( !fs ) return -1;
+	int ret = fs->openFn (rootDisk, path);
+	__vfsLeave ();
+	return ret;
 }
 
 //Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
@@ -90,8 +189,11 @@ int vfsOpen (const char *path) {
 //nbytes. Retorna o numero de bytes efetivamente lidos em caso de sucesso ou
 //-1, caso contrario.
 int vfsRead (int fd, char *buf, unsigned int nbytes) {
-	if ( !rootDisk || !rootFS ) return -1;
-	return rootFS->readFn (fd, buf, nbytes);
+	FSInfo *fs = __vfsEnter ();
+	if ( !fs ) return -1;
+	int ret = fs->readFn (fd, buf, nbytes);
+	__vfsLeave ();
+	return ret;
 }
 
 //Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
@@ -99,23 +201,381 @@ int vfsRead (int fd, char *buf, unsigned int nbytes) {
 //maximo de nbytes. Retorna o numero de bytes efetivamente escritos em caso
 //de sucesso ou -1, caso contrario
 int vfsWrite (int fd, const char *buf, unsigned int nbytes) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->writeFn (fd, buf, nbytes);
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = fs->writeFn (fd, buf, nbytes);
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. O cursor do arquivo nao e' alterado. Os dados
+//serao copiados para buf e terao tamanho maximo de nbytes. Retorna o numero
+//de bytes efetivamente lidos em caso de sucesso ou -1, caso contrario
+int vfsPread (int fd, char *buf, unsigned int nbytes, unsigned int offset) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->preadFn ? fs->preadFn (fd, buf, nbytes, offset) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. O cursor do arquivo nao e' alterado. Os dados
+//de buf serao copiados para o disco e terao tamanho maximo de nbytes. Retorna
+//o numero de bytes efetivamente escritos em caso de sucesso ou -1, caso
+//contrario
+int vfsPwrite (int fd, const char *buf, unsigned int nbytes,
+               unsigned int offset) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->pwriteFn ? fs->pwriteFn (fd, buf, nbytes, offset) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao interna que verifica se a posicao (fd, offset) vem antes da
+//posicao do pedido r no elevador
+int __vfsAioBefore (int fd, unsigned int offset, VFSAioReq *r) {
+	return fd < r->fd || ( fd == r->fd && offset < r->offset );
+}
+
+//Funcao interna que escolhe o proximo pedido a iniciar: o primeiro depois
+//do ultimo iniciado ou, se nao houver, o primeiro de todos. Retorna NULL se
+//nao houver pedidos esperando. Chamada com aioMutex travado
+VFSAioReq* __vfsAioNext (void) {
+	VFSAioReq *next = NULL, *first = NULL;
+	for (VFSAioReq *r = aioReqs; r; r = r->next) {
+		if ( r->state == VFS_AIO_RUNNING ) continue;
+		if ( !first || __vfsAioBefore (r->fd, r->offset, first) )
+			first = r;
+		if ( __vfsAioBefore (aioLastFd, aioLastOffset, r) &&
+		     ( !next || __vfsAioBefore (r->fd, r->offset, next) ) )
+			next = r;
+	}
+	return next ? next : first;
+}
+
+//Funcao interna que entrega a conclusao de um pedido, ja' fora da lista de
+//pedidos: chama a funcao do pedido e o coloca na sua fila, ou o libera
+void __vfsAioComplete (VFSAioReq *r) {
+	if ( r->fn ) r->fn (r->tag, r->result);
+	VFSAioQueue *q = r->queue;
+	if ( !q ) {
+		free (r);
+		return;
+	}
+	r->next = NULL;
+	pthread_mutex_lock (&q->mutex);
+	if ( q->tail ) q->tail->next = r;
+	else q->head = r;
+	q->tail = r;
+	pthread_cond_signal (&q->ready);
+	pthread_mutex_unlock (&q->mutex);
+}
+
+//Funcao interna executada pelas threads que atendem os pedidos assincronos
+void* __vfsAioWorker (void *arg) {
+	(void) arg;
+	pthread_mutex_lock (&aioMutex);
+	for (;;) {
+		VFSAioReq *r = __vfsAioNext ();
+		if ( !r ) {
+			pthread_cond_wait (&aioWork, &aioMutex);
+			continue;
+		}
+		aioLastFd = r->fd;
+		aioLastOffset = r->offset;
+		int cancelled = r->state == VFS_AIO_CANCELLED;
+		r->state = VFS_AIO_RUNNING;
+		pthread_mutex_unlock (&aioMutex);
+
+		if ( cancelled ) r->result = -1;
+		else if ( r->write )
+			r->result = vfsPwrite (r->fd, r->buf, r->nbytes, r->offset);
+		else r->result = vfsPread (r->fd, r->buf, r->nbytes, r->offset);
+
+		pthread_mutex_lock (&aioMutex);
+		VFSAioReq **link = &aioReqs;
+		while ( *link != r ) link = &(*link)->next;
+		*link = r->next;
+		pthread_cond_broadcast (&aioDone);
+		pthread_mutex_unlock (&aioMutex);
+		__vfsAioComplete (r);
+		pthread_mutex_lock (&aioMutex);
+	}
+	return NULL;
+}
+
+//Funcao interna que enfileira um pedido assincrono, iniciando as threads
+//no primeiro. Retorna 0 se o pedido foi aceito, ou -1 caso contrario
+int __vfsAioSubmit (int fd, int write, char *buf, unsigned int nbytes,
+                    unsigned int offset, VFSAioFn fn, VFSAioQueue *queue,
+                    void *tag) {
+	if ( fd <= 0 || !buf ) return -1;
+	VFSAioReq *r = malloc (sizeof (VFSAioReq));
+	if ( !r ) return -1;
+	r->fd = fd;
+	r->write = write;
+	r->buf = buf;
+	r->nbytes = nbytes;
+	r->offset = offset;
+	r->fn = fn;
+	r->queue = queue;
+	r->tag = tag;
+	r->result = -1;
+	r->state = VFS_AIO_PENDING;
+
+	pthread_mutex_lock (&aioMutex);
+	while ( aioWorkers < VFS_AIO_WORKERS ) {
+		pthread_t thread;
+		if ( pthread_create (&thread, NULL, __vfsAioWorker, NULL) ) break;
+		pthread_detach (thread);
+		aioWorkers++;
+	}
+	if ( !aioWorkers ) {
+		pthread_mutex_unlock (&aioMutex);
+		free (r);
+		return -1;
+	}
+	if ( queue ) {
+		pthread_mutex_lock (&queue->mutex);
+		queue->outstanding++;
+		pthread_mutex_unlock (&queue->mutex);
+	}
+	r->next = aioReqs;
+	aioReqs = r;
+	pthread_cond_signal (&aioWork);
+	pthread_mutex_unlock (&aioMutex);
+	return 0;
+}
+
+//Funcao interna que cancela os pedidos ainda nao iniciados do descritor fd
+//e espera pelos que estao em andamento
+void __vfsAioCancel (int fd) {
+	pthread_mutex_lock (&aioMutex);
+	for (;;) {
+		int busy = 0;
+		for (VFSAioReq *r = aioReqs; r; r = r->next) {
+			if ( r->fd != fd ) continue;
+			if ( r->state == VFS_AIO_PENDING ) r->state = VFS_AIO_CANCELLED;
+			else if ( r->state == VFS_AIO_RUNNING ) busy = 1;
+		}
+		if ( !busy ) break;
+		pthread_cond_wait (&aioDone, &aioMutex);
+	}
+	pthread_mutex_unlock (&aioMutex);
+}
+
+//Funcao que pede a leitura de nbytes a partir da posicao offset do arquivo
+//identificado por um descritor existente para buf, sem esperar por ela. Na
+//conclusao, chama fn e coloca a conclusao em queue, ambas com tag. Retorna
+//0 se o pedido foi aceito, ou -1 caso contrario
+int vfsReadAsync (int fd, char *buf, unsigned int nbytes, unsigned int offset,
+                  VFSAioFn fn, VFSAioQueue *queue, void *tag) {
+        return __vfsAioSubmit (fd, 0, buf, nbytes, offset, fn, queue, tag);
+}
+
+//Funcao que pede a escrita dos nbytes de buf a partir da posicao offset do
+//arquivo identificado por um descritor existente, sem esperar por ela. Na
+//conclusao, chama fn e coloca a conclusao em queue, ambas com tag. Retorna
+//0 se o pedido foi aceito, ou -1 caso contrario
+int vfsWriteAsync (int fd, const char *buf, unsigned int nbytes,
+                   unsigned int offset, VFSAioFn fn, VFSAioQueue *queue,
+                   void *tag) {
+        return __vfsAioSubmit (fd, 1, (char *) buf, nbytes, offset, fn, queue, tag);
+}
+
+//Funcao que cria uma fila de conclusoes vazia. Retorna ponteiro para ela ou
+//NULL em caso de falha
+VFSAioQueue* vfsAioQueueCreate (void) {
+	VFSAioQueue *q = malloc (sizeof (VFSAioQueue));
+	if ( !q ) return NULL;
+	pthread_mutex_init (&q->mutex, NULL);
+	pthread_cond_init (&q->ready, NULL);
+	q->head = q->tail = NULL;
+	q->outstanding = 0;
+	return q;
+}
+
+//Funcao que retira de queue a conclusao mais antiga e a copia para done,
+//esperando pela proxima se wait for diferente de 0 e houver pedidos
+//pendentes. Retorna 1 se uma conclusao foi retirada, 0 se nao havia
+//nenhuma ou -1 em caso de falha
+int vfsAioWait (VFSAioQueue *queue, VFSCompletion *done, int wait) {
+	if ( !queue || !done ) return -1;
+	pthread_mutex_lock (&queue->mutex);
+	while ( !queue->head && wait && queue->outstanding )
+		pthread_cond_wait (&queue->ready, &queue->mutex);
+	VFSAioReq *r = queue->head;
+	if ( r ) {
+		queue->head = r->next;
+		if ( !queue->head ) queue->tail = NULL;
+		queue->outstanding--;
+	}
+	pthread_mutex_unlock (&queue->mutex);
+	if ( !r ) return 0;
+	done->tag = r->tag;
+	done->result = r->result;
+	free (r);
+	return 1;
+}
+
+//Funcao que libera uma fila de conclusoes sem pedidos pendentes nem
+//conclusoes por retirar. Retorna 0 caso bem sucedido, ou -1 caso contrario
+int vfsAioQueueDestroy (VFSAioQueue *queue) {
+	if ( !queue ) return -1;
+	pthread_mutex_lock (&queue->mutex);
+	unsigned int outstanding = queue->outstanding;
+	pthread_mutex_unlock (&queue->mutex);
+	if ( outstanding ) return -1;
+	pthread_cond_destroy (&queue->ready);
+	pthread_mutex_destroy (&queue->mutex);
+	free (queue);
+	return 0;
+}
+
+//Funcao para a leitura vetorial de um arquivo, a partir de um descritor de
+//arquivo existente. Os dados lidos a partir da posicao atual do cursor sao
+//distribuidos, em ordem, pelos iovcnt buffers de iov. Retorna o numero de
+//bytes efetivamente lidos em caso de sucesso ou -1, caso contrario
+int vfsReadv (int fd, const VFSIOVec *iov, int iovcnt) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->readvFn ? fs->readvFn (fd, iov, iovcnt) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a escrita vetorial de um arquivo, a partir de um descritor de
+//arquivo existente. O conteudo dos iovcnt buffers de iov e' gravado, em
+//ordem, a partir da posicao atual do cursor. Retorna o numero de bytes
+//efetivamente escritos em caso de sucesso ou -1, caso contrario
+int vfsWritev (int fd, const VFSIOVec *iov, int iovcnt) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->writevFn ? fs->writevFn (fd, iov, iovcnt) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para reposicionar o cursor de um arquivo, a partir de um descritor de
+//arquivo existente, conforme offset e whence (VFS_SEEK_*). Retorna a nova
+//posicao em caso de sucesso ou -1, caso contrario
+long vfsLseek (int fd, long offset, int whence) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        long ret = ( fs->lseekFn ? fs->lseekFn (fd, offset, whence) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para clonagem de um arquivo, a partir de um descritor de arquivo
+//existente. Cria o arquivo indicado pelo caminho absoluto path, que nao pode
+//existir, compartilhando os blocos de dados do original. Retorna um
+//descritor para o clone, em caso de sucesso. Retorna -1, caso contrario
+int vfsClone (int fd, const char *path) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->cloneFn ? fs->cloneFn (fd, path) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao que copia para flags os atributos (VFS_FLAG_*) do arquivo ou
+//diretorio identificado por um descritor existente. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int vfsGetFlags (int fd, unsigned int *flags) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->getflagsFn ? fs->getflagsFn (fd, flags) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao que altera os atributos (VFS_FLAG_*) do arquivo ou diretorio
+//identificado por um descritor existente, herdados pelos arquivos e
+//diretorios criados depois nele. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario
+int vfsSetFlags (int fd, unsigned int flags) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->setflagsFn ? fs->setflagsFn (fd, flags) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao que trava, de forma consultiva, o trecho de len bytes a partir de
+//offset (len 0: ate' o fim do arquivo) do arquivo identificado por um
+//descritor existente, com o tipo type (VFS_LOCK_*). Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int vfsLockRange (int fd, unsigned int offset, unsigned int len, int type) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        // Chamado sozinho, o sistema de arquivos esperaria para sempre:
+        // ninguem mais poderia liberar a trava
+        if ( !fs->concurrent ) type |= VFS_LOCK_NOWAIT;
+        int ret = ( fs->lockrangeFn ? fs->lockrangeFn (fd, offset, len, type) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao que libera as travas do descritor fd no trecho de len bytes a
+//partir de offset (len 0: ate' o fim do arquivo). Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int vfsUnlockRange (int fd, unsigned int offset, unsigned int len) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->unlockrangeFn ? fs->unlockrangeFn (fd, offset, len) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->closeFn (fd);
+        __vfsAioCancel (fd);
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = fs->closeFn (fd);
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para abertura de um diretorio, a partir do caminho especificado em
 //path, no modo Read/Write, criando o diretorio se nao existir. Retorna um
 //descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
 int vfsOpendir (const char *path) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->opendirFn (rootDisk, path);
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = fs->opendirFn (rootDisk, path);
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para abertura de um arquivo, a partir do caminho path relativo ao
+//diretorio aberto identificado pelo descritor dirfd, no modo Read/Write,
+//criando o arquivo se nao existir. Caminhos absolutos ignoram dirfd. Retorna
+//um descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
+int vfsOpenAt (int dirfd, const char *path) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->openatFn ? fs->openatFn (dirfd, path) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para abertura de um diretorio, a partir do caminho path relativo ao
+//diretorio aberto identificado pelo descritor dirfd, no modo Read/Write,
+//criando o diretorio se nao existir. Caminhos absolutos ignoram dirfd.
+//Retorna um descritor de arquivo, em caso de sucesso. Retorna -1, caso
+//contrario.
+int vfsOpendirAt (int dirfd, const char *path) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->opendiratFn ? fs->opendiratFn (dirfd, path) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para a leitura de um diretorio, identificado por um descritor de
@@ -125,8 +585,25 @@ int vfsOpendir (const char *path) {
 //correspondente 'a entrada e' copiado para inumber. Retorna 1 se uma entrada
 //foi lida, 0 se fim do diretorio ou -1 caso mal sucedido.
 int vfsReaddir (int fd, char *filename, unsigned int *inumber) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->readdirFn (fd, filename, inumber);
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = fs->readdirFn (fd, filename, inumber);
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a leitura em lote de um diretorio, identificado por um descritor
+//de arquivo existente. Copia para entries ate' maxEntries entradas a partir
+//da posicao atual do cursor no diretorio. Se withAttrs for diferente de 0,
+//inclui o tipo e o tamanho de cada entrada. Retorna o numero de entradas
+//lidas, 0 se fim de diretorio ou -1 caso mal sucedido.
+int vfsReaddirPlus (int fd, VFSDirEntry *entries, unsigned int maxEntries,
+                    int withAttrs) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->readdirplusFn ? fs->readdirplusFn (fd, entries, maxEntries, withAttrs) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para adicionar uma entrada a um diretorio, identificado por um 
@@ -134,52 +611,108 @@ int vfsReaddir (int fd, char *filename, unsigned int *inumber) {
 //filename e apontara' para o numero de i-node indicado por inumber. Retorna 0\
 //caso bem sucedido, ou -1 caso contrario.
 int vfsLink (int fd, const char *filename, unsigned int inumber) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->linkFn (fd, filename, inumber);
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = fs->linkFn (fd, filename, inumber);
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para remover uma entrada existente em um diretorio, este identificado
 //por um descritor de arquivo existente. A entrada e' identificada pelo nome 
 //indicado em filename. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsUnlink (int fd, const char *filename) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->unlinkFn (fd, filename);
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = fs->unlinkFn (fd, filename);
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para fechar um diretorio, identificado por um descritor de arquivo
 //existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsClosedir (int fd) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->closedirFn (fd);
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = fs->closedirFn (fd);
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para sincronizacao do sistema de arquivos raiz, persistindo no disco
+//quaisquer dados pendentes de gravacao. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int vfsSync ( void ) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->syncFn ? fs->syncFn (rootDisk) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao que preenche stats com as informacoes do sistema de arquivos raiz.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsStatfs (FSStats *stats) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->statfsFn ? fs->statfsFn (rootDisk, stats) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para criacao de um snapshot do sistema de arquivos raiz, de nome name.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsSnapshot (const char *name) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->snapshotFn ? fs->snapshotFn (rootDisk, name) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para remocao do snapshot de nome name do sistema de arquivos raiz.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsDeleteSnapshot (const char *name) {
+        FSInfo *fs = __vfsEnter ();
+        if ( !fs ) return -1;
+        int ret = ( fs->delsnapshotFn ? fs->delsnapshotFn (rootDisk, name) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Registra novo sistema de arquivos. Retorna um identificador unico (slot),
 //caso o sistema de arquivos tenha sido registrado com sucesso. Caso contrario,
 //retorna -1
 int vfsRegisterFS (FSInfo* fsInfo) {
-	int i;
+	int i, ret = -1;
 	if ( !fsInfo ) return -1;
+	pthread_rwlock_wrlock (&vfsLock);
 	for (i=MAX_INSTALLED_FS; i>0; i--)
 		if ( !installedFSInfo[i-1] ) {
 			installedFSInfo[i-1] = fsInfo;
-			return 0;
+			ret = 0;
+			break;
 		}
-	return -1;
+	pthread_rwlock_unlock (&vfsLock);
+	return ret;
 }
 
 //Desfaz o registro de um sistema de arquivos. Um sistema de arquivos montado
 //nao pode ter seu registro desfeito. Retorna 0 se bem sucedido e -1 caso
 //contrario
 int vfsUnregisterFS(char fsId) {
-	if (fsId == rootFS->fsid) return -1;
-	for (int i=0; i<MAX_INSTALLED_FS; i++) {
+	int ret = -1;
+	pthread_rwlock_wrlock (&vfsLock);
+	for (int i=0; i<MAX_INSTALLED_FS && !(rootFS && fsId == rootFS->fsid); i++) {
 		if ( !installedFSInfo[i] ) continue;
 		if ( fsId == installedFSInfo[i]->fsid ) {
 			installedFSInfo[i] = NULL;
-			return 0;
+			ret = 0;
+			break;
 		}
 	}
-	return -1;
+	pthread_rwlock_unlock (&vfsLock);
+	return ret;
 }
 
 //Escreve na saida padrao as informacoes sobre sistemas de arquivos registrados
@@ -21,12 +21,68 @@
 #define FILETYPE_DIR 128    //Identificador de tipo de arquivo: diretorio
 #define FILETYPE_REGULAR 64 //Identificador de tipo de arquivo: arq regular
 
+#define VFS_SEEK_SET 0  //Posicao relativa ao inicio do arquivo
+#define VFS_SEEK_CUR 1  //Posicao relativa ao cursor atual
+#define VFS_SEEK_END 2  //Posicao relativa ao fim do arquivo
+#define VFS_SEEK_DATA 3 //Proximo trecho com dados a partir da posicao
+#define VFS_SEEK_HOLE 4 //Proximo buraco a partir da posicao
+
+#define VFS_FLAG_COMPRESS 1 //Atributo de arquivo: dados gravados comprimidos
+#define VFS_FLAG_DEDUP 2    //Atributo de arquivo: blocos repetidos compartilhados
+
+#define VFS_LOCK_SHARED 0    //Trava de trecho compartilhada (leitura)
+#define VFS_LOCK_EXCLUSIVE 1 //Trava de trecho exclusiva (escrita)
+#define VFS_LOCK_NOWAIT 2    //Somado ao tipo: falha em vez de esperar
+
+//Estrutura com informacoes gerais sobre um sistema de arquivos montado
+typedef struct fs_stats {
+	unsigned int blockSize;		// Tamanho do bloco, em bytes
+	unsigned int totalBlocks;	// Numero total de blocos de dados
+	unsigned int freeBlocks;	// Numero de blocos de dados livres
+	unsigned int totalInodes;	// Numero total de i-nodes
+	unsigned int freeInodes;	// Numero de i-nodes livres
+} FSStats;
+
+//Entrada de diretorio devolvida pela leitura de diretorio em lote. Os
+//atributos do i-node so' sao preenchidos quando solicitados; caso
+//contrario, fileType e fileSize ficam com 0
+typedef struct vfs_dirent {
+	unsigned int inumber;			// Numero do i-node da entrada
+	unsigned int fileType;			// Tipo de arquivo (FILETYPE_*)
+	unsigned int fileSize;			// Tamanho do arquivo, em bytes
+	char name[MAX_FILENAME_LENGTH + 1];	// Nome terminado em \0
+} VFSDirEntry;
+
+//Buffer de uma operacao de leitura ou escrita vetorial
+typedef struct vfs_iovec {
+	void *base;		// Inicio do buffer
+	unsigned int len;	// Tamanho do buffer, em bytes
+} VFSIOVec;
+
+//Conclusao de uma leitura ou escrita assincrona, retirada de uma fila de
+//conclusoes
+typedef struct vfs_completion {
+	void *tag;	// Valor informado no pedido
+	int result;	// Retorno da leitura ou escrita (como vfsPread/vfsPwrite)
+} VFSCompletion;
+
+//Fila de conclusoes de leituras e escritas assincronas
+typedef struct vfs_aio_queue VFSAioQueue;
+
+//Funcao chamada na conclusao de uma leitura ou escrita assincrona, em uma
+//thread interna do VFS, com o valor tag do pedido e o retorno da operacao.
+//Nao deve esperar pela conclusao de outros pedidos assincronos
+typedef void (*VFSAioFn) (void *tag, int result);
+
 //Estrutura para definicao da API de sistemas de arquivos.
 //Deve ser preenchida com os ponteiros das respectivas funcoes e passada
 //para registro por meio da funcao vfsRegister()
 typedef struct fs_info {
 	char fsid;	// Identificador do tipo de sistema de arquivos
 	char *fsname;	// Nome do tipo de sistema de arquivos
+	int concurrent;	// Diferente de 0 se as funcoes abaixo podem ser
+			// chamadas por varias threads ao mesmo tempo. Caso
+			// contrario, o VFS as chama uma de cada vez
 
 	//Funcao para verificacao se o sistema de arquivos está ocioso, ou seja,
 	//se nao ha quisquer descritores de arquivos em uso atualmente. Retorna
@@ -100,8 +156,128 @@ typedef struct fs_info {
 	//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.	
 	int (*closedirFn) (int fd);
 
+	//Funcao para sincronizacao do sistema de arquivos montado no disco d,
+	//persistindo quaisquer dados pendentes de gravacao. Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*syncFn) (Disk *d);
+
+	//Funcao que preenche stats com as informacoes do sistema de arquivos
+	//montado no disco d. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+	int (*statfsFn) (Disk *d, FSStats *stats);
+
+	//Funcao para a leitura em lote de um diretorio, identificado por um
+	//descritor de arquivo existente. Copia para entries ate' maxEntries
+	//entradas a partir da posicao atual do cursor no diretorio, avancando-o.
+	//Se withAttrs for diferente de 0, inclui o tipo e o tamanho de cada
+	//entrada, lidos do seu i-node. Retorna o numero de entradas lidas, 0 se
+	//fim do diretorio ou -1 caso mal sucedido.
+	int (*readdirplusFn) (int fd, VFSDirEntry *entries, unsigned int maxEntries,
+	                      int withAttrs);
+
+	//Funcao para abertura de um arquivo, a partir do caminho path relativo
+	//ao diretorio aberto identificado pelo descritor dirfd, no modo
+	//Read/Write, criando o arquivo se nao existir. Caminhos absolutos
+	//ignoram dirfd. Retorna um descritor de arquivo, em caso de sucesso.
+	//Retorna -1, caso contrario.
+	int (*openatFn) (int dirfd, const char *path);
+
+	//Funcao para abertura de um diretorio, a partir do caminho path
+	//relativo ao diretorio aberto identificado pelo descritor dirfd, no
+	//modo Read/Write, criando o diretorio se nao existir. Caminhos
+	//absolutos ignoram dirfd. Retorna um descritor de arquivo, em caso de
+	//sucesso. Retorna -1, caso contrario.
+	int (*opendiratFn) (int dirfd, const char *path);
+
+	//Funcao para a leitura de um arquivo, a partir de um descritor de
+	//arquivo existente, na posicao offset, sem alterar o cursor. Os dados
+	//sao copiados para buf e terao tamanho maximo de nbytes. Retorna o
+	//numero de bytes efetivamente lidos em caso de sucesso ou -1, caso
+	//contrario.
+	int (*preadFn) (int fd, char *buf, unsigned int nbytes, unsigned int offset);
+
+	//Funcao para a escrita de um arquivo, a partir de um descritor de
+	//arquivo existente, na posicao offset, sem alterar o cursor. Os dados
+	//de buf serao copiados para o disco e terao tamanho maximo de nbytes.
+	//Retorna o numero de bytes efetivamente escritos em caso de sucesso ou
+	//-1, caso contrario.
+	int (*pwriteFn) (int fd, const char *buf, unsigned int nbytes,
+	                 unsigned int offset);
+
+	//Funcao para a leitura vetorial de um arquivo, a partir de um descritor
+	//de arquivo existente. Os dados lidos a partir da posicao atual do
+	//cursor sao distribuidos, em ordem, pelos iovcnt buffers de iov, e o
+	//cursor avanca o total lido. Retorna o numero de bytes efetivamente
+	//lidos em caso de sucesso ou -1, caso contrario.
+	int (*readvFn) (int fd, const VFSIOVec *iov, int iovcnt);
+
+	//Funcao para a escrita vetorial de um arquivo, a partir de um descritor
+	//de arquivo existente. O conteudo dos iovcnt buffers de iov e' gravado,
+	//em ordem, a partir da posicao atual do cursor, que avanca o total
+	//escrito. Retorna o numero de bytes efetivamente escritos em caso de
+	//sucesso ou -1, caso contrario.
+	int (*writevFn) (int fd, const VFSIOVec *iov, int iovcnt);
+
+	//Funcao para reposicionar o cursor de um arquivo, a partir de um
+	//descritor de arquivo existente, conforme offset e whence (VFS_SEEK_*).
+	//Com VFS_SEEK_DATA e VFS_SEEK_HOLE, o cursor vai para o primeiro byte
+	//com dados ou de um buraco a partir de offset; o fim do arquivo conta
+	//como buraco. Retorna a nova posicao em caso de sucesso ou -1, caso
+	//contrario.
+	long (*lseekFn) (int fd, long offset, int whence);
+
+	//Funcao para clonagem de um arquivo, a partir de um descritor de
+	//arquivo existente. Cria o arquivo indicado pelo caminho absoluto path,
+	//que nao pode existir, compartilhando os blocos de dados do original;
+	//blocos compartilhados so' sao copiados quando um dos arquivos os
+	//altera. Retorna um descritor para o clone, em caso de sucesso. Retorna
+	//-1, caso contrario.
+	int (*cloneFn) (int fd, const char *path);
+
+	//Funcao para criacao de um snapshot somente leitura, de nome name, do
+	//sistema de arquivos montado no disco d. Retorna 0 caso bem sucedido,
+	//ou -1 caso contrario.
+	int (*snapshotFn) (Disk *d, const char *name);
+
+	//Funcao para remocao do snapshot de nome name do sistema de arquivos
+	//montado no disco d. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+	int (*delsnapshotFn) (Disk *d, const char *name);
+
+	//Funcao para montagem, somente para leitura, do snapshot de nome name
+	//do disco d, cuja raiz passa a ser a raiz da montagem. A desmontagem e'
+	//feita por xMountFn. Retorna um positivo se a montagem foi bem sucedida
+	//ou, caso contrario, 0.
+	int (*xMountSnapshotFn) (Disk *d, const char *name);
+
+	//Funcao que copia para flags os atributos (VFS_FLAG_*) do arquivo ou
+	//diretorio identificado por um descritor existente. Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*getflagsFn) (int fd, unsigned int *flags);
+
+	//Funcao que altera os atributos (VFS_FLAG_*) do arquivo ou diretorio
+	//identificado por um descritor existente. Arquivos e diretorios criados
+	//em um diretorio herdam seus atributos. Retorna 0 caso bem sucedido, ou
+	//-1 caso contrario.
+	int (*setflagsFn) (int fd, unsigned int flags);
+
+	//Funcao que trava, de forma consultiva, o trecho de len bytes a partir
+	//de offset (len 0: ate' o fim do arquivo) do arquivo identificado por
+	//um descritor existente, com o tipo type (VFS_LOCK_*). A trava pertence
+	//ao descritor e e' liberada quando ele e' fechado. Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*lockrangeFn) (int fd, unsigned int offset, unsigned int len,
+	                    int type);
+
+	//Funcao que libera as travas do descritor existente fd no trecho de len
+	//bytes a partir de offset (len 0: ate' o fim do arquivo). Retorna 0
+	//caso bem sucedido, ou -1 caso contrario.
+	int (*unlockrangeFn) (int fd, unsigned int offset, unsigned int len);
+
 } FSInfo;
 
+//As funcoes abaixo podem ser chamadas por varias threads ao mesmo tempo.
+//Montagem, desmontagem e registro esperam as chamadas em andamento e sao
+//feitas sozinhas
+
 //Funcao para inicializacao do sistema de arquivos virtual
 void vfsInit ( void );
 
@@ -109,6 +285,13 @@ void vfsInit ( void );
 //unica do sistema (Unix-like). Retorna 0 caso bem sucedido e -1 em contrario
 int vfsMountRoot (Disk *d, char fsId);
 
+//Funcao para a montagem, somente para leitura, do snapshot de nome name do
+//sistema de arquivos do disco d, como raiz da arvore unica do sistema. Outros
+//processos podem continuar alterando o sistema de arquivos original enquanto
+//o snapshot e' lido (p.ex. por um backup). Retorna 0 caso bem sucedido e -1
+//em contrario
+int vfsMountRootSnapshot (Disk *d, char fsId, const char *name);
+
 //Funcao para a desmontagem do sistema de arquivos. Nao podem haver arquivos
 //ou diretorios abertos para a desmontagem. Retorna 0 caso bem sucedido e -1 
 //caso contrario
@@ -137,8 +320,125 @@ int vfsRead (int fd, char *buf, unsigned int nbytes);
 //de sucesso ou -1, caso contrario
 int vfsWrite (int fd, const char *buf, unsigned int nbytes);
 
-//Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
+//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. O cursor do arquivo nao e' alterado, de modo
+//que leituras em posicoes diferentes podem compartilhar o descritor. Os dados
+//serao copiados para buf e terao tamanho maximo de nbytes. Retorna o numero
+//de bytes efetivamente lidos em caso de sucesso ou -1, caso contrario
+int vfsPread (int fd, char *buf, unsigned int nbytes, unsigned int offset);
+
+//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
+//existente, na posicao offset. O cursor do arquivo nao e' alterado. Os dados
+//de buf serao copiados para o disco e terao tamanho maximo de nbytes. Retorna
+//o numero de bytes efetivamente escritos em caso de sucesso ou -1, caso
+//contrario
+int vfsPwrite (int fd, const char *buf, unsigned int nbytes,
+               unsigned int offset);
+
+//Funcao que pede a leitura de nbytes a partir da posicao offset do arquivo
+//identificado por um descritor existente para buf, sem esperar por ela. A
+//leitura e' feita por uma thread interna, como por vfsPread; na conclusao,
+//fn e' chamada (se nao for NULL) e, depois, a conclusao e' colocada em queue
+//(se nao for NULL), ambas com tag. buf deve ficar valido ate' la'. Um
+//descritor pode ter muitos pedidos pendentes, que sao agrupados e
+//reordenados por descritor e posicao para reduzir os deslocamentos do disco:
+//pedidos sobrepostos nao tem ordem garantida. Retorna 0 se o pedido foi
+//aceito, ou -1 caso contrario
+int vfsReadAsync (int fd, char *buf, unsigned int nbytes, unsigned int offset,
+                  VFSAioFn fn, VFSAioQueue *queue, void *tag);
+
+//Funcao que pede a escrita dos nbytes de buf a partir da posicao offset do
+//arquivo identificado por um descritor existente, sem esperar por ela, como
+//vfsReadAsync. A escrita e' feita como por vfsPwrite
+int vfsWriteAsync (int fd, const char *buf, unsigned int nbytes,
+                   unsigned int offset, VFSAioFn fn, VFSAioQueue *queue,
+                   void *tag);
+
+//Funcao que cria uma fila de conclusoes vazia. Retorna ponteiro para ela ou
+//NULL em caso de falha
+VFSAioQueue* vfsAioQueueCreate (void);
+
+//Funcao que retira de queue a conclusao mais antiga e a copia para done. Se
+//nao houver nenhuma e wait for diferente de 0, espera pela proxima dos
+//pedidos pendentes com essa fila. Retorna 1 se uma conclusao foi retirada, 0
+//se nao havia nenhuma (ou pedidos pendentes, se wait for diferente de 0) ou
+//-1 em caso de falha
+int vfsAioWait (VFSAioQueue *queue, VFSCompletion *done, int wait);
+
+//Funcao que libera uma fila de conclusoes. A fila nao pode ter pedidos
+//pendentes nem conclusoes por retirar. Retorna 0 caso bem sucedido, ou -1
+//caso contrario
+int vfsAioQueueDestroy (VFSAioQueue *queue);
+
+//Funcao para a leitura vetorial de um arquivo, a partir de um descritor de
+//arquivo existente. Os dados lidos a partir da posicao atual do cursor sao
+//distribuidos, em ordem, pelos iovcnt buffers de iov. Retorna o numero de
+//bytes efetivamente lidos em caso de sucesso ou -1, caso contrario
+int vfsReadv (int fd, const VFSIOVec *iov, int iovcnt);
+
+//Funcao para a escrita vetorial de um arquivo, a partir de um descritor de
+//arquivo existente. O conteudo dos iovcnt buffers de iov e' gravado, em
+//ordem, a partir da posicao atual do cursor. Retorna o numero de bytes
+//efetivamente escritos em caso de sucesso ou -1, caso contrario
+int vfsWritev (int fd, const VFSIOVec *iov, int iovcnt);
+
+//Funcao para reposicionar o cursor de um arquivo, a partir de um descritor de
+//arquivo existente. A nova posicao e' offset somado 'a referencia indicada
+//por whence: inicio do arquivo (VFS_SEEK_SET), cursor atual (VFS_SEEK_CUR)
+//ou fim do arquivo (VFS_SEEK_END). Com VFS_SEEK_DATA e VFS_SEEK_HOLE, a nova
+//posicao e' o primeiro byte com dados ou de um buraco a partir de offset, o
+//que permite percorrer arquivos esparsos sem ler os buracos. Escritas alem do
+//fim do arquivo so' ocupam os blocos tocados. Retorna a nova posicao em caso
+//de sucesso ou -1, caso contrario
+long vfsLseek (int fd, long offset, int whence);
+
+//Funcao para clonagem de um arquivo, a partir de um descritor de arquivo
+//existente. Cria o arquivo indicado pelo caminho absoluto path, que nao pode
+//existir, com o mesmo conteudo, sem copiar os dados: os dois arquivos
+//compartilham os blocos, que so' sao copiados quando um deles os altera.
+//Retorna um descritor para o clone, em caso de sucesso. Retorna -1, caso
+//contrario
+int vfsClone (int fd, const char *path);
+
+//Funcao que copia para flags os atributos (VFS_FLAG_*) do arquivo ou
+//diretorio identificado por um descritor existente. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int vfsGetFlags (int fd, unsigned int *flags);
+
+//Funcao que altera os atributos (VFS_FLAG_*) do arquivo ou diretorio
+//identificado por um descritor existente. Arquivos e diretorios criados em um
+//diretorio herdam seus atributos, entao marcar a raiz vale para todo o sistema
+//de arquivos. Com VFS_FLAG_COMPRESS, os dados do arquivo sao gravados
+//comprimidos, de forma transparente para a leitura e a escrita; em arquivos
+//regulares, o atributo so' pode mudar enquanto o arquivo esta vazio. Com
+//VFS_FLAG_DEDUP, cada bloco gravado com conteudo identico ao de um bloco ja
+//existente passa a compartilha-lo, e blocos zerados viram buracos; vale para
+//as escritas seguintes e e' ignorado em arquivos comprimidos. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario
+int vfsSetFlags (int fd, unsigned int flags);
+
+//Funcao que trava o trecho de len bytes a partir de offset (len 0: ate' o fim
+//do arquivo, mesmo que ele cresca) do arquivo identificado por um descritor
+//existente, para coordenar processos que usam regioes do mesmo arquivo. A
+//trava e' consultiva: nao impede leituras e escritas, so' outras travas.
+//Com VFS_LOCK_SHARED, convive com outras travas compartilhadas do trecho;
+//com VFS_LOCK_EXCLUSIVE, com nenhuma de outro descritor. Somando
+//VFS_LOCK_NOWAIT ao tipo, falha em vez de esperar por travas conflitantes,
+//que sao atendidas na ordem dos pedidos. Travar de novo parte de um trecho
+//ja' travado pelo descritor troca o tipo dessa parte. A trava pertence ao
+//descritor, que a libera ao ser fechado. Retorna 0 caso bem sucedido, ou -1
+//caso contrario
+int vfsLockRange (int fd, unsigned int offset, unsigned int len, int type);
+
+//Funcao que libera as travas do descritor fd no trecho de len bytes a partir
+//de offset (len 0: ate' o fim do arquivo), mesmo que so' em parte dele.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
+int vfsUnlockRange (int fd, unsigned int offset, unsigned int len);
+
+//Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
+//Leituras e escritas assincronas do descritor ainda nao iniciadas sao
+//canceladas (concluidas com -1) e as em andamento sao esperadas. Retorna 0
+//caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd);
 
 //Funcao para abertura de um diretorio, a partir do caminho especificado em
@@ -146,6 +446,19 @@ int vfsClose (int fd);
 //descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
 int vfsOpendir (const char *path);
 
+//Funcao para abertura de um arquivo, a partir do caminho path relativo ao
+//diretorio aberto identificado pelo descritor dirfd, no modo Read/Write,
+//criando o arquivo se nao existir. Caminhos absolutos ignoram dirfd. Retorna
+//um descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
+int vfsOpenAt (int dirfd, const char *path);
+
+//Funcao para abertura de um diretorio, a partir do caminho path relativo ao
+//diretorio aberto identificado pelo descritor dirfd, no modo Read/Write,
+//criando o diretorio se nao existir. Caminhos absolutos ignoram dirfd.
+//Retorna um descritor de arquivo, em caso de sucesso. Retorna -1, caso
+//contrario.
+int vfsOpendirAt (int dirfd, const char *path);
+
 //Funcao para a leitura de um diretorio, identificado por um descritor de
 //arquivo existente. Os dados lidos correspondem a uma entrada de diretorio
 //na posicao atual do cursor no diretorio. O nome da entrada e' copiado para
@@ -154,6 +467,14 @@ int vfsOpendir (const char *path);
 //foi lida, 0 se fim de diretorio ou -1 caso mal sucedido
 int vfsReaddir (int fd, char *filename, unsigned int *inumber);
 
+//Funcao para a leitura em lote de um diretorio, identificado por um
+//descritor de arquivo existente. Copia para entries ate' maxEntries entradas
+//a partir da posicao atual do cursor no diretorio. Se withAttrs for diferente
+//de 0, inclui o tipo e o tamanho de cada entrada. Retorna o numero de
+//entradas lidas, 0 se fim de diretorio ou -1 caso mal sucedido
+int vfsReaddirPlus (int fd, VFSDirEntry *entries, unsigned int maxEntries,
+                    int withAttrs);
+
 //Funcao para adicionar uma entrada a um diretorio, identificado por um 
 //descritor de arquivo existente. A nova entrada tera' o nome indicado por
 //filename e apontara' para o numero de i-node indicado por inumber. Retorna 0\
@@ -169,6 +490,26 @@ int vfsUnlink (int fd, const char *filename);
 //existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsClosedir (int fd);
 
+//Funcao para sincronizacao do sistema de arquivos raiz, persistindo no disco
+//quaisquer dados pendentes de gravacao. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int vfsSync ( void );
+
+//Funcao que preenche stats com as informacoes do sistema de arquivos raiz.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsStatfs (FSStats *stats);
+
+//Funcao para criacao de um snapshot do sistema de arquivos raiz, de nome name.
+//O snapshot congela a arvore atual sem copiar dados: blocos e i-nodes so' sao
+//copiados quando alterados depois. Seu conteudo e' acessivel, somente para
+//leitura, em /.snap/name. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsSnapshot (const char *name);
+
+//Funcao para remocao do snapshot de nome name do sistema de arquivos raiz,
+//liberando o espaco usado apenas por ele. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int vfsDeleteSnapshot (const char *name);
+
 //Registra novo sistema de arquivos. Retorna um identificador unico (slot),
 //caso o sistema de arquivos tenha sido registrado com sucesso. Caso contrario,
 //retorna -1